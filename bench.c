@@ -0,0 +1,1058 @@
+/*
+ * =============================================================================
+ *
+ *       Filename:  bench.c
+ *
+ *    Description:  Spawn benchmarks for exec_process
+ *
+ *        Version:  1.0
+ *        Created:  10/17/2026 09:12:03 AM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Oliver Lorenz (ol), olli@olorenz.org
+ *
+ * =============================================================================
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include "bufio.h"
+#include "exec.h"
+#include "ioengine.h"
+#include "pool.h"
+#include "records.h"
+
+#define BENCH_CMD		"/bin/true"
+#define ECHO_CMD		"/bin/cat"
+#define ECHO_MESSAGES		20000U
+#define CHAT_LINES		100000U
+#define CHAT_BATCH		64U
+#define DUPLEX_MIB		64U
+#define FEED_MIB		64U
+#define FEED_CHILDREN		8U
+#define CAPTURE_MIB		512U
+#define ENGINE_CHILDREN		2000U
+#define ENGINE_WINDOW		128U
+#define DEFAULT_ITERATIONS	200U
+#define FANOUT_WIDTH		64U
+#define PIPELINE_STAGES		3U
+#define POOL_JOBS		2000U
+#define PATH_DEPTH		32U
+#define RECORDS_MIB		256U
+#define MIB			(1024UL * 1024UL)
+
+static const size_t default_rss_mib[] = { 0, 256, 1024 };
+static const unsigned int pool_limits[] = { 1, 8, 64 };
+
+static const struct {
+	enum exec_backend  be_backend;
+	const char        *be_name;
+} backends[] = {
+	{ EXEC_BACKEND_FORK,		"fork"		},
+	{ EXEC_BACKEND_VFORK,		"vfork"		},
+	{ EXEC_BACKEND_POSIX_SPAWN,	"posix_spawn"	},
+	{ EXEC_BACKEND_SERVER,		"server"	},
+};
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec * 1e6 + (double) ts.tv_nsec / 1e3;
+}
+
+static void *inflate_rss(size_t mib)
+{
+	char *mem;
+	size_t i;
+
+	if (!mib)
+		return NULL;
+
+	if ((mem = malloc(mib * MIB)) == NULL)
+		return NULL;
+
+	/* touch every page, untouched memory has no page tables to copy */
+	for (i = 0; i < mib * MIB; i += 4096)
+		mem[i] = (char) i;
+
+	return mem;
+}
+
+static int bench_backend(enum exec_backend backend, unsigned int iterations,
+                         double *avg_us)
+{
+	char *argv[] = { BENCH_CMD, NULL };
+	struct exec_attr attr;
+	unsigned int i;
+	double start;
+	int ret;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.ea_backend = backend;
+
+	start = now_us();
+	for (i = 0; i < iterations; ++i) {
+		ret = exec_process_attr(NULL, true, NULL, USERINFO_TYPE_NONE,
+		                        argv[0], argv, &attr);
+		if (ret)
+			return ret;
+	}
+
+	*avg_us = (now_us() - start) / iterations;
+	return 0;
+}
+
+/*
+ * Spawns BENCH_CMD as @user, if set, flushing the credential cache before
+ * each spawn with @flush to show what resolving the user costs.
+ */
+static int bench_user(const char *user, bool flush, unsigned int iterations,
+                      double *avg_us)
+{
+	char *argv[] = { BENCH_CMD, NULL };
+	unsigned int i;
+	double start;
+	int ret;
+
+	start = now_us();
+	for (i = 0; i < iterations; ++i) {
+		if (flush)
+			exec_user_cache_flush();
+
+		ret = exec_process_attr(NULL, true, user,
+		                        user ? USERINFO_TYPE_NAME :
+		                               USERINFO_TYPE_NONE,
+		                        argv[0], argv, NULL);
+		if (ret)
+			return ret;
+	}
+
+	*avg_us = (now_us() - start) / iterations;
+	return 0;
+}
+
+/*
+ * Spawns BENCH_CMD from a precompiled specification, with pipes like
+ * exec_process() would set up.
+ */
+static int bench_spec(unsigned int iterations, double *avg_us)
+{
+	char *argv[] = { BENCH_CMD, NULL };
+	struct process_info proc;
+	struct exec_spec *spec;
+	unsigned int i;
+	double start;
+	int ret = 0;
+
+	spec = exec_spec_new(argv[0], argv, NULL, USERINFO_TYPE_NONE, NULL);
+	if (!spec)
+		return -errno;
+
+	start = now_us();
+	for (i = 0; i < iterations && !ret; ++i) {
+		if ((ret = exec_spawn(spec, &proc)) == 0)
+			ret = wait_for_child(&proc, true) | proc.pi_retval;
+	}
+
+	*avg_us = (now_us() - start) / iterations;
+	exec_spec_free(spec);
+	return ret;
+}
+
+/*
+ * Spawns "true" through a $PATH that has @depth empty directories in
+ * front, flushing the lookup cache before each spawn with @flush.
+ */
+static int bench_path(unsigned int depth, bool flush, unsigned int iterations,
+                      double *avg_us)
+{
+	char *argv[] = { "true", NULL };
+	char path[4096], *saved;
+	const char *old;
+	unsigned int i;
+	size_t len = 0;
+	double start;
+	int ret = 0;
+
+	if ((old = getenv("PATH")) == NULL)
+		old = "/bin:/usr/bin";
+	if ((saved = strdup(old)) == NULL)
+		return -ENOMEM;
+
+	for (i = 0; i < depth && len + 32 < sizeof(path); ++i)
+		len += (size_t) snprintf(path + len, sizeof(path) - len,
+		                         "/nonexistent/%u:", i);
+	snprintf(path + len, sizeof(path) - len, "%s", saved);
+	setenv("PATH", path, 1);
+
+	start = now_us();
+	for (i = 0; i < iterations && !ret; ++i) {
+		if (flush)
+			exec_path_cache_flush();
+
+		ret = exec_process_p(NULL, true, NULL, USERINFO_TYPE_NONE,
+		                     argv[0], argv);
+	}
+	*avg_us = (now_us() - start) / iterations;
+
+	setenv("PATH", saved, 1);
+	free(saved);
+	return ret;
+}
+
+static int bench_fanout(enum exec_backend backend, bool batch,
+                        unsigned int iterations, double *avg_us)
+{
+	char *argv[] = { BENCH_CMD, NULL };
+	struct process_info procs[FANOUT_WIDTH];
+	struct exec_cmd cmds[FANOUT_WIDTH];
+	struct exec_attr attr;
+	unsigned int i, j;
+	double start;
+	int ret;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.ea_backend = backend;
+
+	memset(cmds, 0, sizeof(cmds));
+	for (j = 0; j < FANOUT_WIDTH; ++j) {
+		cmds[j].ec_cmd = argv[0];
+		cmds[j].ec_argv = argv;
+		cmds[j].ec_attr = &attr;
+	}
+
+	start = now_us();
+	for (i = 0; i < iterations; ++i) {
+		if (batch) {
+			ret = exec_process_batch(cmds, procs, FANOUT_WIDTH);
+			if (ret < 0)
+				return ret;
+		} else {
+			for (j = 0; j < FANOUT_WIDTH; ++j) {
+				cmds[j].ec_result = exec_process_attr(&procs[j],
+				        false, NULL, USERINFO_TYPE_NONE,
+				        argv[0], argv, &attr);
+			}
+		}
+
+		for (j = 0; j < FANOUT_WIDTH; ++j) {
+			if (cmds[j].ec_result)
+				return cmds[j].ec_result;
+			wait_for_child(&procs[j], true);
+		}
+	}
+
+	*avg_us = (now_us() - start) / iterations;
+	return 0;
+}
+
+/*
+ * Runs "true | cat | cat" either as a shell pipeline or through
+ * exec_pipeline(), which saves the shell and its fork per stage.
+ */
+static int bench_pipeline(bool shell, unsigned int iterations, double *avg_us)
+{
+	char *sh_argv[] = { "/bin/sh", "-c",
+	                    BENCH_CMD " | " ECHO_CMD " | " ECHO_CMD, NULL };
+	char *true_argv[] = { BENCH_CMD, NULL };
+	char *cat_argv[] = { ECHO_CMD, NULL };
+	struct process_info procs[PIPELINE_STAGES];
+	struct exec_cmd cmds[PIPELINE_STAGES];
+	unsigned int i, j;
+	double start;
+	int ret;
+
+	memset(cmds, 0, sizeof(cmds));
+	for (j = 0; j < PIPELINE_STAGES; ++j) {
+		cmds[j].ec_cmd = j ? cat_argv[0] : true_argv[0];
+		cmds[j].ec_argv = j ? cat_argv : true_argv;
+	}
+
+	start = now_us();
+	for (i = 0; i < iterations; ++i) {
+		if (shell) {
+			ret = exec_process_attr(NULL, true, NULL,
+			                        USERINFO_TYPE_NONE, sh_argv[0],
+			                        sh_argv, NULL);
+			if (ret)
+				return ret;
+			continue;
+		}
+
+		if ((ret = exec_pipeline(cmds, procs, PIPELINE_STAGES, NULL)))
+			return ret;
+
+		for (j = 0; j < PIPELINE_STAGES; ++j) {
+			ret = wait_for_child(&procs[j], true);
+			if (ret || procs[j].pi_retval)
+				return ret ? ret : procs[j].pi_retval;
+		}
+	}
+
+	*avg_us = (now_us() - start) / iterations;
+	return 0;
+}
+
+/*
+ * Pushes @jobs runs of BENCH_CMD through a pool allowing @limit at a time,
+ * all submitted up front.
+ */
+static int bench_pool(unsigned int limit, unsigned int jobs,
+                      double *jobs_per_s, uint64_t *backoffs)
+{
+	char *argv[] = { BENCH_CMD, NULL };
+	struct exec_pool_stats stats;
+	struct exec_pool *pool;
+	struct exec_job *list;
+	unsigned int i;
+	int ret = 0;
+
+	if ((list = calloc(jobs, sizeof(*list))) == NULL)
+		return -errno;
+
+	if ((pool = exec_pool_new(limit, 0)) == NULL) {
+		free(list);
+		return -errno;
+	}
+
+	for (i = 0; i < jobs && !ret; ++i) {
+		list[i].ej_cmd.ec_cmd = argv[0];
+		list[i].ej_cmd.ec_argv = argv;
+		ret = exec_pool_submit(pool, &list[i]);
+	}
+
+	if (!ret)
+		ret = exec_pool_wait(pool);
+
+	exec_pool_stats(pool, &stats);
+	*jobs_per_s = (double) stats.ps_completed * 1e9 /
+	              (double) stats.ps_busy_ns;
+	*backoffs = stats.ps_backoffs;
+
+	exec_pool_free(pool);
+	free(list);
+	return ret ? ret : (stats.ps_failed ? -EIO : 0);
+}
+
+/*
+ * Bounces single bytes off cat(1). Without stream mode, each timed call
+ * costs up to three extra fcntl(2) calls, which is what this shows.
+ */
+static int bench_echo(bool stream, unsigned int messages, double *avg_us)
+{
+	char *argv[] = { ECHO_CMD, NULL };
+	struct process_info proc;
+	struct exec_attr attr;
+	unsigned int i;
+	double start;
+	ssize_t count;
+	char c = 'x';
+	int ret;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.ea_nonblock = stream;
+
+	ret = exec_process_attr(&proc, false, NULL, USERINFO_TYPE_NONE,
+	                        argv[0], argv, &attr);
+	if (ret)
+		return ret;
+
+	start = now_us();
+	for (i = 0; i < messages; ++i) {
+		if (stream) {
+			count = timed_write_stream(proc.pi_stdin, &c, 1, 5);
+			if (count == 1)
+				count = timed_read_stream(proc.pi_stdout,
+				                          &c, 1, 5);
+		} else {
+			count = timed_write(proc.pi_stdin, &c, 1, 5);
+			if (count == 1)
+				count = timed_read(proc.pi_stdout, &c, 1, 5);
+		}
+
+		if (count != 1) {
+			ret = count == -1 ? -errno : -EIO;
+			break;
+		}
+	}
+	*avg_us = (now_us() - start) / messages;
+
+	close(proc.pi_stdin);
+	proc.pi_stdin = -1;
+	(void) wait_for_child(&proc, true);
+	return ret;
+}
+
+/*
+ * Sends lines to cat(1) in batches and reads them back, either with
+ * timed calls that a caller without buffering would make, a write per
+ * line and a read per byte, or through exec_writer and exec_reader.
+ */
+static int bench_chat(bool buffered, unsigned int lines, double *avg_us)
+{
+	static const char line[] = "status ok 0123456789\n";
+	char *argv[] = { ECHO_CMD, NULL };
+	struct exec_reader *reader = NULL;
+	struct exec_writer *writer = NULL;
+	struct process_info proc;
+	struct exec_attr attr;
+	unsigned int i, j;
+	const void *data;
+	double start;
+	ssize_t count;
+	char c;
+	int ret;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.ea_nonblock = true;
+
+	ret = exec_process_attr(&proc, false, NULL, USERINFO_TYPE_NONE,
+	                        argv[0], argv, &attr);
+	if (ret)
+		return ret;
+
+	if (buffered) {
+		writer = exec_writer_new(proc.pi_stdin, 0);
+		reader = exec_reader_new(proc.pi_stdout, 0);
+		if (!writer || !reader)
+			ret = -ENOMEM;
+	}
+
+	start = now_us();
+	for (i = 0; i < lines && !ret; i += CHAT_BATCH) {
+		for (j = 0; j < CHAT_BATCH && !ret; ++j) {
+			if (buffered)
+				count = exec_writer_write(writer, line,
+				                          sizeof(line) - 1,
+				                          NULL);
+			else
+				count = timed_write_stream(proc.pi_stdin, line,
+				                           sizeof(line) - 1,
+				                           5);
+			if (count != sizeof(line) - 1)
+				ret = count < 0 ? -EIO : -EPIPE;
+		}
+		if (!ret && buffered)
+			ret = exec_writer_flush(writer, NULL);
+
+		for (j = 0; j < CHAT_BATCH && !ret; ++j) {
+			if (buffered) {
+				count = exec_reader_until(reader, '\n', &data,
+				                          NULL);
+				if (count != sizeof(line) - 1)
+					ret = -EIO;
+				continue;
+			}
+
+			do {
+				count = timed_read_stream(proc.pi_stdout,
+				                          &c, 1, 5);
+			} while (count == 1 && c != '\n');
+			if (count != 1)
+				ret = -EIO;
+		}
+	}
+	*avg_us = (now_us() - start) / lines;
+
+	exec_writer_free(writer);
+	exec_reader_free(reader);
+	close(proc.pi_stdin);
+	proc.pi_stdin = -1;
+	(void) wait_for_child(&proc, true);
+	return ret;
+}
+
+/* pushes a large payload through cat(1) and back with exec_communicate() */
+static int bench_duplex(size_t mib, double *mb_per_s)
+{
+	char *argv[] = { ECHO_CMD, NULL };
+	struct process_info proc;
+	char *input, *output;
+	size_t size, out_size;
+	double start;
+	int ret;
+
+	size = mib * MIB;
+	if ((input = malloc(size)) == NULL)
+		return -ENOMEM;
+	memset(input, 'x', size);
+
+	ret = exec_process(&proc, false, NULL, USERINFO_TYPE_NONE,
+	                   argv[0], NULL);
+	if (ret)
+		goto out;
+
+	start = now_us();
+	ret = exec_communicate(&proc, input, size, &output, &out_size,
+	                       NULL, NULL, NULL);
+	if (ret)
+		goto out;
+
+	*mb_per_s = (double) (2 * size) / (now_us() - start);
+	if (out_size != size)
+		ret = -EIO;
+	free(output);
+out:
+	free(input);
+	return ret;
+}
+
+/*
+ * Feeds the same input to @children readers one after the other, either
+ * pushed through their pipes with exec_communicate() or from a sealed
+ * memory file that is filled once.
+ */
+static int bench_feed(bool memfd, unsigned int children, size_t mib,
+                      double *mb_per_s)
+{
+	char *argv[] = { "/bin/sh", "-c", "exec cat >/dev/null", NULL };
+	struct process_info proc;
+	struct exec_attr attr;
+	unsigned int i;
+	char *input;
+	double start;
+	size_t size;
+	int ret = 0, fd = -1;
+
+	size = mib * MIB;
+	if ((input = malloc(size)) == NULL)
+		return -ENOMEM;
+	memset(input, 'x', size);
+
+	start = now_us();
+	memset(&attr, 0, sizeof(attr));
+	if (memfd) {
+		if ((fd = exec_memfd_new("bench", input, size)) < 0) {
+			ret = fd;
+			goto out;
+		}
+		attr.ea_stdio[0].es_mode = EXEC_STDIO_REOPEN;
+		attr.ea_stdio[0].es_fd = fd;
+	}
+
+	for (i = 0; i < children && !ret; ++i) {
+		if (memfd) {
+			ret = exec_process_attr(NULL, true, NULL,
+			                        USERINFO_TYPE_NONE, argv[0],
+			                        argv, &attr);
+			continue;
+		}
+
+		ret = exec_process_attr(&proc, false, NULL, USERINFO_TYPE_NONE,
+		                        argv[0], argv, &attr);
+		if (!ret)
+			ret = exec_communicate(&proc, input, size, NULL, NULL,
+			                       NULL, NULL, NULL);
+		if (!ret)
+			ret = proc.pi_retval;
+	}
+	*mb_per_s = (double) (children * size) / (now_us() - start);
+
+out:
+	if (fd >= 0)
+		close(fd);
+	free(input);
+	return ret;
+}
+
+/*
+ * Moves the output of head(1) to a scratch file, either with exec_capture()
+ * or the way it used to be done, through a buffer of our own. /dev/null
+ * would make for a meaningless target, it discards without copying.
+ * @attr decides on the capacity of the pipe in between.
+ */
+static int bench_capture(bool splice, const struct exec_attr *attr,
+                         size_t mib, double *mb_per_s)
+{
+	char cmd[64];
+	char *argv[] = { "/bin/sh", "-c", cmd, NULL };
+	struct process_info proc;
+	uint64_t moved = 0;
+	char buf[64 * 1024];
+	double start;
+	ssize_t count;
+	int ret, sink;
+	char sink_path[] = "/tmp/exec_bench_XXXXXX";
+
+	if ((sink = mkstemp(sink_path)) == -1)
+		return -errno;
+	unlink(sink_path);
+
+	snprintf(cmd, sizeof(cmd), "exec head -c %zu /dev/zero", mib * MIB);
+	ret = exec_process_attr(&proc, false, NULL, USERINFO_TYPE_NONE,
+	                        argv[0], argv, attr);
+	if (ret)
+		goto out;
+
+	start = now_us();
+	if (splice) {
+		ret = exec_capture(&proc, sink, -1, &moved, NULL, NULL);
+	} else {
+		while ((count = timed_read(proc.pi_stdout, buf,
+		                           sizeof(buf), 0)) > 0) {
+			if (write(sink, buf, (size_t) count) != count) {
+				ret = -EIO;
+				break;
+			}
+			moved += (uint64_t) count;
+		}
+	}
+	*mb_per_s = (double) moved / (now_us() - start);
+
+	ret |= wait_for_child(&proc, true);
+out:
+	close(sink);
+	return ret;
+}
+
+/*
+ * Splits a scratch file of log lines, either with a record reader or the
+ * way it used to be done, a byte at a time through a buffer of our own.
+ * Reading from the page cache keeps pipes out of the picture.
+ */
+static int bench_records(bool reader, size_t mib, double *mb_per_s,
+                         uint64_t *lines)
+{
+	static const char line[] = "2026-10-17 21:41:18 worker[4711]: "
+	                           "request served in 12 ms\n";
+	struct exec_records *records;
+	struct exec_record rec;
+	char buf[64 * 1024];
+	size_t size, i;
+	ssize_t count;
+	double start;
+	int ret = 0, fd;
+	char path[] = "/tmp/exec_bench_XXXXXX";
+
+	if ((fd = mkstemp(path)) == -1)
+		return -errno;
+	unlink(path);
+
+	for (i = 0; i + sizeof(line) - 1 <= sizeof(buf); i += sizeof(line) - 1)
+		memcpy(buf + i, line, sizeof(line) - 1);
+	for (size = 0; size < mib * MIB; size += i) {
+		if (write(fd, buf, i) != (ssize_t) i) {
+			ret = -EIO;
+			goto out;
+		}
+	}
+
+	/* once to warm the page cache, once for real */
+	for (*lines = 0; *lines < 2; ++*lines) {
+		if (lseek(fd, 0, SEEK_SET)) {
+			ret = -errno;
+			goto out;
+		}
+		while (read(fd, buf, sizeof(buf)) > 0)
+			;
+	}
+	(void) lseek(fd, 0, SEEK_SET);
+
+	*lines = 0;
+	start = now_us();
+	if (reader) {
+		if ((records = exec_records_new(fd, '\n', 0)) == NULL) {
+			ret = -errno;
+			goto out;
+		}
+		while ((ret = exec_records_next(records, &rec, NULL)) == 1)
+			++*lines;
+		exec_records_free(records);
+	} else {
+		while ((count = read(fd, buf, sizeof(buf))) > 0) {
+			for (i = 0; i < (size_t) count; ++i)
+				*lines += (buf[i] == '\n');
+		}
+		if (count == -1)
+			ret = -errno;
+	}
+	*mb_per_s = (double) size / (now_us() - start);
+out:
+	close(fd);
+	return ret;
+}
+
+static const struct {
+	enum exec_io_backend  ee_backend;
+	const char           *ee_name;
+} engines[] = {
+	{ EXEC_IO_BACKEND_EPOLL,	"epoll"		},
+	{ EXEC_IO_BACKEND_URING,	"io_uring"	},
+};
+
+struct engine_slot {
+	struct process_info  es_proc;
+	struct exec_io_proc *es_handle;
+};
+
+static void engine_exit(struct exec_io_proc *p, void *arg)
+{
+	(void) p;
+	(void) arg;
+}
+
+/*
+ * Spawns @children echo(1) processes, at most ENGINE_WINDOW at a time, and
+ * drains them with an I/O engine. Only the engine's own system calls are
+ * counted, spawning costs the same either way.
+ */
+static int bench_engine(enum exec_io_backend backend, unsigned int children,
+                        double *avg_us, double *syscalls)
+{
+	static const struct exec_io_ops ops = { NULL, NULL, engine_exit };
+	struct engine_slot slots[ENGINE_WINDOW];
+	struct exec_io_stats stats;
+	struct exec_io *io;
+	unsigned int started, finished, i;
+	double start;
+	int ret = 0;
+
+	if ((io = exec_io_new_backend(backend)) == NULL)
+		return -errno;
+	if (exec_io_get_backend(io) != backend) {
+		exec_io_free(io);
+		return -ENOSYS;
+	}
+
+	memset(slots, 0, sizeof(slots));
+	started = finished = 0;
+	start = now_us();
+
+	while (finished < children) {
+		for (i = 0; i < ENGINE_WINDOW && started < children; ++i) {
+			if (slots[i].es_handle)
+				continue;
+
+			ret = exec_process(&slots[i].es_proc, false, NULL,
+			                   USERINFO_TYPE_NONE, "/bin/echo",
+			                   "hello", "world", NULL);
+			if (ret)
+				goto out;
+
+			slots[i].es_handle = exec_io_add(io, &slots[i].es_proc,
+			                                 &ops, NULL);
+			if (!slots[i].es_handle) {
+				ret = -errno;
+				(void) wait_for_child(&slots[i].es_proc, true);
+				goto out;
+			}
+			++started;
+		}
+
+		if ((ret = exec_io_run(io, -1)) < 0)
+			goto out;
+		ret = 0;
+
+		for (i = 0; i < ENGINE_WINDOW; ++i) {
+			if (!slots[i].es_handle ||
+			    !exec_io_done(slots[i].es_handle) ||
+			    !exec_io_exited(slots[i].es_handle))
+				continue;
+
+			exec_io_remove(slots[i].es_handle);
+			slots[i].es_handle = NULL;
+			(void) wait_for_child(&slots[i].es_proc, true);
+			++finished;
+		}
+	}
+
+	exec_io_stats(io, &stats);
+	*avg_us = (now_us() - start) / children;
+	*syscalls = (double) stats.es_syscalls / children;
+
+out:
+	for (i = 0; i < ENGINE_WINDOW; ++i) {
+		if (!slots[i].es_handle)
+			continue;
+		exec_io_remove(slots[i].es_handle);
+		(void) wait_for_child(&slots[i].es_proc, true);
+	}
+	exec_io_free(io);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned int iterations = DEFAULT_ITERATIONS;
+	size_t rss_mib[16];
+	unsigned int num_rss, i, j;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:")) != -1) {
+		switch (opt) {
+		case 'n':
+			iterations = (unsigned int) strtoul(optarg, NULL, 10);
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n iterations] "
+			        "[rss_mib ...]\n", argv[0]);
+			return 1;
+		}
+	}
+
+	if (!iterations)
+		iterations = DEFAULT_ITERATIONS;
+
+	/* while we're still small */
+	if (exec_server_start())
+		fprintf(stderr, "spawn server unavailable\n");
+
+	num_rss = 0;
+	for (i = (unsigned int) optind; i < (unsigned int) argc &&
+	     num_rss < ARRAY_SIZE(rss_mib); ++i)
+		rss_mib[num_rss++] = strtoul(argv[i], NULL, 10);
+
+	if (!num_rss) {
+		for (i = 0; i < ARRAY_SIZE(default_rss_mib); ++i)
+			rss_mib[num_rss++] = default_rss_mib[i];
+	}
+
+	printf("%-12s %10s %12s\n", "backend", "rss_mib", "spawn_us");
+	for (i = 0; i < num_rss; ++i) {
+		void *ballast = inflate_rss(rss_mib[i]);
+
+		if (rss_mib[i] && !ballast) {
+			fprintf(stderr, "cannot allocate %zu MiB: %s\n",
+			        rss_mib[i], strerror(errno));
+			continue;
+		}
+
+		for (j = 0; j < ARRAY_SIZE(backends); ++j) {
+			double avg_us;
+			int ret;
+
+			ret = bench_backend(backends[j].be_backend,
+			                    iterations, &avg_us);
+			if (ret) {
+				char *exit_string = NULL;
+				(void) copy_exit_detail_str(ret, &exit_string);
+				fprintf(stderr, "%s: %s\n", backends[j].be_name,
+				        exit_string ? exit_string : "error");
+				free(exit_string);
+				continue;
+			}
+
+			printf("%-12s %10zu %12.1f\n", backends[j].be_name,
+			       rss_mib[i], avg_us);
+		}
+
+		free(ballast);
+	}
+
+	{
+		double avg_us;
+
+		if (bench_spec(iterations, &avg_us))
+			fprintf(stderr, "spec: spawn failed\n");
+		else
+			printf("\n%-12s %10s %12s\n%-12s %10s %12.1f\n",
+			       "reuse", "pipes", "spawn_us", "exec_spawn",
+			       "yes", avg_us);
+	}
+
+	printf("\n%-12s %10s %12s\n", "path", "depth", "spawn_us");
+	for (j = 0; j < 2; ++j) {
+		double avg_us;
+
+		if (bench_path(PATH_DEPTH, j, iterations, &avg_us)) {
+			fprintf(stderr, "path: spawn failed\n");
+			continue;
+		}
+
+		printf("%-12s %10u %12.1f\n", j ? "flushed" : "warm",
+		       PATH_DEPTH, avg_us);
+	}
+
+	printf("\n%-12s %10s %12s\n", "user", "cache", "spawn_us");
+	for (j = 0; j < 3; ++j) {
+		const char *user = j ? "nobody" : NULL;
+		double avg_us;
+
+		if (bench_user(user, j == 2, iterations, &avg_us)) {
+			fprintf(stderr, "user: cannot spawn as nobody\n");
+			continue;
+		}
+
+		printf("%-12s %10s %12.1f\n", j ? user : "self",
+		       j == 2 ? "flushed" : "warm", avg_us);
+	}
+
+	printf("\n%-12s %10s %12s %12s\n", "backend", "width",
+	       "serial_us", "batch_us");
+	for (j = 0; j < ARRAY_SIZE(backends); ++j) {
+		double serial_us, batch_us;
+		unsigned int rounds = iterations / FANOUT_WIDTH + 1;
+
+		if (bench_fanout(backends[j].be_backend, false, rounds,
+		                 &serial_us) ||
+		    bench_fanout(backends[j].be_backend, true, rounds,
+		                 &batch_us)) {
+			fprintf(stderr, "%s: fan-out failed\n",
+			        backends[j].be_name);
+			continue;
+		}
+
+		printf("%-12s %10u %12.1f %12.1f\n", backends[j].be_name,
+		       FANOUT_WIDTH, serial_us, batch_us);
+	}
+
+	/* one at a time through the server, all at once without it */
+	{
+		double serial_us, batch_us;
+		unsigned int rounds = iterations / FANOUT_WIDTH + 1;
+
+		if (bench_fanout(EXEC_BACKEND_DEFAULT, false, rounds,
+		                 &serial_us) ||
+		    bench_fanout(EXEC_BACKEND_DEFAULT, true, rounds,
+		                 &batch_us))
+			fprintf(stderr, "default: fan-out failed\n");
+		else
+			printf("%-12s %10u %12.1f %12.1f\n", "default",
+			       FANOUT_WIDTH, serial_us, batch_us);
+	}
+
+	printf("\n%-12s %10s %12s\n", "pipeline", "stages", "run_us");
+	for (j = 0; j < 2; ++j) {
+		double avg_us;
+
+		if (bench_pipeline(!j, iterations, &avg_us)) {
+			fprintf(stderr, "pipeline: failed\n");
+			continue;
+		}
+
+		printf("%-12s %10u %12.1f\n", j ? "exec" : "shell",
+		       PIPELINE_STAGES, avg_us);
+	}
+
+	printf("\n%-12s %10s %12s\n", "echo", "messages", "roundtrip_us");
+	for (j = 0; j < 2; ++j) {
+		double avg_us;
+
+		if (bench_echo(j, ECHO_MESSAGES, &avg_us)) {
+			fprintf(stderr, "echo: ping-pong failed\n");
+			continue;
+		}
+
+		printf("%-12s %10u %12.2f\n", j ? "stream" : "toggle",
+		       ECHO_MESSAGES, avg_us);
+	}
+
+	printf("\n%-12s %10s %12s\n", "chat", "lines", "line_us");
+	for (j = 0; j < 2; ++j) {
+		double avg_us;
+
+		if (bench_chat(j, CHAT_LINES, &avg_us)) {
+			fprintf(stderr, "chat: line protocol failed\n");
+			continue;
+		}
+
+		printf("%-12s %10u %12.2f\n", j ? "bufio" : "timed",
+		       CHAT_LINES, avg_us);
+	}
+
+	{
+		double mb_per_s;
+
+		if (bench_duplex(DUPLEX_MIB, &mb_per_s))
+			fprintf(stderr, "duplex: communicate failed\n");
+		else
+			printf("\n%-12s %10s %12s\n%-12s %10u %12.1f\n",
+			       "duplex", "mib", "mb_per_s", "communicate",
+			       DUPLEX_MIB, mb_per_s);
+	}
+
+	printf("\n%-12s %10s %12s\n", "feed", "mib", "mb_per_s");
+	for (j = 0; j < 2; ++j) {
+		double mb_per_s;
+
+		if (bench_feed(j, FEED_CHILDREN, FEED_MIB, &mb_per_s)) {
+			fprintf(stderr, "feed: failed\n");
+			continue;
+		}
+
+		printf("%-12s %10u %12.1f\n", j ? "memfd" : "pipe",
+		       FEED_CHILDREN * FEED_MIB, mb_per_s);
+	}
+
+	printf("\n%-12s %10s %12s\n", "capture", "mib", "mb_per_s");
+	for (j = 0; j < 4; ++j) {
+		static const char *const names[] = {
+			"read_write", "splice", "pipe_1m", "pipe_grow"
+		};
+		struct exec_attr attr;
+		double mb_per_s;
+
+		/* the same splice loop, behind a bigger pipe */
+		memset(&attr, 0, sizeof(attr));
+		if (j == 2)
+			attr.ea_stdio[1].es_pipe_size = MIB;
+		attr.ea_pipe_autogrow = (j == 3);
+
+		if (bench_capture(j > 0, &attr, CAPTURE_MIB, &mb_per_s)) {
+			fprintf(stderr, "capture: failed\n");
+			continue;
+		}
+
+		printf("%-12s %10u %12.1f\n", names[j], CAPTURE_MIB,
+		       mb_per_s);
+	}
+
+	printf("\n%-12s %10s %12s %12s\n", "records", "mib", "mb_per_s",
+	       "lines");
+	for (j = 0; j < 2; ++j) {
+		double mb_per_s;
+		uint64_t lines;
+
+		if (bench_records(j, RECORDS_MIB, &mb_per_s, &lines)) {
+			fprintf(stderr, "records: failed\n");
+			continue;
+		}
+
+		printf("%-12s %10u %12.1f %12llu\n", j ? "reader" : "byte_loop",
+		       RECORDS_MIB, mb_per_s, (unsigned long long) lines);
+	}
+
+	printf("\n%-12s %10s %12s %12s\n", "engine", "children",
+	       "child_us", "syscalls");
+	for (j = 0; j < ARRAY_SIZE(engines); ++j) {
+		double avg_us, syscalls;
+
+		if (bench_engine(engines[j].ee_backend, ENGINE_CHILDREN,
+		                 &avg_us, &syscalls)) {
+			fprintf(stderr, "%s: engine unavailable\n",
+			        engines[j].ee_name);
+			continue;
+		}
+
+		printf("%-12s %10u %12.1f %12.2f\n", engines[j].ee_name,
+		       ENGINE_CHILDREN, avg_us, syscalls);
+	}
+
+	printf("\n%-12s %10s %12s %12s\n", "pool", "limit", "jobs_per_s",
+	       "backoffs");
+	for (j = 0; j < ARRAY_SIZE(pool_limits); ++j) {
+		double jobs_per_s;
+		uint64_t backoffs;
+
+		if (bench_pool(pool_limits[j], POOL_JOBS, &jobs_per_s,
+		               &backoffs)) {
+			fprintf(stderr, "pool: failed\n");
+			continue;
+		}
+
+		printf("%-12s %10u %12.0f %12llu\n", "true", pool_limits[j],
+		       jobs_per_s, (unsigned long long) backoffs);
+	}
+
+	(void) exec_server_stop();
+	return 0;
+}
@@ -0,0 +1,390 @@
+/*
+ * =============================================================================
+ *
+ *       Filename:  bufio.c
+ *
+ *    Description:  Buffered reading from and writing to processes
+ *
+ *        Version:  1.0
+ *        Created:  10/17/2026 10:27:05 PM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Oliver Lorenz (ol), olli@olorenz.org
+ *
+ * =============================================================================
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "bufio.h"
+#include "internal.h"
+
+#define BUFIO_DEFAULT_SIZE	(64 * 1024)
+
+struct exec_reader {
+	int     rd_fd;
+	bool    rd_nonblock;
+	bool    rd_eof;
+	char   *rd_buf;
+	size_t  rd_size;
+	size_t  rd_start;
+	size_t  rd_end;
+	size_t  rd_scan;
+};
+
+struct exec_writer {
+	int     wr_fd;
+	bool    wr_nonblock;
+	char   *wr_buf;
+	size_t  wr_size;
+	size_t  wr_start;
+	size_t  wr_end;
+};
+
+/*
+ * A nonblocking descriptor is tried first and only waited for if it has
+ * nothing to offer. A blocking one is waited for first if there is a
+ * deadline to keep.
+ */
+static ssize_t bufio_read(int fd, bool nonblock, void *buf, size_t size,
+                          const struct timespec *deadline)
+{
+	ssize_t count;
+	int ret;
+
+	if (!nonblock && deadline && (ret = fd_wait(fd, POLLIN, deadline)))
+		return ret;
+
+	for (;;) {
+		count = read(fd, buf, size);
+		if (count >= 0)
+			return count;
+
+		if (errno == EINTR)
+			continue;
+		if (errno != EAGAIN)
+			return -errno;
+		if ((ret = fd_wait(fd, POLLIN, deadline)))
+			return ret;
+	}
+}
+
+static ssize_t bufio_writev(int fd, bool nonblock, const struct iovec *iov,
+                            int iovcnt, const struct timespec *deadline)
+{
+	ssize_t count;
+	int ret;
+
+	if (!nonblock && deadline && (ret = fd_wait(fd, POLLOUT, deadline)))
+		return ret;
+
+	for (;;) {
+		count = writev(fd, iov, iovcnt);
+		if (count >= 0)
+			return count;
+
+		if (errno == EINTR)
+			continue;
+		if (errno != EAGAIN)
+			return -errno;
+		if ((ret = fd_wait(fd, POLLOUT, deadline)))
+			return ret;
+	}
+}
+
+static bool fd_is_nonblocking(int fd)
+{
+	int flags = fd_get_flags(fd);
+
+	return flags != -1 && (flags & O_NONBLOCK);
+}
+
+struct exec_reader *exec_reader_new(int fd, size_t size)
+{
+	struct exec_reader *r;
+
+	if ((r = calloc(1, sizeof(*r))) == NULL)
+		return NULL;
+
+	r->rd_size = size ? size : BUFIO_DEFAULT_SIZE;
+	if ((r->rd_buf = malloc(r->rd_size)) == NULL) {
+		free(r);
+		return NULL;
+	}
+
+	r->rd_fd = fd;
+	r->rd_nonblock = fd_is_nonblocking(fd);
+	return r;
+}
+
+void exec_reader_free(struct exec_reader *reader)
+{
+	if (!reader)
+		return;
+
+	free(reader->rd_buf);
+	free(reader);
+}
+
+static void reader_compact(struct exec_reader *r)
+{
+	memmove(r->rd_buf, r->rd_buf + r->rd_start, r->rd_end - r->rd_start);
+	r->rd_end -= r->rd_start;
+	r->rd_scan = r->rd_scan > r->rd_start ? r->rd_scan - r->rd_start : 0;
+	r->rd_start = 0;
+}
+
+/* a single read into the free space, which has to be there */
+static ssize_t reader_fill(struct exec_reader *r,
+                           const struct timespec *deadline)
+{
+	ssize_t count;
+
+	if (r->rd_start == r->rd_end)
+		r->rd_start = r->rd_end = r->rd_scan = 0;
+	else if (r->rd_end == r->rd_size)
+		reader_compact(r);
+
+	count = bufio_read(r->rd_fd, r->rd_nonblock, r->rd_buf + r->rd_end,
+	                   r->rd_size - r->rd_end, deadline);
+	if (count > 0)
+		r->rd_end += (size_t) count;
+	else if (count == 0)
+		r->rd_eof = true;
+
+	return count;
+}
+
+ssize_t exec_reader_read(struct exec_reader *reader, void *buf, size_t size,
+                         const struct timespec *deadline)
+{
+	struct exec_reader *r = reader;
+	ssize_t count;
+	size_t avail;
+
+	if (r->rd_start == r->rd_end) {
+		if (r->rd_eof || !size)
+			return 0;
+
+		/* nothing to gain from copying twice */
+		if (size >= r->rd_size) {
+			count = bufio_read(r->rd_fd, r->rd_nonblock, buf, size,
+			                   deadline);
+			if (count == 0)
+				r->rd_eof = true;
+			return count;
+		}
+
+		if ((count = reader_fill(r, deadline)) <= 0)
+			return count;
+	}
+
+	avail = r->rd_end - r->rd_start;
+	if (size > avail)
+		size = avail;
+
+	memcpy(buf, r->rd_buf + r->rd_start, size);
+	r->rd_start += size;
+	return (ssize_t) size;
+}
+
+ssize_t exec_reader_read_exact(struct exec_reader *reader, void *buf,
+                               size_t size, const struct timespec *deadline)
+{
+	size_t have = 0;
+	ssize_t count;
+
+	while (have < size) {
+		count = exec_reader_read(reader, (char *) buf + have,
+		                         size - have, deadline);
+		if (count < 0)
+			return count;
+		if (count == 0)
+			break;
+
+		have += (size_t) count;
+	}
+
+	return (ssize_t) have;
+}
+
+ssize_t exec_reader_peek(struct exec_reader *reader, const void **data,
+                         size_t size, const struct timespec *deadline)
+{
+	struct exec_reader *r = reader;
+	ssize_t count;
+
+	if (size > r->rd_size)
+		return -EINVAL;
+
+	while (r->rd_end - r->rd_start < size && !r->rd_eof) {
+		if (r->rd_start + size > r->rd_size)
+			reader_compact(r);
+
+		if ((count = reader_fill(r, deadline)) < 0)
+			return count;
+	}
+
+	*data = r->rd_buf + r->rd_start;
+	return (ssize_t) (r->rd_end - r->rd_start);
+}
+
+void exec_reader_consume(struct exec_reader *reader, size_t size)
+{
+	struct exec_reader *r = reader;
+
+	if (size > r->rd_end - r->rd_start)
+		size = r->rd_end - r->rd_start;
+
+	r->rd_start += size;
+}
+
+ssize_t exec_reader_until(struct exec_reader *reader, int delim,
+                          const void **data,
+                          const struct timespec *deadline)
+{
+	struct exec_reader *r = reader;
+	size_t from, len;
+	ssize_t count;
+	char *hit;
+
+	for (;;) {
+		/* don't look at the same bytes twice */
+		from = r->rd_scan > r->rd_start ? r->rd_scan : r->rd_start;
+		hit = memchr(r->rd_buf + from, delim, r->rd_end - from);
+		if (hit) {
+			len = (size_t) (hit + 1 - (r->rd_buf + r->rd_start));
+			break;
+		}
+		r->rd_scan = r->rd_end;
+
+		if (r->rd_eof) {
+			len = r->rd_end - r->rd_start;
+			break;
+		}
+
+		if (r->rd_start == 0 && r->rd_end == r->rd_size)
+			return -ENOBUFS;
+
+		if ((count = reader_fill(r, deadline)) < 0)
+			return count;
+	}
+
+	*data = r->rd_buf + r->rd_start;
+	r->rd_start += len;
+	return (ssize_t) len;
+}
+
+struct exec_writer *exec_writer_new(int fd, size_t size)
+{
+	struct exec_writer *w;
+
+	if ((w = calloc(1, sizeof(*w))) == NULL)
+		return NULL;
+
+	w->wr_size = size ? size : BUFIO_DEFAULT_SIZE;
+	if ((w->wr_buf = malloc(w->wr_size)) == NULL) {
+		free(w);
+		return NULL;
+	}
+
+	w->wr_fd = fd;
+	w->wr_nonblock = fd_is_nonblocking(fd);
+	return w;
+}
+
+void exec_writer_free(struct exec_writer *writer)
+{
+	if (!writer)
+		return;
+
+	free(writer->wr_buf);
+	free(writer);
+}
+
+static void writer_append(struct exec_writer *w, const void *buf,
+                          size_t size)
+{
+	if (w->wr_start == w->wr_end) {
+		w->wr_start = w->wr_end = 0;
+	} else if (w->wr_end + size > w->wr_size) {
+		memmove(w->wr_buf, w->wr_buf + w->wr_start,
+		        w->wr_end - w->wr_start);
+		w->wr_end -= w->wr_start;
+		w->wr_start = 0;
+	}
+
+	memcpy(w->wr_buf + w->wr_end, buf, size);
+	w->wr_end += size;
+}
+
+ssize_t exec_writer_write(struct exec_writer *writer, const void *buf,
+                          size_t size, const struct timespec *deadline)
+{
+	struct exec_writer *w = writer;
+	struct iovec iov[2];
+	size_t pending, done;
+	ssize_t count;
+
+	/*
+	 * Whatever doesn't fit goes out together with the buffer, until the
+	 * rest of @buf fits.
+	 */
+	done = 0;
+	while ((pending = w->wr_end - w->wr_start) + size - done > w->wr_size) {
+		iov[0].iov_base = w->wr_buf + w->wr_start;
+		iov[0].iov_len  = pending;
+		iov[1].iov_base = (char *) buf + done;
+		iov[1].iov_len  = size - done;
+
+		count = bufio_writev(w->wr_fd, w->wr_nonblock,
+		                     pending ? iov : iov + 1, pending ? 2 : 1,
+		                     deadline);
+		/* what is gone must not be sent again by a retry */
+		if (count < 0)
+			return done ? (ssize_t) done : count;
+
+		if ((size_t) count < pending) {
+			w->wr_start += (size_t) count;
+		} else {
+			w->wr_start = w->wr_end = 0;
+			done += (size_t) count - pending;
+		}
+	}
+
+	writer_append(w, (const char *) buf + done, size - done);
+	return (ssize_t) size;
+}
+
+int exec_writer_flush(struct exec_writer *writer,
+                      const struct timespec *deadline)
+{
+	struct exec_writer *w = writer;
+	struct iovec iov;
+	ssize_t count;
+
+	while (w->wr_start < w->wr_end) {
+		iov.iov_base = w->wr_buf + w->wr_start;
+		iov.iov_len  = w->wr_end - w->wr_start;
+
+		count = bufio_writev(w->wr_fd, w->wr_nonblock, &iov, 1,
+		                     deadline);
+		if (count < 0)
+			return (int) count;
+
+		w->wr_start += (size_t) count;
+	}
+
+	w->wr_start = w->wr_end = 0;
+	return 0;
+}
+
+size_t exec_writer_pending(const struct exec_writer *writer)
+{
+	return writer->wr_end - writer->wr_start;
+}
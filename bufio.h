@@ -0,0 +1,197 @@
+/*
+ * =============================================================================
+ *
+ *       Filename:  bufio.h
+ *
+ *    Description:  Buffered reading from and writing to processes
+ *
+ *        Version:  1.0
+ *        Created:  10/17/2026 10:27:05 PM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Oliver Lorenz (ol), olli@olorenz.org
+ *
+ * =============================================================================
+ */
+
+#ifndef PROCEXEC_BUFIO_H
+#define PROCEXEC_BUFIO_H
+
+#include <stddef.h>
+#include <time.h>
+#include <sys/types.h>
+
+
+struct exec_reader;
+struct exec_writer;
+
+
+/**
+ * exec_reader_new - create a buffered reader
+ * @fd:				descriptor to read from, e.g. @pi_stdout
+ * @size:			buffer size, %0 for a default of 64 KiB
+ *
+ * Every refill is a single read(2) of as much as the buffer takes. If
+ * @fd is nonblocking, see exec_stream_mode(), the read is tried before
+ * waiting with ppoll(2), so data that is already there costs no extra
+ * system call. Otherwise, a wait comes first whenever a deadline is
+ * given, so that a read never blocks past it.
+ * @fd is not closed by exec_reader_free().
+ *
+ * @return: the new reader, or %NULL with @errno set.
+ */
+extern struct exec_reader *exec_reader_new(int fd, size_t size);
+
+
+/**
+ * exec_reader_free - destroy a buffered reader
+ * @reader:			reader to destroy, may be %NULL
+ *
+ * Data still buffered is lost.
+ */
+extern void exec_reader_free(struct exec_reader *reader);
+
+
+/**
+ * exec_reader_read - read what is there
+ * @reader:			the reader
+ * @buf:			buffer for the returned data
+ * @size:			size of @buf
+ * @deadline:			absolute %CLOCK_MONOTONIC time to give up
+ *				waiting for data, %NULL to wait forever
+ *
+ * Like read(2): returns buffered data if there is any, otherwise refills
+ * once. Reads larger than the buffer bypass it.
+ *
+ * @return: the number of bytes read, %0 at end of file, or a negative
+ *          error code, %-ETIMEDOUT once @deadline has passed.
+ */
+extern ssize_t exec_reader_read(struct exec_reader *reader, void *buf,
+                                size_t size, const struct timespec *deadline);
+
+
+/**
+ * exec_reader_read_exact - read a given number of bytes
+ * @reader:			the reader
+ * @buf:			buffer for the returned data
+ * @size:			number of bytes to read
+ * @deadline:			see exec_reader_read()
+ *
+ * @return: @size, fewer bytes if end of file came first, or a negative
+ *          error code. On error, data read so far stays consumed.
+ */
+extern ssize_t exec_reader_read_exact(struct exec_reader *reader, void *buf,
+                                      size_t size,
+                                      const struct timespec *deadline);
+
+
+/**
+ * exec_reader_peek - look at data without consuming it
+ * @reader:			the reader
+ * @data:			set to the buffered data
+ * @size:			number of bytes wanted, at most the buffer size
+ * @deadline:			see exec_reader_read()
+ *
+ * Refills until @size bytes are buffered. exec_reader_consume() drops
+ * what has been dealt with. @data is valid until the reader is used
+ * again.
+ *
+ * @return: the number of bytes at @data, which may exceed @size and is
+ *          only smaller at end of file, or a negative error code,
+ *          %-EINVAL if @size exceeds the buffer.
+ */
+extern ssize_t exec_reader_peek(struct exec_reader *reader, const void **data,
+                                size_t size, const struct timespec *deadline);
+
+
+/**
+ * exec_reader_consume - drop peeked data
+ * @reader:			the reader
+ * @size:			number of bytes to drop, at most what
+ *				exec_reader_peek() returned
+ */
+extern void exec_reader_consume(struct exec_reader *reader, size_t size);
+
+
+/**
+ * exec_reader_until - read up to and including a delimiter
+ * @reader:			the reader
+ * @delim:			byte to stop after, e.g. '\n'
+ * @data:			set to the data read
+ * @deadline:			see exec_reader_read()
+ *
+ * @data points into the buffer and is valid until the reader is used
+ * again.
+ *
+ * @return: the number of bytes at @data, including @delim unless end of
+ *          file came first, %0 at end of file, or a negative error code,
+ *          %-ENOBUFS if the buffer filled up without a delimiter, which
+ *          leaves the data buffered.
+ */
+extern ssize_t exec_reader_until(struct exec_reader *reader, int delim,
+                                 const void **data,
+                                 const struct timespec *deadline);
+
+
+/**
+ * exec_writer_new - create a buffered writer
+ * @fd:				descriptor to write to, e.g. @pi_stdin
+ * @size:			buffer size, %0 for a default of 64 KiB
+ *
+ * Writes are collected in the buffer until it would overflow or
+ * exec_writer_flush() is called. An overflowing write goes out in a
+ * single writev(2) together with what has been buffered.
+ * @fd is not closed by exec_writer_free().
+ *
+ * @return: the new writer, or %NULL with @errno set.
+ */
+extern struct exec_writer *exec_writer_new(int fd, size_t size);
+
+
+/**
+ * exec_writer_free - destroy a buffered writer
+ * @writer:			writer to destroy, may be %NULL
+ *
+ * Data not flushed yet is discarded.
+ */
+extern void exec_writer_free(struct exec_writer *writer);
+
+
+/**
+ * exec_writer_write - write through the buffer
+ * @writer:			the writer
+ * @buf:			data to write
+ * @size:			size of @buf
+ * @deadline:			absolute %CLOCK_MONOTONIC time to give up
+ *				waiting for @fd to drain, %NULL to wait
+ *				forever
+ *
+ * @return: @size, or a negative error code if nothing of @buf has been
+ *          written or buffered. If an error or the deadline hits after
+ *          part of @buf has been written, that part is returned as a
+ *          short count, the rest has neither been written nor buffered.
+ *          Buffered data that didn't make it out is kept either way.
+ */
+extern ssize_t exec_writer_write(struct exec_writer *writer, const void *buf,
+                                 size_t size, const struct timespec *deadline);
+
+
+/**
+ * exec_writer_flush - write out everything buffered
+ * @writer:			the writer
+ * @deadline:			see exec_writer_write()
+ *
+ * @return: On success, %0 is returned, otherwise a negative error code.
+ */
+extern int exec_writer_flush(struct exec_writer *writer,
+                             const struct timespec *deadline);
+
+
+/**
+ * exec_writer_pending - get the amount of buffered data
+ * @writer:			the writer
+ */
+extern size_t exec_writer_pending(const struct exec_writer *writer);
+
+#endif
@@ -0,0 +1,230 @@
+/*
+ * =============================================================================
+ *
+ *       Filename:  capture.c
+ *
+ *    Description:  Move child output to other descriptors without copying
+ *                  it through user space
+ *
+ *        Version:  1.0
+ *        Created:  10/17/2026 02:31:08 PM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Oliver Lorenz (ol), olli@olorenz.org
+ *
+ * =============================================================================
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include "exec.h"
+#include "internal.h"
+
+#define SPLICE_CHUNK		(1024 * 1024)
+#define COPY_CHUNK		(64 * 1024)
+
+enum { CAPTURE_OUT, CAPTURE_ERR, NUM_CAPTURE };
+
+/* waits until @fd is ready for @events, %-ETIMEDOUT once @deadline passed */
+static int wait_ready(int fd, short events, const struct timespec *deadline)
+{
+	struct pollfd pfd;
+	struct timespec left;
+	int ret;
+
+	pfd.fd = fd;
+	pfd.events = events;
+
+	for (;;) {
+		if (!deadline) {
+			ret = poll(&pfd, 1, -1);
+		} else {
+			/* one last look even if @deadline has passed */
+			if (!deadline_left(deadline, &left))
+				memset(&left, 0, sizeof(left));
+			ret = ppoll(&pfd, 1, &left, NULL);
+		}
+
+		if (ret > 0)
+			return 0;
+		if (ret == 0)
+			return -ETIMEDOUT;
+		if (errno != EINTR)
+			return -errno;
+	}
+}
+
+static int write_all(int fd, const char *buf, size_t len,
+                     const struct timespec *deadline)
+{
+	ssize_t count;
+	int ret;
+
+	while (len) {
+		count = write(fd, buf, len);
+		if (count == -1) {
+			if (errno == EINTR)
+				continue;
+			if (errno != EAGAIN)
+				return -errno;
+			if ((ret = wait_ready(fd, POLLOUT, deadline)) != 0)
+				return ret;
+			continue;
+		}
+
+		buf += count;
+		len -= (size_t) count;
+	}
+
+	return 0;
+}
+
+static ssize_t copy_some(int in, int out, size_t len,
+                         const struct timespec *deadline)
+{
+	char buf[COPY_CHUNK];
+	ssize_t count;
+	int ret;
+
+	if (len > sizeof(buf))
+		len = sizeof(buf);
+
+	do {
+		count = read(in, buf, len);
+	} while (count == -1 && errno == EINTR);
+
+	if (count <= 0)
+		return count == 0 ? 0 : -errno;
+
+	if (out == -1)
+		return count;
+
+	if ((ret = write_all(out, buf, (size_t) count, deadline)) != 0)
+		return ret;
+
+	return count;
+}
+
+ssize_t fd_transfer(int in, int out, size_t len, bool *use_splice,
+                    const struct timespec *deadline)
+{
+#ifdef __linux__
+	static const struct timespec expired;
+	ssize_t count;
+	int ret;
+
+	while (*use_splice && out != -1) {
+		count = splice(in, NULL, out, NULL, len,
+		               SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+		if (count >= 0)
+			return count;
+
+		switch (errno) {
+		case EINTR:
+			continue;
+		case EAGAIN:
+			/* either @in ran dry or @out is full */
+			if (wait_ready(in, POLLIN, &expired))
+				return -EAGAIN;
+			if ((ret = wait_ready(out, POLLOUT, deadline)) != 0)
+				return ret;
+			continue;
+		case EINVAL:
+		case ENOSYS:
+		case EOPNOTSUPP:
+			/* e.g. an O_APPEND file, nothing has moved yet */
+			*use_splice = false;
+			continue;
+		default:
+			break;
+		}
+
+		return -errno;
+	}
+#else
+	*use_splice = false;
+#endif
+
+	return copy_some(in, out, len, deadline);
+}
+
+int exec_capture(struct process_info *proc, int out_fd, int err_fd,
+                 uint64_t *out_bytes, uint64_t *err_bytes,
+                 const struct timespec *deadline)
+{
+	struct pollfd pfds[NUM_CAPTURE];
+	int targets[NUM_CAPTURE];
+	uint64_t *counters[NUM_CAPTURE];
+	bool use_splice[NUM_CAPTURE];
+	struct timespec left;
+	ssize_t count;
+	unsigned int i, open;
+	int ret;
+
+	pfds[CAPTURE_OUT].fd = proc->pi_stdout;
+	pfds[CAPTURE_ERR].fd = proc->pi_stderr;
+	targets[CAPTURE_OUT] = out_fd;
+	targets[CAPTURE_ERR] = err_fd;
+	counters[CAPTURE_OUT] = out_bytes;
+	counters[CAPTURE_ERR] = err_bytes;
+
+	for (i = 0; i < NUM_CAPTURE; ++i) {
+		pfds[i].events = POLLIN;
+		use_splice[i] = true;
+		if (counters[i])
+			*counters[i] = 0;
+	}
+
+	for (;;) {
+		open = 0;
+		for (i = 0; i < NUM_CAPTURE; ++i)
+			open += (pfds[i].fd != -1);
+		if (!open)
+			return 0;
+
+		if (!deadline)
+			ret = poll(pfds, NUM_CAPTURE, -1);
+		else if (deadline_left(deadline, &left))
+			ret = ppoll(pfds, NUM_CAPTURE, &left, NULL);
+		else
+			ret = 0;
+
+		if (ret == 0)
+			return -ETIMEDOUT;
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		for (i = 0; i < NUM_CAPTURE; ++i) {
+			if (pfds[i].fd == -1 || !pfds[i].revents)
+				continue;
+
+			count = fd_transfer(pfds[i].fd, targets[i],
+			                    SPLICE_CHUNK, &use_splice[i],
+			                    deadline);
+			if (count == -EAGAIN)
+				continue;
+			if (count < 0)
+				return (int) count;
+
+			if (count == 0) {
+				/* stays open for wait_for_child() to close */
+				pfds[i].fd = -1;
+				continue;
+			}
+
+			if (counters[i])
+				*counters[i] += (uint64_t) count;
+			pipe_autogrow(proc, i + 1, (size_t) count,
+			              use_splice[i] && targets[i] != -1 ?
+			              SPLICE_CHUNK : COPY_CHUNK);
+		}
+	}
+}
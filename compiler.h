@@ -25,6 +25,7 @@
 #define _used			_unused
 #define _unused			__attribute__((__unused__))
 #define _sentinel		__attribute__((__sentinel__(0)))
+#define _noreturn		__attribute__((__noreturn__))
 #define _transparent_union	__attribute__((__transparent_union__))
 
 #define ARRAY_SIZE(a)		(sizeof(a)/sizeof((a)[0]) + __must_be_array(a))
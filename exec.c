@@ -19,15 +19,27 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <grp.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
 #include <pwd.h>
+#include <sched.h>
+#include <signal.h>
+#include <spawn.h>
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <stdint.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 #include "exec.h"
+#include "internal.h"
 
 #define ROOT_UID		0
 
@@ -40,17 +52,652 @@
 #define PIPE_RD_FD		0
 #define PIPE_WR_FD		1
 
-static int drop_privileges(const struct passwd *user)
+#define PWBUF_SIZE		1024
+#define NGROUPS_HINT		32
+
+#define CRED_CACHE_SIZE		32
+#define CRED_CACHE_TTL		60
+
+#define VFORK_STACK_SIZE	(64 * 1024)
+#define DEFAULT_PATH		"/bin:/usr/bin"
+#define PATH_CACHE_SIZE		64
+#define PROC_FD_BUF_SIZE	4096
+
+#define COMM_CHUNK		(64 * 1024)
+#define PIPE_MAX_SIZE_PATH	"/proc/sys/fs/pipe-max-size"
+#define PIPE_MAX_SIZE_DEFAULT	(1024 * 1024)
+#define CHILD_NAP_MIN_NS	1000000L
+#define CHILD_NAP_MAX_NS	64000000L
+#define FIRST_NON_STDIO_FD	(STDERR_FILENO + 1)
+
+#ifndef CLONE_PIDFD
+#define CLONE_PIDFD		0x00001000
+#endif
+
+#ifdef __linux__
+#define DEFAULT_BACKEND		EXEC_BACKEND_VFORK
+#else
+#define DEFAULT_BACKEND		EXEC_BACKEND_FORK
+#endif
+
+#if defined(__GLIBC__) && defined(__GLIBC_PREREQ)
+#if __GLIBC_PREREQ(2, 34)
+#define HAVE_SPAWN_CLOSEFROM	1
+#endif
+#endif
+#ifndef HAVE_SPAWN_CLOSEFROM
+#define HAVE_SPAWN_CLOSEFROM	0
+#endif
+
+struct user_cred {
+	uid_t  uc_uid;
+	gid_t  uc_gid;
+	int    uc_ngroups;
+	gid_t *uc_groups;
+};
+
+struct spawn_ctx {
+	int                     sc_pipes[NUM_PIPES][2];
+	int                     sc_self_pipe[2];
+	bool                    sc_stdio;
+	const char             *sc_cmd;
+	char *const            *sc_argv;
+	user_info_t             sc_user;
+	enum user_info_type     sc_user_type;
+	const struct user_cred *sc_cred;
+	const struct spawn_env *sc_env;
+	const int              *sc_keep_fds;
+	unsigned int            sc_num_keep_fds;
+	sigset_t                sc_sigmask;
+	pid_t                   sc_pid;
+	bool                    sc_want_pidfd;
+	int                     sc_pidfd;
+	bool                    sc_nonblock;
+	struct timespec         sc_start;
+	unsigned int            sc_timing_slot;
+	uint64_t               *sc_stamps;
+	int                     sc_stdio_fds[NUM_PIPES];
+	size_t                  sc_pipe_size[NUM_PIPES];
+	bool                    sc_pipe_autogrow;
+	bool                    sc_batch;
+
+	/* preset by exec_spawn() */
+	const char             *sc_path;
+	void                   *sc_stack;
+	size_t                  sc_stack_size;
+	const int              *sc_inherit_fds;
+	unsigned int            sc_num_inherit_fds;
+	int                    *sc_keep_buf;
+
+	/* owned by the parent, released by spawn_ctx_release() */
+	int                     sc_stdio_files[NUM_PIPES];
+	char                   *sc_path_alloc;
+	struct user_cred        sc_cred_store;
+	int                    *sc_keep_alloc;
+};
+
+static int resolve_cred(user_info_t user, enum user_info_type type,
+                        struct user_cred *cred)
 {
-	if (setgid(user->pw_gid))
-		return 1;
+	struct passwd pwd;
+	struct passwd *_user = NULL;
+	char *buf = NULL;
+	long bufsize;
+	gid_t *groups = NULL;
+	int ngroups, ret;
 
-	if (initgroups(user->pw_name, user->pw_gid))
-		return 1;
+	bufsize = sysconf(_SC_GETPW_R_SIZE_MAX);
+	if (bufsize <= 0)
+		bufsize = PWBUF_SIZE;
+
+	for (;;) {
+		char *tmp;
+
+		if ((tmp = realloc(buf, (size_t) bufsize)) == NULL)
+			goto fail;
+		buf = tmp;
+
+		switch (type) {
+		case USERINFO_TYPE_UID:
+			ret = getpwuid_r(*(user.ui_uid), &pwd, buf,
+			                 (size_t) bufsize, &_user);
+			break;
+		case USERINFO_TYPE_NAME:
+			ret = getpwnam_r(user.ui_name, &pwd, buf,
+			                 (size_t) bufsize, &_user);
+			break;
+		case USERINFO_TYPE_NONE:
+			/* fallthrough */
+		default:
+			ret = EINVAL;
+			break;
+		}
+
+		if (ret != ERANGE)
+			break;
+		bufsize *= 2;
+	}
+
+	if (ret) {
+		errno = ret;
+		goto fail;
+	}
+
+	if (!_user) {
+		errno = ENOENT;
+		goto fail;
+	}
+
+	ngroups = NGROUPS_HINT;
+	for (;;) {
+		gid_t *tmp;
+		int have = ngroups;
+
+		tmp = realloc(groups, (size_t) ngroups * sizeof(*groups));
+		if (tmp == NULL)
+			goto fail;
+		groups = tmp;
+
+		if (getgrouplist(_user->pw_name, _user->pw_gid,
+		                 groups, &have) != -1) {
+			ngroups = have;
+			break;
+		}
+
+		/* have holds the required size now, but some libcs don't */
+		ngroups = (have > ngroups ? have : ngroups * 2);
+	}
+
+	cred->uc_uid     = _user->pw_uid;
+	cred->uc_gid     = _user->pw_gid;
+	cred->uc_ngroups = ngroups;
+	cred->uc_groups  = groups;
+
+	free(buf);
+	return 0;
+
+fail:
+	ret = errno;
+	free(groups);
+	free(buf);
+	errno = ret;
+	return -1;
+}
+
+/*
+ * Resolved credentials, keyed by what the caller passed in. NSS lookups
+ * can take milliseconds, entries are reused for CRED_CACHE_TTL seconds.
+ */
+struct cred_entry {
+	bool                 ce_used;
+	enum user_info_type  ce_type;
+	uid_t                ce_uid;
+	char                *ce_name;
+	time_t               ce_expires;
+	uint64_t             ce_stamp;
+	struct user_cred     ce_cred;
+};
+
+static pthread_mutex_t cred_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct cred_entry cred_cache[CRED_CACHE_SIZE];
+static uint64_t cred_clock;
+static uint64_t cred_hits;
+static uint64_t cred_misses;
+
+static time_t cred_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+static int cred_copy(struct user_cred *dst, const struct user_cred *src)
+{
+	size_t size = (size_t) src->uc_ngroups * sizeof(*src->uc_groups);
+
+	*dst = *src;
+	if ((dst->uc_groups = malloc(size ? size : 1)) == NULL)
+		return -1;
+
+	memcpy(dst->uc_groups, src->uc_groups, size);
+	return 0;
+}
+
+static void cred_entry_clear(struct cred_entry *e)
+{
+	free(e->ce_name);
+	free(e->ce_cred.uc_groups);
+	memset(e, 0, sizeof(*e));
+}
+
+static bool cred_entry_matches(const struct cred_entry *e, user_info_t user,
+                               enum user_info_type type)
+{
+	if (!e->ce_used || e->ce_type != type)
+		return false;
+
+	if (type == USERINFO_TYPE_UID)
+		return e->ce_uid == *(user.ui_uid);
+
+	return !strcmp(e->ce_name, user.ui_name);
+}
+
+/* called with cred_lock held */
+static struct cred_entry *cred_cache_find(user_info_t user,
+                                          enum user_info_type type)
+{
+	unsigned int i;
+
+	for (i = 0; i < CRED_CACHE_SIZE; ++i) {
+		if (cred_entry_matches(&cred_cache[i], user, type))
+			return &cred_cache[i];
+	}
+
+	return NULL;
+}
+
+/* called with cred_lock held, evicts the least recently used entry */
+static void cred_cache_store(user_info_t user, enum user_info_type type,
+                             const struct user_cred *cred)
+{
+	struct cred_entry *e;
+	unsigned int i;
+
+	if ((e = cred_cache_find(user, type)) == NULL) {
+		e = &cred_cache[0];
+		for (i = 1; i < CRED_CACHE_SIZE && e->ce_used; ++i) {
+			if (!cred_cache[i].ce_used ||
+			    cred_cache[i].ce_stamp < e->ce_stamp)
+				e = &cred_cache[i];
+		}
+	}
+	cred_entry_clear(e);
+
+	if (type == USERINFO_TYPE_NAME &&
+	    (e->ce_name = strdup(user.ui_name)) == NULL)
+		return;
+
+	if (cred_copy(&e->ce_cred, cred)) {
+		cred_entry_clear(e);
+		return;
+	}
+
+	e->ce_used    = true;
+	e->ce_type    = type;
+	e->ce_uid     = (type == USERINFO_TYPE_UID ? *(user.ui_uid) : 0);
+	e->ce_expires = cred_now() + CRED_CACHE_TTL;
+	e->ce_stamp   = ++cred_clock;
+}
+
+/*
+ * resolve_cred() in front of the cache. On success, @cred is the
+ * caller's to free either way.
+ */
+static int lookup_cred(user_info_t user, enum user_info_type type,
+                       struct user_cred *cred)
+{
+	struct cred_entry *e;
+	int ret = 1;
+
+	if (type != USERINFO_TYPE_UID && type != USERINFO_TYPE_NAME) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&cred_lock);
+	e = cred_cache_find(user, type);
+	if (e && e->ce_expires > cred_now()) {
+		ret = cred_copy(cred, &e->ce_cred);
+		e->ce_stamp = ++cred_clock;
+		++cred_hits;
+	} else {
+		++cred_misses;
+	}
+	pthread_mutex_unlock(&cred_lock);
+
+	if (ret <= 0)
+		return ret;
+
+	/* NSS may take its time, don't hold up everybody else meanwhile */
+	if (resolve_cred(user, type, cred))
+		return -1;
+
+	pthread_mutex_lock(&cred_lock);
+	cred_cache_store(user, type, cred);
+	pthread_mutex_unlock(&cred_lock);
+	return 0;
+}
+
+void exec_user_cache_flush(void)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&cred_lock);
+	for (i = 0; i < CRED_CACHE_SIZE; ++i)
+		cred_entry_clear(&cred_cache[i]);
+	pthread_mutex_unlock(&cred_lock);
+}
+
+void exec_user_cache_stats(struct exec_cache_stats *stats)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&cred_lock);
+	stats->cs_hits    = cred_hits;
+	stats->cs_misses  = cred_misses;
+	stats->cs_entries = 0;
+	for (i = 0; i < CRED_CACHE_SIZE; ++i)
+		stats->cs_entries += cred_cache[i].ce_used;
+	pthread_mutex_unlock(&cred_lock);
+}
+
+/*
+ * Whether @cred may execute what @st describes, going by the mode bits.
+ * The parent's own credentials don't tell.
+ */
+static bool cred_may_exec(const struct stat *st, const struct user_cred *cred)
+{
+	int i;
+
+	if (cred->uc_uid == ROOT_UID)
+		return st->st_mode & (S_IXUSR | S_IXGRP | S_IXOTH);
+	if (st->st_uid == cred->uc_uid)
+		return st->st_mode & S_IXUSR;
+	if (st->st_gid == cred->uc_gid)
+		return st->st_mode & S_IXGRP;
+	for (i = 0; i < cred->uc_ngroups; ++i) {
+		if (st->st_gid == cred->uc_groups[i])
+			return st->st_mode & S_IXGRP;
+	}
+
+	return st->st_mode & S_IXOTH;
+}
+
+/*
+ * Looks @cmd up in @path the way execvp() would, on behalf of @cred if
+ * set. Names containing a slash are taken as they are.
+ */
+static char *resolve_path(const char *cmd, const char *path,
+                          const struct user_cred *cred)
+{
+	const char *dir, *end;
+	size_t dir_len, cmd_len;
+	struct stat st;
+	int err = ENOENT;
+	char *file;
+
+	if (!*cmd) {
+		errno = ENOENT;
+		return NULL;
+	}
+
+	if (strchr(cmd, '/'))
+		return strdup(cmd);
+
+	cmd_len = strlen(cmd);
+	for (dir = path; ; dir = end + 1) {
+		end = strchrnul(dir, ':');
+		dir_len = (size_t) (end - dir);
+
+		/* an empty entry means the current directory */
+		if ((file = malloc(dir_len + cmd_len + 3)) == NULL)
+			return NULL;
+		if (dir_len) {
+			memcpy(file, dir, dir_len);
+		} else {
+			file[0] = '.';
+			dir_len = 1;
+		}
+		file[dir_len] = '/';
+		memcpy(file + dir_len + 1, cmd, cmd_len + 1);
+
+		if (!stat(file, &st) && S_ISREG(st.st_mode)) {
+			if (cred ? cred_may_exec(&st, cred) :
+			           !access(file, X_OK))
+				return file;
+			err = EACCES;
+		}
+		free(file);
+
+		if (!*end)
+			break;
+	}
+
+	errno = err;
+	return NULL;
+}
+
+/*
+ * Commands found in $PATH, for our own credentials or those of @pe_uid.
+ * An entry is used as long as $PATH hasn't changed and the file it points
+ * to is still the same.
+ */
+struct path_entry {
+	char            *pe_cmd;
+	uid_t            pe_uid;
+	char            *pe_path;
+	dev_t            pe_dev;
+	ino_t            pe_ino;
+	struct timespec  pe_mtime;
+	struct timespec  pe_ctime;
+	uint64_t         pe_stamp;
+};
+
+static pthread_mutex_t path_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct path_entry path_cache[PATH_CACHE_SIZE];
+static char *path_env;
+static uint64_t path_clock;
+static uint64_t path_hits;
+static uint64_t path_misses;
+
+static bool same_time(const struct timespec *a, const struct timespec *b)
+{
+	return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+static void path_entry_clear(struct path_entry *e)
+{
+	free(e->pe_cmd);
+	free(e->pe_path);
+	memset(e, 0, sizeof(*e));
+}
+
+/* called with path_lock held */
+static void path_cache_clear(void)
+{
+	unsigned int i;
+
+	for (i = 0; i < PATH_CACHE_SIZE; ++i)
+		path_entry_clear(&path_cache[i]);
+	free(path_env);
+	path_env = NULL;
+}
+
+/* called with path_lock held */
+static struct path_entry *path_cache_find(const char *cmd, uid_t uid)
+{
+	unsigned int i;
+
+	for (i = 0; i < PATH_CACHE_SIZE; ++i) {
+		if (path_cache[i].pe_cmd && path_cache[i].pe_uid == uid &&
+		    !strcmp(path_cache[i].pe_cmd, cmd))
+			return &path_cache[i];
+	}
+
+	return NULL;
+}
+
+/* called with path_lock held, evicts the least recently used entry */
+static void path_cache_store(const char *cmd, uid_t uid, const char *file,
+                             const struct stat *st)
+{
+	struct path_entry *e;
+	unsigned int i;
+
+	if ((e = path_cache_find(cmd, uid)) == NULL) {
+		e = &path_cache[0];
+		for (i = 1; i < PATH_CACHE_SIZE && e->pe_cmd; ++i) {
+			if (!path_cache[i].pe_cmd ||
+			    path_cache[i].pe_stamp < e->pe_stamp)
+				e = &path_cache[i];
+		}
+	}
+	path_entry_clear(e);
+
+	e->pe_cmd = strdup(cmd);
+	e->pe_path = strdup(file);
+	if (!e->pe_cmd || !e->pe_path) {
+		path_entry_clear(e);
+		return;
+	}
+
+	e->pe_uid   = uid;
+	e->pe_dev   = st->st_dev;
+	e->pe_ino   = st->st_ino;
+	e->pe_mtime = st->st_mtim;
+	e->pe_ctime = st->st_ctim;
+	e->pe_stamp = ++path_clock;
+}
+
+/* $PATH as the child will see it, in @envp or, if that is %NULL, ours */
+static const char *env_path(char *const envp[])
+{
+	const char *path;
+	size_t i;
+
+	if (!envp) {
+		path = getenv("PATH");
+		return path ? path : DEFAULT_PATH;
+	}
+
+	for (i = 0; envp[i]; ++i) {
+		if (!strncmp(envp[i], "PATH=", 5))
+			return envp[i] + 5;
+	}
+
+	return DEFAULT_PATH;
+}
+
+/*
+ * resolve_path() against the $PATH in @envp, in front of the cache.
+ * Returns a copy of the path that is the caller's to free.
+ */
+static char *lookup_path(const char *cmd, char *const envp[],
+                         const struct user_cred *cred)
+{
+	/* no user gets this one, it stands for our own credentials */
+	uid_t uid = cred ? cred->uc_uid : (uid_t) -1;
+	const char *path;
+	struct path_entry *e;
+	struct stat st;
+	char *file = NULL;
+
+	if (strchr(cmd, '/'))
+		return strdup(cmd);
+
+	path = env_path(envp);
+
+	pthread_mutex_lock(&path_lock);
+	if (path_env && strcmp(path_env, path))
+		path_cache_clear();
+
+	e = path_cache_find(cmd, uid);
+	if (e && !stat(e->pe_path, &st) && st.st_dev == e->pe_dev &&
+	    st.st_ino == e->pe_ino && same_time(&st.st_mtim, &e->pe_mtime) &&
+	    same_time(&st.st_ctim, &e->pe_ctime)) {
+		file = strdup(e->pe_path);
+		e->pe_stamp = ++path_clock;
+		++path_hits;
+	} else {
+		++path_misses;
+	}
+	pthread_mutex_unlock(&path_lock);
+
+	if (file)
+		return file;
+
+	/* a long $PATH means lots of system calls, don't block meanwhile */
+	if ((file = resolve_path(cmd, path, cred)) == NULL)
+		return NULL;
+
+	if (stat(file, &st))
+		return file;
+
+	pthread_mutex_lock(&path_lock);
+	if (!path_env)
+		path_env = strdup(path);
+	if (path_env && !strcmp(path_env, path))
+		path_cache_store(cmd, uid, file, &st);
+	pthread_mutex_unlock(&path_lock);
+	return file;
+}
+
+void exec_path_cache_flush(void)
+{
+	pthread_mutex_lock(&path_lock);
+	path_cache_clear();
+	pthread_mutex_unlock(&path_lock);
+}
+
+void exec_path_cache_stats(struct exec_cache_stats *stats)
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&path_lock);
+	stats->cs_hits    = path_hits;
+	stats->cs_misses  = path_misses;
+	stats->cs_entries = 0;
+	for (i = 0; i < PATH_CACHE_SIZE; ++i)
+		stats->cs_entries += (path_cache[i].pe_cmd != NULL);
+	pthread_mutex_unlock(&path_lock);
+}
 
-	if (setuid(user->pw_uid))
+/*
+ * All a child does with credentials resolved up front. A child sharing our
+ * address space must not go through the C library's set*id() wrappers: in
+ * a threaded parent they try to synchronize the credentials of every
+ * thread, and those threads aren't ours anymore. The raw system calls
+ * only affect the calling thread, which is all a child has.
+ */
+#ifdef __linux__
+static int drop_privileges(const struct user_cred *cred)
+{
+#ifdef SYS_setgroups32
+	if (syscall(SYS_setgroups32, cred->uc_ngroups, cred->uc_groups))
+		return 1;
+	if (syscall(SYS_setgid32, cred->uc_gid))
+		return 1;
+	if (syscall(SYS_setuid32, cred->uc_uid))
+		return 1;
+	if (syscall(SYS_setuid32, ROOT_UID) == 0) {
+		errno = EPERM;
+		return 1;
+	}
+#else
+	if (syscall(SYS_setgroups, cred->uc_ngroups, cred->uc_groups))
+		return 1;
+	if (syscall(SYS_setgid, cred->uc_gid))
+		return 1;
+	if (syscall(SYS_setuid, cred->uc_uid))
 		return 1;
+	if (syscall(SYS_setuid, ROOT_UID) == 0) {
+		errno = EPERM;
+		return 1;
+	}
+#endif
 
+	return 0;
+}
+#else
+static int drop_privileges(const struct user_cred *cred)
+{
+	if (setgroups(cred->uc_ngroups, cred->uc_groups))
+		return 1;
+	if (setgid(cred->uc_gid))
+		return 1;
+	if (setuid(cred->uc_uid))
+		return 1;
 	if (setuid(ROOT_UID) == 0) {
 		errno = EPERM;
 		return 1;
@@ -58,50 +705,576 @@ static int drop_privileges(const struct passwd *user)
 
 	return 0;
 }
+#endif
+
+static bool fd_is_kept(const int *keep, unsigned int num_keep, long fd)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_keep; ++i) {
+		if (keep[i] == fd)
+			return true;
+	}
+
+	return false;
+}
 
-static struct passwd *resolve_user(user_info_t user, enum user_info_type type)
+#ifdef __linux__
+struct linux_dirent64 {
+	uint64_t       d_ino;
+	int64_t        d_off;
+	unsigned short d_reclen;
+	unsigned char  d_type;
+	char           d_name[];
+};
+
+static int close_fds_range(const int *keep, unsigned int num_keep)
 {
-	struct passwd *_user = NULL;
+#ifdef SYS_close_range
+	unsigned int i, first;
 
-	errno = 0;
-	switch (type) {
-	case USERINFO_TYPE_UID:
-		_user = getpwuid(*(user.ui_uid));
-		break;
-	case USERINFO_TYPE_NAME:
-		_user = getpwnam(user.ui_name);
-		break;
-	case USERINFO_TYPE_NONE:
-		/* fallthrough */
-	default:
-		errno = EINVAL;
-		break;
+	/* keep is sorted, close the gaps in between */
+	first = FIRST_NON_STDIO_FD;
+	for (i = 0; i < num_keep; ++i) {
+		unsigned int fd = (unsigned int) keep[i];
+
+		if (fd > first && syscall(SYS_close_range, first, fd - 1, 0))
+			return -1;
+		first = fd + 1;
 	}
 
-	if (!_user && !errno)
-		errno = ENOENT;
+	return (syscall(SYS_close_range, first, ~0U, 0) ? -1 : 0);
+#else
+	(void) keep;
+	(void) num_keep;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+static int close_fds_proc(const int *keep, unsigned int num_keep)
+{
+	char buf[PROC_FD_BUF_SIZE];
+	struct linux_dirent64 *entry;
+	long count, pos;
+	long fd;
+	int dir;
+	char *p;
+
+	/* no opendir(), we may not touch the heap in here */
+	dir = open("/proc/self/fd", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+	if (dir == -1)
+		return -1;
+
+	while ((count = syscall(SYS_getdents64, dir, buf, sizeof(buf))) > 0) {
+		for (pos = 0; pos < count; pos += entry->d_reclen) {
+			entry = (struct linux_dirent64 *) (buf + pos);
+
+			fd = 0;
+			for (p = entry->d_name; *p >= '0' && *p <= '9'; ++p)
+				fd = fd * 10 + (*p - '0');
+
+			/* skips "." and ".." as well */
+			if (*p || p == entry->d_name)
+				continue;
+
+			if (fd < FIRST_NON_STDIO_FD || fd == dir ||
+			    fd_is_kept(keep, num_keep, fd))
+				continue;
+
+			close((int) fd);
+		}
+	}
+
+	close(dir);
+	return (count ? -1 : 0);
+}
+#endif
+
+static void close_fds_loop(const int *keep, unsigned int num_keep)
+{
+	long maxfd;
+
+	maxfd = sysconf(_SC_OPEN_MAX);
+	while (--maxfd >= FIRST_NON_STDIO_FD) {
+		if (fd_is_kept(keep, num_keep, maxfd))
+			continue;
+		close((int)maxfd);
+	}
+}
+
+/*
+ * Prefers close_range(2), then walks /proc/self/fd and only iterates
+ * up to _SC_OPEN_MAX as a last resort.
+ */
+void close_fds_except(const int *keep, unsigned int num_keep)
+{
+#ifdef __linux__
+	if (close_fds_range(keep, num_keep) == 0)
+		return;
+
+	if (close_fds_proc(keep, num_keep) == 0)
+		return;
+#endif
+
+	close_fds_loop(keep, num_keep);
+}
+
+/*
+ * Closes every descriptor but stdio and the ones listed in sc_keep_fds,
+ * which are made inheritable.
+ */
+static int sanitize_fds(const struct spawn_ctx *ctx)
+{
+	unsigned int i;
+	int flags;
+
+	for (i = 0; i < ctx->sc_num_keep_fds; ++i) {
+		int fd = ctx->sc_keep_fds[i];
+
+		if (fd == ctx->sc_self_pipe[PIPE_WR_FD])
+			continue;
+
+		flags = fcntl(fd, F_GETFD);
+		if (flags == -1)
+			return -1;
+
+		if ((flags & FD_CLOEXEC) &&
+		    fcntl(fd, F_SETFD, flags & ~FD_CLOEXEC))
+			return -1;
+	}
+
+	close_fds_except(ctx->sc_keep_fds, ctx->sc_num_keep_fds);
+	return 0;
+}
+
+/*
+ * What the child's standard stream @i comes from: our pipe, a descriptor
+ * handed in by the caller, one picked by the stdio plan, or %-1 to leave
+ * it as inherited.
+ */
+static int child_stdio_fd(const struct spawn_ctx *ctx, int i)
+{
+	int end = (i == PIPE_STDIN ? PIPE_RD_FD : PIPE_WR_FD);
+
+	if (ctx->sc_stdio && ctx->sc_pipes[i][end] != -1)
+		return ctx->sc_pipes[i][end];
+
+	if (ctx->sc_env && ctx->sc_env->se_stdio_fds[i] >= 0)
+		return ctx->sc_env->se_stdio_fds[i];
+
+	return ctx->sc_stdio_fds[i];
+}
+
+/*
+ * execve(2) on a path resolved by the parent. Like execvp(), files
+ * without an interpreter line are handed to the shell.
+ */
+static void exec_file(const char *path, char *const argv[],
+                      char *const envp[])
+{
+	char **sh_argv;
+	int argc, i;
+
+	execve(path, argv, envp);
+	if (errno != ENOEXEC)
+		return;
+
+	/* the vfork stack has room for this */
+	for (argc = 0; argv[argc]; ++argc)
+		;
+	sh_argv = alloca((size_t) (argc + 3) * sizeof(*sh_argv));
+	sh_argv[0] = "/bin/sh";
+	sh_argv[1] = (char *) path;
+	for (i = 1; i < argc; ++i)
+		sh_argv[i + 1] = argv[i];
+	sh_argv[i + 1] = NULL;
+
+	execve(sh_argv[0], sh_argv, envp);
+	errno = ENOEXEC;
+}
+
+static _noreturn void child_exec(const struct spawn_ctx *ctx)
+{
+	const struct spawn_env *env = ctx->sc_env;
+	int child_error;
+	int i;
+
+	timing_stamp(ctx->sc_stamps, TS_CHILD);
+
+	for (i = 0; i < NUM_PIPES; ++i) {
+		int fd = child_stdio_fd(ctx, i);
+
+		if (fd < 0)
+			continue;
+
+		/* our files are close-on-exec, even if they landed here */
+		if (fd == i ? fcntl(fd, F_SETFD, 0) == -1 : dup2(fd, i) == -1)
+			goto fail;
+	}
+
+	if (ctx->sc_stdio) {
+		for (i = 0; i < NUM_PIPES; ++i) {
+			if (ctx->sc_pipes[i][PIPE_RD_FD] > STDERR_FILENO)
+				close(ctx->sc_pipes[i][PIPE_RD_FD]);
+			if (ctx->sc_pipes[i][PIPE_WR_FD] > STDERR_FILENO)
+				close(ctx->sc_pipes[i][PIPE_WR_FD]);
+		}
+	}
+
+	close(ctx->sc_self_pipe[PIPE_RD_FD]);
+
+	if (env && env->se_cwd_fd >= 0 && fchdir(env->se_cwd_fd))
+		goto fail;
+
+	/* before dropping privileges, which may forbid raising them */
+	for (i = 0; env && i < (int) env->se_num_rlimits; ++i) {
+		struct rlimit limit;
+
+		limit.rlim_cur = env->se_rlimits[i].rl_cur;
+		limit.rlim_max = env->se_rlimits[i].rl_max;
+		if (setrlimit(env->se_rlimits[i].rl_resource, &limit))
+			goto fail;
+	}
+
+	timing_stamp(ctx->sc_stamps, TS_SETUP);
+	if (ctx->sc_cred && drop_privileges(ctx->sc_cred))
+		goto fail;
+
+	timing_stamp(ctx->sc_stamps, TS_CREDS);
+	if (sanitize_fds(ctx))
+		goto fail;
+
+	timing_stamp(ctx->sc_stamps, TS_CLOSED);
+	exec_file(ctx->sc_path, ctx->sc_argv,
+	          env && env->se_envp ? env->se_envp : environ);
+
+fail:
+	child_error = EXEC_PROCESS_ERROR_OFFSET + errno;
+	write(ctx->sc_self_pipe[PIPE_WR_FD], &child_error, sizeof(child_error));
+	_exit(1);
+}
+
+static int spawn_fork(struct spawn_ctx *ctx, pid_t *pid)
+{
+	*pid = fork();
+	if (*pid == 0)
+		child_exec(ctx);
+
+	return (*pid == (pid_t) -1 ? -1 : 0);
+}
+
+#ifdef __linux__
+static int vfork_child(void *arg)
+{
+	const struct spawn_ctx *ctx = arg;
+	struct sigaction sa;
+	int sig;
+
+	/*
+	 * Our parent's handlers would run on our stack, but with its
+	 * memory. Reset everything that isn't ignored before unblocking.
+	 */
+	for (sig = 1; sig < _NSIG; ++sig) {
+		if (sigaction(sig, NULL, &sa))
+			continue;
+		if (sa.sa_handler == SIG_IGN || sa.sa_handler == SIG_DFL)
+			continue;
+		sa.sa_handler = SIG_DFL;
+		sa.sa_flags = 0;
+		(void) sigaction(sig, &sa, NULL);
+	}
+
+	(void) sigprocmask(SIG_SETMASK, &ctx->sc_sigmask, NULL);
+	child_exec(ctx);
+	return 1;
+}
+
+static int spawn_vfork(struct spawn_ctx *ctx, pid_t *pid)
+{
+	static bool have_clone_pidfd = true;
+	sigset_t all;
+	size_t stack_size;
+	long page_size;
+	void *stack;
+	int flags, err, argc;
+
+	if (ctx->sc_stack) {
+		stack = ctx->sc_stack;
+		stack_size = ctx->sc_stack_size;
+	} else {
+		/* exec_file() copies argv onto the stack when falling back */
+		for (argc = 0; ctx->sc_argv[argc]; ++argc)
+			;
+
+		page_size = sysconf(_SC_PAGESIZE);
+		stack_size = VFORK_STACK_SIZE +
+		             (size_t) (argc + 3) * sizeof(char *);
+		stack_size = (stack_size + (size_t) page_size - 1) &
+		             ~((size_t) page_size - 1);
+		stack = mmap(NULL, stack_size, PROT_READ | PROT_WRITE,
+		             MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+		if (stack == MAP_FAILED)
+			return -1;
+	}
+
+	sigfillset(&all);
+	(void) sigprocmask(SIG_SETMASK, &all, &ctx->sc_sigmask);
+
+	flags = CLONE_VM | CLONE_VFORK | SIGCHLD;
+	if (ctx->sc_env)
+		flags |= ctx->sc_env->se_clone_flags;
+	if (ctx->sc_want_pidfd &&
+	    __atomic_load_n(&have_clone_pidfd, __ATOMIC_RELAXED))
+		flags |= CLONE_PIDFD;
+
+	/* we're suspended until the child has called execve() or _exit() */
+	for (;;) {
+		*pid = clone(vfork_child, (char *) stack + stack_size, flags,
+		             ctx, &ctx->sc_pidfd);
+		err = errno;
+
+		/* kernels before 5.2 don't know CLONE_PIDFD */
+		if (*pid != (pid_t) -1 || err != EINVAL ||
+		    !(flags & CLONE_PIDFD))
+			break;
+
+		__atomic_store_n(&have_clone_pidfd, false, __ATOMIC_RELAXED);
+		flags &= ~CLONE_PIDFD;
+	}
+
+	if (!(flags & CLONE_PIDFD))
+		ctx->sc_pidfd = -1;
+
+	(void) sigprocmask(SIG_SETMASK, &ctx->sc_sigmask, NULL);
+	if (!ctx->sc_stack)
+		(void) munmap(stack, stack_size);
+
+	errno = err;
+	return (*pid == (pid_t) -1 ? -1 : 0);
+}
+#else
+static int spawn_vfork(struct spawn_ctx *ctx, pid_t *pid)
+{
+	return spawn_fork(ctx, pid);
+}
+#endif
+
+#if HAVE_SPAWN_CLOSEFROM
+static int spawn_posix(struct spawn_ctx *ctx, pid_t *pid)
+{
+	posix_spawn_file_actions_t actions;
+	unsigned int i;
+	int child_error;
+	int err, fd;
+
+	err = posix_spawn_file_actions_init(&actions);
+	if (err) {
+		errno = err;
+		return -1;
+	}
+
+	for (i = 0; i < NUM_PIPES && !err; ++i) {
+		/* PIPE_STDIN..PIPE_STDERR match the standard descriptors */
+		if ((fd = child_stdio_fd(ctx, (int) i)) < 0)
+			continue;
+		err = posix_spawn_file_actions_adddup2(&actions, fd, (int) i);
+	}
+
+	if (!err)
+		err = posix_spawn_file_actions_addclosefrom_np(&actions,
+		                                               STDERR_FILENO + 1);
+
+	if (err) {
+		(void) posix_spawn_file_actions_destroy(&actions);
+		errno = err;
+		return -1;
+	}
+
+	err = posix_spawnp(pid, ctx->sc_path, &actions, NULL, ctx->sc_argv,
+	                   ctx->sc_env && ctx->sc_env->se_envp ?
+	                   ctx->sc_env->se_envp : environ);
+	(void) posix_spawn_file_actions_destroy(&actions);
+
+	if (err) {
+		/*
+		 * posix_spawnp() has already collected the child's exec
+		 * error, hand it over the way a forked child would have
+		 */
+		*pid = -1;
+		child_error = EXEC_PROCESS_ERROR_OFFSET + err;
+		write(ctx->sc_self_pipe[PIPE_WR_FD], &child_error,
+		      sizeof(child_error));
+	}
+
+	return 0;
+}
+#else
+static int spawn_posix(struct spawn_ctx *ctx, pid_t *pid)
+{
+	return spawn_vfork(ctx, pid);
+}
+#endif
+
+int open_pidfd(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+	return (int) syscall(SYS_pidfd_open, pid, 0);
+#else
+	(void) pid;
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+static uint64_t timeval_ns(const struct timeval *tv)
+{
+	return (uint64_t) tv->tv_sec * NSEC_PER_SEC +
+	       (uint64_t) tv->tv_usec * 1000;
+}
+
+void usage_from_rusage(struct exec_usage *usage, const struct rusage *ru)
+{
+	clock_gettime(CLOCK_MONOTONIC, &usage->eu_end);
+	usage->eu_utime_ns = timeval_ns(&ru->ru_utime);
+	usage->eu_stime_ns = timeval_ns(&ru->ru_stime);
+	usage->eu_maxrss   = ru->ru_maxrss;
+	usage->eu_minflt   = ru->ru_minflt;
+	usage->eu_majflt   = ru->ru_majflt;
+	usage->eu_nvcsw    = ru->ru_nvcsw;
+	usage->eu_nivcsw   = ru->ru_nivcsw;
+}
+
+int reap_child(pid_t pid, int *status, struct exec_usage *usage)
+{
+	struct rusage ru;
+	pid_t child;
+	int _status;
+
+	do {
+		child = wait4(pid, status ? status : &_status, 0,
+		              usage ? &ru : NULL);
+	} while (child == (pid_t) - 1 && errno == EINTR);
+
+	if (child == (pid_t) - 1)
+		return -1;
 
-	return _user;
+	if (usage)
+		usage_from_rusage(usage, &ru);
+	return 0;
 }
 
 int wait_for_child(struct process_info *proc, bool close_fds)
 {
-	pid_t child;
+	int ret;
 
-	do {
-		child = waitpid(proc->pi_pid, &(proc)->pi_retval, 0);
-	} while (child == (pid_t) - 1 && errno == EINTR);
+	ret = reap_child(proc->pi_pid, &(proc)->pi_retval, &proc->pi_usage);
 
 	if (close_fds) {
 		close(proc->pi_stdin);
 		close(proc->pi_stdout);
 		close(proc->pi_stderr);
+		if (proc->pi_pidfd != -1)
+			close(proc->pi_pidfd);
 		proc->pi_stdin  = -1;
 		proc->pi_stdout = -1;
 		proc->pi_stderr = -1;
+		proc->pi_pidfd  = -1;
+	}
+
+	return ret;
+}
+
+/*
+ * Waits until @pid has exited or @deadline has passed, without reaping.
+ * Returns 1 once it has exited, 0 on timeout and -1 on error.
+ */
+static int child_wait_exit(int pidfd, pid_t pid,
+                           const struct timespec *deadline)
+{
+	struct timespec left, nap;
+	struct pollfd pfd;
+	siginfo_t info;
+	int ret;
+
+	if (pidfd == -1) {
+		/* no pidfds, check back with growing naps */
+		nap.tv_sec = 0;
+		nap.tv_nsec = CHILD_NAP_MIN_NS;
+		for (;;) {
+			memset(&info, 0, sizeof(info));
+			if (waitid(P_PID, (id_t) pid, &info,
+			           WEXITED | WNOHANG | WNOWAIT)) {
+				if (errno == EINTR)
+					continue;
+				return -1;
+			}
+			if (info.si_pid)
+				return 1;
+
+			if (deadline && !deadline_left(deadline, &left))
+				return 0;
+			if (deadline && left.tv_sec == 0 &&
+			    left.tv_nsec < nap.tv_nsec)
+				nap = left;
+
+			(void) nanosleep(&nap, NULL);
+			if (nap.tv_nsec < CHILD_NAP_MAX_NS)
+				nap.tv_nsec *= 2;
+		}
+	}
+
+	pfd.fd = pidfd;
+	pfd.events = POLLIN;
+	for (;;) {
+		if (deadline && !deadline_left(deadline, &left))
+			return 0;
+
+		ret = ppoll(&pfd, 1, deadline ? &left : NULL, NULL);
+		if (ret > 0)
+			return 1;
+		if (ret == -1 && errno != EINTR)
+			return -1;
+	}
+}
+
+int wait_for_child_timeout(struct process_info *proc, bool close_fds,
+                           int timeout, int grace)
+{
+	struct timespec deadline;
+	int pidfd, ret, err;
+
+	if (timeout < 0)
+		return wait_for_child(proc, close_fds);
+
+	pidfd = proc->pi_pidfd;
+	if (pidfd == -1)
+		pidfd = open_pidfd(proc->pi_pid);
+
+	exec_deadline(&deadline, (uint64_t) timeout * NSEC_PER_MSEC);
+	ret = child_wait_exit(pidfd, proc->pi_pid, &deadline);
+
+	/* still unreaped, so the PID can't have been reused */
+	if (!ret && grace > 0) {
+		(void) kill(proc->pi_pid, SIGTERM);
+		exec_deadline(&deadline, (uint64_t) grace * NSEC_PER_MSEC);
+		ret = child_wait_exit(pidfd, proc->pi_pid, &deadline);
+	}
+	if (!ret && grace >= 0) {
+		(void) kill(proc->pi_pid, SIGKILL);
+		ret = 1;
+	}
+
+	err = errno;
+	if (pidfd != proc->pi_pidfd && pidfd != -1)
+		close(pidfd);
+
+	if (ret != 1) {
+		errno = (ret ? err : ETIMEDOUT);
+		return -1;
 	}
 
-	return (child == (pid_t) - 1 ? -1 : 0);
+	return wait_for_child(proc, close_fds);
 }
 
 void get_exit_details(int status, int *ret, bool *core, bool *signaled, bool *parent)
@@ -161,157 +1334,569 @@ int copy_exit_detail_str(int status, char **buffer)
 	return (ret == -1);
 }
 
-static inline int fd_get_flags(int fd)
+/*
+ * Waits for @fd with ppoll(2) and moves data until @size bytes are done,
+ * time runs out or end of file is hit. Without @deadline, every single wait
+ * is bounded by @interval instead, %NULL meaning forever.
+ * @fd must be nonblocking, otherwise a large write could block past the
+ * timeout.
+ */
+static ssize_t timed_io(int fd, void *buf, size_t size,
+                        const struct timespec *deadline,
+                        const struct timespec *interval, bool writing)
+{
+	int ret;
+	struct pollfd pfd;
+	struct timespec left;
+	size_t have;
+	ssize_t count;
+
+	have = 0;
+	while (have < size) {
+		pfd.fd = fd;
+		pfd.events = writing ? POLLOUT : POLLIN;
+
+		if (!deadline)
+			ret = ppoll(&pfd, 1, interval, NULL);
+		else if (deadline_left(deadline, &left))
+			ret = ppoll(&pfd, 1, &left, NULL);
+		else
+			ret = 0;
+
+		if (ret == 0) {
+			if (!have) {
+				errno = ETIMEDOUT;
+				return -1;
+			}
+			break;
+		} else if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+
+		if (writing)
+			count = write(fd, (const char *) buf + have,
+			              size - have);
+		else
+			count = read(fd, (char *) buf + have, size - have);
+
+		if (count == -1) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			return -1;
+		} else if (count == 0) {
+			break;
+		}
+
+		have += (size_t) count;
+	}
+
+	return (ssize_t) have;
+}
+
+/*
+ * Descriptors in stream mode are left alone, everything else is switched
+ * to nonblocking for the duration of the call only.
+ */
+static ssize_t timed_io_toggle(int fd, void *buf, size_t size,
+                               const struct timespec *deadline,
+                               const struct timespec *interval, bool writing)
+{
+	int flags, err;
+	ssize_t ret;
+
+	flags = fd_get_flags(fd);
+	if (flags == -1)
+		return -1;
+
+	if (flags & O_NONBLOCK)
+		return timed_io(fd, buf, size, deadline, interval, writing);
+
+	if (fd_set_nonblocking(fd, flags))
+		return -1;
+
+	ret = timed_io(fd, buf, size, deadline, interval, writing);
+
+	err = errno;
+	(void) fd_clear_nonblocking(fd, flags);
+	errno = err;
+
+	return ret;
+}
+
+/* %0 seconds means no timeout at all */
+static const struct timespec *timeout_interval(unsigned int timeout,
+                                               struct timespec *ts)
 {
-	return fcntl(fd, F_GETFL, NULL);
+	if (!timeout)
+		return NULL;
+
+	ts->tv_sec = (time_t) timeout;
+	ts->tv_nsec = 0;
+	return ts;
 }
 
-static inline int fd_set_flags(int fd, int flags)
+ssize_t timed_read(int fd, void *buf, size_t size, unsigned int timeout)
 {
-	return fcntl(fd, F_SETFL, flags);
+	struct timespec ts;
+
+	return timed_io_toggle(fd, buf, size, NULL,
+	                       timeout_interval(timeout, &ts), false);
 }
 
-static inline int fd_set_nonblocking(int fd, int flags)
+ssize_t timed_write(int fd, const void *buf, size_t size, unsigned int timeout)
 {
-	return fd_set_flags(fd, flags | O_NONBLOCK);
+	struct timespec ts;
+
+	return timed_io_toggle(fd, (void *) buf, size, NULL,
+	                       timeout_interval(timeout, &ts), true);
 }
 
-static inline int fd_clear_nonblocking(int fd, int flags)
+ssize_t timed_read_stream(int fd, void *buf, size_t size,
+                          unsigned int timeout)
 {
-	return fd_set_flags(fd, flags & (~O_NONBLOCK));
+	struct timespec ts;
+
+	return timed_io(fd, buf, size, NULL,
+	                timeout_interval(timeout, &ts), false);
 }
 
-static inline int fd_make_nonblocking(int fd)
+ssize_t timed_write_stream(int fd, const void *buf, size_t size,
+                           unsigned int timeout)
 {
-	int flags;
-	flags = fd_get_flags(fd);
-	if (flags == -1)
-		return -1;
-	return fd_set_nonblocking(fd, flags);
+	struct timespec ts;
+
+	return timed_io(fd, (void *) buf, size, NULL,
+	                timeout_interval(timeout, &ts), true);
 }
 
-ssize_t timed_read(int fd, void *buf, size_t size, unsigned int timeout)
+void exec_deadline(struct timespec *deadline, uint64_t budget_ns)
 {
-	int ret;
+	clock_gettime(CLOCK_MONOTONIC, deadline);
+
+	budget_ns += (uint64_t) deadline->tv_nsec;
+	deadline->tv_sec += (time_t) (budget_ns / NSEC_PER_SEC);
+	deadline->tv_nsec = (long) (budget_ns % NSEC_PER_SEC);
+}
+
+ssize_t timed_read_deadline(int fd, void *buf, size_t size,
+                            const struct timespec *deadline)
+{
+	return timed_io_toggle(fd, buf, size, deadline, NULL, false);
+}
+
+ssize_t timed_write_deadline(int fd, const void *buf, size_t size,
+                             const struct timespec *deadline)
+{
+	return timed_io_toggle(fd, (void *) buf, size, deadline, NULL, true);
+}
+
+ssize_t timed_read_budget(int fd, void *buf, size_t size, uint64_t budget_ns)
+{
+	struct timespec deadline;
+
+	exec_deadline(&deadline, budget_ns);
+	return timed_io_toggle(fd, buf, size, &deadline, NULL, false);
+}
+
+ssize_t timed_write_budget(int fd, const void *buf, size_t size,
+                           uint64_t budget_ns)
+{
+	struct timespec deadline;
+
+	exec_deadline(&deadline, budget_ns);
+	return timed_io_toggle(fd, (void *) buf, size, &deadline, NULL, true);
+}
+
+int exec_stream_mode(struct process_info *proc, bool nonblock)
+{
+	int fds[3];
 	int flags;
-	fd_set set;
-	size_t have;
-	ssize_t count;
-	struct timeval wait_time;
+	unsigned int i;
 
-	flags = fd_get_flags(fd);
-	if (flags == -1)
-		return -1;
+	fds[0] = proc->pi_stdin;
+	fds[1] = proc->pi_stdout;
+	fds[2] = proc->pi_stderr;
 
-	if (fd_set_nonblocking(fd, flags))
-		return -1;
+	for (i = 0; i < ARRAY_SIZE(fds); ++i) {
+		if (fds[i] == -1)
+			continue;
 
-	if (!timeout)
-		timeout = (unsigned int) -1;
+		flags = fd_get_flags(fds[i]);
+		if (flags == -1)
+			return -errno;
 
-	have = 0;
-	for (;;) {
-		FD_ZERO(&set);
-		FD_SET(fd, &set);
+		if (!!(flags & O_NONBLOCK) == nonblock)
+			continue;
 
-		wait_time.tv_sec = timeout;
-		wait_time.tv_usec = 0;
+		if (nonblock ? fd_set_nonblocking(fds[i], flags) :
+		               fd_clear_nonblocking(fds[i], flags))
+			return -errno;
+	}
 
-		ret = select(fd + 1, &set, NULL, NULL, &wait_time);
-		if (ret == 0) {
-			if (!have) {
-				errno = ETIMEDOUT;
-				have = -1;
-			}
-			break;
-		} else if (ret == -1) {
-			if (errno == EINTR) {
-				continue;
-			} else {
-				have = -1;
-				break;
-			}
-		} else {
-			count = read(fd, buf + have, size - have);
-			if (count == -1) {
-				if (errno == EINTR || errno == EAGAIN) {
-					continue;
-				} else {
-					have = -1;
-					break;
-				}
-			} else if (count == 0) {
-				break;
-			} else {
-				have += (size_t) count;
-			}
+	proc->pi_nonblock = nonblock;
+	return 0;
+}
+
+/* only read once, the limit merely caps what we ask for */
+static size_t pipe_max_size(void)
+{
+	static size_t cached;
+	char buf[32];
+	ssize_t count;
+	size_t max;
+	int fd;
+
+	if ((max = __atomic_load_n(&cached, __ATOMIC_RELAXED)) != 0)
+		return max;
+
+	max = PIPE_MAX_SIZE_DEFAULT;
+	if ((fd = open(PIPE_MAX_SIZE_PATH, O_RDONLY | O_CLOEXEC)) != -1) {
+		count = read(fd, buf, sizeof(buf) - 1);
+		if (count > 0) {
+			buf[count] = '\0';
+			if (strtoul(buf, NULL, 10))
+				max = strtoul(buf, NULL, 10);
 		}
+		close(fd);
 	}
 
-	(void) fd_clear_nonblocking(fd, flags);
-	return have;
+	__atomic_store_n(&cached, max, __ATOMIC_RELAXED);
+	return max;
 }
 
-ssize_t timed_write(int fd, const void *buf, size_t size, unsigned int timeout)
+ssize_t exec_pipe_size(int fd)
 {
+#ifdef F_GETPIPE_SZ
 	int ret;
-	int flags;
-	fd_set set;
-	size_t have;
+
+	ret = fcntl(fd, F_GETPIPE_SZ);
+	return ret == -1 ? -errno : ret;
+#else
+	(void) fd;
+	return -ENOSYS;
+#endif
+}
+
+ssize_t exec_pipe_resize(int fd, size_t size)
+{
+#ifdef F_SETPIPE_SZ
+	size_t max = pipe_max_size();
+	int ret;
+
+	ret = fcntl(fd, F_SETPIPE_SZ, (int) (size < max ? size : max));
+	return ret == -1 ? -errno : ret;
+#else
+	(void) fd;
+	(void) size;
+	return -ENOSYS;
+#endif
+}
+
+int exec_memfd_new(const char *name, const void *data, size_t size)
+{
+#ifdef MFD_ALLOW_SEALING
+	const char *p = data;
 	ssize_t count;
-	struct timeval wait_time;
+	int fd, err;
 
-	flags = fd_get_flags(fd);
-	if (flags == -1)
-		return -1;
+	fd = memfd_create(name ? name : "exec_stdin",
+	                  MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if (fd == -1)
+		return -errno;
 
-	if (fd_set_nonblocking(fd, flags))
-		return -1;
+	/* no growing page by page */
+	if (ftruncate(fd, (off_t) size))
+		goto fail;
 
-	if (!timeout)
-		timeout = (unsigned int) -1;
+	while (size) {
+		count = write(fd, p, size);
+		if (count == -1) {
+			if (errno == EINTR)
+				continue;
+			goto fail;
+		}
+		p += count;
+		size -= (size_t) count;
+	}
+
+	if (fcntl(fd, F_ADD_SEALS, F_SEAL_WRITE | F_SEAL_SHRINK |
+	                           F_SEAL_GROW | F_SEAL_SEAL))
+		goto fail;
+
+	return fd;
+
+fail:
+	err = errno;
+	close(fd);
+	return -err;
+#else
+	(void) name;
+	(void) data;
+	(void) size;
+	return -ENOSYS;
+#endif
+}
+
+size_t pipe_setup_size(int fd, const struct exec_attr *attr, unsigned int i)
+{
+	ssize_t size = 0;
+
+	if (!attr || (!attr->ea_stdio[i].es_pipe_size &&
+	              !attr->ea_pipe_autogrow))
+		return 0;
+
+	if (attr->ea_stdio[i].es_pipe_size)
+		size = exec_pipe_resize(fd, attr->ea_stdio[i].es_pipe_size);
+
+	/* one that couldn't be resized still tells what it has */
+	if (size <= 0)
+		size = exec_pipe_size(fd);
+
+	return size > 0 ? (size_t) size : 0;
+}
+
+void pipe_autogrow(struct process_info *proc, unsigned int i, size_t count,
+                   size_t room)
+{
+	size_t size = proc->pi_pipe_size[i];
+	int fd = i == 1 ? proc->pi_stdout : proc->pi_stderr;
+	ssize_t granted;
+	int queued;
+
+	if (!proc->pi_pipe_autogrow || !size || size >= pipe_max_size())
+		return;
+
+	/* a read that ran out of room may have left the rest behind */
+	if (count < size && count == room && ioctl(fd, FIONREAD, &queued) == 0)
+		count += (size_t) queued;
+	if (count < size)
+		return;
+
+	granted = exec_pipe_resize(fd, 2 * size);
+	if (granted > 0)
+		proc->pi_pipe_size[i] = (size_t) granted;
+	else
+		/* out of allowance, asking again won't help */
+		proc->pi_pipe_autogrow = false;
+}
+
+/*
+ * Writing to a child that went away must not kill us with SIGPIPE. The
+ * signal is blocked for this thread while communicating and a SIGPIPE
+ * raised by ourselves is swallowed before the old mask comes back.
+ */
+static void sigpipe_block(sigset_t *old, bool *pending)
+{
+	sigset_t pipe_set;
+
+	sigemptyset(&pipe_set);
+	sigaddset(&pipe_set, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &pipe_set, old);
+
+	sigpending(&pipe_set);
+	*pending = sigismember(&pipe_set, SIGPIPE);
+}
+
+static void sigpipe_restore(const sigset_t *old, bool pending, bool raised)
+{
+	static const struct timespec zero;
+	sigset_t pipe_set;
+
+	if (raised && !pending) {
+		sigemptyset(&pipe_set);
+		sigaddset(&pipe_set, SIGPIPE);
+		while (sigtimedwait(&pipe_set, NULL, &zero) == -1 &&
+		       errno == EINTR)
+			;
+	}
+
+	pthread_sigmask(SIG_SETMASK, old, NULL);
+}
+
+struct comm_buf {
+	char   *cb_data;
+	size_t  cb_len;
+	size_t  cb_size;
+};
+
+/*
+ * makes room for at least COMM_CHUNK or @want more bytes, whichever is
+ * more, plus a terminating NUL
+ */
+static int comm_buf_reserve(struct comm_buf *b, size_t want)
+{
+	size_t size;
+	char *data;
+
+	if (want < COMM_CHUNK)
+		want = COMM_CHUNK;
+	if (b->cb_size - b->cb_len > want)
+		return 0;
+
+	size = b->cb_size ? b->cb_size * 2 : COMM_CHUNK * 2;
+	while (size - b->cb_len <= want)
+		size *= 2;
+	if ((data = realloc(b->cb_data, size)) == NULL)
+		return -ENOMEM;
+
+	b->cb_data = data;
+	b->cb_size = size;
+	return 0;
+}
+
+/* hands @b over to @data and @size or discards it if nobody wants it */
+static void comm_buf_handover(struct comm_buf *b, char **data, size_t *size)
+{
+	if (!data) {
+		free(b->cb_data);
+		return;
+	}
+
+	if (!b->cb_data && comm_buf_reserve(b, 0) == 0)
+		b->cb_len = 0;
+	if (b->cb_data)
+		b->cb_data[b->cb_len] = '\0';
+
+	*data = b->cb_data;
+	if (size)
+		*size = b->cb_len;
+}
+
+int exec_communicate(struct process_info *proc,
+                     const void *input, size_t input_size,
+                     char **output, size_t *output_size,
+                     char **errors, size_t *errors_size,
+                     const struct timespec *deadline)
+{
+	enum { COMM_IN, COMM_OUT, COMM_ERR, NUM_COMM };
+	struct pollfd pfds[NUM_COMM];
+	struct comm_buf bufs[NUM_COMM];
+	struct timespec left;
+	sigset_t old_mask;
+	bool pending, raised;
+	size_t written, room;
+	ssize_t count;
+	unsigned int i, open;
+	int res, ret;
+
+	memset(bufs, 0, sizeof(bufs));
+	pfds[COMM_IN].fd  = proc->pi_stdin;
+	pfds[COMM_OUT].fd = proc->pi_stdout;
+	pfds[COMM_ERR].fd = proc->pi_stderr;
+	pfds[COMM_IN].events  = POLLOUT;
+	pfds[COMM_OUT].events = POLLIN;
+	pfds[COMM_ERR].events = POLLIN;
+
+	if (!proc->pi_nonblock) {
+		for (i = 0; i < NUM_COMM; ++i) {
+			if (pfds[i].fd != -1 && fd_make_nonblocking(pfds[i].fd))
+				return -errno;
+		}
+		proc->pi_nonblock = true;
+	}
+
+	/* nothing to say, let the child see end of file right away */
+	if (!input_size && proc->pi_stdin != -1) {
+		close(proc->pi_stdin);
+		proc->pi_stdin = pfds[COMM_IN].fd = -1;
+	}
+
+	sigpipe_block(&old_mask, &pending);
+	raised = false;
+	written = 0;
+	res = 0;
 
-	have = 0;
 	for (;;) {
-		FD_ZERO(&set);
-		FD_SET(fd, &set);
+		open = 0;
+		for (i = 0; i < NUM_COMM; ++i)
+			open += (pfds[i].fd != -1);
+		if (!open)
+			break;
 
-		wait_time.tv_sec = timeout;
-		wait_time.tv_usec = 0;
+		if (!deadline)
+			ret = poll(pfds, NUM_COMM, -1);
+		else if (deadline_left(deadline, &left))
+			ret = ppoll(pfds, NUM_COMM, &left, NULL);
+		else
+			ret = 0;
 
-		ret = select(fd + 1, NULL, &set, NULL, &wait_time);
 		if (ret == 0) {
-			if (!have) {
-				errno = ETIMEDOUT;
-				have = -1;
-			}
+			res = -ETIMEDOUT;
 			break;
 		} else if (ret == -1) {
-			if (errno == EINTR) {
+			if (errno == EINTR)
 				continue;
-			} else {
-				have = -1;
-				break;
+			res = -errno;
+			break;
+		}
+
+		if (pfds[COMM_IN].fd != -1 && pfds[COMM_IN].revents) {
+			count = write(pfds[COMM_IN].fd,
+			              (const char *) input + written,
+			              input_size - written);
+			if (count > 0)
+				written += (size_t) count;
+
+			/*
+			 * A child that stops reading early is its business,
+			 * the output still has to be collected.
+			 */
+			if (written == input_size || (count == -1 &&
+			    errno != EAGAIN && errno != EINTR)) {
+				raised |= (count == -1 && errno == EPIPE);
+				close(proc->pi_stdin);
+				proc->pi_stdin = pfds[COMM_IN].fd = -1;
 			}
-		} else {
-			count = write(fd, buf + have, size - have);
-			if (count == -1) {
-				if (errno == EINTR || errno == EAGAIN) {
-					continue;
-				} else {
-					have = -1;
-					break;
-				}
-			} else if (count == 0) {
+		}
+
+		for (i = COMM_OUT; i < NUM_COMM; ++i) {
+			if (pfds[i].fd == -1 || !pfds[i].revents)
+				continue;
+
+			/* a full pipe has to fit, or autogrow can't tell */
+			res = comm_buf_reserve(&bufs[i],
+			                       proc->pi_pipe_autogrow ?
+			                       proc->pi_pipe_size[i] : 0);
+			if (res)
 				break;
-			} else {
-				have += (size_t) count;
+
+			room = bufs[i].cb_size - bufs[i].cb_len - 1;
+			count = read(pfds[i].fd,
+			             bufs[i].cb_data + bufs[i].cb_len, room);
+			if (count > 0) {
+				bufs[i].cb_len += (size_t) count;
+				pipe_autogrow(proc, i, (size_t) count, room);
+			} else if (count == 0 ||
+			           (errno != EAGAIN && errno != EINTR)) {
+				/* stays open for wait_for_child() to close */
+				pfds[i].fd = -1;
 			}
 		}
+
+		if (res)
+			break;
+	}
+
+	sigpipe_restore(&old_mask, pending, raised);
+
+	if (res) {
+		for (i = 0; i < NUM_COMM; ++i)
+			free(bufs[i].cb_data);
+		return res;
+	}
+
+	if (wait_for_child(proc, true)) {
+		res = -errno;
+		for (i = 0; i < NUM_COMM; ++i)
+			free(bufs[i].cb_data);
+		return res;
 	}
 
-	(void) fd_clear_nonblocking(fd, flags);
-	return have;
+	comm_buf_handover(&bufs[COMM_OUT], output, output_size);
+	comm_buf_handover(&bufs[COMM_ERR], errors, errors_size);
+	return 0;
 }
 
 _sentinel int exec_process(struct process_info *proc_info, bool wait,
@@ -359,167 +1944,898 @@ int exec_process_p(struct process_info *proc_info, bool wait,
                    user_info_t user, enum user_info_type user_type,
                    const char *cmd, char *const argv[])
 {
-	int pipes[NUM_PIPES][2];
-	int self_pipe[2] = { -1, -1 };
+	return exec_process_attr(proc_info, wait, user, user_type,
+	                         cmd, argv, NULL);
+}
+
+static int cmp_fd(const void *a, const void *b)
+{
+	return *(const int *) a - *(const int *) b;
+}
+
+/*
+ * Collects the descriptors that survive sanitize_fds() into a sorted array.
+ * Without an explicit list, that's just the self-pipe.
+ */
+static int prepare_keep_fds(struct spawn_ctx *ctx,
+                            const struct exec_attr *attr)
+{
+	unsigned int i, num;
+	int *fds;
+
+	if (ctx->sc_keep_buf) {
+		/* presorted, the self-pipe just needs to be slotted in */
+		int self = ctx->sc_self_pipe[PIPE_WR_FD];
+
+		fds = ctx->sc_keep_buf;
+		for (i = 0, num = 0; i < ctx->sc_num_inherit_fds; ++i) {
+			if (num == i && ctx->sc_inherit_fds[i] > self)
+				fds[num++] = self;
+			fds[num++] = ctx->sc_inherit_fds[i];
+		}
+		if (num == i)
+			fds[num++] = self;
+
+		ctx->sc_keep_fds = fds;
+		ctx->sc_num_keep_fds = num;
+		return 0;
+	}
+
+	if (!attr || !attr->ea_num_inherit_fds) {
+		ctx->sc_keep_fds = &ctx->sc_self_pipe[PIPE_WR_FD];
+		ctx->sc_num_keep_fds = 1;
+		return 0;
+	}
+
+	fds = malloc((attr->ea_num_inherit_fds + 1) * sizeof(*fds));
+	if (!fds)
+		return -1;
+
+	num = 0;
+	fds[num++] = ctx->sc_self_pipe[PIPE_WR_FD];
+	for (i = 0; i < attr->ea_num_inherit_fds; ++i) {
+		int fd = attr->ea_inherit_fds[i];
+
+		/* stdio is always inherited */
+		if (fd >= 0 && fd < FIRST_NON_STDIO_FD)
+			continue;
+
+		if (fcntl(fd, F_GETFD) == -1) {
+			free(fds);
+			return -1;
+		}
+		fds[num++] = fd;
+	}
+
+	qsort(fds, num, sizeof(*fds), cmp_fd);
+	for (i = 1; i < num; ++i) {
+		if (fds[i] == fds[i - 1]) {
+			memmove(&fds[i - 1], &fds[i],
+			        (num - i) * sizeof(*fds));
+			--num;
+			--i;
+		}
+	}
+
+	ctx->sc_keep_fds = fds;
+	ctx->sc_num_keep_fds = num;
+	ctx->sc_keep_alloc = fds;
+	return 0;
+}
+
+static enum exec_backend select_backend(const struct exec_attr *attr,
+                                        enum user_info_type user_type,
+                                        const struct spawn_env *env)
+{
+	enum exec_backend backend;
+
+	/* only clone(2) takes the flags the spawn server relies on */
+	if (env && env->se_clone_flags)
+		return EXEC_BACKEND_VFORK;
+
+	backend = attr ? attr->ea_backend : EXEC_BACKEND_DEFAULT;
+	if (backend == EXEC_BACKEND_DEFAULT || backend == EXEC_BACKEND_SERVER)
+		backend = DEFAULT_BACKEND;
+
+	if (backend == EXEC_BACKEND_POSIX_SPAWN) {
+		/*
+		 * posix_spawn() can neither drop privileges nor close all
+		 * but a given set of descriptors, the latter not even at all
+		 * on older C libraries. Changing into a directory by
+		 * descriptor is too new to rely on.
+		 */
+		if (user_type != USERINFO_TYPE_NONE || !HAVE_SPAWN_CLOSEFROM ||
+		    (attr && attr->ea_num_inherit_fds) ||
+		    (env && (env->se_num_rlimits || env->se_cwd_fd >= 0)))
+			backend = EXEC_BACKEND_VFORK;
+	}
+
+#ifndef __linux__
+	if (backend == EXEC_BACKEND_VFORK)
+		backend = EXEC_BACKEND_FORK;
+#endif
+
+	return backend;
+}
+
+int exec_process_attr(struct process_info *proc_info, bool wait,
+                      user_info_t user, enum user_info_type user_type,
+                      const char *cmd, char *const argv[],
+                      const struct exec_attr *attr)
+{
+	if (exec_server_wanted(attr))
+		return exec_server_spawn(proc_info, wait, user, user_type,
+		                         cmd, argv, attr);
+
+	return exec_spawn_env(proc_info, wait, user, user_type,
+	                      cmd, argv, attr, NULL);
+}
+
+static void spawn_ctx_init(struct spawn_ctx *ctx, bool stdio,
+                           user_info_t user, enum user_info_type user_type,
+                           const char *cmd, char *const argv[],
+                           const struct spawn_env *env)
+{
 	unsigned int i;
-	int flags, child_error;
-	pid_t pid;
-	int res;
+
+	memset(ctx, 0, sizeof(*ctx));
 
 	for (i = 0; i < NUM_PIPES; ++i) {
-		pipes[i][PIPE_RD_FD] = -1;
-		pipes[i][PIPE_WR_FD] = -1;
+		ctx->sc_pipes[i][PIPE_RD_FD] = -1;
+		ctx->sc_pipes[i][PIPE_WR_FD] = -1;
+		ctx->sc_stdio_fds[i] = -1;
+		ctx->sc_stdio_files[i] = -1;
 	}
+	ctx->sc_self_pipe[PIPE_RD_FD] = -1;
+	ctx->sc_self_pipe[PIPE_WR_FD] = -1;
+	ctx->sc_stdio     = stdio;
+	ctx->sc_cmd       = cmd;
+	ctx->sc_argv      = argv;
+	ctx->sc_user      = user;
+	ctx->sc_user_type = user_type;
+	ctx->sc_env       = env;
+	ctx->sc_pid       = -1;
+	ctx->sc_want_pidfd = stdio;
+	ctx->sc_pidfd     = -1;
+}
 
-	if (wait) {
-		/* Not needed if we're waiting */
-		proc_info = NULL;
+static void close_fd(int *fd)
+{
+	if (*fd == -1)
+		return;
+
+	(void) close(*fd);
+	*fd = -1;
+}
+
+static void spawn_ctx_release(struct spawn_ctx *ctx)
+{
+	unsigned int i;
+
+	close_fd(&ctx->sc_self_pipe[PIPE_RD_FD]);
+	close_fd(&ctx->sc_self_pipe[PIPE_WR_FD]);
+	close_fd(&ctx->sc_pidfd);
+	for (i = 0; i < NUM_PIPES; ++i) {
+		close_fd(&ctx->sc_pipes[i][PIPE_RD_FD]);
+		close_fd(&ctx->sc_pipes[i][PIPE_WR_FD]);
+		close_fd(&ctx->sc_stdio_files[i]);
 	}
 
-	if (proc_info) {
-#ifdef __linux__
-		if (pipe2(pipes[ PIPE_STDIN], 0) ||
-		    pipe2(pipes[PIPE_STDOUT], O_NONBLOCK) ||
-		    pipe2(pipes[PIPE_STDERR], O_NONBLOCK)) {
-			res = -errno;
-			goto exit;
-		}
-#else
-		if (pipe(pipes[ PIPE_STDIN]) ||
-		    pipe(pipes[PIPE_STDOUT]) ||
-		    pipe(pipes[PIPE_STDERR])) {
-			res = -errno;
-			goto exit;
+	free(ctx->sc_keep_alloc);
+	free(ctx->sc_path_alloc);
+	free(ctx->sc_cred_store.uc_groups);
+	ctx->sc_keep_alloc = NULL;
+	ctx->sc_path_alloc = NULL;
+	ctx->sc_cred_store.uc_groups = NULL;
+}
+
+/*
+ * Works out where the child's standard streams go, opening files as
+ * needed. Returns the streams that want a pipe as a bitmask, or a
+ * negative error code.
+ */
+static int stdio_plan(struct spawn_ctx *ctx, const struct exec_attr *attr)
+{
+	const struct exec_stdio *es;
+	char path[32];
+	unsigned int i;
+	int pipes = 0;
+	int flags, fd;
+
+	for (i = 0; i < NUM_PIPES; ++i) {
+		/* streams wired up by the caller don't get a pipe */
+		if (ctx->sc_env && ctx->sc_env->se_stdio_fds[i] >= 0)
+			continue;
+
+		es = attr ? &attr->ea_stdio[i] : NULL;
+		switch (es ? es->es_mode : EXEC_STDIO_PIPE) {
+		case EXEC_STDIO_PIPE:
+			if (ctx->sc_stdio)
+				pipes |= 1 << i;
+			break;
+		case EXEC_STDIO_INHERIT:
+			break;
+		case EXEC_STDIO_MERGE:
+			if (i != PIPE_STDERR)
+				return -EINVAL;
+			/* set up in order, standard output is done by then */
+			ctx->sc_stdio_fds[i] = STDOUT_FILENO;
+			break;
+		case EXEC_STDIO_FD:
+			if (es->es_fd < 0)
+				return -EBADF;
+			ctx->sc_stdio_fds[i] = es->es_fd;
+			break;
+		case EXEC_STDIO_NULL:
+			/* fallthrough */
+		case EXEC_STDIO_REOPEN:
+			/* fallthrough */
+		case EXEC_STDIO_PATH:
+			if (es->es_mode == EXEC_STDIO_NULL) {
+				fd = open("/dev/null", (i == PIPE_STDIN ?
+				          O_RDONLY : O_WRONLY) | O_CLOEXEC);
+			} else if (es->es_mode == EXEC_STDIO_REOPEN) {
+				if (i != PIPE_STDIN)
+					return -EINVAL;
+				if (es->es_fd < 0)
+					return -EBADF;
+				/* a new open file description, a new offset */
+				snprintf(path, sizeof(path), "/proc/self/fd/%d",
+				         es->es_fd);
+				fd = open(path, O_RDONLY | O_CLOEXEC);
+			} else {
+				if (!es->es_path)
+					return -EINVAL;
+				flags = es->es_flags;
+				if (!flags)
+					flags = (i == PIPE_STDIN ? O_RDONLY :
+					         O_WRONLY | O_CREAT | O_TRUNC);
+				fd = open(es->es_path, flags | O_CLOEXEC, 0666);
+			}
+			if (fd == -1)
+				return -errno;
+			ctx->sc_stdio_files[i] = ctx->sc_stdio_fds[i] = fd;
+			break;
+		default:
+			return -EINVAL;
 		}
+	}
 
-		if (fd_make_nonblocking(pipes[PIPE_STDOUT][PIPE_RD_FD]) ||
-		    fd_make_nonblocking(pipes[PIPE_STDOUT][PIPE_WR_FD]) ||
-		    fd_make_nonblocking(pipes[PIPE_STDERR][PIPE_RD_FD]) ||
-		    fd_make_nonblocking(pipes[PIPE_STDERR][PIPE_WR_FD])) {
-			res = -errno;
-			goto exit;
+	return pipes;
+}
+
+/*
+ * Sets up the pipes and launches the child. On success, only our ends
+ * are left open and sc_self_pipe[PIPE_RD_FD] delivers the exec result.
+ */
+static int spawn_start(struct spawn_ctx *ctx, const struct exec_attr *attr)
+{
+	enum exec_backend backend;
+	unsigned int i;
+	int pipes, res;
+
+	if (timing_enabled())
+		ctx->sc_stamps = timing_begin(ctx->sc_timing_slot);
+
+	backend = select_backend(attr, ctx->sc_user_type, ctx->sc_env);
+
+	/*
+	 * CLONE_VFORK holds us until the child has exec'd, which would take
+	 * turns with the rest of a batch. Unless asked for, fork instead.
+	 */
+	if (ctx->sc_batch && backend == EXEC_BACKEND_VFORK &&
+	    (!attr || attr->ea_backend == EXEC_BACKEND_DEFAULT ||
+	     attr->ea_backend == EXEC_BACKEND_SERVER))
+		backend = EXEC_BACKEND_FORK;
+
+	if (ctx->sc_user_type != USERINFO_TYPE_NONE) {
+		/*
+		 * NSS is neither async-signal-safe nor cheap, so the child
+		 * only gets to apply what has been resolved here. Failing to
+		 * resolve the user used to be reported by the child; keep it
+		 * that way.
+		 */
+		if (lookup_cred(ctx->sc_user, ctx->sc_user_type,
+		                &ctx->sc_cred_store))
+			return -(EXEC_PROCESS_ERROR_OFFSET + errno);
+		ctx->sc_cred = &ctx->sc_cred_store;
+	}
+
+	if (!ctx->sc_path) {
+		/* same here, execvp() would have failed in the child */
+		ctx->sc_path_alloc = lookup_path(ctx->sc_cmd,
+		                                 ctx->sc_env ?
+		                                 ctx->sc_env->se_envp : NULL,
+		                                 ctx->sc_cred);
+		if (!ctx->sc_path_alloc)
+			return -(EXEC_PROCESS_ERROR_OFFSET + errno);
+		ctx->sc_path = ctx->sc_path_alloc;
+	}
+
+	timing_stamp(ctx->sc_stamps, TS_RESOLVED);
+
+	if ((pipes = stdio_plan(ctx, attr)) < 0)
+		return pipes;
+
+	if (ctx->sc_stdio) {
+		for (i = 0; i < NUM_PIPES; ++i) {
+			if (!(pipes & (1 << i)))
+				continue;
+			if (pipe(ctx->sc_pipes[i]))
+				return -errno;
+			ctx->sc_pipe_size[i] =
+				pipe_setup_size(ctx->sc_pipes[i][PIPE_RD_FD],
+				                attr, i);
+		}
+		ctx->sc_pipe_autogrow = attr && attr->ea_pipe_autogrow;
+
+		/*
+		 * Only our ends are nonblocking. Status flags belong to the
+		 * open file description, so a child handed nonblocking write
+		 * ends fails with EAGAIN as soon as a pipe fills up.
+		 */
+		for (i = PIPE_STDOUT; i < NUM_PIPES; ++i) {
+			if (ctx->sc_pipes[i][PIPE_RD_FD] != -1 &&
+			    fd_set_flags(ctx->sc_pipes[i][PIPE_RD_FD],
+			                 O_RDONLY | O_NONBLOCK))
+				return -errno;
 		}
+
+		ctx->sc_nonblock = attr && attr->ea_nonblock;
+		if (ctx->sc_nonblock &&
+		    ctx->sc_pipes[PIPE_STDIN][PIPE_WR_FD] != -1 &&
+		    fd_set_flags(ctx->sc_pipes[PIPE_STDIN][PIPE_WR_FD],
+		                 O_WRONLY | O_NONBLOCK))
+			return -errno;
+	}
+
+#ifdef __linux__
+	if (pipe2(ctx->sc_self_pipe, O_CLOEXEC))
+		return -errno;
+#else
+	{
+		int flags;
+
+		if (pipe(ctx->sc_self_pipe))
+			return -errno;
+
+		flags = fcntl(ctx->sc_self_pipe[PIPE_WR_FD], F_GETFD);
+		if (flags == -1)
+			return -errno;
+
+		if (fcntl(ctx->sc_self_pipe[PIPE_WR_FD], F_SETFD,
+		          flags | FD_CLOEXEC))
+			return -errno;
+	}
 #endif
+
+	if (prepare_keep_fds(ctx, attr))
+		return -errno;
+
+	timing_stamp(ctx->sc_stamps, TS_PIPES);
+	clock_gettime(CLOCK_MONOTONIC, &ctx->sc_start);
+
+	switch (backend) {
+	case EXEC_BACKEND_POSIX_SPAWN:
+		res = spawn_posix(ctx, &ctx->sc_pid);
+		break;
+	case EXEC_BACKEND_VFORK:
+		res = spawn_vfork(ctx, &ctx->sc_pid);
+		break;
+	case EXEC_BACKEND_FORK:
+		/* fallthrough */
+	default:
+		res = spawn_fork(ctx, &ctx->sc_pid);
+		break;
 	}
 
-	if (pipe(self_pipe)) {
-		res = -errno;
-		goto exit;
+	if (res)
+		return -errno;
+
+	/* parent */
+	if (ctx->sc_stdio) {
+		close_fd(&ctx->sc_pipes[ PIPE_STDIN][PIPE_RD_FD]);
+		close_fd(&ctx->sc_pipes[PIPE_STDOUT][PIPE_WR_FD]);
+		close_fd(&ctx->sc_pipes[PIPE_STDERR][PIPE_WR_FD]);
 	}
+	for (i = 0; i < NUM_PIPES; ++i)
+		close_fd(&ctx->sc_stdio_files[i]);
 
-	flags = fcntl(self_pipe[PIPE_WR_FD], F_GETFD);
-	if (flags == -1) {
-		res = -errno;
-		goto exit;
+	close_fd(&ctx->sc_self_pipe[PIPE_WR_FD]);
+	return 0;
+}
+
+static bool spawn_parent_reaps(const struct spawn_ctx *ctx)
+{
+#ifdef CLONE_PARENT
+	return ctx->sc_env && (ctx->sc_env->se_clone_flags & CLONE_PARENT);
+#else
+	(void) ctx;
+	return false;
+#endif
+}
+
+/*
+ * Consumes the self-pipe once it is readable: EOF means the child has
+ * called execve() successfully, otherwise we get its errno.
+ */
+static int spawn_result(struct spawn_ctx *ctx)
+{
+	int child_error;
+	ssize_t count;
+
+	while ((count =
+		read(ctx->sc_self_pipe[PIPE_RD_FD], &child_error,
+		     sizeof(child_error))) == -1) {
+		if (errno != EAGAIN && errno != EINTR)
+			break;
 	}
 
-	if (fcntl(self_pipe[PIPE_WR_FD], F_SETFD, flags | FD_CLOEXEC)) {
-		res = -errno;
+	close_fd(&ctx->sc_self_pipe[PIPE_RD_FD]);
+
+	if (count == -1)
+		return -errno;
+
+	if (count) {
+		/*
+		 * The child has already given up, don't leave a zombie.
+		 * With CLONE_PARENT, it is our parent's to reap.
+		 */
+		if (ctx->sc_pid > 0 && !spawn_parent_reaps(ctx))
+			(void) reap_child(ctx->sc_pid, NULL, NULL);
+		return -child_error;
+	}
+
+	if (ctx->sc_want_pidfd && ctx->sc_pidfd == -1)
+		ctx->sc_pidfd = open_pidfd(ctx->sc_pid);
+
+	if (ctx->sc_stamps)
+		timing_end(ctx->sc_stamps);
+
+	return 0;
+}
+
+static void spawn_handover(struct spawn_ctx *ctx,
+                           struct process_info *proc_info)
+{
+	proc_info->pi_pid    = ctx->sc_pid;
+	proc_info->pi_stdin  = ctx->sc_pipes[ PIPE_STDIN][PIPE_WR_FD];
+	proc_info->pi_stdout = ctx->sc_pipes[PIPE_STDOUT][PIPE_RD_FD];
+	proc_info->pi_stderr = ctx->sc_pipes[PIPE_STDERR][PIPE_RD_FD];
+	proc_info->pi_pidfd  = ctx->sc_pidfd;
+	proc_info->pi_retval = 0;
+	proc_info->pi_nonblock = ctx->sc_nonblock;
+	memset(&proc_info->pi_usage, 0, sizeof(proc_info->pi_usage));
+	proc_info->pi_usage.eu_start = ctx->sc_start;
+	memcpy(proc_info->pi_pipe_size, ctx->sc_pipe_size,
+	       sizeof(proc_info->pi_pipe_size));
+	proc_info->pi_pipe_autogrow = ctx->sc_pipe_autogrow;
+
+	ctx->sc_pidfd = -1;
+
+	ctx->sc_pipes[ PIPE_STDIN][PIPE_WR_FD] = -1;
+	ctx->sc_pipes[PIPE_STDOUT][PIPE_RD_FD] = -1;
+	ctx->sc_pipes[PIPE_STDERR][PIPE_RD_FD] = -1;
+}
+
+/*
+ * Runs a prepared spawn_ctx to the end: starts the child, collects the
+ * exec result and either waits or hands over to @proc_info.
+ */
+static int spawn_run(struct spawn_ctx *ctx, struct process_info *proc_info,
+                     bool wait, const struct exec_attr *attr)
+{
+	int res;
+
+	res = spawn_start(ctx, attr);
+	if (!res)
+		res = spawn_result(ctx);
+	if (res)
 		goto exit;
+
+	if (wait) {
+		int ret;
+
+		if (attr && attr->ea_usage)
+			attr->ea_usage->eu_start = ctx->sc_start;
+		res = (reap_child(ctx->sc_pid, &ret,
+		                  attr ? attr->ea_usage : NULL) ? -errno : ret);
+	}
+
+	if (proc_info)
+		spawn_handover(ctx, proc_info);
+
+	spawn_ctx_release(ctx);
+	return res;
+
+exit:
+	if (proc_info) {
+		memset(proc_info, 0, sizeof(*proc_info));
+		proc_info->pi_pidfd = -1;
 	}
+	spawn_ctx_release(ctx);
+	return res;
+}
+
+int exec_spawn_env(struct process_info *proc_info, bool wait,
+                   user_info_t user, enum user_info_type user_type,
+                   const char *cmd, char *const argv[],
+                   const struct exec_attr *attr, struct spawn_env *env)
+{
+	struct spawn_ctx ctx;
+	int res;
+
+	if (wait) {
+		/* Not needed if we're waiting */
+		proc_info = NULL;
+	}
+
+	spawn_ctx_init(&ctx, proc_info != NULL, user, user_type,
+	               cmd, argv, env);
+
+	res = spawn_run(&ctx, proc_info, wait, attr);
+	if (env)
+		env->se_pid = ctx.sc_pid;
+
+	return res;
+}
 
-	pid = fork();
-	if (pid == 0) {
-		/* child */
-		long maxfd;
-		struct passwd *_user = NULL;
+struct exec_spec {
+	char                *sp_path;
+	char               **sp_argv;
+	char               **sp_envp;
+	struct exec_rlimit  *sp_rlimits;
+	int                  sp_stdio_fds[NUM_PIPES];
+	char                *sp_stdio_paths[NUM_PIPES];
+	struct user_cred     sp_cred;
+	bool                 sp_has_cred;
+	struct exec_attr     sp_attr;
+	struct spawn_env     sp_env;
+	int                 *sp_inherit_fds;
+	unsigned int         sp_num_inherit_fds;
+	int                 *sp_keep_buf;
+	void                *sp_stack;
+	size_t               sp_stack_size;
+};
+
+/* copies a NULL-terminated string vector into a single allocation */
+static char **copy_strv(char *const strv[])
+{
+	size_t count, size, len;
+	char **copy;
+	char *p;
+
+	size = 0;
+	for (count = 0; strv[count]; ++count)
+		size += strlen(strv[count]) + 1;
+
+	copy = malloc((count + 1) * sizeof(*copy) + size);
+	if (!copy)
+		return NULL;
+
+	p = (char *) (copy + count + 1);
+	for (count = 0; strv[count]; ++count) {
+		len = strlen(strv[count]) + 1;
+		copy[count] = memcpy(p, strv[count], len);
+		p += len;
+	}
+	copy[count] = NULL;
+
+	return copy;
+}
+
+/*
+ * Sorts the descriptors to be inherited and sets aside room to merge the
+ * self-pipe in on each spawn.
+ */
+static int spec_keep_fds(struct exec_spec *spec, const struct exec_attr *attr)
+{
+	unsigned int i, num;
+	int *fds;
 
-		if (proc_info) {
-			dup2(pipes[ PIPE_STDIN][PIPE_RD_FD], STDIN_FILENO);
-			dup2(pipes[PIPE_STDOUT][PIPE_WR_FD], STDOUT_FILENO);
-			dup2(pipes[PIPE_STDERR][PIPE_WR_FD], STDERR_FILENO);
+	num = attr ? attr->ea_num_inherit_fds : 0;
+	fds = malloc((2 * num + 1) * sizeof(*fds));
+	if (!fds)
+		return -1;
 
-			close(pipes[ PIPE_STDIN][PIPE_RD_FD]);
-			close(pipes[PIPE_STDOUT][PIPE_WR_FD]);
-			close(pipes[PIPE_STDERR][PIPE_WR_FD]);
+	spec->sp_num_inherit_fds = 0;
+	for (i = 0; i < num; ++i) {
+		/* stdio is always inherited */
+		if (attr->ea_inherit_fds[i] < FIRST_NON_STDIO_FD)
+			continue;
+		fds[spec->sp_num_inherit_fds++] = attr->ea_inherit_fds[i];
+	}
 
-			close(pipes[ PIPE_STDIN][PIPE_WR_FD]);
-			close(pipes[PIPE_STDOUT][PIPE_RD_FD]);
-			close(pipes[PIPE_STDERR][PIPE_RD_FD]);
+	qsort(fds, spec->sp_num_inherit_fds, sizeof(*fds), cmp_fd);
+	for (i = 1, num = spec->sp_num_inherit_fds; i < num; ++i) {
+		if (fds[i] == fds[i - 1]) {
+			memmove(&fds[i - 1], &fds[i],
+			        (num - i) * sizeof(*fds));
+			--num;
+			--i;
 		}
+	}
+
+	spec->sp_num_inherit_fds = num;
+	spec->sp_inherit_fds = fds;
+	spec->sp_keep_buf = fds + num;
+	return 0;
+}
+
+void exec_spec_attr_init(struct exec_spec_attr *attr)
+{
+	memset(attr, 0, sizeof(*attr));
+	attr->sa_stdio_fds[0] = -1;
+	attr->sa_stdio_fds[1] = -1;
+	attr->sa_stdio_fds[2] = -1;
+}
+
+struct exec_spec *exec_spec_new(const char *cmd, char *const argv[],
+                                user_info_t user,
+                                enum user_info_type user_type,
+                                const struct exec_spec_attr *attr)
+{
+	struct exec_spec_attr defaults;
+	struct exec_spec *spec;
+	size_t size;
+	long page_size;
+	unsigned int i;
+	int argc, err;
 
-		close(self_pipe[PIPE_RD_FD]);
+	if (!attr) {
+		exec_spec_attr_init(&defaults);
+		attr = &defaults;
+	}
+
+	if ((spec = calloc(1, sizeof(*spec))) == NULL)
+		return NULL;
 
-		_user = resolve_user(user, user_type);
-		if (!_user && errno != EINVAL /* USERINFO_TYPE_NONE */ )
+	spec->sp_env.se_cwd_fd = -1;
+	spec->sp_stack = MAP_FAILED;
+
+	/* the user decides which file in $PATH can be run */
+	if (user_type != USERINFO_TYPE_NONE) {
+		if (lookup_cred(user, user_type, &spec->sp_cred))
 			goto fail;
+		spec->sp_has_cred = true;
+	}
 
-		if (_user && drop_privileges(_user))
+	spec->sp_path = lookup_path(cmd, attr->sa_envp, spec->sp_has_cred ?
+	                                               &spec->sp_cred : NULL);
+	if (!spec->sp_path)
+		goto fail;
+
+	if ((spec->sp_argv = copy_strv(argv)) == NULL)
+		goto fail;
+
+	if (attr->sa_envp && (spec->sp_envp = copy_strv(attr->sa_envp)) == NULL)
+		goto fail;
+
+	if (attr->sa_cwd) {
+		spec->sp_env.se_cwd_fd = open(attr->sa_cwd, O_RDONLY |
+		                              O_DIRECTORY | O_CLOEXEC);
+		if (spec->sp_env.se_cwd_fd == -1)
 			goto fail;
+	}
 
-		maxfd = sysconf(_SC_OPEN_MAX);
-		while (--maxfd > 3) {
-			if (maxfd == self_pipe[PIPE_WR_FD])
-				continue;
-			close((int)maxfd);
-		}
+	if (attr->sa_num_rlimits) {
+		size = attr->sa_num_rlimits * sizeof(*spec->sp_rlimits);
+		if ((spec->sp_rlimits = malloc(size)) == NULL)
+			goto fail;
+		memcpy(spec->sp_rlimits, attr->sa_rlimits, size);
+	}
 
-		execvp(cmd, argv);
+	if (spec_keep_fds(spec, attr->sa_attr))
+		goto fail;
+
+	/* only fork and vfork leave the heap alone in the parent */
+	if (attr->sa_attr)
+		spec->sp_attr = *attr->sa_attr;
+	if (spec->sp_attr.ea_backend != EXEC_BACKEND_FORK)
+		spec->sp_attr.ea_backend = DEFAULT_BACKEND;
+	spec->sp_attr.ea_inherit_fds = NULL;
+	spec->sp_attr.ea_num_inherit_fds = 0;
+
+	/* files named in the stdio plan are opened on each spawn */
+	for (i = 0; i < NUM_PIPES; ++i) {
+		struct exec_stdio *es = &spec->sp_attr.ea_stdio[i];
+
+		if (es->es_mode != EXEC_STDIO_PATH || !es->es_path)
+			continue;
+		if ((spec->sp_stdio_paths[i] = strdup(es->es_path)) == NULL)
+			goto fail;
+		es->es_path = spec->sp_stdio_paths[i];
+	}
+
+#ifdef __linux__
+	if (spec->sp_attr.ea_backend == EXEC_BACKEND_VFORK) {
+		for (argc = 0; argv[argc]; ++argc)
+			;
+
+		page_size = sysconf(_SC_PAGESIZE);
+		spec->sp_stack_size = VFORK_STACK_SIZE +
+		                      (size_t) (argc + 3) * sizeof(char *);
+		spec->sp_stack_size = (spec->sp_stack_size +
+		                       (size_t) page_size - 1) &
+		                      ~((size_t) page_size - 1);
+		spec->sp_stack = mmap(NULL, spec->sp_stack_size,
+		                      PROT_READ | PROT_WRITE,
+		                      MAP_PRIVATE | MAP_ANONYMOUS |
+		                      MAP_STACK, -1, 0);
+		if (spec->sp_stack == MAP_FAILED)
+			goto fail;
+	}
+#else
+	(void) page_size;
+	(void) argc;
+#endif
+
+	spec->sp_env.se_envp = spec->sp_envp;
+	spec->sp_env.se_rlimits = spec->sp_rlimits;
+	spec->sp_env.se_num_rlimits = attr->sa_num_rlimits;
+	for (i = 0; i < NUM_PIPES; ++i)
+		spec->sp_env.se_stdio_fds[i] = attr->sa_stdio_fds[i];
+
+	return spec;
 
 fail:
-		child_error = EXEC_PROCESS_ERROR_OFFSET + errno;
-		write(self_pipe[PIPE_WR_FD], &child_error, sizeof(child_error));
-		_exit(1);
-	} else if (pid > 0) {
-		/* parent */
-		ssize_t count;
-
-		if (proc_info) {
-			close(pipes[ PIPE_STDIN][PIPE_RD_FD]);
-			close(pipes[PIPE_STDOUT][PIPE_WR_FD]);
-			close(pipes[PIPE_STDERR][PIPE_WR_FD]);
-		}
+	err = errno;
+	exec_spec_free(spec);
+	errno = err;
+	return NULL;
+}
 
-		close(self_pipe[PIPE_WR_FD]);
+void exec_spec_free(struct exec_spec *spec)
+{
+	unsigned int i;
 
-		while ((count =
-			read(self_pipe[PIPE_RD_FD], &child_error,
-			     sizeof(child_error))) == -1) {
-			if (errno != EAGAIN && errno != EINTR)
-				break;
-		}
+	if (!spec)
+		return;
+
+	if (spec->sp_stack != MAP_FAILED)
+		(void) munmap(spec->sp_stack, spec->sp_stack_size);
+	if (spec->sp_env.se_cwd_fd != -1)
+		close(spec->sp_env.se_cwd_fd);
+
+	for (i = 0; i < NUM_PIPES; ++i)
+		free(spec->sp_stdio_paths[i]);
+	free(spec->sp_inherit_fds);
+	free(spec->sp_rlimits);
+	free(spec->sp_cred.uc_groups);
+	free(spec->sp_envp);
+	free(spec->sp_argv);
+	free(spec->sp_path);
+	free(spec);
+}
+
+int exec_spawn(struct exec_spec *spec, struct process_info *proc)
+{
+	struct spawn_ctx ctx;
+
+	spawn_ctx_init(&ctx, proc != NULL, NULL, USERINFO_TYPE_NONE,
+	               spec->sp_path, spec->sp_argv, &spec->sp_env);
+
+	ctx.sc_path = spec->sp_path;
+	ctx.sc_cred = spec->sp_has_cred ? &spec->sp_cred : NULL;
+	ctx.sc_inherit_fds = spec->sp_inherit_fds;
+	ctx.sc_num_inherit_fds = spec->sp_num_inherit_fds;
+	ctx.sc_keep_buf = spec->sp_keep_buf;
+	if (spec->sp_stack != MAP_FAILED) {
+		ctx.sc_stack = spec->sp_stack;
+		ctx.sc_stack_size = spec->sp_stack_size;
+	}
+
+	return spawn_run(&ctx, proc, proc == NULL, &spec->sp_attr);
+}
 
-		close(self_pipe[PIPE_RD_FD]);
+int exec_process_batch(struct exec_cmd *cmds, struct process_info *procs,
+                       unsigned int num)
+{
+	struct spawn_ctx *ctx;
+	struct pollfd *pfds;
+	unsigned int i, pending;
+	int started, ret;
+
+	ctx = calloc(num, sizeof(*ctx));
+	pfds = calloc(num, sizeof(*pfds));
+	if ((!ctx || !pfds) && num) {
+		free(pfds);
+		free(ctx);
+		return -ENOMEM;
+	}
 
-		if (count) {
-			res = -child_error;
-			goto exit;
+	/* launch everything first, the children exec concurrently */
+	pending = 0;
+	for (i = 0; i < num; ++i) {
+		struct exec_cmd *cmd = &cmds[i];
+
+		pfds[i].fd = -1;
+		pfds[i].events = POLLIN;
+
+		spawn_ctx_init(&ctx[i], procs != NULL, cmd->ec_user,
+		               cmd->ec_user_type, cmd->ec_cmd, cmd->ec_argv,
+		               NULL);
+		ctx[i].sc_timing_slot = i;
+		ctx[i].sc_batch = true;
+
+		/*
+		 * The server creates one child after the other, so only
+		 * those who insist get it.
+		 */
+		if (cmd->ec_attr &&
+		    cmd->ec_attr->ea_backend == EXEC_BACKEND_SERVER &&
+		    exec_server_wanted(cmd->ec_attr)) {
+			struct process_info proc;
+
+			cmd->ec_result = exec_server_spawn(procs ? &proc : NULL,
+			                                   false,
+			                                   cmd->ec_user,
+			                                   cmd->ec_user_type,
+			                                   cmd->ec_cmd,
+			                                   cmd->ec_argv,
+			                                   cmd->ec_attr);
+			if (!cmd->ec_result && procs) {
+				ctx[i].sc_pid = proc.pi_pid;
+				ctx[i].sc_pipes[ PIPE_STDIN][PIPE_WR_FD] =
+					proc.pi_stdin;
+				ctx[i].sc_pipes[PIPE_STDOUT][PIPE_RD_FD] =
+					proc.pi_stdout;
+				ctx[i].sc_pipes[PIPE_STDERR][PIPE_RD_FD] =
+					proc.pi_stderr;
+				ctx[i].sc_pidfd = proc.pi_pidfd;
+				ctx[i].sc_nonblock = proc.pi_nonblock;
+				memcpy(ctx[i].sc_pipe_size, proc.pi_pipe_size,
+				       sizeof(ctx[i].sc_pipe_size));
+				ctx[i].sc_pipe_autogrow =
+					proc.pi_pipe_autogrow;
+			}
+			continue;
 		}
 
-		if (wait) {
-			int ret;
-			pid_t child;
+		cmd->ec_result = spawn_start(&ctx[i], cmd->ec_attr);
+		if (cmd->ec_result)
+			continue;
 
-			do {
-				child = waitpid(pid, &ret, 0);
-			} while (child == (pid_t) -1 && errno == EINTR);
+		pfds[i].fd = ctx[i].sc_self_pipe[PIPE_RD_FD];
+		++pending;
+	}
 
-			res = (child == (pid_t) -1 ? -errno : ret);
-		} else {
-			res = 0;
+	/* ... and collect all exec results at once */
+	while (pending) {
+		ret = poll(pfds, (nfds_t) num, -1);
+		if (ret == -1) {
+			if (errno == EINTR)
+				continue;
+			/* spawn_result() blocks on whatever is left */
+			for (i = 0; i < num; ++i)
+				pfds[i].revents =
+					(pfds[i].fd == -1 ? 0 : POLLIN);
 		}
 
-		if (proc_info) {
-			proc_info->pi_pid = pid;
-			proc_info->pi_stdin  = pipes[ PIPE_STDIN][PIPE_WR_FD];
-			proc_info->pi_stdout = pipes[PIPE_STDOUT][PIPE_RD_FD];
-			proc_info->pi_stderr = pipes[PIPE_STDERR][PIPE_RD_FD];
+		for (i = 0; i < num; ++i) {
+			if (pfds[i].fd == -1 || !pfds[i].revents)
+				continue;
+
+			cmds[i].ec_result = spawn_result(&ctx[i]);
+			pfds[i].fd = -1;
+			--pending;
 		}
-	} else {
-		res = -errno;
-		goto exit;
 	}
 
-	return res;
-
-exit:
-	(void) close(self_pipe[PIPE_RD_FD]);
-	(void) close(self_pipe[PIPE_WR_FD]);
-	for (i = 0; i < NUM_PIPES; ++i) {
-		(void) close(pipes[i][PIPE_RD_FD]);
-		(void) close(pipes[i][PIPE_WR_FD]);
+	started = 0;
+	for (i = 0; i < num; ++i) {
+		if (!cmds[i].ec_result) {
+			++started;
+			if (procs)
+				spawn_handover(&ctx[i], &procs[i]);
+		} else if (procs) {
+			memset(&procs[i], 0, sizeof(procs[i]));
+			procs[i].pi_pidfd = -1;
+		}
+		spawn_ctx_release(&ctx[i]);
 	}
-	if (proc_info)
-		memset(proc_info, 0, sizeof(*proc_info));
-	return res;
+
+	free(pfds);
+	free(ctx);
+	return started;
 }
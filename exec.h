@@ -20,30 +20,80 @@
 #define PROCEXEC_H
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
+#include <time.h>
+#include <sys/resource.h>
 #include "compiler.h"
 
 
+/**
+ * struct exec_usage - resources used by a child process
+ * @eu_start:		when the process was created
+ * @eu_end:		when the process was reaped
+ * @eu_utime_ns:	CPU time spent in user mode
+ * @eu_stime_ns:	CPU time spent in the kernel
+ * @eu_maxrss:		peak resident set size in kilobytes
+ * @eu_minflt:		page faults served without I/O
+ * @eu_majflt:		page faults that required I/O
+ * @eu_nvcsw:		voluntary context switches
+ * @eu_nivcsw:		involuntary context switches
+ *
+ * Timestamps are taken from CLOCK_MONOTONIC, the wall-clock run time is
+ * @eu_end minus @eu_start. Resource figures come from wait4(2) and
+ * include the process' own children that it has waited for.
+ */
+struct exec_usage {
+	struct timespec eu_start;
+	struct timespec eu_end;
+	uint64_t        eu_utime_ns;
+	uint64_t        eu_stime_ns;
+	long            eu_maxrss;
+	long            eu_minflt;
+	long            eu_majflt;
+	long            eu_nvcsw;
+	long            eu_nivcsw;
+};
+
+
 /**
  * struct process_info - process information
  * @pi_pid:		PID of the process
  * @pi_stdin:		file descriptor connected to stdin of process %pi_pid
  * @pi_stdout:		file descriptor connected to stdout of process %pi_pid
  * @pi_stderr:		file descriptor connected to stderr of process %pi_pid
+ * @pi_pidfd:		pidfd referring to process %pi_pid, %-1 if the kernel
+ *			doesn't support pidfds
  * @pi_retval:		holds the exit status once the process has exited
+ * @pi_nonblock:	%true if the descriptors above are in stream mode,
+ *			see exec_stream_mode()
+ * @pi_usage:		@eu_start is set when the process is created, the
+ *			rest once it has been reaped
+ * @pi_pipe_size:	capacity of the pipe behind each standard stream,
+ *			%0 if it was left at the default and isn't grown
+ * @pi_pipe_autogrow:	%true if exec_communicate() and exec_capture() grow
+ *			output pipes they find full, see
+ *			&exec_attr.ea_pipe_autogrow
  *
  * This struct will be filled by exec_process() to maintain
  * two-way communication with the child process once the function
  * returns. The file descriptors referring to stdin, stdout, and stderr
  * respectively of the child process have to be closed manually or by calling
  * wait_for_child() with @close_fds set to %true once they are of no use anymore
+ * The same goes for @pi_pidfd, which becomes readable once the process has
+ * exited and can be used with exec_reaper_add().
  */
 struct process_info {
-	pid_t pi_pid;
-	int   pi_stdin;
-	int   pi_stdout;
-	int   pi_stderr;
-	int   pi_retval;
+	pid_t             pi_pid;
+	int               pi_stdin;
+	int               pi_stdout;
+	int               pi_stderr;
+	int               pi_pidfd;
+	int               pi_retval;
+	bool              pi_nonblock;
+	struct exec_usage pi_usage;
+	size_t            pi_pipe_size[3];
+	bool              pi_pipe_autogrow;
 };
 
 
@@ -71,6 +121,144 @@ typedef union {
 } _transparent_union user_info_t;
 
 
+/**
+ * enum exec_backend - mechanism used to create the child process
+ * @EXEC_BACKEND_DEFAULT:	let the library decide (%EXEC_BACKEND_VFORK on
+ *				Linux, %EXEC_BACKEND_FORK elsewhere)
+ * @EXEC_BACKEND_FORK:		plain fork(2), the parent's page tables are
+ *				copied for every child
+ * @EXEC_BACKEND_VFORK:		clone(2) with CLONE_VM and CLONE_VFORK, the
+ *				child borrows the parent's address space until
+ *				it has called execve(2)
+ * @EXEC_BACKEND_POSIX_SPAWN:	posix_spawnp(3), falls back to
+ *				%EXEC_BACKEND_VFORK if privileges have to be
+ *				dropped
+ * @EXEC_BACKEND_SERVER:	hand the request to the spawn server started by
+ *				exec_server_start(), %EXEC_BACKEND_DEFAULT if
+ *				there is none
+ *
+ * While a spawn server is running, %EXEC_BACKEND_DEFAULT selects
+ * %EXEC_BACKEND_SERVER.
+ */
+enum exec_backend {
+	EXEC_BACKEND_DEFAULT,
+	EXEC_BACKEND_FORK,
+	EXEC_BACKEND_VFORK,
+	EXEC_BACKEND_POSIX_SPAWN,
+	EXEC_BACKEND_SERVER
+};
+
+
+/**
+ * enum exec_stdio_mode - where a standard stream of the child goes
+ * @EXEC_STDIO_PIPE:		a pipe whose other end is handed out in struct
+ *				process_info, our own stream if there is none
+ * @EXEC_STDIO_INHERIT:		our own stream
+ * @EXEC_STDIO_NULL:		/dev/null
+ * @EXEC_STDIO_MERGE:		wherever standard output goes, only valid for
+ *				standard error
+ * @EXEC_STDIO_FD:		a descriptor of ours
+ * @EXEC_STDIO_PATH:		a file opened for the child
+ * @EXEC_STDIO_REOPEN:		a read-only descriptor of its own for the file
+ *				behind one of ours, at its start, only valid
+ *				for standard input
+ *
+ * %EXEC_STDIO_REOPEN lets any number of children read the same file, e.g.
+ * one from exec_memfd_new(), at the same time without sharing a file
+ * offset.
+ */
+enum exec_stdio_mode {
+	EXEC_STDIO_PIPE,
+	EXEC_STDIO_INHERIT,
+	EXEC_STDIO_NULL,
+	EXEC_STDIO_MERGE,
+	EXEC_STDIO_FD,
+	EXEC_STDIO_PATH,
+	EXEC_STDIO_REOPEN
+};
+
+
+/**
+ * struct exec_stdio - disposition of a standard stream
+ * @es_mode:			where the stream goes
+ * @es_fd:			descriptor for %EXEC_STDIO_FD and
+ *				%EXEC_STDIO_REOPEN, left open
+ * @es_path:			file for %EXEC_STDIO_PATH
+ * @es_flags:			open(2) flags for @es_path, %0 for %O_RDONLY
+ *				on standard input and %O_WRONLY | %O_CREAT |
+ *				%O_TRUNC otherwise
+ * @es_pipe_size:		capacity for %EXEC_STDIO_PIPE, %0 for the
+ *				system default, see exec_pipe_resize()
+ */
+struct exec_stdio {
+	enum exec_stdio_mode  es_mode;
+	int                   es_fd;
+	const char           *es_path;
+	int                   es_flags;
+	size_t                es_pipe_size;
+};
+
+
+/**
+ * struct exec_attr - optional attributes for exec_process_attr()
+ * @ea_backend:		how the child process is created
+ * @ea_inherit_fds:	descriptors the child inherits besides its standard
+ *			input, output and standard error
+ * @ea_num_inherit_fds:	number of entries in @ea_inherit_fds
+ * @ea_nonblock:		hand out the standard stream descriptors in
+ *			stream mode, see exec_stream_mode()
+ * @ea_usage:		filled with the resources the process used if
+ *			exec_process_attr() waits for it, may be %NULL
+ * @ea_stdio:		standard input, output and standard error of the
+ *			child, indexed by descriptor
+ * @ea_pipe_autogrow:	double the capacity of an output pipe whenever
+ *			exec_communicate() or exec_capture() drain it full,
+ *			up to /proc/sys/fs/pipe-max-size
+ *
+ * A zero-initialized struct exec_attr yields the same behaviour as
+ * exec_process_p().
+ * Every descriptor above standard error that is not listed in
+ * @ea_inherit_fds is closed in the child before @cmd is executed. Listed
+ * descriptors keep their number and have FD_CLOEXEC cleared in the child.
+ * Pipes are only created for streams left at %EXEC_STDIO_PIPE, the
+ * descriptors in struct process_info are %-1 for the others. Requests
+ * that set up any other stream are spawned locally, not by the spawn
+ * server. A pipe that can't be given the capacity asked for keeps what it
+ * has, &process_info.pi_pipe_size tells.
+ */
+struct exec_attr {
+	enum exec_backend  ea_backend;
+	const int         *ea_inherit_fds;
+	unsigned int       ea_num_inherit_fds;
+	bool               ea_nonblock;
+	struct exec_usage *ea_usage;
+	struct exec_stdio  ea_stdio[3];
+	bool               ea_pipe_autogrow;
+};
+
+
+/**
+ * struct exec_cmd - command descriptor for exec_process_batch()
+ * @ec_cmd:			the file to be executed
+ * @ec_argv:			NULL-terminated list of arguments passed to
+ *                              @ec_cmd
+ * @ec_user:			if set, drop privileges before executing @ec_cmd
+ * @ec_user_type:		if @ec_user is non-null, indicates the type of
+ *                              user information (uid or name)
+ * @ec_attr:			spawn attributes, may be %NULL
+ * @ec_result:			set to what exec_process_attr() would have
+ *                              returned for this command
+ */
+struct exec_cmd {
+	const char             *ec_cmd;
+	char *const            *ec_argv;
+	user_info_t             ec_user;
+	enum user_info_type     ec_user_type;
+	const struct exec_attr *ec_attr;
+	int                     ec_result;
+};
+
+
 #define EXEC_PROCESS_ERROR_OFFSET		255
 
 
@@ -149,12 +337,259 @@ extern int exec_process_p(struct process_info *proc, bool wait,
                           const char *cmd, char *const argv[]);
 
 
+/**
+ * exec_process_attr - execute a file using extended attributes
+ * @proc:			storage space for process information
+ * @wait:			if set, wait until @cmd terminates
+ * @user:			if set, drop privileges before executing @cmd
+ * @user_type:			if @user is non-null, indicates the type of
+ *                              user information (uid or name)
+ * @cmd:			the file to be executed
+ * @argv:			NULL-terminated list of arguments passed to @cmd
+ * @attr:			spawn attributes, may be %NULL
+ *
+ * exec_process_attr() behaves like exec_process_p(), but lets the caller
+ * tune how the child is created through @attr. Whichever backend is used,
+ * @proc is filled in the same way and errors are reported using the same
+ * conventions.
+ * NOTE: whichever backend is used, the user given in @user is looked up
+ *       before the child is created, in the calling process or, for
+ *       requests it serves, in the spawn server. The result is cached
+ *       for 60 seconds, see exec_user_cache_flush().
+ *
+ * @return: see exec_process_p()
+ */
+extern int exec_process_attr(struct process_info *proc, bool wait,
+                             user_info_t user, enum user_info_type user_type,
+                             const char *cmd, char *const argv[],
+                             const struct exec_attr *attr);
+
+
+/**
+ * exec_process_batch - execute several files at once
+ * @cmds:			commands to be executed
+ * @procs:			storage space for @num process information
+ *                              structures, may be %NULL
+ * @num:			number of entries in @cmds and @procs
+ *
+ * exec_process_batch() behaves like calling exec_process_attr() with
+ * @wait set to %false for every entry in @cmds, but creates all children
+ * before collecting their exec results in a single poll(2) loop. The
+ * children execute their files concurrently, so commands that leave the
+ * backend to the library get %EXEC_BACKEND_FORK rather than
+ * %EXEC_BACKEND_VFORK, which would wait for each exec in turn. For the
+ * same reason, the spawn server, which creates one child after the other,
+ * is only used by commands that ask for %EXEC_BACKEND_SERVER.
+ * The outcome for each command is stored in its @ec_result, @procs[i] is
+ * filled for every command that has been started successfully and zeroed
+ * for the others.
+ *
+ * @return: the number of children started, or a negative
+ *          error code if the batch couldn't be set up at all.
+ */
+extern int exec_process_batch(struct exec_cmd *cmds,
+                              struct process_info *procs, unsigned int num);
+
+
+/**
+ * struct exec_rlimit - resource limit for a child process
+ * @rl_resource:		the resource, as passed to setrlimit(2)
+ * @rl_cur:			the soft limit
+ * @rl_max:			the hard limit
+ */
+struct exec_rlimit {
+	int    rl_resource;
+	rlim_t rl_cur;
+	rlim_t rl_max;
+};
+
+
+/**
+ * struct exec_spec_attr - how a spawn specification runs its command
+ * @sa_envp:			environment of the new process, %NULL for
+ *                              ours as of each spawn
+ * @sa_cwd:			directory to run in, %NULL to inherit ours
+ * @sa_stdio_fds:		descriptors to use as standard input, output
+ *                              and standard error instead of pipes, %-1 for
+ *                              a pipe or, if no pipes are created, to
+ *                              inherit ours
+ * @sa_rlimits:			resource limits to set in the child
+ * @sa_num_rlimits:		number of entries in @sa_rlimits
+ * @sa_attr:			spawn attributes, may be %NULL
+ *
+ * Use exec_spec_attr_init() to get the defaults, all of the above are
+ * copied by exec_spec_new().
+ */
+struct exec_spec_attr {
+	char *const              *sa_envp;
+	const char               *sa_cwd;
+	int                       sa_stdio_fds[3];
+	const struct exec_rlimit *sa_rlimits;
+	unsigned int              sa_num_rlimits;
+	const struct exec_attr   *sa_attr;
+};
+
+
+struct exec_spec;
+
+
+/**
+ * exec_spec_attr_init - initialize spawn specification attributes
+ * @attr:			attributes to reset to the defaults
+ */
+extern void exec_spec_attr_init(struct exec_spec_attr *attr);
+
+
+/**
+ * exec_spec_new - precompile a command for repeated spawning
+ * @cmd:			the file to be executed
+ * @argv:			NULL-terminated list of arguments passed to
+ *                              @cmd
+ * @user:			if set, drop privileges before executing @cmd
+ * @user_type:			if @user is non-null, indicates the type of
+ *                              user information (uid or name)
+ * @attr:			attributes, may be %NULL for the defaults
+ *
+ * Everything exec_process_attr() works out on each call is done once
+ * here: @argv and the environment are copied, @cmd is looked up in $PATH
+ * unless it contains a slash, the user's credentials are resolved, the
+ * working directory is opened and memory for the child's stack and
+ * descriptor list is set aside. The child runs @cmd with execve(2), so
+ * scripts need an interpreter line.
+ * NOTE: @cmd, the user and the working directory are resolved only
+ *       once, create a new specification to pick up changes.
+ *
+ * @return: the new specification, or %NULL with @errno set.
+ */
+extern struct exec_spec *exec_spec_new(const char *cmd, char *const argv[],
+                                       user_info_t user,
+                                       enum user_info_type user_type,
+                                       const struct exec_spec_attr *attr);
+
+
+/**
+ * exec_spec_free - destroy a spawn specification
+ * @spec:			specification to destroy, may be %NULL
+ */
+extern void exec_spec_free(struct exec_spec *spec);
+
+
+/**
+ * exec_spawn - run a precompiled command
+ * @spec:			specification returned by exec_spec_new()
+ * @proc:			storage space for process information, %NULL
+ *                              to wait for the child instead
+ *
+ * Behaves like exec_process_attr() with @wait set if @proc is %NULL, and
+ * cleared otherwise, but doesn't allocate any memory. Children are
+ * always created locally, with %EXEC_BACKEND_FORK if requested and
+ * %EXEC_BACKEND_VFORK otherwise.
+ * NOTE: a specification must not be used by several threads at once.
+ *
+ * @return: see exec_process().
+ */
+extern int exec_spawn(struct exec_spec *spec, struct process_info *proc);
+
+
+/**
+ * exec_server_start - start the spawn server
+ *
+ * exec_server_start() forks a small helper process that creates all
+ * further children on behalf of the caller. Requests are passed over a
+ * Unix socket along with the caller's environment, working directory and
+ * standard descriptors, the child's pipes are passed back. Commands are
+ * looked up in the $PATH of the environment that came with the request.
+ * Children are created with CLONE_PARENT, so they remain children of the
+ * caller and wait_for_child() works as usual. Spawn cost is then
+ * independent of the caller's size and number of threads. The server
+ * lives as long as the calling process, no matter whether the thread
+ * that started it exits.
+ * NOTE: call this as early as possible, while the process is still small
+ *       and single-threaded. Requests with @ea_inherit_fds or an explicit
+ *       backend other than %EXEC_BACKEND_SERVER are still served locally,
+ *       as are all requests if the server has died.
+ *
+ * @return: On success, %0 is returned, otherwise a negative
+ *          error code. Linux only, %-ENOSYS elsewhere.
+ */
+extern int exec_server_start(void);
+
+
+/**
+ * exec_server_stop - stop the spawn server
+ *
+ * Children spawned by the server are not affected.
+ *
+ * @return: On success, %0 is returned, otherwise a negative
+ *          error code according to waitpid(2).
+ */
+extern int exec_server_stop(void);
+
+
+/**
+ * struct exec_cache_stats - lookup cache counters
+ * @cs_hits:			lookups answered from the cache
+ * @cs_misses:			lookups that had to go to the system
+ * @cs_entries:			entries currently cached
+ */
+struct exec_cache_stats {
+	uint64_t     cs_hits;
+	uint64_t     cs_misses;
+	unsigned int cs_entries;
+};
+
+
+/**
+ * exec_user_cache_flush - forget all cached user credentials
+ *
+ * Users passed to exec_process() and friends are resolved in the parent,
+ * along with their supplementary groups, and the result is kept for a
+ * minute so that repeated spawns don't go through NSS each time; the
+ * child only applies it. Call this after changing users or groups to
+ * have them picked up right away.
+ */
+extern void exec_user_cache_flush(void);
+
+
+/**
+ * exec_user_cache_stats - get the counters of the user credential cache
+ * @stats:			filled with the counters
+ */
+extern void exec_user_cache_stats(struct exec_cache_stats *stats);
+
+
+/**
+ * exec_path_cache_flush - forget all cached command lookups
+ *
+ * Commands without a slash are looked up in $PATH by the parent, which
+ * remembers where they were found; the child runs the file with
+ * execve(2) right away. For a child that runs as another user, files that
+ * user can't execute by their mode bits are skipped, and the lookup is
+ * remembered for that user alone. An entry is dropped as soon as $PATH
+ * changes or the file it points to has been replaced or modified. Call
+ * this after installing a command in a directory that comes earlier in
+ * $PATH.
+ */
+extern void exec_path_cache_flush(void);
+
+
+/**
+ * exec_path_cache_stats - get the counters of the command lookup cache
+ * @stats:			filled with the counters
+ */
+extern void exec_path_cache_stats(struct exec_cache_stats *stats);
+
+
 /**
  * wait_for_child - wait for a child process to terminate
  * @proc:			process information
  * @close_fds:			if %true, open file descriptors to the child's
- *                              standard input, output and standard error are
- *                              closed upon process termination.
+ *                              standard input, output and standard error as
+ *                              well as its pidfd are closed upon process
+ *                              termination.
+ *
+ * Fills @proc->pi_usage with the resources the process has used.
+ *
  * @return: On sucess, %0 is returned, otherwise the
  *          function returns %-1 and @errno is set
  *          according to waitpid(2).
@@ -162,6 +597,172 @@ extern int exec_process_p(struct process_info *proc, bool wait,
 extern int wait_for_child(struct process_info *proc, bool close_fds);
 
 
+/**
+ * wait_for_child_timeout - wait for a child process, killing it if needed
+ * @proc:			process information
+ * @close_fds:			see wait_for_child()
+ * @timeout:			time to wait for the child to exit on its own
+ *                              in milliseconds, %-1 to wait forever
+ * @grace:			once @timeout has passed, time in milliseconds
+ *                              between SIGTERM and SIGKILL, %0 to send
+ *                              SIGKILL right away, %-1 to leave the child
+ *                              alone
+ *
+ * Sleeps on @pi_pidfd, or a pidfd of its own, and needs neither busy
+ * waiting nor a SIGCHLD handler. Without pidfd support, the child is
+ * checked with waitid(2) at growing intervals instead.
+ * A child killed this way is reaped as by wait_for_child(), with the
+ * signal in @pi_retval.
+ *
+ * @return: On sucess, %0 is returned, otherwise the function returns %-1
+ *          and @errno is set, %ETIMEDOUT if the child is still running
+ *          because @grace was %-1.
+ */
+extern int wait_for_child_timeout(struct process_info *proc, bool close_fds,
+                                  int timeout, int grace);
+
+
+/**
+ * exec_communicate - feed a process and collect its output
+ * @proc:			process started with standard streams
+ * @input:			data for the standard input of @proc
+ * @input_size:			size of @input, %0 closes standard input
+ *				right away
+ * @output:			receives the standard output, %NULL to discard
+ * @output_size:		receives the size of @output, may be %NULL
+ * @errors:			receives the standard error, %NULL to discard
+ * @errors_size:		receives the size of @errors, may be %NULL
+ * @deadline:			absolute %CLOCK_MONOTONIC time to give up at,
+ *				%NULL to wait forever
+ *
+ * exec_communicate() writes @input to the process while reading its
+ * standard output and standard error at the same time, all from a single
+ * poll(2) loop. Unlike writing everything first and reading afterwards,
+ * this can't deadlock on a child that fills one pipe while we are stuck on
+ * another. Standard input is closed once @input has been written or the
+ * child stops reading, which is not an error. Once both outputs have hit
+ * end of file, the process is reaped like wait_for_child() with
+ * @close_fds set does and its exit status is left in &process_info.pi_retval.
+ *
+ * The collected outputs are NUL terminated for convenience and have to be
+ * released with free(3). %SIGPIPE is blocked for the calling thread while
+ * exec_communicate() runs.
+ *
+ * @return: %0 on success. Otherwise a negative error code and nothing is
+ *          handed out. On %-ETIMEDOUT the process is still running and has
+ *          to be dealt with by the caller, e.g. kill(2) followed by
+ *          wait_for_child().
+ */
+extern int exec_communicate(struct process_info *proc,
+                            const void *input, size_t input_size,
+                            char **output, size_t *output_size,
+                            char **errors, size_t *errors_size,
+                            const struct timespec *deadline);
+
+
+/**
+ * exec_capture - move the output of a process to other descriptors
+ * @proc:			process started with standard streams
+ * @out_fd:			where standard output goes, %-1 to discard it
+ * @err_fd:			where standard error goes, %-1 to discard it
+ * @out_bytes:			receives the number of bytes moved from
+ *				standard output, may be %NULL
+ * @err_bytes:			receives the number of bytes moved from
+ *				standard error, may be %NULL
+ * @deadline:			absolute %CLOCK_MONOTONIC time to give up at,
+ *				%NULL to wait forever
+ *
+ * exec_capture() drains standard output and standard error of @proc into
+ * @out_fd and @err_fd until both have hit end of file. Data is moved from
+ * pipe to target with splice(2), so it never passes through user space.
+ * Targets splice(2) can't handle, like files opened with %O_APPEND, are
+ * served with read(2) and write(2) instead. Nonblocking targets are
+ * waited for.
+ *
+ * The process is neither fed nor reaped, use wait_for_child() afterwards.
+ *
+ * @return: %0 on success, a negative error code otherwise. The byte
+ *          counts reflect what has been moved either way.
+ */
+extern int exec_capture(struct process_info *proc, int out_fd, int err_fd,
+                        uint64_t *out_bytes, uint64_t *err_bytes,
+                        const struct timespec *deadline);
+
+
+/**
+ * struct exec_tap - copy of the data passing between two pipeline stages
+ * @et_fd:			where the copy goes, %-1 for a direct link
+ * @et_in:			our end of the pipe coming from the upstream
+ *				stage, %-1 once the tap is done
+ * @et_out:			our end of the pipe going to the downstream
+ *				stage
+ * @et_bytes:			number of bytes that have passed the tap
+ * @et_blocked:			private to exec_tap_pump()
+ * @et_splice:			private to exec_tap_pump()
+ *
+ * Only @et_fd is set by the caller, exec_pipeline() fills in the rest.
+ */
+struct exec_tap {
+	int      et_fd;
+	int      et_in;
+	int      et_out;
+	uint64_t et_bytes;
+	bool     et_blocked;
+	bool     et_splice;
+};
+
+
+/**
+ * exec_pipeline - run processes as a pipeline
+ * @cmds:			the stages, first to last. @ec_result receives
+ *				the outcome of each spawn
+ * @procs:			array of @num, receives the stages' process
+ *				information
+ * @num:			number of stages
+ * @taps:			%NULL, or an array of @num - 1 taps, one for
+ *				each link between two stages
+ *
+ * exec_pipeline() does what a shell does for "a | b | c" without running
+ * one: the standard output of each stage is connected straight to the
+ * standard input of the next. Only the ends are handed out, the standard
+ * input of the first stage as @procs[0].pi_stdin and the standard output
+ * of the last one as @procs[@num - 1].pi_stdout; the other stdin and
+ * stdout members are %-1. Every stage has its own standard error pipe and
+ * has to be waited for with wait_for_child().
+ *
+ * A link with a tap isn't direct: the data passes through us and is
+ * copied to &exec_tap.et_fd with tee(2) and splice(2), without ever
+ * reaching user space. Nothing moves over such a link unless
+ * exec_tap_pump() is called.
+ *
+ * Stages are always spawned locally, even if a spawn server is running.
+ *
+ * @return: %0 on success, otherwise the negative error code of the first
+ *          stage that failed. Stages already started are killed and reaped
+ *          then.
+ */
+extern int exec_pipeline(struct exec_cmd *cmds, struct process_info *procs,
+                         unsigned int num, struct exec_tap *taps);
+
+
+/**
+ * exec_tap_pump - move data across pipeline taps
+ * @taps:			the taps handed to exec_pipeline()
+ * @num:			number of taps, at most %64
+ * @timeout:			time to wait in milliseconds, %-1 to wait
+ *				forever
+ *
+ * Call this until it returns %0 for the tapped links to make progress.
+ * Once the upstream stage of a tap is done, the downstream one sees end
+ * of file. A downstream stage exiting early closes the link, just like a
+ * shell pipeline would. SIGPIPE should be ignored by the caller.
+ *
+ * @return: the number of taps still open, or a negative error code.
+ */
+extern int exec_tap_pump(struct exec_tap *taps, unsigned int num,
+                         int timeout);
+
+
 /**
  * timed_read - read from a file descriptor
  * @fd:				file descriptor to read from
@@ -171,8 +772,10 @@ extern int wait_for_child(struct process_info *proc, bool close_fds);
  *
  * timed_read() attempts to read up to @size bytes from file descriptor @fd
  * into the buffer starting at @buf. If @timeout was set to %0, this
- * function behaves exactly like read(2). Otherwise, select(2) will be used
+ * function behaves exactly like read(2). Otherwise, ppoll(2) will be used
  * to wait up to @timeout seconds until returning an error.
+ * The timeout applies to each wait on its own, timed_read_deadline() bounds
+ * the call as a whole.
  * NOTE: when using %0 timeout, this function may block forever due to
  *       stream buffering in the child process. Therefore, only use %0
  *       timeout if it is assured that the child process exits while waiting.
@@ -180,7 +783,7 @@ extern int wait_for_child(struct process_info *proc, bool close_fds);
  * @return: On success, the number of bytes read is
  *          returned (zero indicates end of file).
  *          On error, -1 is returned, and errno is set
- *          according to read(2) and select(2).
+ *          according to read(2) and ppoll(2).
  */
 extern ssize_t timed_read(int fd, void *buf, size_t size, unsigned int timeout);
 
@@ -194,18 +797,201 @@ extern ssize_t timed_read(int fd, void *buf, size_t size, unsigned int timeout);
  *
  * timed_write() attempts to write up to @size bytes from the buffer starting
  * at @buf to the file descriptor @fd. If @timeout was set to %0, this
- * function behaves exactly like write(2). Otherwise, select(2) will be used
+ * function behaves exactly like write(2). Otherwise, ppoll(2) will be used
  * to wait up to @timeout seconds until returning an error.
+ * The timeout applies to each wait on its own, timed_write_deadline() bounds
+ * the call as a whole.
  *
  * @return: On success, the number of bytes written is
  *          returned (zero indicates end of file).
  *          On error, -1 is returned, and errno is set
- *          according to write(2) and select(2).
+ *          according to write(2) and ppoll(2).
  */
 extern ssize_t timed_write(int fd, const void *buf,
                            size_t size, unsigned int timeout);
 
 
+/**
+ * exec_stream_mode - switch the standard streams of a process
+ * @proc:			process whose descriptors are switched
+ * @nonblock:			%true to enter stream mode, %false to leave it
+ *
+ * In stream mode, the descriptors in @proc are nonblocking for good instead
+ * of only for the duration of a timed_read() or timed_write() call. Both
+ * functions notice this and skip switching the descriptor back and forth,
+ * timed_read_stream() and timed_write_stream() don't even look.
+ * Setting &exec_attr.ea_nonblock gets there at spawn time for the price of a
+ * single fcntl(2).
+ *
+ * @return: %0 on success, a negative error code otherwise.
+ */
+extern int exec_stream_mode(struct process_info *proc, bool nonblock);
+
+
+/**
+ * exec_pipe_size - get the capacity of a pipe
+ * @fd:				either end of the pipe
+ *
+ * @return: the capacity in bytes, or a negative error code.
+ */
+extern ssize_t exec_pipe_size(int fd);
+
+
+/**
+ * exec_pipe_resize - change the capacity of a pipe
+ * @fd:				either end of the pipe
+ * @size:			capacity wanted, capped at
+ *				/proc/sys/fs/pipe-max-size
+ *
+ * The kernel rounds @size up to a power of two number of pages. A child
+ * writing bulk data into a larger pipe stalls less often, and each time
+ * we drain it, more data is moved at once.
+ *
+ * @return: the capacity granted, or a negative error code, %-EBUSY if
+ *          more data is buffered than fits and %-EPERM once the user's
+ *          allowance for pipe buffers is used up.
+ */
+extern ssize_t exec_pipe_resize(int fd, size_t size);
+
+
+/**
+ * exec_memfd_new - put data into a sealed memory file
+ * @name:			name for /proc/<pid>/fd, %NULL for a default
+ * @data:			contents of the file, e.g. an mmap(2)ed region
+ * @size:			size of @data
+ *
+ * @data is copied once into a file created with memfd_create(2), which
+ * is then sealed against writing, resizing and further seals. Handed to
+ * children with %EXEC_STDIO_REOPEN, it becomes their seekable standard
+ * input, which they read straight from the page cache instead of through
+ * a pipe we have to keep filling. The file lives on as long as a
+ * descriptor refers to it, so it can be closed once the last child has
+ * been spawned.
+ *
+ * @return: the descriptor, with %FD_CLOEXEC set, or a negative error code,
+ *          %-ENOSYS without memfd_create(2).
+ */
+extern int exec_memfd_new(const char *name, const void *data, size_t size);
+
+
+/**
+ * timed_read_stream - read from a descriptor in stream mode
+ * @fd:				nonblocking file descriptor to read from
+ * @buf:			buffer for the returned data
+ * @size:			size of the buffer pointed to by @buf
+ * @timeout:			time to wait for data
+ *
+ * Same as timed_read() minus the fcntl(2) calls; @fd must have %O_NONBLOCK
+ * set already, e.g. by exec_stream_mode().
+ *
+ * @return: see timed_read().
+ */
+extern ssize_t timed_read_stream(int fd, void *buf, size_t size,
+                                 unsigned int timeout);
+
+
+/**
+ * timed_write_stream - write to a descriptor in stream mode
+ * @fd:				nonblocking file descriptor to write to
+ * @buf:			buffer containing the data to be written
+ * @size:			size of the buffer pointed to by @buf
+ * @timeout:			time to wait for @fd to become ready
+ *
+ * Same as timed_write() minus the fcntl(2) calls; @fd must have %O_NONBLOCK
+ * set already, e.g. by exec_stream_mode().
+ *
+ * @return: see timed_write().
+ */
+extern ssize_t timed_write_stream(int fd, const void *buf, size_t size,
+                                  unsigned int timeout);
+
+
+/**
+ * exec_deadline - compute a deadline
+ * @deadline:			where the deadline is stored
+ * @budget_ns:			nanoseconds from now
+ *
+ * Stores the %CLOCK_MONOTONIC time @budget_ns nanoseconds from now in
+ * @deadline, ready to be handed to timed_read_deadline() and
+ * timed_write_deadline(). Sharing one deadline between the write of a
+ * request and the read of its response bounds the whole exchange.
+ */
+extern void exec_deadline(struct timespec *deadline, uint64_t budget_ns);
+
+
+/**
+ * timed_read_deadline - read from a file descriptor until a deadline
+ * @fd:				file descriptor to read from
+ * @buf:			buffer for the returned data
+ * @size:			size of the buffer pointed to by @buf
+ * @deadline:			absolute %CLOCK_MONOTONIC time, %NULL to wait
+ *				forever
+ *
+ * Like timed_read(), but time does not start over whenever some data
+ * arrives: a child trickling out single bytes can't keep the call going
+ * past @deadline. Waiting uses ppoll(2), so @deadline is honoured with
+ * nanosecond resolution as far as the system timers allow.
+ *
+ * @return: On success, the number of bytes read is returned, which may be
+ *          less than @size if @deadline passed or end of file was hit.
+ *          If @deadline passes before any data arrived, -1 is returned
+ *          and errno is set to %ETIMEDOUT. On other errors, -1 is
+ *          returned and errno is set according to read(2) and ppoll(2).
+ */
+extern ssize_t timed_read_deadline(int fd, void *buf, size_t size,
+                                   const struct timespec *deadline);
+
+
+/**
+ * timed_write_deadline - write to a file descriptor until a deadline
+ * @fd:				file descriptor to write to
+ * @buf:			buffer containing the data to be written
+ * @size:			size of the buffer pointed to by @buf
+ * @deadline:			absolute %CLOCK_MONOTONIC time, %NULL to wait
+ *				forever
+ *
+ * The counterpart of timed_read_deadline().
+ *
+ * @return: On success, the number of bytes written is returned, which may
+ *          be less than @size if @deadline passed. If @deadline passes
+ *          before anything was written, -1 is returned and errno is set to
+ *          %ETIMEDOUT. On other errors, -1 is returned and errno is set
+ *          according to write(2) and ppoll(2).
+ */
+extern ssize_t timed_write_deadline(int fd, const void *buf, size_t size,
+                                    const struct timespec *deadline);
+
+
+/**
+ * timed_read_budget - read from a file descriptor within a time budget
+ * @fd:				file descriptor to read from
+ * @buf:			buffer for the returned data
+ * @size:			size of the buffer pointed to by @buf
+ * @budget_ns:			total time the call may take in nanoseconds
+ *
+ * Shorthand for timed_read_deadline() with a deadline @budget_ns from now.
+ *
+ * @return: see timed_read_deadline().
+ */
+extern ssize_t timed_read_budget(int fd, void *buf, size_t size,
+                                 uint64_t budget_ns);
+
+
+/**
+ * timed_write_budget - write to a file descriptor within a time budget
+ * @fd:				file descriptor to write to
+ * @buf:			buffer containing the data to be written
+ * @size:			size of the buffer pointed to by @buf
+ * @budget_ns:			total time the call may take in nanoseconds
+ *
+ * Shorthand for timed_write_deadline() with a deadline @budget_ns from now.
+ *
+ * @return: see timed_write_deadline().
+ */
+extern ssize_t timed_write_budget(int fd, const void *buf, size_t size,
+                                  uint64_t budget_ns);
+
+
 /**
  * get_exit_details - get information about a process exit value
  * @status:			exit status
@@ -0,0 +1,299 @@
+/*
+ * =============================================================================
+ *
+ *       Filename:  internal.h
+ *
+ *    Description:  Helpers shared between the exec_process modules
+ *
+ *        Version:  1.0
+ *        Created:  10/17/2026 10:02:41 AM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Oliver Lorenz (ol), olli@olorenz.org
+ *
+ * =============================================================================
+ */
+
+#ifndef PROCEXEC_INTERNAL_H
+#define PROCEXEC_INTERNAL_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include "exec.h"
+
+#define NSEC_PER_SEC		1000000000LL
+#define NSEC_PER_MSEC		1000000LL
+
+
+static inline int fd_get_flags(int fd)
+{
+	return fcntl(fd, F_GETFL, NULL);
+}
+
+static inline int fd_set_flags(int fd, int flags)
+{
+	return fcntl(fd, F_SETFL, flags);
+}
+
+static inline int fd_set_nonblocking(int fd, int flags)
+{
+	return fd_set_flags(fd, flags | O_NONBLOCK);
+}
+
+static inline int fd_clear_nonblocking(int fd, int flags)
+{
+	return fd_set_flags(fd, flags & (~O_NONBLOCK));
+}
+
+static inline int fd_make_nonblocking(int fd)
+{
+	int flags;
+	flags = fd_get_flags(fd);
+	if (flags == -1)
+		return -1;
+	return fd_set_nonblocking(fd, flags);
+}
+
+/*
+ * Stores how much time is left until @deadline in @left. Returns %false
+ * once @deadline has passed.
+ */
+static inline bool deadline_left(const struct timespec *deadline,
+                                 struct timespec *left)
+{
+	struct timespec now;
+	long long ns;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	ns = (long long) (deadline->tv_sec - now.tv_sec) * NSEC_PER_SEC +
+	     (deadline->tv_nsec - now.tv_nsec);
+	if (ns <= 0)
+		return false;
+
+	left->tv_sec  = (time_t) (ns / NSEC_PER_SEC);
+	left->tv_nsec = (long) (ns % NSEC_PER_SEC);
+	return true;
+}
+
+
+/*
+ * Waits with ppoll(2) until @fd reports @events or @deadline, if any, has
+ * passed. Returns %0 once ready, otherwise a negative error code,
+ * %-ETIMEDOUT on timeout.
+ */
+static inline int fd_wait(int fd, short events,
+                          const struct timespec *deadline)
+{
+	struct timespec left;
+	struct pollfd pfd;
+	int ret;
+
+	pfd.fd = fd;
+	pfd.events = events;
+	for (;;) {
+		if (deadline && !deadline_left(deadline, &left))
+			return -ETIMEDOUT;
+
+		ret = ppoll(&pfd, 1, deadline ? &left : NULL, NULL);
+		if (ret > 0)
+			return 0;
+		if (ret == -1 && errno != EINTR)
+			return -errno;
+	}
+}
+
+
+/*
+ * Moves up to @len bytes from @in to @out, with splice(2) as long as
+ * *@use_splice holds and with read(2) and write(2) once the kernel refused.
+ * @out may be %-1 to discard. Returns the number of bytes moved, %0 at end
+ * of file or a negative error code, %-EAGAIN if @in had nothing to offer.
+ */
+extern ssize_t fd_transfer(int in, int out, size_t len, bool *use_splice,
+                           const struct timespec *deadline);
+
+
+/*
+ * Sizes the pipe behind standard stream @i as @attr asks for. Returns its
+ * capacity if it is to be reported, %0 otherwise.
+ */
+extern size_t pipe_setup_size(int fd, const struct exec_attr *attr,
+                              unsigned int i);
+
+
+/*
+ * Grows output pipe @i of @proc if @count bytes, what was just read from
+ * it into @room bytes of space, show that it had been full. See
+ * &exec_attr.ea_pipe_autogrow.
+ */
+extern void pipe_autogrow(struct process_info *proc, unsigned int i,
+                          size_t count, size_t room);
+
+
+/*
+ * Timestamps taken during a spawn, see exec_timing_enable(). The child's
+ * are written through shared memory.
+ */
+enum timing_stamp {
+	TS_START,
+	TS_RESOLVED,
+	TS_PIPES,
+	TS_CHILD,
+	TS_SETUP,
+	TS_CREDS,
+	TS_CLOSED,
+	TS_DONE,
+	NUM_TS
+};
+
+#ifdef EXEC_NO_TIMING
+#define timing_enabled()		false
+#define timing_stamp(stamps, which)	do { } while (0)
+#else
+extern int timing_active;
+
+static inline bool timing_enabled(void)
+{
+	return __atomic_load_n(&timing_active, __ATOMIC_RELAXED) != 0;
+}
+
+/* async-signal-safe, CLOCK_MONOTONIC is served by the vDSO */
+static inline void timing_stamp(uint64_t *stamps, enum timing_stamp which)
+{
+	struct timespec now;
+
+	if (!stamps)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	stamps[which] = (uint64_t) now.tv_sec * NSEC_PER_SEC +
+	                (uint64_t) now.tv_nsec;
+}
+#endif
+
+
+/**
+ * timing_begin - start timing a spawn
+ * @slot:			which of the calling thread's stamp arrays to
+ *				use, spawns in flight at the same time need
+ *				distinct slots
+ *
+ * Only to be called if timing_enabled().
+ *
+ * @return: the stamps, with %TS_START taken, or %NULL if they can't be
+ *          recorded.
+ */
+extern uint64_t *timing_begin(unsigned int slot);
+
+
+/**
+ * timing_end - take %TS_DONE and record a successful spawn
+ * @stamps:			as returned by timing_begin()
+ */
+extern void timing_end(uint64_t *stamps);
+
+
+/**
+ * struct spawn_env - execution environment for exec_spawn_env()
+ * @se_envp:			environment of the new process, %NULL for
+ *                              our own
+ * @se_cwd_fd:			directory to change into, %-1 to inherit ours
+ * @se_stdio_fds:		descriptors to use as standard input, output
+ *                              and standard error instead of pipes, %-1 for
+ *                              a pipe or, if no pipes are created, to
+ *                              inherit ours
+ * @se_rlimits:			resource limits to set in the child
+ * @se_num_rlimits:		number of entries in @se_rlimits
+ * @se_clone_flags:		additional clone(2) flags
+ * @se_pid:			PID of the new process on return
+ */
+struct spawn_env {
+	char *const              *se_envp;
+	int                       se_cwd_fd;
+	int                       se_stdio_fds[3];
+	const struct exec_rlimit *se_rlimits;
+	unsigned int              se_num_rlimits;
+	int                       se_clone_flags;
+	pid_t                     se_pid;
+};
+
+
+/**
+ * exec_spawn_env - exec_process_attr() without the spawn server
+ * @env:			execution environment, may be %NULL
+ *
+ * See exec_process_attr() for the remaining parameters.
+ */
+extern int exec_spawn_env(struct process_info *proc, bool wait,
+                          user_info_t user, enum user_info_type user_type,
+                          const char *cmd, char *const argv[],
+                          const struct exec_attr *attr,
+                          struct spawn_env *env);
+
+
+/**
+ * open_pidfd - obtain a pidfd for a child process
+ * @pid:			process to refer to
+ *
+ * @return: the pidfd, or %-1 with @errno set, %ENOSYS if
+ *          the kernel doesn't support pidfds.
+ */
+extern int open_pidfd(pid_t pid);
+
+
+/**
+ * reap_child - wait4(2) that restarts on %EINTR
+ * @pid:			process to wait for
+ * @status:			exit status, may be %NULL
+ * @usage:			filled with the resources used, except for
+ *				@eu_start, may be %NULL
+ */
+extern int reap_child(pid_t pid, int *status, struct exec_usage *usage);
+
+
+/**
+ * usage_from_rusage - fill a struct exec_usage after reaping a child
+ * @usage:			usage to fill in, @eu_start is left alone
+ * @ru:				as returned by wait4(2)
+ */
+extern void usage_from_rusage(struct exec_usage *usage,
+                              const struct rusage *ru);
+
+
+/**
+ * close_fds_except - close every descriptor above standard error
+ * @keep:			sorted list of descriptors to leave open
+ * @num_keep:			number of entries in @keep
+ *
+ * Async-signal-safe, doesn't touch the heap.
+ */
+extern void close_fds_except(const int *keep, unsigned int num_keep);
+
+
+/**
+ * exec_server_wanted - check whether a request goes to the spawn server
+ * @attr:			spawn attributes, may be %NULL
+ */
+extern bool exec_server_wanted(const struct exec_attr *attr);
+
+
+/**
+ * exec_server_spawn - let the spawn server execute a file
+ *
+ * Same parameters and return values as exec_process_attr(). Falls back
+ * to spawning locally if the server has gone away.
+ */
+extern int exec_server_spawn(struct process_info *proc, bool wait,
+                             user_info_t user, enum user_info_type user_type,
+                             const char *cmd, char *const argv[],
+                             const struct exec_attr *attr);
+
+#endif
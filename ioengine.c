@@ -0,0 +1,1228 @@
+/*
+ * =============================================================================
+ *
+ *       Filename:  ioengine.c
+ *
+ *    Description:  Event driven I/O on the standard streams of many
+ *                  child processes
+ *
+ *        Version:  1.0
+ *        Created:  10/17/2026 12:05:14 PM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Oliver Lorenz (ol), olli@olorenz.org
+ *
+ * =============================================================================
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#endif
+#include "ioengine.h"
+#include "internal.h"
+
+#if defined(__NR_io_uring_setup) && defined(IORING_ENTER_EXT_ARG)
+#define HAVE_IO_URING
+#endif
+
+#define IO_NUM_SLOTS		4
+#define IO_SLOT_EXIT		3
+#define IO_MAX_EVENTS		64
+#define IO_READ_SIZE		(64 * 1024)
+#define IO_BUF_MIN		4096U
+
+#define RING_SQ_ENTRIES		1024U
+#define RING_CQ_ENTRIES		32768U
+#define RING_NUM_BUFS		256U
+#define RING_BUF_SIZE		(16 * 1024)
+#define RING_BUF_GROUP		0
+
+/* low bit of the user data, tells a poll from the actual transfer */
+#define RING_OP_POLL		1UL
+
+struct io_stream {
+	struct exec_io_proc *is_owner;
+	unsigned int         is_slot;
+	int                  is_fd;
+	bool                 is_open;
+	bool                 is_armed;
+	char                *is_buf;
+	size_t               is_len;
+	size_t               is_off;
+	size_t               is_size;
+	int                  is_error;
+
+	/* io_uring only */
+	bool                 is_inflight;
+	bool                 is_queued;
+	bool                 is_poll;
+	char                *is_inflight_buf;
+	struct io_stream    *is_next_queued;
+};
+
+struct exec_io_proc {
+	struct exec_io           *ep_io;
+	struct process_info      *ep_proc;
+	const struct exec_io_ops *ep_ops;
+	void                     *ep_arg;
+	bool                      ep_close_stdin;
+	bool                      ep_removed;
+	bool                      ep_exited;
+	unsigned int              ep_active;
+	struct io_stream          ep_streams[IO_NUM_SLOTS];
+	struct exec_io_proc      *ep_prev;
+	struct exec_io_proc      *ep_next;
+};
+
+struct io_backend {
+	enum exec_io_backend ib_type;
+	int                (*ib_init)(struct exec_io *io);
+	void               (*ib_fini)(struct exec_io *io);
+	int                (*ib_watch)(struct io_stream *s);
+	void               (*ib_unwatch)(struct io_stream *s);
+	int                (*ib_run)(struct exec_io *io, int timeout);
+};
+
+struct io_ring;
+
+struct exec_io {
+	const struct io_backend *ei_backend;
+	int                      ei_epfd;
+	struct io_ring          *ei_ring;
+	bool                     ei_running;
+	struct exec_io_proc     *ei_procs;
+	struct exec_io_proc     *ei_graveyard;
+	struct exec_io_stats     ei_stats;
+	unsigned int             ei_active;
+	char                    *ei_rbuf;
+};
+
+static inline struct exec_io *stream_io(const struct io_stream *s)
+{
+	return s->is_owner->ep_io;
+}
+
+static inline int io_watch(struct io_stream *s)
+{
+	return stream_io(s)->ei_backend->ib_watch(s);
+}
+
+static inline void io_unwatch(struct io_stream *s)
+{
+	stream_io(s)->ei_backend->ib_unwatch(s);
+}
+
+#ifdef __linux__
+static int stream_reserve(struct io_stream *s, size_t extra)
+{
+	size_t size;
+	char *buf;
+
+	if (s->is_size - s->is_len >= extra)
+		return 0;
+
+	/*
+	 * Reclaim what has been written already before growing, unless the
+	 * kernel is still busy with it.
+	 */
+	if (s->is_off && !s->is_inflight) {
+		memmove(s->is_buf, s->is_buf + s->is_off,
+		        s->is_len - s->is_off);
+		s->is_len -= s->is_off;
+		s->is_off = 0;
+		if (s->is_size - s->is_len >= extra)
+			return 0;
+	}
+
+	size = s->is_size ? s->is_size : IO_BUF_MIN;
+	while (size - s->is_len < extra)
+		size *= 2;
+
+	if (!s->is_inflight) {
+		if ((buf = realloc(s->is_buf, size)) == NULL)
+			return -1;
+	} else {
+		/* the old buffer goes once the write has completed */
+		if ((buf = malloc(size)) == NULL)
+			return -1;
+		memcpy(buf, s->is_buf, s->is_len);
+		if (s->is_buf != s->is_inflight_buf)
+			free(s->is_buf);
+	}
+
+	s->is_buf = buf;
+	s->is_size = size;
+	return 0;
+}
+
+static void proc_release(struct exec_io_proc *p)
+{
+	unsigned int i;
+
+	for (i = 0; i < IO_NUM_SLOTS; ++i) {
+		if (p->ep_streams[i].is_inflight_buf != p->ep_streams[i].is_buf)
+			free(p->ep_streams[i].is_inflight_buf);
+		free(p->ep_streams[i].is_buf);
+	}
+	free(p);
+}
+
+/* the kernel may still hold on to streams of removed children */
+static bool proc_busy(const struct exec_io_proc *p)
+{
+	unsigned int i;
+
+	for (i = 0; i < IO_NUM_SLOTS; ++i) {
+		if (p->ep_streams[i].is_inflight || p->ep_streams[i].is_queued)
+			return true;
+	}
+
+	return false;
+}
+
+static void bury_dead(struct exec_io *io)
+{
+	struct exec_io_proc **pp, *p;
+
+	pp = &io->ei_graveyard;
+	while ((p = *pp) != NULL) {
+		if (proc_busy(p)) {
+			pp = &p->ep_next;
+			continue;
+		}
+		*pp = p->ep_next;
+		proc_release(p);
+	}
+}
+
+static bool stdin_active(const struct exec_io_proc *p)
+{
+	const struct io_stream *s = &p->ep_streams[EXEC_IO_STDIN];
+
+	return s->is_open && (s->is_len != s->is_off || p->ep_close_stdin);
+}
+
+/*
+ * Brings ei_active, what exec_io_run() returns, up to date with whatever
+ * changed about @p, so that nobody has to count.
+ */
+static void proc_update_active(struct exec_io_proc *p)
+{
+	unsigned int active = 0;
+
+	if (!p->ep_removed)
+		active = p->ep_streams[EXEC_IO_STDOUT].is_open +
+		         p->ep_streams[EXEC_IO_STDERR].is_open +
+		         p->ep_streams[IO_SLOT_EXIT].is_open +
+		         stdin_active(p);
+
+	p->ep_io->ei_active = p->ep_io->ei_active - p->ep_active + active;
+	p->ep_active = active;
+}
+
+static void deliver_output(struct io_stream *s, const char *data, size_t len)
+{
+	struct exec_io_proc *p = s->is_owner;
+
+	stream_io(s)->ei_stats.es_bytes_read += len;
+
+	if (p->ep_ops && p->ep_ops->eo_output) {
+		p->ep_ops->eo_output(p, (enum exec_io_stream) s->is_slot,
+		                     data, len, p->ep_arg);
+		return;
+	}
+
+	/*
+	 * Once something had to be dropped, the rest goes as well, the
+	 * collected output is cut short rather than having a hole in it.
+	 */
+	if (s->is_error)
+		return;
+	if (stream_reserve(s, len)) {
+		s->is_error = -ENOMEM;
+		return;
+	}
+
+	memcpy(s->is_buf + s->is_len, data, len);
+	s->is_len += len;
+}
+
+/* end of file or a broken pipe, either way we're done */
+static void output_done(struct io_stream *s)
+{
+	struct exec_io_proc *p = s->is_owner;
+
+	io_unwatch(s);
+	s->is_open = false;
+	proc_update_active(p);
+	if (p->ep_ops && p->ep_ops->eo_output)
+		p->ep_ops->eo_output(p, (enum exec_io_stream) s->is_slot,
+		                     NULL, 0, p->ep_arg);
+}
+
+static void stdin_finish(struct exec_io_proc *p, int error)
+{
+	struct io_stream *s = &p->ep_streams[EXEC_IO_STDIN];
+
+	io_unwatch(s);
+	s->is_len = 0;
+	s->is_off = 0;
+
+	if (!error && !p->ep_close_stdin) {
+		proc_update_active(p);
+		return;
+	}
+
+	if (!error) {
+		close(s->is_fd);
+		p->ep_proc->pi_stdin = -1;
+	}
+
+	s->is_open = false;
+	p->ep_close_stdin = false;
+	proc_update_active(p);
+	if (p->ep_ops && p->ep_ops->eo_input_done)
+		p->ep_ops->eo_input_done(p, error, p->ep_arg);
+}
+
+static void input_written(struct io_stream *s, size_t count)
+{
+	stream_io(s)->ei_stats.es_bytes_written += count;
+
+	s->is_off += count;
+	if (s->is_off == s->is_len)
+		stdin_finish(s->is_owner, 0);
+}
+
+static void proc_exited(struct exec_io_proc *p)
+{
+	io_unwatch(&p->ep_streams[IO_SLOT_EXIT]);
+	p->ep_streams[IO_SLOT_EXIT].is_open = false;
+	p->ep_exited = true;
+	proc_update_active(p);
+	p->ep_ops->eo_exit(p, p->ep_arg);
+}
+
+/*
+ * epoll(7) backend: readiness is reported by the kernel, the data is moved
+ * with one read(2) or write(2) per ready stream.
+ */
+static int epoll_init(struct exec_io *io)
+{
+	if ((io->ei_rbuf = malloc(IO_READ_SIZE)) == NULL)
+		return -1;
+
+	io->ei_epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (io->ei_epfd == -1) {
+		free(io->ei_rbuf);
+		return -1;
+	}
+
+	return 0;
+}
+
+static void epoll_fini(struct exec_io *io)
+{
+	close(io->ei_epfd);
+	free(io->ei_rbuf);
+}
+
+static int epoll_watch(struct io_stream *s)
+{
+	struct epoll_event ev;
+
+	if (s->is_armed)
+		return 0;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = (s->is_slot == EXEC_IO_STDIN) ? EPOLLOUT : EPOLLIN;
+	ev.data.ptr = s;
+
+	++stream_io(s)->ei_stats.es_syscalls;
+	if (epoll_ctl(stream_io(s)->ei_epfd, EPOLL_CTL_ADD, s->is_fd, &ev))
+		return -1;
+
+	s->is_armed = true;
+	return 0;
+}
+
+static void epoll_unwatch(struct io_stream *s)
+{
+	if (!s->is_armed)
+		return;
+
+	++stream_io(s)->ei_stats.es_syscalls;
+	(void) epoll_ctl(stream_io(s)->ei_epfd, EPOLL_CTL_DEL,
+	                 s->is_fd, NULL);
+	s->is_armed = false;
+}
+
+static void epoll_output(struct exec_io *io, struct io_stream *s)
+{
+	ssize_t count;
+
+	do {
+		++io->ei_stats.es_syscalls;
+		count = read(s->is_fd, io->ei_rbuf, IO_READ_SIZE);
+	} while (count == -1 && errno == EINTR);
+
+	if (count == -1 && errno == EAGAIN)
+		return;
+
+	if (count <= 0)
+		output_done(s);
+	else
+		deliver_output(s, io->ei_rbuf, (size_t) count);
+}
+
+static void epoll_input(struct exec_io *io, struct io_stream *s)
+{
+	ssize_t count;
+
+	do {
+		++io->ei_stats.es_syscalls;
+		count = write(s->is_fd, s->is_buf + s->is_off,
+		              s->is_len - s->is_off);
+	} while (count == -1 && errno == EINTR);
+
+	if (count == -1) {
+		if (errno != EAGAIN)
+			stdin_finish(s->is_owner, errno);
+		return;
+	}
+
+	input_written(s, (size_t) count);
+}
+
+static int epoll_run(struct exec_io *io, int timeout)
+{
+	struct epoll_event events[IO_MAX_EVENTS];
+	struct io_stream *s;
+	int i, num;
+
+	do {
+		++io->ei_stats.es_syscalls;
+		num = epoll_wait(io->ei_epfd, events, IO_MAX_EVENTS, timeout);
+	} while (num == -1 && errno == EINTR);
+
+	if (num == -1)
+		return -errno;
+
+	for (i = 0; i < num; ++i) {
+		s = events[i].data.ptr;
+		if (s->is_owner->ep_removed || !s->is_armed)
+			continue;
+
+		++io->ei_stats.es_events;
+		if (s->is_slot == IO_SLOT_EXIT)
+			proc_exited(s->is_owner);
+		else if (s->is_slot == EXEC_IO_STDIN)
+			epoll_input(io, s);
+		else
+			epoll_output(io, s);
+	}
+
+	return 0;
+}
+
+static const struct io_backend epoll_backend = {
+	.ib_type    = EXEC_IO_BACKEND_EPOLL,
+	.ib_init    = epoll_init,
+	.ib_fini    = epoll_fini,
+	.ib_watch   = epoll_watch,
+	.ib_unwatch = epoll_unwatch,
+	.ib_run     = epoll_run,
+};
+
+#ifdef HAVE_IO_URING
+/*
+ * io_uring(7) backend: reads, writes and exit polls of all children are
+ * queued on one submission ring and handed to the kernel with a single
+ * io_uring_enter(2) per loop iteration, which also collects completions.
+ * Reads pick their buffer from a pool provided to the kernel up front, so
+ * idle streams don't tie up any memory. Each stream has at most one
+ * request in flight; streams that want one are queued until the next
+ * submission.
+ */
+struct io_ring {
+	int                  ir_fd;
+	unsigned int        *ir_sq_head;
+	unsigned int        *ir_sq_tail;
+	unsigned int        *ir_sq_mask;
+	unsigned int        *ir_sq_array;
+	unsigned int        *ir_cq_head;
+	unsigned int        *ir_cq_tail;
+	unsigned int        *ir_cq_mask;
+	struct io_uring_sqe *ir_sqes;
+	struct io_uring_cqe *ir_cqes;
+	unsigned int         ir_sq_entries;
+	unsigned int         ir_to_submit;
+	unsigned int         ir_inflight;
+	void                *ir_ring_map;
+	size_t               ir_ring_len;
+	size_t               ir_sqes_len;
+	char                *ir_bufs;
+	uint16_t             ir_recycle[RING_NUM_BUFS];
+	unsigned int         ir_num_recycle;
+	bool                 ir_provided;
+	struct io_stream    *ir_queue;
+	struct io_stream   **ir_queue_tail;
+};
+
+static int ring_enter(struct exec_io *io, unsigned int to_submit,
+                      unsigned int min_complete, int timeout)
+{
+	struct io_uring_getevents_arg arg;
+	struct __kernel_timespec ts;
+	unsigned int flags = 0;
+	long ret;
+
+	memset(&arg, 0, sizeof(arg));
+	if (min_complete) {
+		flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+		if (timeout >= 0) {
+			ts.tv_sec = timeout / 1000;
+			ts.tv_nsec = (long long) (timeout % 1000) * 1000000;
+			arg.ts = (uint64_t) (uintptr_t) &ts;
+		}
+	}
+
+	++io->ei_stats.es_syscalls;
+	ret = syscall(__NR_io_uring_enter, io->ei_ring->ir_fd, to_submit,
+	              min_complete, flags, min_complete ? &arg : NULL,
+	              min_complete ? sizeof(arg) : 0);
+	if (ret == -1)
+		return -errno;
+
+	io->ei_ring->ir_to_submit -= (unsigned int) ret;
+	return 0;
+}
+
+static struct io_uring_sqe *ring_get_sqe(struct io_ring *ring)
+{
+	unsigned int head, tail;
+	struct io_uring_sqe *sqe;
+
+	head = __atomic_load_n(ring->ir_sq_head, __ATOMIC_ACQUIRE);
+	tail = *ring->ir_sq_tail;
+	if (tail - head >= ring->ir_sq_entries)
+		return NULL;
+
+	sqe = &ring->ir_sqes[tail & *ring->ir_sq_mask];
+	memset(sqe, 0, sizeof(*sqe));
+	ring->ir_sq_array[tail & *ring->ir_sq_mask] = tail & *ring->ir_sq_mask;
+	__atomic_store_n(ring->ir_sq_tail, tail + 1, __ATOMIC_RELEASE);
+	++ring->ir_to_submit;
+
+	return sqe;
+}
+
+static void ring_queue(struct io_stream *s)
+{
+	struct io_ring *ring = stream_io(s)->ei_ring;
+
+	if (s->is_queued)
+		return;
+
+	s->is_queued = true;
+	s->is_next_queued = NULL;
+	*ring->ir_queue_tail = s;
+	ring->ir_queue_tail = &s->is_next_queued;
+}
+
+static void ring_prep(struct io_uring_sqe *sqe, unsigned char opcode, int fd,
+                      uint64_t addr, unsigned int len, uint64_t user_data)
+{
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->addr = addr;
+	sqe->len = len;
+	sqe->user_data = user_data;
+}
+
+/* turns a queued stream into a request, %false if the ring is full */
+static bool ring_submit_stream(struct io_ring *ring, struct io_stream *s)
+{
+	struct io_uring_sqe *sqe;
+	uint64_t tag = (uint64_t) (uintptr_t) s;
+
+	if (!s->is_armed && !s->is_inflight)
+		return true;
+	if (s->is_armed && s->is_inflight)
+		return true;
+
+	if ((sqe = ring_get_sqe(ring)) == NULL)
+		return false;
+
+	if (!s->is_armed) {
+		/* whatever is in flight gets completed with -ECANCELED */
+		ring_prep(sqe, IORING_OP_ASYNC_CANCEL, -1,
+		          tag | (s->is_poll ? RING_OP_POLL : 0), 0, 0);
+		return true;
+	}
+
+	if (s->is_poll || s->is_slot == IO_SLOT_EXIT) {
+		ring_prep(sqe, IORING_OP_POLL_ADD, s->is_fd, 0, 0,
+		          tag | RING_OP_POLL);
+		sqe->poll32_events = (s->is_slot == EXEC_IO_STDIN) ?
+		                     POLLOUT : POLLIN;
+		s->is_poll = true;
+	} else if (s->is_slot == EXEC_IO_STDIN) {
+		ring_prep(sqe, IORING_OP_WRITE, s->is_fd,
+		          (uint64_t) (uintptr_t) (s->is_buf + s->is_off),
+		          (unsigned int) (s->is_len - s->is_off), tag);
+		sqe->off = (uint64_t) -1;
+		s->is_inflight_buf = s->is_buf;
+	} else {
+		ring_prep(sqe, IORING_OP_READ, s->is_fd, 0, RING_BUF_SIZE, tag);
+		sqe->off = (uint64_t) -1;
+		sqe->flags = IOSQE_BUFFER_SELECT;
+		sqe->buf_group = RING_BUF_GROUP;
+	}
+
+	s->is_inflight = true;
+	++ring->ir_inflight;
+	return true;
+}
+
+/* fills the submission ring, returns %false if it ran out of room */
+static bool ring_fill(struct io_ring *ring)
+{
+	struct io_uring_sqe *sqe;
+	struct io_stream *s;
+	uint16_t bid;
+
+	while (ring->ir_num_recycle) {
+		if ((sqe = ring_get_sqe(ring)) == NULL)
+			return false;
+
+		bid = ring->ir_recycle[--ring->ir_num_recycle];
+		ring_prep(sqe, IORING_OP_PROVIDE_BUFFERS, 1,
+		          (uint64_t) (uintptr_t) (ring->ir_bufs +
+		                                  bid * RING_BUF_SIZE),
+		          RING_BUF_SIZE, 0);
+		sqe->off = bid;
+		sqe->buf_group = RING_BUF_GROUP;
+	}
+
+	while ((s = ring->ir_queue) != NULL) {
+		if (!ring_submit_stream(ring, s))
+			return false;
+
+		ring->ir_queue = s->is_next_queued;
+		if (!ring->ir_queue)
+			ring->ir_queue_tail = &ring->ir_queue;
+		s->is_queued = false;
+	}
+
+	return true;
+}
+
+static void ring_fini(struct exec_io *io);
+
+static int ring_init(struct exec_io *io)
+{
+	struct io_uring_params params;
+	struct io_uring_sqe *sqe;
+	struct io_ring *ring;
+	size_t sq_len, cq_len;
+	char *map;
+	int err;
+
+	if ((ring = calloc(1, sizeof(*ring))) == NULL)
+		return -1;
+	ring->ir_queue_tail = &ring->ir_queue;
+	io->ei_ring = ring;
+
+	memset(&params, 0, sizeof(params));
+	params.flags = IORING_SETUP_CQSIZE;
+	params.cq_entries = RING_CQ_ENTRIES;
+
+	ring->ir_fd = (int) syscall(__NR_io_uring_setup, RING_SQ_ENTRIES,
+	                            &params);
+	if (ring->ir_fd == -1) {
+		free(ring);
+		io->ei_ring = NULL;
+		return -1;
+	}
+
+	/* completions must never get lost, timeouts come with EXT_ARG */
+	if (!(params.features & IORING_FEAT_NODROP) ||
+	    !(params.features & IORING_FEAT_EXT_ARG) ||
+	    !(params.features & IORING_FEAT_SINGLE_MMAP)) {
+		errno = ENOSYS;
+		goto fail;
+	}
+
+	sq_len = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+	cq_len = params.cq_off.cqes +
+	         params.cq_entries * sizeof(struct io_uring_cqe);
+	ring->ir_ring_len = sq_len > cq_len ? sq_len : cq_len;
+	ring->ir_sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+
+	map = mmap(NULL, ring->ir_ring_len, PROT_READ | PROT_WRITE,
+	           MAP_SHARED | MAP_POPULATE, ring->ir_fd, IORING_OFF_SQ_RING);
+	if (map == MAP_FAILED)
+		goto fail;
+	ring->ir_ring_map = map;
+
+	ring->ir_sqes = mmap(NULL, ring->ir_sqes_len, PROT_READ | PROT_WRITE,
+	                     MAP_SHARED | MAP_POPULATE, ring->ir_fd,
+	                     IORING_OFF_SQES);
+	if (ring->ir_sqes == MAP_FAILED) {
+		ring->ir_sqes = NULL;
+		goto fail;
+	}
+
+	ring->ir_sq_head  = (unsigned int *) (map + params.sq_off.head);
+	ring->ir_sq_tail  = (unsigned int *) (map + params.sq_off.tail);
+	ring->ir_sq_mask  = (unsigned int *) (map + params.sq_off.ring_mask);
+	ring->ir_sq_array = (unsigned int *) (map + params.sq_off.array);
+	ring->ir_cq_head  = (unsigned int *) (map + params.cq_off.head);
+	ring->ir_cq_tail  = (unsigned int *) (map + params.cq_off.tail);
+	ring->ir_cq_mask  = (unsigned int *) (map + params.cq_off.ring_mask);
+	ring->ir_cqes = (struct io_uring_cqe *) (map + params.cq_off.cqes);
+	ring->ir_sq_entries = params.sq_entries;
+
+	ring->ir_bufs = malloc((size_t) RING_NUM_BUFS * RING_BUF_SIZE);
+	if (!ring->ir_bufs)
+		goto fail;
+
+	/* hand the whole pool over at once, it goes out with the first run */
+	sqe = ring_get_sqe(ring);
+	ring_prep(sqe, IORING_OP_PROVIDE_BUFFERS, RING_NUM_BUFS,
+	          (uint64_t) (uintptr_t) ring->ir_bufs, RING_BUF_SIZE, 0);
+	sqe->buf_group = RING_BUF_GROUP;
+
+	return 0;
+
+fail:
+	err = errno;
+	ring_fini(io);
+	errno = err;
+	return -1;
+}
+
+static void ring_reap(struct exec_io *io);
+
+static void ring_fini(struct exec_io *io)
+{
+	struct io_ring *ring = io->ei_ring;
+	int ret;
+
+	if (!ring)
+		return;
+
+	/* buffers must not be released under the kernel's feet */
+	while (ring->ir_ring_map && ring->ir_sqes && ring->ir_inflight) {
+		(void) ring_fill(ring);
+		ret = ring_enter(io, ring->ir_to_submit, 1, -1);
+		if (ret && ret != -EINTR && ret != -EBUSY)
+			break;
+		ring_reap(io);
+	}
+
+	if (ring->ir_sqes)
+		munmap(ring->ir_sqes, ring->ir_sqes_len);
+	if (ring->ir_ring_map)
+		munmap(ring->ir_ring_map, ring->ir_ring_len);
+	close(ring->ir_fd);
+	free(ring->ir_bufs);
+	free(ring);
+	io->ei_ring = NULL;
+}
+
+static int ring_watch(struct io_stream *s)
+{
+	if (s->is_armed)
+		return 0;
+
+	s->is_armed = true;
+	ring_queue(s);
+	return 0;
+}
+
+static void ring_unwatch(struct io_stream *s)
+{
+	if (!s->is_armed)
+		return;
+
+	s->is_armed = false;
+	if (s->is_inflight)
+		ring_queue(s);
+}
+
+static void ring_complete(struct exec_io *io, struct io_stream *s,
+                          bool poll, int res, unsigned int flags)
+{
+	struct io_ring *ring = io->ei_ring;
+	uint16_t bid;
+
+	s->is_inflight = false;
+	--ring->ir_inflight;
+	++io->ei_stats.es_events;
+
+	if (s->is_slot == EXEC_IO_STDIN && !poll) {
+		if (s->is_inflight_buf != s->is_buf)
+			free(s->is_inflight_buf);
+		s->is_inflight_buf = NULL;
+	}
+
+	if (!poll && (flags & IORING_CQE_F_BUFFER)) {
+		bid = (uint16_t) (flags >> IORING_CQE_BUFFER_SHIFT);
+		if (res > 0 && s->is_armed)
+			deliver_output(s, ring->ir_bufs + bid * RING_BUF_SIZE,
+			               (size_t) res);
+		ring->ir_recycle[ring->ir_num_recycle++] = bid;
+	}
+
+	if (!s->is_armed || s->is_owner->ep_removed || res == -ECANCELED)
+		return;
+
+	if (poll) {
+		if (s->is_slot == IO_SLOT_EXIT) {
+			proc_exited(s->is_owner);
+			return;
+		}
+		/* ready now, go for the data */
+		s->is_poll = false;
+	} else if (res == -EAGAIN || res == -EINTR) {
+		/* a nonblocking descriptor, wait for it first */
+		s->is_poll = (res == -EAGAIN);
+	} else if (res == -ENOBUFS) {
+		/* the pool is drained, retry once buffers have come back */
+	} else if (s->is_slot == EXEC_IO_STDIN) {
+		if (res < 0) {
+			stdin_finish(s->is_owner, -res);
+			return;
+		}
+		input_written(s, (size_t) res);
+		if (!s->is_armed)
+			return;
+	} else if (res <= 0) {
+		output_done(s);
+		return;
+	}
+
+	ring_queue(s);
+}
+
+static void ring_reap(struct exec_io *io)
+{
+	struct io_ring *ring = io->ei_ring;
+	struct io_uring_cqe *cqe;
+	unsigned int head, tail;
+	uint64_t tag;
+
+	head = *ring->ir_cq_head;
+	for (;;) {
+		tail = __atomic_load_n(ring->ir_cq_tail, __ATOMIC_ACQUIRE);
+		if (head == tail)
+			break;
+
+		for (; head != tail; ++head) {
+			cqe = &ring->ir_cqes[head & *ring->ir_cq_mask];
+			tag = cqe->user_data;
+
+			/* buffer hand-overs and cancellations */
+			if (!tag)
+				continue;
+
+			ring_complete(io, (struct io_stream *) (uintptr_t)
+			              (tag & ~RING_OP_POLL), tag & RING_OP_POLL,
+			              cqe->res, cqe->flags);
+		}
+
+		__atomic_store_n(ring->ir_cq_head, head, __ATOMIC_RELEASE);
+	}
+}
+
+static int ring_run(struct exec_io *io, int timeout)
+{
+	struct io_ring *ring = io->ei_ring;
+	int ret;
+
+	/* push out everything that doesn't fit in one go */
+	while (!ring_fill(ring)) {
+		ret = ring_enter(io, ring->ir_to_submit, 0, 0);
+		if (ret == -EBUSY)
+			break;
+		if (ret && ret != -EINTR)
+			return ret;
+	}
+
+	/* nothing in flight, nothing to wait for */
+	if (!ring->ir_inflight && !ring->ir_to_submit)
+		return 0;
+
+	ret = ring_enter(io, ring->ir_to_submit, timeout ? 1 : 0, timeout);
+	if (ret && ret != -ETIME && ret != -EINTR && ret != -EBUSY)
+		return ret;
+
+	ring_reap(io);
+	return 0;
+}
+
+static const struct io_backend ring_backend = {
+	.ib_type    = EXEC_IO_BACKEND_URING,
+	.ib_init    = ring_init,
+	.ib_fini    = ring_fini,
+	.ib_watch   = ring_watch,
+	.ib_unwatch = ring_unwatch,
+	.ib_run     = ring_run,
+};
+#endif
+
+struct exec_io *exec_io_new_backend(enum exec_io_backend backend)
+{
+	struct exec_io *io;
+
+	if ((io = calloc(1, sizeof(*io))) == NULL)
+		return NULL;
+
+	io->ei_epfd = -1;
+
+#ifdef HAVE_IO_URING
+	if (backend == EXEC_IO_BACKEND_URING) {
+		io->ei_backend = &ring_backend;
+		if (ring_init(io) == 0)
+			return io;
+	}
+#else
+	(void) backend;
+#endif
+
+	/* no io_uring here, or it's not up to the job */
+	io->ei_backend = &epoll_backend;
+	if (epoll_init(io)) {
+		free(io);
+		return NULL;
+	}
+
+	return io;
+}
+
+struct exec_io *exec_io_new(void)
+{
+	return exec_io_new_backend(EXEC_IO_BACKEND_DEFAULT);
+}
+
+enum exec_io_backend exec_io_get_backend(const struct exec_io *io)
+{
+	return io->ei_backend->ib_type;
+}
+
+void exec_io_free(struct exec_io *io)
+{
+	if (!io)
+		return;
+
+	while (io->ei_procs)
+		exec_io_remove(io->ei_procs);
+
+	io->ei_backend->ib_fini(io);
+	bury_dead(io);
+	free(io);
+}
+
+struct exec_io_proc *exec_io_add(struct exec_io *io, struct process_info *proc,
+                                 const struct exec_io_ops *ops, void *arg)
+{
+	struct exec_io_proc *p;
+	struct io_stream *s;
+	int fds[IO_NUM_SLOTS];
+	bool uring;
+	unsigned int i;
+	int err;
+
+	if ((p = calloc(1, sizeof(*p))) == NULL)
+		return NULL;
+
+	p->ep_io = io;
+	p->ep_proc = proc;
+	p->ep_ops = ops;
+	p->ep_arg = arg;
+
+	fds[EXEC_IO_STDIN]  = proc->pi_stdin;
+	fds[EXEC_IO_STDOUT] = proc->pi_stdout;
+	fds[EXEC_IO_STDERR] = proc->pi_stderr;
+	fds[IO_SLOT_EXIT]   = (ops && ops->eo_exit) ? proc->pi_pidfd : -1;
+
+	/* io_uring copes with either mode, epoll needs nonblocking streams */
+	uring = (io->ei_backend->ib_type == EXEC_IO_BACKEND_URING);
+
+	for (i = 0; i < IO_NUM_SLOTS; ++i) {
+		s = &p->ep_streams[i];
+		s->is_owner = p;
+		s->is_slot = i;
+		s->is_fd = fds[i];
+		s->is_open = (fds[i] >= 0);
+
+		if (!s->is_open)
+			continue;
+
+		if (!uring && i != IO_SLOT_EXIT && !proc->pi_nonblock) {
+			io->ei_stats.es_syscalls += 2;
+			if (fd_make_nonblocking(s->is_fd))
+				goto fail;
+		}
+
+		/* stdin is watched once there's something to write */
+		if (i != EXEC_IO_STDIN && io_watch(s))
+			goto fail;
+	}
+
+	if (!uring)
+		proc->pi_nonblock = true;
+
+	p->ep_next = io->ei_procs;
+	if (io->ei_procs)
+		io->ei_procs->ep_prev = p;
+	io->ei_procs = p;
+	proc_update_active(p);
+
+	return p;
+
+fail:
+	err = errno;
+	for (i = 0; i < IO_NUM_SLOTS; ++i)
+		io_unwatch(&p->ep_streams[i]);
+	p->ep_removed = true;
+	p->ep_next = io->ei_graveyard;
+	io->ei_graveyard = p;
+	bury_dead(io);
+	errno = err;
+	return NULL;
+}
+
+void exec_io_remove(struct exec_io_proc *p)
+{
+	struct exec_io *io = p->ep_io;
+	unsigned int i;
+
+	if (p->ep_removed)
+		return;
+
+	for (i = 0; i < IO_NUM_SLOTS; ++i)
+		io_unwatch(&p->ep_streams[i]);
+
+	if (p->ep_prev)
+		p->ep_prev->ep_next = p->ep_next;
+	else
+		io->ei_procs = p->ep_next;
+	if (p->ep_next)
+		p->ep_next->ep_prev = p->ep_prev;
+
+	/* events for it may still be pending in the current batch */
+	p->ep_removed = true;
+	proc_update_active(p);
+	p->ep_next = io->ei_graveyard;
+	io->ei_graveyard = p;
+
+	if (!io->ei_running)
+		bury_dead(io);
+}
+
+int exec_io_write(struct exec_io_proc *p, const void *data, size_t len)
+{
+	struct io_stream *s = &p->ep_streams[EXEC_IO_STDIN];
+
+	if (!s->is_open || p->ep_close_stdin)
+		return -EPIPE;
+
+	if (!len)
+		return 0;
+
+	if (stream_reserve(s, len))
+		return -errno;
+
+	memcpy(s->is_buf + s->is_len, data, len);
+	s->is_len += len;
+	proc_update_active(p);
+
+	if (io_watch(s))
+		return -errno;
+
+	return 0;
+}
+
+void exec_io_close_stdin(struct exec_io_proc *p)
+{
+	struct io_stream *s = &p->ep_streams[EXEC_IO_STDIN];
+
+	if (!s->is_open)
+		return;
+
+	p->ep_close_stdin = true;
+	if (s->is_len == s->is_off)
+		stdin_finish(p, 0);
+	else
+		proc_update_active(p);
+}
+
+const void *exec_io_captured(const struct exec_io_proc *p,
+                             enum exec_io_stream stream, size_t *len)
+{
+	const struct io_stream *s;
+
+	*len = 0;
+	if (stream != EXEC_IO_STDOUT && stream != EXEC_IO_STDERR)
+		return NULL;
+
+	s = &p->ep_streams[stream];
+	*len = s->is_len;
+	return s->is_len ? s->is_buf : NULL;
+}
+
+int exec_io_error(const struct exec_io_proc *p, enum exec_io_stream stream)
+{
+	if (stream != EXEC_IO_STDOUT && stream != EXEC_IO_STDERR)
+		return -EINVAL;
+
+	return p->ep_streams[stream].is_error;
+}
+
+bool exec_io_done(const struct exec_io_proc *p)
+{
+	return !p->ep_streams[EXEC_IO_STDOUT].is_open &&
+	       !p->ep_streams[EXEC_IO_STDERR].is_open &&
+	       !stdin_active(p);
+}
+
+bool exec_io_exited(const struct exec_io_proc *p)
+{
+	return p->ep_exited;
+}
+
+struct process_info *exec_io_process(const struct exec_io_proc *p)
+{
+	return p->ep_proc;
+}
+
+void exec_io_stats(const struct exec_io *io, struct exec_io_stats *stats)
+{
+	*stats = io->ei_stats;
+}
+
+int exec_io_run(struct exec_io *io, int timeout)
+{
+	int ret;
+
+	io->ei_running = true;
+	ret = io->ei_backend->ib_run(io, timeout);
+	io->ei_running = false;
+
+	bury_dead(io);
+	return ret ? ret : (int) io->ei_active;
+}
+#else
+struct exec_io *exec_io_new_backend(enum exec_io_backend backend)
+{
+	(void) backend;
+	errno = ENOSYS;
+	return NULL;
+}
+
+struct exec_io *exec_io_new(void)
+{
+	errno = ENOSYS;
+	return NULL;
+}
+
+enum exec_io_backend exec_io_get_backend(const struct exec_io *io)
+{
+	(void) io;
+	return EXEC_IO_BACKEND_DEFAULT;
+}
+
+void exec_io_free(struct exec_io *io)
+{
+	(void) io;
+}
+
+struct exec_io_proc *exec_io_add(struct exec_io *io, struct process_info *proc,
+                                 const struct exec_io_ops *ops, void *arg)
+{
+	(void) io;
+	(void) proc;
+	(void) ops;
+	(void) arg;
+	errno = ENOSYS;
+	return NULL;
+}
+
+void exec_io_remove(struct exec_io_proc *p)
+{
+	(void) p;
+}
+
+int exec_io_write(struct exec_io_proc *p, const void *data, size_t len)
+{
+	(void) p;
+	(void) data;
+	(void) len;
+	return -ENOSYS;
+}
+
+void exec_io_close_stdin(struct exec_io_proc *p)
+{
+	(void) p;
+}
+
+const void *exec_io_captured(const struct exec_io_proc *p,
+                             enum exec_io_stream stream, size_t *len)
+{
+	(void) p;
+	(void) stream;
+	*len = 0;
+	return NULL;
+}
+
+int exec_io_error(const struct exec_io_proc *p, enum exec_io_stream stream)
+{
+	(void) p;
+	(void) stream;
+	return -ENOSYS;
+}
+
+bool exec_io_done(const struct exec_io_proc *p)
+{
+	(void) p;
+	return true;
+}
+
+bool exec_io_exited(const struct exec_io_proc *p)
+{
+	(void) p;
+	return true;
+}
+
+struct process_info *exec_io_process(const struct exec_io_proc *p)
+{
+	(void) p;
+	return NULL;
+}
+
+void exec_io_stats(const struct exec_io *io, struct exec_io_stats *stats)
+{
+	(void) io;
+	memset(stats, 0, sizeof(*stats));
+}
+
+int exec_io_run(struct exec_io *io, int timeout)
+{
+	(void) io;
+	(void) timeout;
+	return -ENOSYS;
+}
+#endif
@@ -0,0 +1,280 @@
+/*
+ * =============================================================================
+ *
+ *       Filename:  ioengine.h
+ *
+ *    Description:  Event driven I/O on the standard streams of many
+ *                  child processes
+ *
+ *        Version:  1.0
+ *        Created:  10/17/2026 12:05:14 PM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Oliver Lorenz (ol), olli@olorenz.org
+ *
+ * =============================================================================
+ */
+
+#ifndef PROCEXEC_IOENGINE_H
+#define PROCEXEC_IOENGINE_H
+
+#include <stdint.h>
+#include "exec.h"
+
+
+/**
+ * enum exec_io_stream - standard stream of a child process
+ * @EXEC_IO_STDIN:		the child's standard input
+ * @EXEC_IO_STDOUT:		the child's standard output
+ * @EXEC_IO_STDERR:		the child's standard error
+ */
+enum exec_io_stream {
+	EXEC_IO_STDIN,
+	EXEC_IO_STDOUT,
+	EXEC_IO_STDERR
+};
+
+
+/**
+ * enum exec_io_backend - how an I/O engine talks to the kernel
+ * @EXEC_IO_BACKEND_DEFAULT:	currently %EXEC_IO_BACKEND_EPOLL
+ * @EXEC_IO_BACKEND_EPOLL:	epoll(7) for readiness, one read(2) or
+ *				write(2) per ready stream
+ * @EXEC_IO_BACKEND_URING:	io_uring(7), all reads, writes and exit waits
+ *				share one submission ring; falls back to
+ *				%EXEC_IO_BACKEND_EPOLL if the kernel doesn't
+ *				offer it
+ */
+enum exec_io_backend {
+	EXEC_IO_BACKEND_DEFAULT,
+	EXEC_IO_BACKEND_EPOLL,
+	EXEC_IO_BACKEND_URING
+};
+
+
+/**
+ * struct exec_io_stats - I/O engine counters
+ * @es_syscalls:		system calls issued by the engine
+ * @es_events:			readiness events or completions handled
+ * @es_bytes_read:		bytes read from standard output and standard
+ *				error
+ * @es_bytes_written:		bytes written to standard input
+ */
+struct exec_io_stats {
+	uint64_t es_syscalls;
+	uint64_t es_events;
+	uint64_t es_bytes_read;
+	uint64_t es_bytes_written;
+};
+
+
+struct exec_io;
+struct exec_io_proc;
+
+
+/**
+ * struct exec_io_ops - per-child callbacks
+ * @eo_output:			called with data read from @stream, a @len of
+ *                              %0 indicates end of file. If %NULL, output is
+ *                              collected in per-stream buffers instead, see
+ *                              exec_io_captured()
+ * @eo_input_done:		called once all data queued with exec_io_write()
+ *                              has been written and standard input has been
+ *                              closed, or writing failed with @error set
+ * @eo_exit:			if set, the engine watches the child's pidfd
+ *				and calls this once the child has exited. The
+ *				child is not reaped, wait_for_child() returns
+ *				right away afterwards
+ */
+struct exec_io_ops {
+	void (*eo_output)(struct exec_io_proc *p, enum exec_io_stream stream,
+	                  const void *data, size_t len, void *arg);
+	void (*eo_input_done)(struct exec_io_proc *p, int error, void *arg);
+	void (*eo_exit)(struct exec_io_proc *p, void *arg);
+};
+
+
+/**
+ * exec_io_new - create an I/O engine
+ *
+ * The engine drives the standard streams of any number of children from
+ * a single epoll(7) loop. There are no limits on descriptor numbers and
+ * the cost of a loop iteration only depends on the number of streams
+ * that are actually ready. See exec_io_new_backend() for io_uring(7).
+ * NOTE: writing to a child that has exited raises SIGPIPE, callers
+ *       should ignore it.
+ *
+ * @return: the new engine, or %NULL with @errno set.
+ */
+extern struct exec_io *exec_io_new(void);
+
+
+/**
+ * exec_io_new_backend - create an I/O engine with a specific backend
+ * @backend:			the backend to use
+ *
+ * Like exec_io_new(). io_uring support is probed at runtime, use
+ * exec_io_get_backend() to learn what the engine ended up with. With
+ * %EXEC_IO_BACKEND_URING, descriptors are used in whatever mode they are
+ * in, nonblocking ones are polled before each transfer.
+ *
+ * @return: the new engine, or %NULL with @errno set.
+ */
+extern struct exec_io *exec_io_new_backend(enum exec_io_backend backend);
+
+
+/**
+ * exec_io_get_backend - get the backend an I/O engine is using
+ * @io:				the engine
+ */
+extern enum exec_io_backend exec_io_get_backend(const struct exec_io *io);
+
+
+/**
+ * exec_io_free - destroy an I/O engine
+ * @io:				engine to destroy, may be %NULL
+ *
+ * All children still registered are removed, see exec_io_remove().
+ */
+extern void exec_io_free(struct exec_io *io);
+
+
+/**
+ * exec_io_add - register a child's standard streams
+ * @io:				the engine
+ * @proc:			the child, as filled by exec_process()
+ * @ops:			callbacks, may be %NULL to capture all output
+ * @arg:			passed to the callbacks
+ *
+ * @proc is referenced, not copied, and must stay valid until the child
+ * has been removed. The child's standard output and standard error are
+ * read as soon as data arrives, its standard input is made non-blocking
+ * and written to whenever there's data queued by exec_io_write().
+ *
+ * @return: a handle for the child, or %NULL with @errno set.
+ */
+extern struct exec_io_proc *exec_io_add(struct exec_io *io,
+                                        struct process_info *proc,
+                                        const struct exec_io_ops *ops,
+                                        void *arg);
+
+
+/**
+ * exec_io_remove - unregister a child
+ * @p:				handle returned by exec_io_add()
+ *
+ * Captured output is released. The child's descriptors are left open,
+ * except for standard input if it has been closed by exec_io_close_stdin().
+ */
+extern void exec_io_remove(struct exec_io_proc *p);
+
+
+/**
+ * exec_io_write - queue data for a child's standard input
+ * @p:				handle returned by exec_io_add()
+ * @data:			the data, copied by the engine
+ * @len:			size of @data
+ *
+ * @return: On success, %0 is returned, otherwise a negative error code.
+ *          %-EPIPE if standard input has been closed already.
+ */
+extern int exec_io_write(struct exec_io_proc *p, const void *data,
+                         size_t len);
+
+
+/**
+ * exec_io_close_stdin - close a child's standard input
+ * @p:				handle returned by exec_io_add()
+ *
+ * Standard input is closed as soon as all queued data has been written,
+ * @pi_stdin of the child's struct process_info is set to %-1 then.
+ */
+extern void exec_io_close_stdin(struct exec_io_proc *p);
+
+
+/**
+ * exec_io_captured - get output collected for a child
+ * @p:				handle returned by exec_io_add()
+ * @stream:			%EXEC_IO_STDOUT or %EXEC_IO_STDERR
+ * @len:			set to the number of bytes collected
+ *
+ * Only meaningful if the child has been registered without @eo_output.
+ * The buffer remains valid until the next call to exec_io_run() or the
+ * child is removed. If memory ran out, the data is cut short, see
+ * exec_io_error().
+ *
+ * @return: the collected data, %NULL if there is none.
+ */
+extern const void *exec_io_captured(const struct exec_io_proc *p,
+                                    enum exec_io_stream stream, size_t *len);
+
+
+/**
+ * exec_io_error - check whether collected output is complete
+ * @p:				handle returned by exec_io_add()
+ * @stream:			%EXEC_IO_STDOUT or %EXEC_IO_STDERR
+ *
+ * Output that doesn't fit into memory any more is read and thrown away,
+ * together with everything after it, so the child doesn't block on a
+ * full pipe.
+ *
+ * @return: %0 if everything read has been collected, otherwise a negative
+ *          error code, %-ENOMEM if output has been dropped.
+ */
+extern int exec_io_error(const struct exec_io_proc *p,
+                         enum exec_io_stream stream);
+
+
+/**
+ * exec_io_done - check whether a child's streams have been drained
+ * @p:				handle returned by exec_io_add()
+ *
+ * @return: %true once end of file has been seen on standard output and
+ *          standard error and no input is waiting to be written.
+ */
+extern bool exec_io_done(const struct exec_io_proc *p);
+
+
+/**
+ * exec_io_exited - check whether a child has exited
+ * @p:				handle returned by exec_io_add()
+ *
+ * Only meaningful if the child has been registered with @eo_exit.
+ *
+ * @return: %true once @eo_exit has been called.
+ */
+extern bool exec_io_exited(const struct exec_io_proc *p);
+
+
+/**
+ * exec_io_process - get the child a handle refers to
+ * @p:				handle returned by exec_io_add()
+ */
+extern struct process_info *exec_io_process(const struct exec_io_proc *p);
+
+
+/**
+ * exec_io_stats - get the counters of an I/O engine
+ * @io:				the engine
+ * @stats:			filled with the counters
+ */
+extern void exec_io_stats(const struct exec_io *io,
+                          struct exec_io_stats *stats);
+
+
+/**
+ * exec_io_run - run one iteration of the event loop
+ * @io:				the engine
+ * @timeout:			time to wait in milliseconds, %-1 to wait
+ *                              forever, %0 to return immediately
+ *
+ * Standard input only counts as active while there is data waiting to be
+ * written or a close pending, an exit watched for @eo_exit until it has
+ * happened.
+ *
+ * @return: the number of streams still active, or a negative error code.
+ */
+extern int exec_io_run(struct exec_io *io, int timeout);
+
+#endif
@@ -16,13 +16,27 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <pwd.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdbool.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/wait.h>
+#include "bufio.h"
 #include "exec.h"
+#include "ioengine.h"
+#include "pool.h"
+#include "records.h"
+#include "reaper.h"
+#include "timing.h"
 
 #define SCRIPT_DIR		PREFIX"/scripts"
 #define BUFFER_SIZE		4096U
@@ -271,8 +285,8 @@ static int t15(void)
 	}
 
 done:
-	kill(proc.pi_pid, SIGTERM);
-	wait_for_child(&proc, true);
+	/* bc waits for more input */
+	wait_for_child_timeout(&proc, true, 0, 1000);
 	return proc.pi_retval;
 }
 
@@ -322,34 +336,1967 @@ static int t16(void)
 	}
 
 done:
-	kill(proc.pi_pid, SIGTERM);
+	/* bc waits for more input */
+	wait_for_child_timeout(&proc, true, 0, 1000);
+	return proc.pi_retval;
+}
+
+static int t17(void)
+{
+	char *argv[] = { SCRIPT_DIR"/ret14.sh", NULL };
+	struct exec_attr attr = { .ea_backend = EXEC_BACKEND_FORK };
+
+	return exec_process_attr(NULL, true, NULL, USERINFO_TYPE_NONE,
+	                         argv[0], argv, &attr);
+}
+
+static int t18(void)
+{
+	int ret;
+	char *argv[] = { "/noent", NULL };
+	struct exec_attr attr = { .ea_backend = EXEC_BACKEND_POSIX_SPAWN };
+	struct process_info proc;
+
+	ret = exec_process_attr(&proc, false, NULL, USERINFO_TYPE_NONE,
+	                        argv[0], argv, &attr);
+	if (ret)
+		return ret;
+
 	wait_for_child(&proc, true);
 	return proc.pi_retval;
 }
 
-const struct testcase testcases[] = {
-	/* wait tests */
-	{ t0,	    0,	true },
-	{ t1,	 3584,	true },
-	{ t2,	- 257,	true },
-	{ t3,	   13,	true },
-	{ t4,	  134,	true },
-	{ t5,	- 256,	true },
-	{ t6,	- 256,	true },
+static int t19(void)
+{
+	int ret;
+	char buffer[BUFFER_SIZE];
+	char *argv[] = { "echo", "posix_spawn", NULL };
+	struct exec_attr attr = { .ea_backend = EXEC_BACKEND_POSIX_SPAWN };
+	struct process_info proc;
 
-	/* no-wait tests */
-	{ t7,	    0,	true },
-	{ t8,	 3584,	true },
-	{ t9,	- 257,	true },
-	{ t10,	   13,	true },
-	{ t11,	  134,	true },
-	{ t12,	- 256,	true },
-	{ t13,	- 256,	true },
+	ret = exec_process_attr(&proc, false, NULL, USERINFO_TYPE_NONE,
+	                        argv[0], argv, &attr);
+	if (ret)
+		return ret;
 
-	/* random tests */
-	{ t14,	  512,	true },
-	{ t15,	   15,	true },
-	{ t16,	   15,	true }
+	memset(buffer, 0, sizeof(buffer));
+	ret = (int) timed_read(proc.pi_stdout, buffer, sizeof(buffer) - 1, 2);
+	if (ret > 0)
+		fprintf(stderr, "STDOUT: %s", buffer);
+
+	wait_for_child(&proc, true);
+	return proc.pi_retval;
+}
+
+static int t20(void)
+{
+	uid_t me = geteuid();
+	char *argv[] = { "/noent", NULL };
+	struct exec_attr attr = { .ea_backend = EXEC_BACKEND_VFORK };
+
+	return exec_process_attr(NULL, true, &me, USERINFO_TYPE_UID,
+	                         argv[0], argv, &attr);
+}
+
+static int t21(void)
+{
+	int ret, fd;
+	char script[64];
+	char *argv[] = { "/bin/sh", "-c", script, NULL };
+	struct exec_attr attr;
+
+	fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return -errno;
+
+	/* the redirection fails unless fd has been inherited */
+	snprintf(script, sizeof(script), ": <&%d", fd);
+
+	memset(&attr, 0, sizeof(attr));
+	attr.ea_inherit_fds = &fd;
+	attr.ea_num_inherit_fds = 1;
+
+	ret = exec_process_attr(NULL, true, NULL, USERINFO_TYPE_NONE,
+	                        argv[0], argv, &attr);
+	close(fd);
+	return ret;
+}
+
+static int t22(void)
+{
+	int ret, fd;
+	char script[64];
+	char *argv[] = { "/bin/sh", "-c", script, NULL };
+
+	fd = open("/dev/null", O_RDONLY);
+	if (fd == -1)
+		return -errno;
+
+	snprintf(script, sizeof(script), ": <&%d 2>/dev/null", fd);
+
+	ret = exec_process_p(NULL, true, NULL, USERINFO_TYPE_NONE,
+	                     argv[0], argv);
+	close(fd);
+	return ret;
+}
+
+static int t23(void)
+{
+	int ret;
+
+	ret = exec_server_start();
+	if (ret)
+		return ret;
+
+	ret = exec_process(NULL, true, NULL, USERINFO_TYPE_NONE,
+	                   SCRIPT_DIR"/ret14.sh", NULL);
+	(void) exec_server_stop();
+	return ret;
+}
+
+static int t24(void)
+{
+	int ret;
+	char buffer[BUFFER_SIZE];
+	struct process_info proc;
+
+	ret = exec_server_start();
+	if (ret)
+		return ret;
+
+	ret = exec_process(&proc, false, NULL, USERINFO_TYPE_NONE,
+	                   "/bin/ls", "-la", "/noent", NULL);
+	if (ret)
+		goto out;
+
+	memset(buffer, 0, sizeof(buffer));
+	ret = (int) timed_read(proc.pi_stderr, buffer, sizeof(buffer) - 1, 2);
+	if (ret > 0)
+		fprintf(stderr, "STDERR: %s", buffer);
+
+	wait_for_child(&proc, true);
+	ret = proc.pi_retval;
+out:
+	(void) exec_server_stop();
+	return ret;
+}
+
+static int t25(void)
+{
+	int ret;
+	const char *user = "root";
+	struct process_info proc;
+
+	ret = exec_server_start();
+	if (ret)
+		return ret;
+
+	ret = exec_process(&proc, false, user, USERINFO_TYPE_NAME,
+	                   "/noent", NULL);
+	if (!ret) {
+		wait_for_child(&proc, true);
+		ret = proc.pi_retval;
+	}
+
+	(void) exec_server_stop();
+	return ret;
+}
+
+static int t26(void)
+{
+	int ret;
+	unsigned int i;
+	char *argv0[] = { SCRIPT_DIR"/ret14.sh", NULL };
+	char *argv1[] = { "/noent", NULL };
+	char *argv2[] = { SCRIPT_DIR"/ret0.sh", NULL };
+	struct exec_attr attr = { .ea_backend = EXEC_BACKEND_FORK };
+	struct exec_cmd cmds[3];
+	struct process_info procs[3];
+
+	memset(cmds, 0, sizeof(cmds));
+	cmds[0].ec_cmd = argv0[0];
+	cmds[0].ec_argv = argv0;
+	cmds[0].ec_attr = &attr;
+	cmds[1].ec_cmd = argv1[0];
+	cmds[1].ec_argv = argv1;
+	cmds[2].ec_cmd = argv2[0];
+	cmds[2].ec_argv = argv2;
+
+	ret = exec_process_batch(cmds, procs, ARRAY_SIZE(cmds));
+	if (ret < 0)
+		return ret;
+
+	for (i = 0; i < ARRAY_SIZE(procs); ++i) {
+		if (!cmds[i].ec_result)
+			wait_for_child(&procs[i], true);
+	}
+
+	if (ret != 2 || cmds[1].ec_result != -257 || procs[2].pi_retval)
+		return -EPROTO;
+
+	return procs[0].pi_retval;
+}
+
+static int t27(void)
+{
+	int ret, i, started;
+	unsigned int left;
+	struct exec_reaper *reaper;
+	struct process_info procs[3];
+	struct process_info *done[3];
+	static const char *const cmds[] = {
+		SCRIPT_DIR"/ret0.sh",
+		SCRIPT_DIR"/ret14.sh",
+		SCRIPT_DIR"/sigPipe.sh"
+	};
+
+	if ((reaper = exec_reaper_new()) == NULL)
+		return -errno;
+
+	for (started = 0; started < 3; ++started) {
+		ret = exec_process(&procs[started], false, NULL,
+		                   USERINFO_TYPE_NONE, cmds[started], NULL);
+		if (ret)
+			goto out;
+
+		ret = exec_reaper_add(reaper, &procs[started]);
+		if (ret) {
+			++started;
+			goto out;
+		}
+	}
+
+	left = 3;
+	while (left) {
+		ret = exec_reaper_wait(reaper, done, ARRAY_SIZE(done), 5000);
+		if (ret <= 0) {
+			ret = ret ? ret : -ETIMEDOUT;
+			goto out;
+		}
+
+		for (i = 0; i < ret; ++i)
+			fprintf(stderr, "REAPED: %d status %d\n",
+			        (int) done[i]->pi_pid, done[i]->pi_retval);
+		left -= (unsigned int) ret;
+	}
+
+	ret = procs[1].pi_retval;
+out:
+	for (i = 0; i < started; ++i) {
+		close(procs[i].pi_stdin);
+		close(procs[i].pi_stdout);
+		close(procs[i].pi_stderr);
+	}
+	exec_reaper_free(reaper);
+	return ret;
+}
+
+static int t28(void)
+{
+	int ret, i, started;
+	bool busy;
+	size_t len;
+	const char *out;
+	char line[32];
+	struct exec_io *io;
+	struct exec_io_proc *handles[3];
+	struct process_info procs[3];
+
+	if ((io = exec_io_new()) == NULL)
+		return -errno;
+
+	/* the engine needs writes to a dead child to fail with EPIPE */
+	signal(SIGPIPE, SIG_IGN);
+
+	for (started = 0; started < 3; ++started) {
+		ret = exec_process(&procs[started], false, NULL,
+		                   USERINFO_TYPE_NONE, "/bin/cat", NULL);
+		if (ret)
+			goto out;
+
+		handles[started] = exec_io_add(io, &procs[started], NULL, NULL);
+		if (!handles[started]) {
+			ret = -errno;
+			++started;
+			goto out;
+		}
+
+		snprintf(line, sizeof(line), "hello from cat %d\n", started);
+		ret = exec_io_write(handles[started], line, strlen(line));
+		if (ret) {
+			++started;
+			goto out;
+		}
+		exec_io_close_stdin(handles[started]);
+	}
+
+	do {
+		ret = exec_io_run(io, 5000);
+		if (ret < 0)
+			goto out;
+
+		busy = false;
+		for (i = 0; i < started; ++i)
+			busy |= !exec_io_done(handles[i]);
+	} while (busy);
+
+	ret = 0;
+	for (i = 0; i < started; ++i) {
+		out = exec_io_captured(handles[i], EXEC_IO_STDOUT, &len);
+		fprintf(stderr, "CAPTURED: %.*s", (int) len, out ? out : "");
+		ret |= exec_io_error(handles[i], EXEC_IO_STDOUT);
+	}
+out:
+	exec_io_free(io);
+	for (i = 0; i < started; ++i) {
+		ret |= wait_for_child(&procs[i], true);
+		ret |= procs[i].pi_retval;
+	}
+	signal(SIGPIPE, SIG_DFL);
+	return ret;
+}
+
+static int t29(void)
+{
+	int ret;
+	char buf[16];
+	ssize_t count;
+	struct exec_attr attr;
+	struct process_info proc;
+	char *const argv[] = { "/bin/cat", NULL };
+
+	memset(&attr, 0, sizeof(attr));
+	attr.ea_nonblock = true;
+
+	ret = exec_process_attr(&proc, false, NULL, USERINFO_TYPE_NONE,
+	                        argv[0], argv, &attr);
+	if (ret)
+		return ret;
+
+	if (!proc.pi_nonblock ||
+	    !(fcntl(proc.pi_stdin, F_GETFL) & O_NONBLOCK)) {
+		ret = -EINVAL;
+		goto out;
+	}
+
+	count = timed_write_stream(proc.pi_stdin, "stream\n", 7, 5);
+	if (count == 7)
+		count = timed_read_stream(proc.pi_stdout, buf, 7, 5);
+	if (count != 7) {
+		ret = -EIO;
+		goto out;
+	}
+	fprintf(stderr, "STREAM: %.*s", (int) count, buf);
+
+	/* leaving stream mode hands back blocking descriptors */
+	ret = exec_stream_mode(&proc, false);
+	if (!ret && (fcntl(proc.pi_stdout, F_GETFL) & O_NONBLOCK))
+		ret = -EINVAL;
+
+out:
+	close(proc.pi_stdin);
+	proc.pi_stdin = -1;
+	ret |= wait_for_child(&proc, true);
+	return ret ? ret : proc.pi_retval;
+}
+
+static int t30(void)
+{
+	int ret;
+	char buf[100];
+	ssize_t count;
+	struct timespec start, end;
+	struct process_info proc;
+	char *const argv[] = {
+		"/bin/sh", "-c", "while :; do printf x; sleep 0.1; done", NULL
+	};
+
+	ret = exec_process_attr(&proc, false, NULL, USERINFO_TYPE_NONE,
+	                        argv[0], argv, NULL);
+	if (ret)
+		return ret;
+
+	/* the child trickles forever, the budget has to end it anyway */
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	count = timed_read_budget(proc.pi_stdout, buf, sizeof(buf),
+	                          350 * 1000 * 1000);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	fprintf(stderr, "BUDGET: %zd bytes in %ld ms\n", count,
+	        (long) (end.tv_sec - start.tv_sec) * 1000 +
+	        (end.tv_nsec - start.tv_nsec) / 1000000);
+
+	if (count <= 0 || (size_t) count == sizeof(buf) ||
+	    end.tv_sec - start.tv_sec > 1)
+		ret = -ETIMEDOUT;
+
+	kill(proc.pi_pid, SIGKILL);
+	(void) wait_for_child(&proc, true);
+	return ret;
+}
+
+static int t31(void)
+{
+	int ret;
+	size_t i, out_size, err_size;
+	char *input, *output, *errors;
+	struct process_info proc;
+	const size_t size = 4 * 1024 * 1024;
+	char *const argv[] = { "/bin/sh", "-c", "cat; echo done >&2", NULL };
+
+	if ((input = malloc(size)) == NULL)
+		return -ENOMEM;
+	for (i = 0; i < size; ++i)
+		input[i] = (char) ('a' + i % 26);
+
+	ret = exec_process_attr(&proc, false, NULL, USERINFO_TYPE_NONE,
+	                        argv[0], argv, NULL);
+	if (ret)
+		goto out;
+
+	/* way more than any pipe holds, in both directions */
+	ret = exec_communicate(&proc, input, size, &output, &out_size,
+	                       &errors, &err_size, NULL);
+	if (ret)
+		goto out;
+
+	fprintf(stderr, "COMMUNICATE: %zu bytes out, stderr %s", out_size,
+	        errors);
+	if (out_size != size || memcmp(input, output, size))
+		ret = -EIO;
+	else
+		ret = proc.pi_retval;
+
+	free(output);
+	free(errors);
+out:
+	free(input);
+	return ret;
+}
+
+static int t32(void)
+{
+	int ret, out_fd, err_fd;
+	uint64_t out_bytes, err_bytes;
+	struct process_info proc;
+	char out_path[] = "/tmp/exec_capture_XXXXXX";
+	char *const argv[] = {
+		"/bin/sh", "-c",
+		"head -c 3000000 /dev/zero; echo oops >&2", NULL
+	};
+
+	if ((out_fd = mkstemp(out_path)) == -1)
+		return -errno;
+	unlink(out_path);
+
+	/* O_APPEND makes splice(2) refuse, standard error takes the detour */
+	err_fd = open("/dev/null", O_WRONLY | O_APPEND);
+	if (err_fd == -1) {
+		ret = -errno;
+		goto out;
+	}
+
+	ret = exec_process_attr(&proc, false, NULL, USERINFO_TYPE_NONE,
+	                        argv[0], argv, NULL);
+	if (ret)
+		goto out;
+
+	ret = exec_capture(&proc, out_fd, err_fd, &out_bytes, &err_bytes,
+	                   NULL);
+	ret |= wait_for_child(&proc, true);
+
+	fprintf(stderr, "CAPTURE: %llu bytes out (file has %lld), %llu err\n",
+	        (unsigned long long) out_bytes,
+	        (long long) lseek(out_fd, 0, SEEK_END),
+	        (unsigned long long) err_bytes);
+
+	if (!ret && (out_bytes != 3000000 || err_bytes != 5 ||
+	             lseek(out_fd, 0, SEEK_END) != 3000000))
+		ret = -EIO;
+	if (!ret)
+		ret = proc.pi_retval;
+
+out:
+	if (err_fd != -1)
+		close(err_fd);
+	close(out_fd);
+	return ret;
+}
+
+static void t33_exit(struct exec_io_proc *p, void *arg)
+{
+	(void) p;
+	++*(unsigned int *) arg;
+}
+
+static int t33(void)
+{
+	int ret, i, started;
+	bool busy;
+	size_t len;
+	const char *out;
+	char line[32];
+	unsigned int exited = 0;
+	struct exec_io *io;
+	struct exec_io_stats stats;
+	struct exec_io_proc *handles[16];
+	struct process_info procs[16];
+	static const struct exec_io_ops ops = { NULL, NULL, t33_exit };
+
+	if ((io = exec_io_new_backend(EXEC_IO_BACKEND_URING)) == NULL)
+		return -errno;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	for (started = 0; started < 16; ++started) {
+		ret = exec_process(&procs[started], false, NULL,
+		                   USERINFO_TYPE_NONE, "/bin/cat", NULL);
+		if (ret)
+			goto out;
+
+		handles[started] = exec_io_add(io, &procs[started], &ops,
+		                               &exited);
+		if (!handles[started]) {
+			ret = -errno;
+			++started;
+			goto out;
+		}
+
+		snprintf(line, sizeof(line), "ring %d\n", started);
+		ret = exec_io_write(handles[started], line, strlen(line));
+		if (ret) {
+			++started;
+			goto out;
+		}
+		exec_io_close_stdin(handles[started]);
+	}
+
+	do {
+		ret = exec_io_run(io, 5000);
+		if (ret < 0)
+			goto out;
+
+		busy = false;
+		for (i = 0; i < started; ++i)
+			busy |= !exec_io_done(handles[i]) ||
+			        !exec_io_exited(handles[i]);
+	} while (busy);
+
+	ret = 0;
+	for (i = 0; i < started; ++i) {
+		out = exec_io_captured(handles[i], EXEC_IO_STDOUT, &len);
+		snprintf(line, sizeof(line), "ring %d\n", i);
+		if (!out || len != strlen(line) || memcmp(out, line, len))
+			ret = -EIO;
+	}
+
+	exec_io_stats(io, &stats);
+	fprintf(stderr, "RING: backend %d, %u exited, %llu syscalls, "
+	        "%llu events\n", (int) exec_io_get_backend(io), exited,
+	        (unsigned long long) stats.es_syscalls,
+	        (unsigned long long) stats.es_events);
+	if (exited != 16)
+		ret = -EIO;
+
+out:
+	exec_io_free(io);
+	for (i = 0; i < started; ++i) {
+		ret |= wait_for_child(&procs[i], true);
+		ret |= procs[i].pi_retval;
+	}
+	signal(SIGPIPE, SIG_DFL);
+	return ret;
+}
+
+static int t34(void)
+{
+	int ret, tap_fd;
+	unsigned int i;
+	char buf[64];
+	ssize_t count;
+	struct exec_cmd cmds[3];
+	struct exec_tap taps[2];
+	struct process_info procs[3];
+	char tap_path[] = "/tmp/exec_tap_XXXXXX";
+	char *const echo[] = { "/bin/echo", "hello pipeline", NULL };
+	char *const tr[] = { "/usr/bin/tr", "a-z", "A-Z", NULL };
+	char *const rev[] = { "/usr/bin/rev", NULL };
+
+	if ((tap_fd = mkstemp(tap_path)) == -1)
+		return -errno;
+	unlink(tap_path);
+
+	memset(cmds, 0, sizeof(cmds));
+	cmds[0].ec_cmd = echo[0];
+	cmds[0].ec_argv = echo;
+	cmds[1].ec_cmd = tr[0];
+	cmds[1].ec_argv = tr;
+	cmds[2].ec_cmd = rev[0];
+	cmds[2].ec_argv = rev;
+
+	/* echo | tee tap | tr | rev */
+	taps[0].et_fd = tap_fd;
+	taps[1].et_fd = -1;
+
+	signal(SIGPIPE, SIG_IGN);
+	ret = exec_pipeline(cmds, procs, 3, taps);
+	if (ret)
+		goto out;
+
+	close(procs[0].pi_stdin);
+	procs[0].pi_stdin = -1;
+
+	while ((ret = exec_tap_pump(taps, 2, 5000)) > 0)
+		;
+
+	count = ret ? -1 : timed_read(procs[2].pi_stdout, buf,
+	                              sizeof(buf) - 1, 5);
+	if (count > 0) {
+		buf[count] = '\0';
+		fprintf(stderr, "PIPELINE: %s", buf);
+		if (strcmp(buf, "ENILEPIP OLLEH\n") ||
+		    taps[0].et_bytes != 15 ||
+		    pread(tap_fd, buf, sizeof(buf), 0) != 15)
+			ret = -EIO;
+	} else if (!ret) {
+		ret = -EIO;
+	}
+
+	for (i = 0; i < 3; ++i) {
+		ret |= wait_for_child(&procs[i], true);
+		ret |= procs[i].pi_retval;
+	}
+out:
+	signal(SIGPIPE, SIG_DFL);
+	close(tap_fd);
+	return ret;
+}
+
+struct t35_state {
+	unsigned int done;
+	unsigned int bad;
+};
+
+static void t35_done(struct exec_job *job, const struct exec_job_result *res,
+                     void *arg)
+{
+	struct t35_state *state = arg;
+	bool ok;
+
+	/* cats echo their input, everything else exits with 3 */
+	if (job->ej_input_size)
+		ok = res->jr_status == 0 &&
+		     res->jr_output_size == job->ej_input_size &&
+		     !memcmp(res->jr_output, job->ej_input,
+		             job->ej_input_size);
+	else
+		ok = WIFEXITED(res->jr_status) &&
+		     WEXITSTATUS(res->jr_status) == 3;
+
+	state->bad += !ok;
+	++state->done;
+}
+
+static int t35(void)
+{
+	int ret;
+	unsigned int i;
+	char input[16][16];
+	struct exec_job jobs[16];
+	struct exec_pool *pool;
+	struct exec_pool_stats stats;
+	struct t35_state state = { 0, 0 };
+	char *const cat[] = { "/bin/cat", NULL };
+	char *const fail[] = { "/bin/sh", "-c", "exit 3", NULL };
+
+	if ((pool = exec_pool_new(4, 0)) == NULL)
+		return -errno;
+
+	signal(SIGPIPE, SIG_IGN);
+
+	memset(jobs, 0, sizeof(jobs));
+	for (i = 0; i < 16; ++i) {
+		jobs[i].ej_done = t35_done;
+		jobs[i].ej_arg = &state;
+		if (i % 4 == 3) {
+			jobs[i].ej_cmd.ec_cmd = fail[0];
+			jobs[i].ej_cmd.ec_argv = fail;
+		} else {
+			snprintf(input[i], sizeof(input[i]), "job %u\n", i);
+			jobs[i].ej_cmd.ec_cmd = cat[0];
+			jobs[i].ej_cmd.ec_argv = cat;
+			jobs[i].ej_input = input[i];
+			jobs[i].ej_input_size = strlen(input[i]);
+		}
+
+		if ((ret = exec_pool_submit(pool, &jobs[i])) != 0)
+			goto out;
+	}
+
+	if ((ret = exec_pool_wait(pool)) != 0)
+		goto out;
+
+	exec_pool_stats(pool, &stats);
+	fprintf(stderr, "POOL: %u done, %u bad, peak %u running, "
+	        "%.0f jobs/s\n", state.done, state.bad,
+	        stats.ps_peak_running,
+	        (double) stats.ps_completed * 1e9 / (double) stats.ps_busy_ns);
+
+	if (state.done != 16 || state.bad || stats.ps_completed != 16 ||
+	    stats.ps_peak_running > 4 || stats.ps_running || stats.ps_queued)
+		ret = -EIO;
+	exec_pool_free(pool);
+
+	/* admission control */
+	if ((pool = exec_pool_new(1, 2)) == NULL)
+		return -errno;
+	for (i = 0; i < 3 && !ret; ++i) {
+		ret = exec_pool_submit(pool, &jobs[i]);
+		if (i == 2)
+			ret = ret == -EAGAIN ? 0 : -EIO;
+	}
+out:
+	signal(SIGPIPE, SIG_DFL);
+	exec_pool_free(pool);
+	return ret;
+}
+
+/*
+ * Runs id(1) as nobody on the fork and vfork backends, only the first spawn may
+ * have to resolve the user.
+ */
+static int t36(void)
+{
+	static const enum exec_backend backends[] = {
+		EXEC_BACKEND_FORK, EXEC_BACKEND_VFORK, EXEC_BACKEND_FORK
+	};
+	const char *user = "nobody";
+	char *const argv[] = { "/bin/sh", "-c", "id -u; id -G", NULL };
+	struct exec_cache_stats before, after;
+	struct process_info proc;
+	struct exec_attr attr;
+	struct passwd *pwd;
+	unsigned int i;
+	char buf[64], want[64];
+	ssize_t count;
+	int ret = 0;
+
+	if ((pwd = getpwnam(user)) == NULL)
+		return -ENOENT;
+	snprintf(want, sizeof(want), "%u\n%u\n", (unsigned int) pwd->pw_uid,
+	         (unsigned int) pwd->pw_gid);
+
+	exec_user_cache_flush();
+	exec_user_cache_stats(&before);
+
+	memset(&attr, 0, sizeof(attr));
+	for (i = 0; i < ARRAY_SIZE(backends) && !ret; ++i) {
+		attr.ea_backend = backends[i];
+		ret = exec_process_attr(&proc, false, user,
+		                        USERINFO_TYPE_NAME, argv[0], argv,
+		                        &attr);
+		if (ret)
+			break;
+
+		count = timed_read(proc.pi_stdout, buf, sizeof(buf) - 1, 5);
+		ret = wait_for_child(&proc, true) | proc.pi_retval;
+		if (count <= 0)
+			ret = -EIO;
+		else if (!ret) {
+			buf[count] = '\0';
+			ret = strcmp(buf, want) ? -EIO : 0;
+		}
+	}
+
+	exec_user_cache_stats(&after);
+	fprintf(stderr, "CREDS: %llu hits, %llu misses\n",
+	        (unsigned long long) (after.cs_hits - before.cs_hits),
+	        (unsigned long long) (after.cs_misses - before.cs_misses));
+
+	if (!ret && (after.cs_misses - before.cs_misses != 1 ||
+	             after.cs_hits - before.cs_hits != 2))
+		ret = -EIO;
+
+	return ret;
+}
+
+/*
+ * Re-runs a precompiled command, checking its environment, directory and
+ * limits. Once warmed up, spawning must not touch the heap.
+ */
+static int t37(void)
+{
+	static const struct exec_rlimit limits[] = {
+		{ RLIMIT_NOFILE, 64, 64 }
+	};
+	char *const argv[] = { "sh", "-c", "echo $SPEC; pwd; ulimit -n", NULL };
+	char *const envp[] = { "SPEC=yes", NULL };
+	const char *want = "yes\n/tmp\n64\n";
+	struct exec_spec_attr attr;
+	struct process_info proc;
+	struct exec_spec *spec;
+	struct mallinfo2 before, after;
+	unsigned int i;
+	char buf[64];
+	ssize_t count;
+	int ret = 0;
+
+	exec_spec_attr_init(&attr);
+	attr.sa_envp = envp;
+	attr.sa_cwd = "/tmp";
+	attr.sa_rlimits = limits;
+	attr.sa_num_rlimits = ARRAY_SIZE(limits);
+
+	if ((spec = exec_spec_new(argv[0], argv, NULL, USERINFO_TYPE_NONE,
+	                          &attr)) == NULL)
+		return -errno;
+
+	memset(&before, 0, sizeof(before));
+	for (i = 0; i < 4 && !ret; ++i) {
+		if (i == 1)
+			before = mallinfo2();
+
+		if ((ret = exec_spawn(spec, &proc)) != 0)
+			break;
+
+		count = timed_read(proc.pi_stdout, buf, sizeof(buf) - 1, 5);
+		ret = wait_for_child(&proc, true) | proc.pi_retval;
+		if (count <= 0) {
+			ret = -EIO;
+		} else if (!ret) {
+			buf[count] = '\0';
+			ret = strcmp(buf, want) ? -EIO : 0;
+		}
+	}
+
+	if (!ret)
+		ret = exec_spawn(spec, NULL);
+
+	after = mallinfo2();
+	fprintf(stderr, "SPEC: %zu bytes allocated while spawning\n",
+	        after.uordblks - before.uordblks);
+	if (!ret && after.uordblks != before.uordblks)
+		ret = -EIO;
+
+	exec_spec_free(spec);
+	return ret;
+}
+
+/*
+ * Spawns commands from $PATH: repeated lookups are answered from the
+ * cache until $PATH changes. Scripts without an interpreter line still
+ * go to the shell.
+ */
+static int t38(void)
+{
+	char *const argv[] = { "true", NULL };
+	char script[] = "/tmp/exec_script_XXXXXX";
+	struct exec_cache_stats before, after;
+	const char *path;
+	char *saved;
+	unsigned int i;
+	int ret = 0, fd;
+
+	if ((path = getenv("PATH")) == NULL || (saved = strdup(path)) == NULL)
+		return -ENOENT;
+
+	exec_path_cache_flush();
+	exec_path_cache_stats(&before);
+
+	for (i = 0; i < 3 && !ret; ++i)
+		ret = exec_process_p(NULL, true, NULL, USERINFO_TYPE_NONE,
+		                     argv[0], argv);
+
+	/* same directories, different $PATH */
+	setenv("PATH", "/usr/bin:/bin", 1);
+	if (!ret)
+		ret = exec_process_p(NULL, true, NULL, USERINFO_TYPE_NONE,
+		                     argv[0], argv);
+	setenv("PATH", saved, 1);
+	free(saved);
+
+	exec_path_cache_stats(&after);
+	fprintf(stderr, "PATH: %llu hits, %llu misses\n",
+	        (unsigned long long) (after.cs_hits - before.cs_hits),
+	        (unsigned long long) (after.cs_misses - before.cs_misses));
+
+	if (!ret && (after.cs_misses - before.cs_misses != 2 ||
+	             after.cs_hits - before.cs_hits != 2))
+		ret = -EIO;
+	if (ret)
+		return ret;
+
+	if ((fd = mkstemp(script)) == -1)
+		return -errno;
+	if (write(fd, "exit 7\n", 7) != 7 || fchmod(fd, 0700))
+		ret = -errno;
+	close(fd);
+
+	if (!ret) {
+		ret = exec_process(NULL, true, NULL, USERINFO_TYPE_NONE,
+		                   script, NULL);
+		ret = WIFEXITED(ret) && WEXITSTATUS(ret) == 7 ? 0 : -EIO;
+	}
+
+	unlink(script);
+	return ret;
+}
+
+/*
+ * Times spawns on every local backend: the child's stages show up for
+ * fork and vfork only, nothing is recorded while timing is off.
+ */
+static int t39(void)
+{
+	static const enum exec_backend backends[] = {
+		EXEC_BACKEND_FORK, EXEC_BACKEND_VFORK, EXEC_BACKEND_POSIX_SPAWN
+	};
+	char *const argv[] = { "/bin/true", NULL };
+	struct exec_timing_snapshot before, after;
+	const struct exec_stage_stats *ss;
+	struct exec_attr attr;
+	unsigned int i;
+	char *dump;
+	int ret = 0;
+
+	if ((ret = exec_timing_snapshot(&before)) != 0)
+		return ret;
+
+	exec_timing_enable(true);
+	memset(&attr, 0, sizeof(attr));
+	for (i = 0; i < ARRAY_SIZE(backends) && !ret; ++i) {
+		attr.ea_backend = backends[i];
+		ret = exec_process_attr(NULL, true, NULL, USERINFO_TYPE_NONE,
+		                        argv[0], argv, &attr);
+	}
+	exec_timing_enable(false);
+
+	/* not counted */
+	if (!ret)
+		ret = exec_process(NULL, true, NULL, USERINFO_TYPE_NONE,
+		                   argv[0], NULL);
+	if (!ret)
+		ret = exec_timing_snapshot(&after);
+	if (ret)
+		return ret;
+
+	for (i = 0; i < EXEC_NUM_STAGES; ++i) {
+		ss = &after.ts_stages[i];
+		fprintf(stderr, "TIMING: %-7s %llu spawns, p50 %llu ns, "
+		        "max %llu ns\n", exec_stage_name((enum exec_stage) i),
+		        (unsigned long long) ss->ss_count,
+		        (unsigned long long) ss->ss_p50_ns,
+		        (unsigned long long) ss->ss_max_ns);
+
+		if (ss->ss_p50_ns > ss->ss_p99_ns ||
+		    ss->ss_p99_ns > ss->ss_max_ns)
+			ret = -EIO;
+	}
+
+	if (after.ts_stages[EXEC_STAGE_TOTAL].ss_count -
+	    before.ts_stages[EXEC_STAGE_TOTAL].ss_count != 3 ||
+	    after.ts_stages[EXEC_STAGE_CLOSE].ss_count -
+	    before.ts_stages[EXEC_STAGE_CLOSE].ss_count != 2)
+		ret = -EIO;
+	if (ret)
+		return ret;
+
+	if ((ret = exec_timing_prometheus(&dump)) < 0)
+		return ret;
+
+	ret = strstr(dump, "exec_spawn_stage_seconds_count{stage=\"close\"}")
+	      ? 0 : -EIO;
+	free(dump);
+	return ret;
+}
+
+/*
+ * Reaping reports what a child cost: CPU time and RSS for a busy loop
+ * run to completion, wall-clock time for a sleep waited for later.
+ */
+static int t40(void)
+{
+	char *const busy[] = { "/bin/sh", "-c",
+	                       "i=0; while [ $i -lt 20000 ]; do i=$((i+1)); "
+	                       "done", NULL };
+	char *const nap[] = { "/bin/sleep", "0.1", NULL };
+	struct exec_usage usage;
+	struct process_info proc;
+	struct exec_attr attr;
+	long long elapsed_ns;
+	int ret;
+
+	memset(&attr, 0, sizeof(attr));
+	memset(&usage, 0, sizeof(usage));
+	attr.ea_usage = &usage;
+	ret = exec_process_attr(NULL, true, NULL, USERINFO_TYPE_NONE,
+	                        busy[0], busy, &attr);
+	if (ret)
+		return ret;
+
+	fprintf(stderr, "USAGE: busy loop took %llu us user, %llu us system, "
+	        "%ld KiB\n", (unsigned long long) usage.eu_utime_ns / 1000,
+	        (unsigned long long) usage.eu_stime_ns / 1000,
+	        usage.eu_maxrss);
+	if (!usage.eu_utime_ns && !usage.eu_stime_ns)
+		return -EIO;
+	if (usage.eu_maxrss <= 0 || !usage.eu_start.tv_sec)
+		return -EIO;
+
+	ret = exec_process_p(&proc, false, NULL, USERINFO_TYPE_NONE,
+	                     nap[0], nap);
+	if (ret)
+		return ret;
+
+	ret = wait_for_child(&proc, true) | proc.pi_retval;
+	if (ret)
+		return ret;
+
+	elapsed_ns = (long long) (proc.pi_usage.eu_end.tv_sec -
+	                          proc.pi_usage.eu_start.tv_sec) *
+	             1000000000LL +
+	             (proc.pi_usage.eu_end.tv_nsec -
+	              proc.pi_usage.eu_start.tv_nsec);
+	fprintf(stderr, "USAGE: sleep took %lld us, %ld voluntary switches\n",
+	        elapsed_ns / 1000, proc.pi_usage.eu_nvcsw);
+
+	return elapsed_ns >= 100000000LL ? 0 : -EIO;
+}
+
+static void t41_done(struct exec_job *job, const struct exec_job_result *res,
+                     void *arg)
+{
+	int *status = arg;
+
+	(void) job;
+	*status = res->jr_status;
+}
+
+/*
+ * Timed waits: a sleeper is left alone, then has to be killed once it
+ * ignores SIGTERM. A pool job running past its timeout frees its slot.
+ */
+static int t41(void)
+{
+	char *const nap[] = { "/bin/sleep", "10", NULL };
+	char *const stubborn[] = { "/bin/sh", "-c",
+	                           "trap '' TERM; exec sleep 10", NULL };
+	struct timespec start, end;
+	struct exec_pool_stats stats;
+	struct process_info proc;
+	struct exec_pool *pool;
+	struct exec_job job;
+	long long elapsed_ms;
+	int ret, status = 0;
+
+	ret = exec_process_p(&proc, false, NULL, USERINFO_TYPE_NONE,
+	                     nap[0], nap);
+	if (ret)
+		return ret;
+
+	ret = wait_for_child_timeout(&proc, false, 50, -1);
+	if (ret != -1 || errno != ETIMEDOUT) {
+		wait_for_child_timeout(&proc, true, 0, 0);
+		return -EIO;
+	}
+
+	ret = wait_for_child_timeout(&proc, true, 0, 0);
+	if (ret || !WIFSIGNALED(proc.pi_retval) ||
+	    WTERMSIG(proc.pi_retval) != SIGKILL)
+		return -EIO;
+
+	ret = exec_process_p(&proc, false, NULL, USERINFO_TYPE_NONE,
+	                     stubborn[0], stubborn);
+	if (ret)
+		return ret;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	ret = wait_for_child_timeout(&proc, true, 50, 100);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	elapsed_ms = (long long) (end.tv_sec - start.tv_sec) * 1000 +
+	             (end.tv_nsec - start.tv_nsec) / 1000000;
+	fprintf(stderr, "KILL: stubborn child gone after %lld ms\n",
+	        elapsed_ms);
+	if (ret || !WIFSIGNALED(proc.pi_retval) ||
+	    WTERMSIG(proc.pi_retval) != SIGKILL || elapsed_ms > 1000)
+		return -EIO;
+
+	if ((pool = exec_pool_new(1, 0)) == NULL)
+		return -errno;
+
+	memset(&job, 0, sizeof(job));
+	job.ej_cmd.ec_cmd = nap[0];
+	job.ej_cmd.ec_argv = nap;
+	job.ej_timeout = 50;
+	job.ej_grace = 100;
+	job.ej_done = t41_done;
+	job.ej_arg = &status;
+
+	ret = exec_pool_submit(pool, &job);
+	if (!ret)
+		ret = exec_pool_wait(pool);
+	exec_pool_stats(pool, &stats);
+	exec_pool_free(pool);
+
+	if (!ret && (stats.ps_timeouts != 1 || !WIFSIGNALED(status) ||
+	             WTERMSIG(status) != SIGTERM))
+		ret = -EIO;
+	return ret;
+}
+
+struct t42_state {
+	unsigned long      count;
+	unsigned long long sum;
+};
+
+static int t42_count(const struct exec_record *rec, void *arg)
+{
+	struct t42_state *state = arg;
+	char num[16];
+
+	if (rec->er_size >= sizeof(num) || rec->er_partial)
+		return -EIO;
+
+	memcpy(num, rec->er_data, rec->er_size);
+	num[rec->er_size] = '\0';
+	state->sum += strtoul(num, NULL, 10);
+	++state->count;
+	return 0;
+}
+
+/*
+ * Reads records of a child in one piece no matter how its writes were
+ * split up: newline- and NUL-delimited, oversized and a long stream.
+ */
+static int t42(void)
+{
+	static const struct {
+		const char *script;
+		int         delim;
+		size_t      max_size;
+		const char *want;
+	} cases[] = {
+		{ "printf 'alpha\\nbe'; sleep 0.05; printf 'ta\\n\\ngamma'",
+		  '\n', 0, "alpha|beta||gamma*|" },
+		{ "printf 'one\\000two\\000'; printf 'three\\000'",
+		  '\0', 0, "one|two|three|" },
+		{ "printf '%0100d\\nok\\n' 0", '\n', 16, "E2BIG|ok|" },
+	};
+	char *argv[] = { "/bin/sh", "-c", NULL, NULL };
+	char *const seq[] = { "/usr/bin/seq", "100000", NULL };
+	struct t42_state state = { 0, 0 };
+	struct exec_records *records;
+	struct process_info proc;
+	struct exec_record rec;
+	struct timespec deadline;
+	char got[128];
+	unsigned int i;
+	size_t len;
+	int ret = 0;
+
+	for (i = 0; i < ARRAY_SIZE(cases) && !ret; ++i) {
+		argv[2] = (char *) cases[i].script;
+		ret = exec_process_p(&proc, false, NULL, USERINFO_TYPE_NONE,
+		                     argv[0], argv);
+		if (ret)
+			return ret;
+
+		records = exec_records_new(proc.pi_stdout, cases[i].delim,
+		                           cases[i].max_size);
+		if (!records) {
+			ret = -errno;
+			wait_for_child(&proc, true);
+			break;
+		}
+
+		exec_deadline(&deadline, 5000000000ULL);
+		got[0] = '\0';
+		len = 0;
+		while ((ret = exec_records_next(records, &rec,
+		                                &deadline)) != 0) {
+			if (ret < 0 && ret != -E2BIG)
+				break;
+			if (ret == -E2BIG)
+				len += (size_t) snprintf(got + len,
+				                         sizeof(got) - len,
+				                         "E2BIG|");
+			else
+				len += (size_t) snprintf(got + len,
+				                         sizeof(got) - len,
+				                         "%.*s%s|",
+				                         (int) rec.er_size,
+				                         rec.er_data,
+				                         rec.er_partial ? "*" :
+				                         "");
+		}
+
+		exec_records_free(records);
+		if (wait_for_child(&proc, true) || proc.pi_retval)
+			ret = -EIO;
+
+		fprintf(stderr, "RECORDS: %s\n", got);
+		if (!ret && strcmp(got, cases[i].want))
+			ret = -EIO;
+	}
+	if (ret)
+		return ret;
+
+	ret = exec_process_p(&proc, false, NULL, USERINFO_TYPE_NONE,
+	                     seq[0], seq);
+	if (ret)
+		return ret;
+
+	if ((records = exec_records_new(proc.pi_stdout, '\n', 0)) == NULL) {
+		ret = -errno;
+	} else {
+		ret = exec_records_foreach(records, t42_count, &state, NULL);
+		exec_records_free(records);
+	}
+
+	if (wait_for_child(&proc, true) || proc.pi_retval)
+		ret = -EIO;
+
+	fprintf(stderr, "RECORDS: %lu numbers, sum %llu\n", state.count,
+	        state.sum);
+	if (!ret && (state.count != 100000 || state.sum != 5000050000ULL))
+		ret = -EIO;
+	return ret;
+}
+
+/*
+ * Talks to cat through a small writer and reader, so that writes overflow
+ * the buffer and lines span refills, then peeks at the output of a child
+ * that goes quiet until the deadline passes.
+ */
+static int t43(void)
+{
+	char *const cat[] = { "/bin/cat", NULL };
+	char *const quiet[] = { "/bin/sh", "-c",
+	                        "printf 'HEADbody'; exec sleep 5", NULL };
+	struct exec_reader *reader;
+	struct exec_writer *writer;
+	struct process_info proc;
+	struct timespec deadline;
+	const void *data;
+	char line[64], got[128];
+	unsigned int i;
+	size_t len = 0;
+	ssize_t count = 0;
+	int ret;
+
+	ret = exec_process_p(&proc, false, NULL, USERINFO_TYPE_NONE,
+	                     cat[0], cat);
+	if (ret)
+		return ret;
+
+	writer = exec_writer_new(proc.pi_stdin, 16);
+	reader = exec_reader_new(proc.pi_stdout, 32);
+	if (!writer || !reader)
+		count = -ENOMEM;
+
+	exec_deadline(&deadline, 5000000000ULL);
+	for (i = 0; i < 4 && count >= 0; ++i) {
+		count = snprintf(line, sizeof(line), "line %u %.*s\n", i,
+		                 (int) (i * 8), "xxxxxxxxxxxxxxxxxxxxxxxx");
+		count = exec_writer_write(writer, line, (size_t) count,
+		                          &deadline);
+	}
+	if (count >= 0)
+		count = exec_writer_write(writer, "tail", 4, &deadline);
+	if (count >= 0 && exec_writer_pending(writer) != 4)
+		count = -EIO;
+	if (count >= 0)
+		count = exec_writer_flush(writer, &deadline);
+
+	/* end of file lets cat finish */
+	close(proc.pi_stdin);
+	proc.pi_stdin = -1;
+
+	while (count >= 0 &&
+	       (count = exec_reader_until(reader, '\n', &data, &deadline)) > 0)
+		len += (size_t) snprintf(got + len, sizeof(got) - len,
+		                         "%.*s|", (int) count -
+		                         (((const char *) data)[count - 1] ==
+		                          '\n'),
+		                         (const char *) data);
+
+	exec_writer_free(writer);
+	exec_reader_free(reader);
+	if (wait_for_child(&proc, true) || proc.pi_retval)
+		ret = -EIO;
+	if (count < 0)
+		return (int) count;
+
+	got[len] = '\0';
+	fprintf(stderr, "BUFIO: %s\n", got);
+	if (ret || strcmp(got, "line 0 |line 1 xxxxxxxx|"
+	                       "line 2 xxxxxxxxxxxxxxxx|"
+	                       "line 3 xxxxxxxxxxxxxxxxxxxxxxxx|tail|"))
+		return -EIO;
+
+	ret = exec_process_p(&proc, false, NULL, USERINFO_TYPE_NONE,
+	                     quiet[0], quiet);
+	if (ret)
+		return ret;
+
+	if ((reader = exec_reader_new(proc.pi_stdout, 0)) == NULL) {
+		ret = -errno;
+	} else {
+		exec_deadline(&deadline, 5000000000ULL);
+		count = exec_reader_peek(reader, &data, 4, &deadline);
+		if (count < 4 || memcmp(data, "HEAD", 4))
+			ret = -EIO;
+		exec_reader_consume(reader, 4);
+
+		if (!ret && (exec_reader_read_exact(reader, line, 4,
+		                                    &deadline) != 4 ||
+		             memcmp(line, "body", 4)))
+			ret = -EIO;
+
+		/* sleep has nothing to say */
+		exec_deadline(&deadline, 50000000ULL);
+		count = exec_reader_read(reader, line, sizeof(line), &deadline);
+		fprintf(stderr, "BUFIO: quiet child: %s\n",
+		        strerror((int) -count));
+		if (!ret && count != -ETIMEDOUT)
+			ret = -EIO;
+		exec_reader_free(reader);
+	}
+
+	wait_for_child_timeout(&proc, true, 0, 1000);
+	return ret;
+}
+
+/*
+ * Spawns with a stdio plan: only standard output gets a pipe, standard
+ * error is merged into it, then input comes from one of our descriptors
+ * and output goes to a file by path.
+ */
+static int t44(void)
+{
+	char *const merged[] = { "/bin/sh", "-c",
+	                         "read x; echo \"in=$x\"; echo err >&2", NULL };
+	char *const copy[] = { "/bin/cat", NULL };
+	char in_path[] = "/tmp/exec_stdio_XXXXXX";
+	char out_path[] = "/tmp/exec_stdio_XXXXXX";
+	struct process_info proc;
+	struct exec_attr attr;
+	char *output = NULL;
+	char buf[32];
+	ssize_t count;
+	int ret, in_fd, out_fd;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.ea_stdio[0].es_mode = EXEC_STDIO_NULL;
+	attr.ea_stdio[2].es_mode = EXEC_STDIO_MERGE;
+
+	ret = exec_process_attr(&proc, false, NULL, USERINFO_TYPE_NONE,
+	                        merged[0], merged, &attr);
+	if (ret)
+		return ret;
+
+	if (proc.pi_stdin != -1 || proc.pi_stderr != -1 || proc.pi_stdout < 0)
+		ret = -EIO;
+
+	if (exec_communicate(&proc, NULL, 0, &output, NULL, NULL, NULL, NULL))
+		ret = -EIO;
+
+	fprintf(stderr, "STDIO: merged output \"%s\"\n", output ? output : "");
+	if (!ret && (proc.pi_retval || !output ||
+	             strcmp(output, "in=\nerr\n")))
+		ret = -EIO;
+	free(output);
+	if (ret)
+		return ret;
+
+	/* standard error only can be merged */
+	attr.ea_stdio[1].es_mode = EXEC_STDIO_MERGE;
+	ret = exec_process_attr(&proc, false, NULL, USERINFO_TYPE_NONE,
+	                        copy[0], copy, &attr);
+	if (ret != -EINVAL)
+		return ret ? ret : -EIO;
+
+	if ((in_fd = mkstemp(in_path)) == -1)
+		return -errno;
+	unlink(in_path);
+
+	/* the leftovers have to be truncated away */
+	if ((out_fd = mkstemp(out_path)) == -1) {
+		ret = -errno;
+		close(in_fd);
+		return ret;
+	}
+
+	if (write(in_fd, "from fd", 7) != 7 || lseek(in_fd, 0, SEEK_SET) ||
+	    write(out_fd, "leftovers", 9) != 9) {
+		ret = -EIO;
+		goto out;
+	}
+
+	memset(&attr, 0, sizeof(attr));
+	attr.ea_stdio[0].es_mode = EXEC_STDIO_FD;
+	attr.ea_stdio[0].es_fd = in_fd;
+	attr.ea_stdio[1].es_mode = EXEC_STDIO_PATH;
+	attr.ea_stdio[1].es_path = out_path;
+
+	ret = exec_process_attr(NULL, true, NULL, USERINFO_TYPE_NONE,
+	                        copy[0], copy, &attr);
+	if (ret)
+		goto out;
+
+	count = pread(out_fd, buf, sizeof(buf) - 1, 0);
+	buf[count > 0 ? count : 0] = '\0';
+	fprintf(stderr, "STDIO: file holds \"%s\"\n", buf);
+	if (strcmp(buf, "from fd"))
+		ret = -EIO;
+
+out:
+	close(in_fd);
+	close(out_fd);
+	unlink(out_path);
+	return ret;
+}
+
+/*
+ * Sizes the output pipe at spawn time, caps an oversized request and
+ * lets exec_capture() and exec_communicate() grow a pipe they find full.
+ */
+static int t45(void)
+{
+	char *const argv[] = { "/bin/sh", "-c",
+	                       "exec head -c 4194304 /dev/zero", NULL };
+	char sink_path[] = "/tmp/exec_pipe_XXXXXX";
+	struct process_info proc;
+	struct exec_attr attr;
+	uint64_t moved = 0;
+	char *output;
+	ssize_t max;
+	size_t first, len;
+	int ret, sink;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.ea_stdio[1].es_pipe_size = 256 * 1024;
+
+	ret = exec_process_attr(&proc, false, NULL, USERINFO_TYPE_NONE,
+	                        argv[0], argv, &attr);
+	if (ret)
+		return ret;
+
+	max = exec_pipe_resize(proc.pi_stdout, (size_t) 1 << 30);
+	fprintf(stderr, "PIPE: asked for 256 KiB, got %zu, at most %zd\n",
+	        proc.pi_pipe_size[1], max);
+	if (proc.pi_pipe_size[1] < 256 * 1024 || proc.pi_pipe_size[0] ||
+	    max < 256 * 1024 || exec_pipe_size(proc.pi_stdout) != max)
+		ret = -EIO;
+
+	kill(proc.pi_pid, SIGKILL);
+	(void) wait_for_child(&proc, true);
+	if (ret)
+		return ret;
+
+	if ((sink = mkstemp(sink_path)) == -1)
+		return -errno;
+	unlink(sink_path);
+
+	memset(&attr, 0, sizeof(attr));
+	attr.ea_pipe_autogrow = true;
+
+	ret = exec_process_attr(&proc, false, NULL, USERINFO_TYPE_NONE,
+	                        argv[0], argv, &attr);
+	if (ret)
+		goto out;
+
+	/* head fills the pipe and stalls before we start draining */
+	first = proc.pi_pipe_size[1];
+	usleep(100000);
+
+	ret = exec_capture(&proc, sink, -1, &moved, NULL, NULL);
+	fprintf(stderr, "PIPE: grew from %zu to %zu moving %llu bytes\n",
+	        first, proc.pi_pipe_size[1], (unsigned long long) moved);
+	if (!ret && (!first || proc.pi_pipe_size[1] <= first ||
+	             moved != 4194304))
+		ret = -EIO;
+
+	if (wait_for_child(&proc, true) || proc.pi_retval)
+		ret = ret ? ret : -EIO;
+	if (ret)
+		goto out;
+
+	/* exec_communicate() has to keep growing it as well */
+	ret = exec_process_attr(&proc, false, NULL, USERINFO_TYPE_NONE,
+	                        argv[0], argv, &attr);
+	if (ret)
+		goto out;
+
+	first = proc.pi_pipe_size[1];
+	usleep(100000);
+
+	ret = exec_communicate(&proc, NULL, 0, &output, &len, NULL, NULL,
+	                       NULL);
+	fprintf(stderr, "PIPE: communicate grew from %zu to %zu reading "
+	        "%zu bytes\n", first, proc.pi_pipe_size[1], len);
+	if (!ret) {
+		if (proc.pi_pipe_size[1] < 4 * first || len != 4194304)
+			ret = -EIO;
+		free(output);
+	}
+out:
+	close(sink);
+	return ret;
+}
+
+/*
+ * Feeds one sealed memory file to several children at once, each of which
+ * has to see all of it, and checks that it can't be changed anymore.
+ */
+static int t46(void)
+{
+	static const char data[] = "alpha\nbeta\ngamma\n";
+	char *const argv[] = { "/bin/sh", "-c",
+	                       "cat; echo; exec cat /dev/stdin", NULL };
+	struct process_info procs[4];
+	struct exec_attr attr;
+	char *output;
+	unsigned int i, started;
+	int ret, fd;
+
+	if ((fd = exec_memfd_new("t46", data, sizeof(data) - 1)) < 0)
+		return fd;
+
+	ret = write(fd, "x", 1) == -1 && errno == EPERM ? 0 : -EIO;
+	if (ret)
+		goto out;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.ea_stdio[0].es_mode = EXEC_STDIO_REOPEN;
+	attr.ea_stdio[0].es_fd = fd;
+
+	for (started = 0; started < ARRAY_SIZE(procs); ++started) {
+		ret = exec_process_attr(&procs[started], false, NULL,
+		                        USERINFO_TYPE_NONE, argv[0], argv,
+		                        &attr);
+		if (ret)
+			break;
+	}
+
+	/* they are all running before the first one is read from */
+	for (i = 0; i < started; ++i) {
+		output = NULL;
+		if (exec_communicate(&procs[i], NULL, 0, &output, NULL,
+		                     NULL, NULL, NULL) || procs[i].pi_retval) {
+			ret = ret ? ret : -EIO;
+			(void) wait_for_child(&procs[i], true);
+		} else if (!ret && (strlen(output) != 2 * sizeof(data) - 1 ||
+		                    strncmp(output, data, sizeof(data) - 1) ||
+		                    strcmp(output + sizeof(data), data))) {
+			/* a shared offset would leave the others nothing */
+			ret = -EIO;
+		}
+
+		if (i == 0)
+			fprintf(stderr, "MEMFD: %u children, first read "
+			        "%zu bytes\n", started,
+			        output ? strlen(output) : 0);
+		free(output);
+	}
+
+	attr.ea_stdio[1].es_mode = EXEC_STDIO_REOPEN;
+	if (!ret && exec_process_attr(NULL, true, NULL, USERINFO_TYPE_NONE,
+	                              argv[0], argv, &attr) != -EINVAL)
+		ret = -EIO;
+out:
+	close(fd);
+	return ret;
+}
+
+/*
+ * Lets the spawn server fail to exec, with and without waiting. Its
+ * children are ours, so nothing may be left for waitpid() to find.
+ */
+static int t47(void)
+{
+	char *const argv[] = { "/etc/passwd", NULL };
+	struct process_info proc;
+	unsigned int i, leaked;
+	int ret;
+
+	/* whatever earlier tests left behind isn't our business here */
+	while (waitpid(-1, NULL, WNOHANG) > 0)
+		;
+
+	ret = exec_server_start();
+	if (ret)
+		return ret;
+
+	for (i = 0; i < 4; ++i) {
+		ret = exec_process_p(i < 3 ? &proc : NULL, i == 3, NULL,
+		                     USERINFO_TYPE_NONE, argv[0], argv);
+		if (ret > -EXEC_PROCESS_ERROR_OFFSET) {
+			(void) exec_server_stop();
+			return ret ? ret : -EIO;
+		}
+	}
+
+	for (leaked = 0; waitpid(-1, NULL, WNOHANG) > 0; ++leaked)
+		;
+
+	(void) exec_server_stop();
+	fprintf(stderr, "SERVER: failed execs left %u zombies\n", leaked);
+	return leaked ? -EIO : 0;
+}
+
+/*
+ * Overflows a writer into a pipe nobody reads. What fits has to be
+ * reported as a short count when the deadline passes, so that a retry
+ * doesn't send it twice.
+ */
+static int t48(void)
+{
+	static char data[64 * 1024];
+	struct exec_writer *writer;
+	struct timespec deadline;
+	ssize_t first, again;
+	int fds[2];
+
+	if (pipe2(fds, O_NONBLOCK | O_CLOEXEC))
+		return -errno;
+
+	/* a page, so that a single write can't take it all */
+	(void) exec_pipe_resize(fds[1], 4096);
+
+	if ((writer = exec_writer_new(fds[1], 16)) == NULL) {
+		close(fds[0]);
+		close(fds[1]);
+		return -ENOMEM;
+	}
+
+	exec_deadline(&deadline, 100000000ULL);
+	first = exec_writer_write(writer, data, sizeof(data), &deadline);
+	again = exec_writer_write(writer, data, sizeof(data), &deadline);
+	fprintf(stderr, "SHORT: wrote %zd of %zu, then %zd\n", first,
+	        sizeof(data), again);
+
+	exec_writer_free(writer);
+	close(fds[0]);
+	close(fds[1]);
+
+	if (first <= 0 || (size_t) first >= sizeof(data) ||
+	    again != -ETIMEDOUT)
+		return -EIO;
+	return 0;
+}
+
+static void *t49_start(void *arg)
+{
+	*(int *) arg = exec_server_start();
+	/* give the server time to settle in before we go */
+	usleep(100000);
+	return NULL;
+}
+
+/*
+ * Starts the spawn server from a thread that exits right away. The server
+ * belongs to the process, so it must not die along with the thread.
+ */
+static int t49(void)
+{
+	pthread_t thread;
+	unsigned int died;
+	int ret;
+
+	while (waitpid(-1, NULL, WNOHANG) > 0)
+		;
+
+	if ((ret = pthread_create(&thread, NULL, t49_start, &ret)) != 0)
+		return -ret;
+	pthread_join(thread, NULL);
+	if (ret)
+		return ret;
+
+	usleep(100000);
+	for (died = 0; waitpid(-1, NULL, WNOHANG) > 0; ++died)
+		;
+
+	ret = exec_server_stop();
+	fprintf(stderr, "SERVER: %u died with the starting thread\n", died);
+	return died ? -EIO : ret;
+}
+
+/* puts a script that exits with @code into @dir/@name as path_cmd */
+static int path_script(const char *dir, const char *name, int code,
+                       mode_t mode)
+{
+	char path[128], script[32];
+	int fd, len;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, name);
+	if (mkdir(path, 0755))
+		return -errno;
+
+	strncat(path, "/path_cmd", sizeof(path) - strlen(path) - 1);
+	len = snprintf(script, sizeof(script), "#!/bin/sh\nexit %d\n", code);
+	if ((fd = open(path, O_WRONLY | O_CREAT | O_EXCL, mode)) == -1)
+		return -errno;
+	if (write(fd, script, (size_t) len) != len || fchmod(fd, mode)) {
+		close(fd);
+		return -EIO;
+	}
+
+	return close(fd) ? -errno : 0;
+}
+
+/*
+ * Looks a command up in $PATH on behalf of another user. The first match
+ * is ours alone, so nobody has to get the second one, like execvp() would
+ * have done, no matter what the cache remembers from our own lookup.
+ */
+static int t50(void)
+{
+	char dir[] = "/tmp/exec_path_XXXXXX";
+	char path[128];
+	char *saved;
+	int self, other, ret;
+
+	if (!mkdtemp(dir))
+		return -errno;
+	if ((saved = strdup(getenv("PATH") ? getenv("PATH") : "")) == NULL)
+		return -ENOMEM;
+
+	if (chmod(dir, 0755) ||
+	    (ret = path_script(dir, "p1", 5, 0700)) != 0 ||
+	    (ret = path_script(dir, "p2", 7, 0755)) != 0) {
+		ret = ret ? ret : -errno;
+		goto out;
+	}
+
+	snprintf(path, sizeof(path), "%s/p1:%s/p2", dir, dir);
+	setenv("PATH", path, 1);
+	self = exec_process(NULL, true, NULL, USERINFO_TYPE_NONE, "path_cmd",
+	                    NULL);
+	other = exec_process(NULL, true, "nobody", USERINFO_TYPE_NAME,
+	                     "path_cmd", NULL);
+	setenv("PATH", saved, 1);
+
+	fprintf(stderr, "LOOKUP: we got %d, nobody got %d\n", self, other);
+	ret = (self == 5 << 8 && other == 7 << 8) ? 0 : -EIO;
+out:
+	snprintf(path, sizeof(path), "rm -rf %s", dir);
+	if (system(path))
+		ret = ret ? ret : -EIO;
+	free(saved);
+	return ret;
+}
+
+/*
+ * Looks a command up through the spawn server in a $PATH set after the
+ * server has been started. The result must be the same as without it.
+ */
+static int t51(void)
+{
+	char dir[] = "/tmp/exec_path_XXXXXX";
+	char path[128];
+	char *saved;
+	int ret;
+
+	if (!mkdtemp(dir))
+		return -errno;
+	if ((saved = strdup(getenv("PATH") ? getenv("PATH") : "")) == NULL)
+		return -ENOMEM;
+
+	if (chmod(dir, 0755) ||
+	    (ret = path_script(dir, "bin", 7, 0755)) != 0) {
+		ret = ret ? ret : -errno;
+		goto out;
+	}
+
+	if ((ret = exec_server_start()) != 0)
+		goto out;
+
+	snprintf(path, sizeof(path), "%s/bin:%s", dir, saved);
+	setenv("PATH", path, 1);
+	ret = exec_process(NULL, true, NULL, USERINFO_TYPE_NONE, "path_cmd",
+	                   NULL);
+	setenv("PATH", saved, 1);
+	(void) exec_server_stop();
+
+	fprintf(stderr, "LOOKUP: the server got %d\n", ret);
+	ret = ret == 7 << 8 ? 0 : -EIO;
+out:
+	snprintf(path, sizeof(path), "rm -rf %s", dir);
+	if (system(path))
+		ret = ret ? ret : -EIO;
+	free(saved);
+	return ret;
+}
+
+/*
+ * Times a batch wider than one chunk of stamps. Every spawn in it has to
+ * be recorded, the child's stages included.
+ */
+static int t52(void)
+{
+	char *const argv[] = { "/bin/true", NULL };
+	struct exec_timing_snapshot before, after;
+	struct process_info procs[70];
+	struct exec_cmd cmds[70];
+	uint64_t total, closed;
+	unsigned int i;
+	int ret, started;
+
+	if ((ret = exec_timing_snapshot(&before)) != 0)
+		return ret;
+
+	memset(cmds, 0, sizeof(cmds));
+	for (i = 0; i < ARRAY_SIZE(cmds); ++i) {
+		cmds[i].ec_cmd = argv[0];
+		cmds[i].ec_argv = argv;
+	}
+
+	exec_timing_enable(true);
+	started = exec_process_batch(cmds, procs, ARRAY_SIZE(cmds));
+	exec_timing_enable(false);
+	if (started < 0)
+		return started;
+
+	for (i = 0; i < ARRAY_SIZE(cmds); ++i) {
+		if (!cmds[i].ec_result)
+			ret |= wait_for_child(&procs[i], true);
+	}
+	if (ret || (ret = exec_timing_snapshot(&after)) != 0)
+		return ret ? ret : -EIO;
+
+	total = after.ts_stages[EXEC_STAGE_TOTAL].ss_count -
+	        before.ts_stages[EXEC_STAGE_TOTAL].ss_count;
+	closed = after.ts_stages[EXEC_STAGE_CLOSE].ss_count -
+	        before.ts_stages[EXEC_STAGE_CLOSE].ss_count;
+	fprintf(stderr, "TIMING: batch of %d, %llu timed, %llu closed\n",
+	        started, (unsigned long long) total,
+	        (unsigned long long) closed);
+
+	return (started == (int) ARRAY_SIZE(cmds) &&
+	        total == (uint64_t) started &&
+	        closed == (uint64_t) started) ? 0 : -EIO;
+}
+
+const struct testcase testcases[] = {
+	/* wait tests */
+	{ t0,	    0,	true },
+	{ t1,	 3584,	true },
+	{ t2,	- 257,	true },
+	{ t3,	   13,	true },
+	{ t4,	  134,	true },
+	{ t5,	- 256,	true },
+	{ t6,	- 256,	true },
+
+	/* no-wait tests */
+	{ t7,	    0,	true },
+	{ t8,	 3584,	true },
+	{ t9,	- 257,	true },
+	{ t10,	   13,	true },
+	{ t11,	  134,	true },
+	{ t12,	- 256,	true },
+	{ t13,	- 256,	true },
+
+	/* random tests */
+	{ t14,	  512,	true },
+	{ t15,	   15,	true },
+	{ t16,	   15,	true },
+
+	/* spawn backend tests */
+	{ t17,	 3584,	true },
+	{ t18,	- 257,	true },
+	{ t19,	    0,	true },
+	{ t20,	- 256,	true },
+
+	/* descriptor inheritance tests */
+	{ t21,	    0,	true },
+	{ t22,	  512,	true },
+
+	/* spawn server tests */
+	{ t23,	 3584,	true },
+	{ t24,	  512,	true },
+	{ t25,	- 256,	true },
+
+	/* batch tests */
+	{ t26,	 3584,	true },
+
+	/* reaper tests */
+	{ t27,	 3584,	true },
+
+	/* I/O engine tests */
+	{ t28,	    0,	true },
+
+	/* stream mode tests */
+	{ t29,	    0,	true },
+
+	/* deadline tests */
+	{ t30,	    0,	true },
+
+	/* communicate tests */
+	{ t31,	    0,	true },
+
+	/* capture tests */
+	{ t32,	    0,	true },
+
+	/* io_uring engine tests */
+	{ t33,	    0,	true },
+
+	/* pipeline tests */
+	{ t34,	    0,	true },
+
+	/* job pool tests */
+	{ t35,	    0,	true },
+
+	/* user credential cache tests */
+	{ t36,	    0,	true },
+
+	/* spawn specification tests */
+	{ t37,	    0,	true },
+
+	/* PATH cache tests */
+	{ t38,	    0,	true },
+
+	/* spawn timing tests */
+	{ t39,	    0,	true },
+
+	/* resource usage tests */
+	{ t40,	    0,	true },
+
+	/* timed wait tests */
+	{ t41,	    0,	true },
+
+	/* record reader tests */
+	{ t42,	    0,	true },
+
+	/* buffered stream tests */
+	{ t43,	    0,	true },
+
+	/* stdio plan tests */
+	{ t44,	    0,	true },
+
+	/* pipe capacity tests */
+	{ t45,	    0,	true },
+
+	/* memory file tests */
+	{ t46,	    0,	true },
+
+	/* spawn server reaping tests */
+	{ t47,	    0,	true },
+
+	/* buffered writer short count tests */
+	{ t48,	    0,	true },
+
+	/* spawn server lifetime tests */
+	{ t49,	    0,	true },
+
+	/* command lookup on behalf of other users tests */
+	{ t50,	    0,	true },
+
+	/* command lookup in the caller's $PATH by the spawn server tests */
+	{ t51,	    0,	true },
+
+	/* timing of wide batches tests */
+	{ t52,	    0,	true }
 };
 
 static int run_test(const struct testcase *test)
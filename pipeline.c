@@ -0,0 +1,253 @@
+/*
+ * =============================================================================
+ *
+ *       Filename:  pipeline.c
+ *
+ *    Description:  Chain processes without a shell in between
+ *
+ *        Version:  1.0
+ *        Created:  10/17/2026 04:12:55 PM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Oliver Lorenz (ol), olli@olorenz.org
+ *
+ * =============================================================================
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include "exec.h"
+#include "internal.h"
+
+#define TAP_MAX_POLL		64U
+
+static void close_fd(int *fd)
+{
+	if (*fd != -1) {
+		close(*fd);
+		*fd = -1;
+	}
+}
+
+static bool tap_wanted(const struct exec_tap *taps, unsigned int i)
+{
+	return taps && taps[i].et_fd != -1;
+}
+
+/*
+ * Sets up the link between stage @i and @i + 1. Stage @i writes to
+ * @link[1], stage @i + 1 reads from @link[0]; with a tap, we sit in between.
+ */
+static int link_stages(struct exec_tap *tap, int link[2])
+{
+	int upstream[2], downstream[2];
+
+	if (!tap)
+		return pipe2(link, O_CLOEXEC) ? -errno : 0;
+
+	if (pipe2(upstream, O_CLOEXEC))
+		return -errno;
+
+	if (pipe2(downstream, O_CLOEXEC)) {
+		close(upstream[0]);
+		close(upstream[1]);
+		return -errno;
+	}
+
+	tap->et_in = upstream[0];
+	tap->et_out = downstream[1];
+	tap->et_bytes = 0;
+	tap->et_blocked = false;
+	tap->et_splice = true;
+
+	link[0] = downstream[0];
+	link[1] = upstream[1];
+
+	if (fd_make_nonblocking(tap->et_in) ||
+	    fd_make_nonblocking(tap->et_out))
+		return -errno;
+
+	return 0;
+}
+
+static void tap_close(struct exec_tap *tap)
+{
+	close_fd(&tap->et_in);
+	close_fd(&tap->et_out);
+}
+
+int exec_pipeline(struct exec_cmd *cmds, struct process_info *procs,
+                  unsigned int num, struct exec_tap *taps)
+{
+	struct spawn_env env;
+	int link[2] = { -1, -1 };
+	int prev_rd = -1;
+	unsigned int i, started;
+	int res = 0;
+
+	if (!num)
+		return -EINVAL;
+
+	for (i = 0; taps && i + 1 < num; ++i)
+		taps[i].et_in = taps[i].et_out = -1;
+
+	for (started = 0; started < num; ++started) {
+		i = started;
+
+		memset(&env, 0, sizeof(env));
+		env.se_cwd_fd = -1;
+		env.se_stdio_fds[0] = prev_rd;
+		env.se_stdio_fds[1] = -1;
+		env.se_stdio_fds[2] = -1;
+
+		if (i + 1 < num) {
+			res = link_stages(tap_wanted(taps, i) ?
+			                  &taps[i] : NULL, link);
+			if (res)
+				break;
+			env.se_stdio_fds[1] = link[1];
+		}
+
+		/* stages run locally, the server can't splice pipes in */
+		res = exec_spawn_env(&procs[i], false, cmds[i].ec_user,
+		                     cmds[i].ec_user_type, cmds[i].ec_cmd,
+		                     cmds[i].ec_argv, cmds[i].ec_attr, &env);
+		cmds[i].ec_result = res;
+
+		/* the children hold on to their ends now */
+		close_fd(&prev_rd);
+		close_fd(&link[1]);
+		prev_rd = link[0];
+		link[0] = -1;
+
+		if (res)
+			break;
+	}
+
+	if (!res)
+		return 0;
+
+	/* half a pipeline is no pipeline, take down what's running */
+	close_fd(&prev_rd);
+	close_fd(&link[0]);
+	close_fd(&link[1]);
+	for (i = 0; taps && i + 1 < num; ++i)
+		tap_close(&taps[i]);
+
+	for (i = 0; i < started; ++i) {
+		kill(procs[i].pi_pid, SIGKILL);
+		(void) wait_for_child(&procs[i], true);
+	}
+
+	return res;
+}
+
+/*
+ * Duplicates whatever sits in the upstream pipe into the downstream one
+ * with tee(2), then moves the same amount to the tap's target.
+ */
+static int tap_move(struct exec_tap *tap)
+{
+	bool was_blocked = tap->et_blocked;
+	ssize_t count, moved;
+	size_t left;
+
+	do {
+		count = tee(tap->et_in, tap->et_out, INT_MAX,
+		            SPLICE_F_NONBLOCK);
+	} while (count == -1 && errno == EINTR);
+
+	if (count == -1) {
+		if (errno == EAGAIN) {
+			/*
+			 * If room turned up downstream, we're short of data
+			 * now, otherwise of room.
+			 */
+			tap->et_blocked = !was_blocked;
+			return 0;
+		}
+		/* the next stage is gone, so is this link */
+		count = errno;
+		tap_close(tap);
+		return count == EPIPE ? 0 : (int) -count;
+	}
+
+	tap->et_blocked = false;
+
+	if (count == 0) {
+		/* the next stage sees end of file once we let go */
+		tap_close(tap);
+		return 0;
+	}
+
+	for (left = (size_t) count; left; left -= (size_t) moved) {
+		moved = fd_transfer(tap->et_in, tap->et_fd, left,
+		                    &tap->et_splice, NULL);
+		if (moved <= 0) {
+			tap_close(tap);
+			return moved ? (int) moved : -EIO;
+		}
+		tap->et_bytes += (uint64_t) moved;
+	}
+
+	return 0;
+}
+
+int exec_tap_pump(struct exec_tap *taps, unsigned int num, int timeout)
+{
+	struct pollfd pfds[TAP_MAX_POLL];
+	unsigned int i, open;
+	int ret;
+
+	if (num > TAP_MAX_POLL)
+		return -EINVAL;
+
+	open = 0;
+	for (i = 0; i < num; ++i) {
+		pfds[i].fd = -1;
+		pfds[i].events = 0;
+		if (taps[i].et_in == -1)
+			continue;
+
+		/* a full downstream pipe is what we have to wait for then */
+		if (taps[i].et_blocked) {
+			pfds[i].fd = taps[i].et_out;
+			pfds[i].events = POLLOUT;
+		} else {
+			pfds[i].fd = taps[i].et_in;
+			pfds[i].events = POLLIN;
+		}
+		++open;
+	}
+
+	if (!open)
+		return 0;
+
+	do {
+		ret = poll(pfds, (nfds_t) num, timeout);
+	} while (ret == -1 && errno == EINTR);
+
+	if (ret == -1)
+		return -errno;
+
+	for (i = 0; i < num; ++i) {
+		if (pfds[i].fd == -1 || !pfds[i].revents)
+			continue;
+
+		if ((ret = tap_move(&taps[i])) != 0)
+			return ret;
+	}
+
+	open = 0;
+	for (i = 0; i < num; ++i)
+		open += (taps[i].et_in != -1);
+
+	return (int) open;
+}
@@ -0,0 +1,506 @@
+/*
+ * =============================================================================
+ *
+ *       Filename:  pool.c
+ *
+ *    Description:  Run queued commands with bounded concurrency
+ *
+ *        Version:  1.0
+ *        Created:  10/17/2026 05:02:41 PM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Oliver Lorenz (ol), olli@olorenz.org
+ *
+ * =============================================================================
+ */
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include "pool.h"
+#include "ioengine.h"
+#include "internal.h"
+
+#define POOL_QUEUE_MIN		16U
+#define POOL_BACKOFF_MIN_NS	1000000ULL
+#define POOL_BACKOFF_MAX_NS	256000000ULL
+#define POOL_MAX_RETRIES	10U
+
+struct pool_slot {
+	struct exec_job     *pj_job;
+	struct process_info  pj_proc;
+	struct exec_io_proc *pj_handle;
+	uint64_t             pj_deadline;
+	int                  pj_signal;
+};
+
+struct exec_pool {
+	struct exec_io          *pl_io;
+	struct pool_slot        *pl_slots;
+	unsigned int             pl_max_running;
+	unsigned int             pl_max_queued;
+	unsigned int             pl_limit;
+	struct exec_job        **pl_queue;
+	unsigned int             pl_head;
+	unsigned int             pl_size;
+	unsigned int             pl_retries;
+	uint64_t                 pl_backoff_ns;
+	uint64_t                 pl_retry_at;
+	uint64_t                 pl_busy_since;
+	struct exec_pool_stats   pl_stats;
+};
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * NSEC_PER_SEC + (uint64_t) ts.tv_nsec;
+}
+
+static void pool_exit(struct exec_io_proc *p, void *arg)
+{
+	/* nothing to do, completion is checked after each iteration */
+	(void) p;
+	(void) arg;
+}
+
+static const struct exec_io_ops pool_ops = { NULL, NULL, pool_exit };
+
+static bool pool_busy(const struct exec_pool *pool)
+{
+	return pool->pl_stats.ps_queued || pool->pl_stats.ps_running;
+}
+
+/* account busy time whenever the pool turns idle */
+static void pool_update_busy(struct exec_pool *pool, bool was_busy)
+{
+	bool busy = pool_busy(pool);
+
+	if (!was_busy && busy) {
+		pool->pl_busy_since = now_ns();
+	} else if (was_busy && !busy) {
+		pool->pl_stats.ps_busy_ns += now_ns() - pool->pl_busy_since;
+	}
+}
+
+static int queue_push(struct exec_pool *pool, struct exec_job *job)
+{
+	struct exec_job **queue;
+	unsigned int count = pool->pl_stats.ps_queued;
+	unsigned int size, i;
+
+	if (count == pool->pl_size) {
+		size = pool->pl_size ? pool->pl_size * 2 : POOL_QUEUE_MIN;
+		queue = malloc(size * sizeof(*queue));
+		if (!queue)
+			return -ENOMEM;
+
+		/* unwrap while moving over */
+		for (i = 0; i < count; ++i)
+			queue[i] = pool->pl_queue[(pool->pl_head + i) %
+			                          pool->pl_size];
+
+		free(pool->pl_queue);
+		pool->pl_queue = queue;
+		pool->pl_size = size;
+		pool->pl_head = 0;
+	}
+
+	pool->pl_queue[(pool->pl_head + count) % pool->pl_size] = job;
+	++pool->pl_stats.ps_queued;
+	return 0;
+}
+
+static struct exec_job *queue_pop(struct exec_pool *pool)
+{
+	struct exec_job *job = pool->pl_queue[pool->pl_head];
+
+	pool->pl_head = (pool->pl_head + 1) % pool->pl_size;
+	--pool->pl_stats.ps_queued;
+	return job;
+}
+
+static void job_complete(struct exec_pool *pool, struct exec_job *job,
+                         struct exec_job_result *res)
+{
+	if (res->jr_status < 0)
+		++pool->pl_stats.ps_failed;
+	++pool->pl_stats.ps_completed;
+
+	if (job->ej_done)
+		job->ej_done(job, res, job->ej_arg);
+}
+
+/*
+ * A job that couldn't be started for lack of resources. While others are
+ * running, there's no point in trying before one of them has completed;
+ * with nothing running, only waiting helps.
+ */
+static bool job_defer(struct exec_pool *pool, int err)
+{
+	if (err != -EAGAIN && err != -EMFILE && err != -ENFILE)
+		return false;
+
+	if (pool->pl_stats.ps_running) {
+		pool->pl_limit = pool->pl_stats.ps_running;
+		++pool->pl_stats.ps_backoffs;
+		return true;
+	}
+
+	if (pool->pl_retries == POOL_MAX_RETRIES)
+		return false;
+
+	if (pool->pl_backoff_ns < POOL_BACKOFF_MIN_NS)
+		pool->pl_backoff_ns = POOL_BACKOFF_MIN_NS;
+	else if (pool->pl_backoff_ns < POOL_BACKOFF_MAX_NS)
+		pool->pl_backoff_ns *= 2;
+
+	pool->pl_retry_at = now_ns() + pool->pl_backoff_ns;
+	++pool->pl_retries;
+	++pool->pl_stats.ps_backoffs;
+	return true;
+}
+
+static int job_start(struct exec_pool *pool, struct pool_slot *slot,
+                     struct exec_job *job)
+{
+	const struct exec_cmd *cmd = &job->ej_cmd;
+	int ret;
+
+	ret = exec_process_attr(&slot->pj_proc, false, cmd->ec_user,
+	                        cmd->ec_user_type, cmd->ec_cmd, cmd->ec_argv,
+	                        cmd->ec_attr);
+	if (ret)
+		return ret;
+
+	slot->pj_handle = exec_io_add(pool->pl_io, &slot->pj_proc,
+	                              &pool_ops, NULL);
+	if (!slot->pj_handle) {
+		ret = -errno;
+		goto fail;
+	}
+
+	if (job->ej_input_size) {
+		ret = exec_io_write(slot->pj_handle, job->ej_input,
+		                    job->ej_input_size);
+		if (ret) {
+			exec_io_remove(slot->pj_handle);
+			slot->pj_handle = NULL;
+			goto fail;
+		}
+	}
+
+	exec_io_close_stdin(slot->pj_handle);
+	slot->pj_job = job;
+	slot->pj_signal = 0;
+	slot->pj_deadline = job->ej_timeout ?
+	                    now_ns() + job->ej_timeout * NSEC_PER_MSEC : 0;
+	return 0;
+
+fail:
+	kill(slot->pj_proc.pi_pid, SIGKILL);
+	(void) wait_for_child(&slot->pj_proc, true);
+	return ret;
+}
+
+static struct pool_slot *pool_free_slot(struct exec_pool *pool)
+{
+	unsigned int i;
+
+	for (i = 0; i < pool->pl_max_running; ++i) {
+		if (!pool->pl_slots[i].pj_job)
+			return &pool->pl_slots[i];
+	}
+
+	return NULL;
+}
+
+static void pool_start(struct exec_pool *pool)
+{
+	struct exec_job_result res;
+	struct exec_pool_stats *stats = &pool->pl_stats;
+	struct pool_slot *slot;
+	struct exec_job *job;
+	int ret;
+
+	if (pool->pl_retry_at && now_ns() < pool->pl_retry_at)
+		return;
+	pool->pl_retry_at = 0;
+
+	while (stats->ps_queued && stats->ps_running < pool->pl_limit) {
+		slot = pool_free_slot(pool);
+		job = pool->pl_queue[pool->pl_head];
+
+		ret = job_start(pool, slot, job);
+		if (ret && job_defer(pool, ret))
+			return;
+
+		(void) queue_pop(pool);
+		job->ej_cmd.ec_result = ret;
+		pool->pl_retries = 0;
+		pool->pl_backoff_ns = 0;
+
+		if (ret) {
+			memset(&res, 0, sizeof(res));
+			res.jr_status = ret;
+			job_complete(pool, job, &res);
+			continue;
+		}
+
+		if (++stats->ps_running > stats->ps_peak_running)
+			stats->ps_peak_running = stats->ps_running;
+	}
+}
+
+/*
+ * Signals jobs that have run past ej_timeout: SIGTERM first if they have
+ * a grace period, SIGKILL once that is over. They complete as usual once
+ * they have exited and their streams are drained.
+ */
+static void pool_expire(struct exec_pool *pool)
+{
+	struct pool_slot *slot;
+	struct exec_job *job;
+	unsigned int i;
+	uint64_t now;
+
+	now = now_ns();
+	for (i = 0; i < pool->pl_max_running; ++i) {
+		slot = &pool->pl_slots[i];
+		job = slot->pj_job;
+		if (!job || !slot->pj_deadline || now < slot->pj_deadline)
+			continue;
+
+		if (!slot->pj_signal)
+			++pool->pl_stats.ps_timeouts;
+
+		/* not reaped before completion, the PID is still ours */
+		if (!slot->pj_signal && job->ej_grace) {
+			slot->pj_signal = SIGTERM;
+			slot->pj_deadline = now + job->ej_grace * NSEC_PER_MSEC;
+		} else {
+			slot->pj_signal = SIGKILL;
+			slot->pj_deadline = 0;
+		}
+
+		(void) kill(slot->pj_proc.pi_pid, slot->pj_signal);
+	}
+}
+
+/* the earliest retry or job deadline, %0 for none */
+static uint64_t pool_wake_at(const struct exec_pool *pool)
+{
+	const struct pool_slot *slot;
+	uint64_t wake_at = pool->pl_retry_at;
+	unsigned int i;
+
+	for (i = 0; i < pool->pl_max_running; ++i) {
+		slot = &pool->pl_slots[i];
+		if (!slot->pj_job || !slot->pj_deadline)
+			continue;
+		if (!wake_at || slot->pj_deadline < wake_at)
+			wake_at = slot->pj_deadline;
+	}
+
+	return wake_at;
+}
+
+static bool slot_finished(const struct pool_slot *slot)
+{
+	if (!exec_io_done(slot->pj_handle))
+		return false;
+
+	/* without a pidfd, drained streams are all we can go by */
+	return slot->pj_proc.pi_pidfd == -1 || exec_io_exited(slot->pj_handle);
+}
+
+static void slot_close(struct process_info *proc)
+{
+	if (proc->pi_stdin != -1)
+		close(proc->pi_stdin);
+	close(proc->pi_stdout);
+	close(proc->pi_stderr);
+	if (proc->pi_pidfd != -1)
+		close(proc->pi_pidfd);
+}
+
+static void slot_complete(struct exec_pool *pool, struct pool_slot *slot)
+{
+	struct exec_job_result res;
+	struct exec_job *job = slot->pj_job;
+
+	memset(&res, 0, sizeof(res));
+	res.jr_pid = slot->pj_proc.pi_pid;
+	res.jr_output = exec_io_captured(slot->pj_handle, EXEC_IO_STDOUT,
+	                                 &res.jr_output_size);
+	res.jr_errors = exec_io_captured(slot->pj_handle, EXEC_IO_STDERR,
+	                                 &res.jr_errors_size);
+	if ((res.jr_truncated = exec_io_error(slot->pj_handle,
+	                                      EXEC_IO_STDOUT)) == 0)
+		res.jr_truncated = exec_io_error(slot->pj_handle,
+		                                 EXEC_IO_STDERR);
+
+	/* the engine still watches the descriptors, keep them for now */
+	if (wait_for_child(&slot->pj_proc, false))
+		res.jr_status = -errno;
+	else
+		res.jr_status = slot->pj_proc.pi_retval;
+	res.jr_usage = slot->pj_proc.pi_usage;
+
+	slot->pj_job = NULL;
+	--pool->pl_stats.ps_running;
+	if (pool->pl_limit < pool->pl_max_running)
+		++pool->pl_limit;
+
+	/* the slot is free already, but the output lives until removal */
+	job_complete(pool, job, &res);
+
+	exec_io_remove(slot->pj_handle);
+	slot->pj_handle = NULL;
+	slot_close(&slot->pj_proc);
+}
+
+struct exec_pool *exec_pool_new(unsigned int max_running,
+                                unsigned int max_queued)
+{
+	struct exec_pool *pool;
+
+	if (!max_running) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if ((pool = calloc(1, sizeof(*pool))) == NULL)
+		return NULL;
+
+	pool->pl_slots = calloc(max_running, sizeof(*pool->pl_slots));
+	if (!pool->pl_slots)
+		goto fail;
+
+	if ((pool->pl_io = exec_io_new()) == NULL)
+		goto fail;
+
+	pool->pl_max_running = max_running;
+	pool->pl_max_queued = max_queued;
+	pool->pl_limit = max_running;
+	return pool;
+
+fail:
+	free(pool->pl_slots);
+	free(pool);
+	return NULL;
+}
+
+void exec_pool_free(struct exec_pool *pool)
+{
+	struct pool_slot *slot;
+	unsigned int i;
+
+	if (!pool)
+		return;
+
+	for (i = 0; i < pool->pl_max_running; ++i) {
+		slot = &pool->pl_slots[i];
+		if (!slot->pj_job)
+			continue;
+
+		exec_io_remove(slot->pj_handle);
+		kill(slot->pj_proc.pi_pid, SIGKILL);
+		(void) wait_for_child(&slot->pj_proc, true);
+	}
+
+	exec_io_free(pool->pl_io);
+	free(pool->pl_queue);
+	free(pool->pl_slots);
+	free(pool);
+}
+
+int exec_pool_submit(struct exec_pool *pool, struct exec_job *job)
+{
+	struct exec_pool_stats *stats = &pool->pl_stats;
+	bool was_busy = pool_busy(pool);
+	int ret;
+
+	if (pool->pl_max_queued && stats->ps_queued >= pool->pl_max_queued) {
+		++stats->ps_rejected;
+		return -EAGAIN;
+	}
+
+	if ((ret = queue_push(pool, job)) != 0)
+		return ret;
+
+	++stats->ps_submitted;
+	if (stats->ps_queued > stats->ps_peak_queued)
+		stats->ps_peak_queued = stats->ps_queued;
+
+	pool_update_busy(pool, was_busy);
+	return 0;
+}
+
+int exec_pool_run(struct exec_pool *pool, int timeout)
+{
+	struct exec_pool_stats *stats = &pool->pl_stats;
+	bool was_busy = pool_busy(pool);
+	uint64_t now, wake_at, wait_ms;
+	unsigned int i;
+	int ret;
+
+	pool_start(pool);
+
+	/* don't sleep past the next retry or job deadline */
+	wake_at = pool_wake_at(pool);
+	if (wake_at) {
+		now = now_ns();
+		wait_ms = wake_at > now ?
+		          (wake_at - now + 999999) / 1000000 : 0;
+		if (timeout < 0 || wait_ms < (uint64_t) timeout)
+			timeout = (int) wait_ms;
+	}
+
+	if (stats->ps_running || pool->pl_retry_at) {
+		ret = exec_io_run(pool->pl_io, timeout);
+		if (ret < 0)
+			goto out;
+	}
+
+	pool_expire(pool);
+
+	for (i = 0; i < pool->pl_max_running; ++i) {
+		if (pool->pl_slots[i].pj_job &&
+		    slot_finished(&pool->pl_slots[i]))
+			slot_complete(pool, &pool->pl_slots[i]);
+	}
+
+	/* fill slots freed above right away */
+	pool_start(pool);
+	ret = (int) (stats->ps_queued + stats->ps_running);
+out:
+	pool_update_busy(pool, was_busy);
+	return ret;
+}
+
+int exec_pool_wait(struct exec_pool *pool)
+{
+	int ret;
+
+	while ((ret = exec_pool_run(pool, -1)) > 0)
+		;
+
+	return ret;
+}
+
+void exec_pool_stats(const struct exec_pool *pool,
+                     struct exec_pool_stats *stats)
+{
+	*stats = pool->pl_stats;
+	stats->ps_limit = pool->pl_limit;
+
+	if (pool_busy(pool))
+		stats->ps_busy_ns += now_ns() - pool->pl_busy_since;
+}
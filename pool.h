@@ -0,0 +1,203 @@
+/*
+ * =============================================================================
+ *
+ *       Filename:  pool.h
+ *
+ *    Description:  Run queued commands with bounded concurrency
+ *
+ *        Version:  1.0
+ *        Created:  10/17/2026 05:02:41 PM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Oliver Lorenz (ol), olli@olorenz.org
+ *
+ * =============================================================================
+ */
+
+#ifndef PROCEXEC_POOL_H
+#define PROCEXEC_POOL_H
+
+#include <stdint.h>
+#include "exec.h"
+
+
+/**
+ * struct exec_job_result - outcome of a job
+ * @jr_pid:			PID the job ran as, %0 if it never started
+ * @jr_status:			what exec_process() with @wait set would have
+ *				returned: the child's status as understood by
+ *				get_exit_details(), or a negative error code
+ *				if it couldn't be started or waited for
+ * @jr_output:			the job's standard output, %NULL if empty
+ * @jr_output_size:		size of @jr_output
+ * @jr_errors:			the job's standard error, %NULL if empty
+ * @jr_errors_size:		size of @jr_errors
+ * @jr_truncated:		%0, or a negative error code if @jr_output or
+ *				@jr_errors have been cut short, see
+ *				exec_io_error()
+ * @jr_usage:			resources used by the job, zero if it never
+ *				started
+ *
+ * The output buffers belong to the pool and are only valid for the
+ * duration of the completion callback.
+ */
+struct exec_job_result {
+	pid_t             jr_pid;
+	int               jr_status;
+	const void       *jr_output;
+	size_t            jr_output_size;
+	const void       *jr_errors;
+	size_t            jr_errors_size;
+	int               jr_truncated;
+	struct exec_usage jr_usage;
+};
+
+
+/**
+ * struct exec_job - job descriptor for exec_pool_submit()
+ * @ej_cmd:			the command to run, @ec_result is set once the
+ *				job has been started or has failed to start
+ * @ej_input:			data for the job's standard input, copied when
+ *				the job starts. Standard input is closed
+ *				afterwards
+ * @ej_input_size:		size of @ej_input
+ * @ej_timeout:			time in milliseconds the job may run before it
+ *				is signalled, %0 for no limit
+ * @ej_grace:			time in milliseconds between SIGTERM and
+ *				SIGKILL once @ej_timeout has passed, %0 to
+ *				send SIGKILL right away
+ * @ej_done:			called once the job has exited and its output
+ *				has been drained, may be %NULL
+ * @ej_arg:			passed to @ej_done
+ */
+struct exec_job {
+	struct exec_cmd   ej_cmd;
+	const void       *ej_input;
+	size_t            ej_input_size;
+	unsigned int      ej_timeout;
+	unsigned int      ej_grace;
+	void            (*ej_done)(struct exec_job *job,
+	                           const struct exec_job_result *res,
+	                           void *arg);
+	void             *ej_arg;
+};
+
+
+/**
+ * struct exec_pool_stats - pool counters
+ * @ps_queued:			jobs waiting to be started
+ * @ps_running:			jobs started and not yet completed
+ * @ps_limit:			jobs currently allowed to run at once, lowered
+ *				below the pool's maximum after spawning failed
+ *				for lack of resources
+ * @ps_peak_queued:		highest @ps_queued seen
+ * @ps_peak_running:		highest @ps_running seen
+ * @ps_submitted:		jobs accepted by exec_pool_submit()
+ * @ps_rejected:		jobs turned away because the queue was full
+ * @ps_completed:		jobs whose callback has been called
+ * @ps_failed:			completed jobs that couldn't be started
+ * @ps_backoffs:		spawns deferred because fork(2) or the
+ *				descriptor tables ran out of resources
+ * @ps_timeouts:		jobs signalled for running past @ej_timeout
+ * @ps_busy_ns:			time the pool had jobs queued or running
+ *
+ * Run-to-completion throughput is @ps_completed per @ps_busy_ns.
+ */
+struct exec_pool_stats {
+	unsigned int ps_queued;
+	unsigned int ps_running;
+	unsigned int ps_limit;
+	unsigned int ps_peak_queued;
+	unsigned int ps_peak_running;
+	uint64_t     ps_submitted;
+	uint64_t     ps_rejected;
+	uint64_t     ps_completed;
+	uint64_t     ps_failed;
+	uint64_t     ps_backoffs;
+	uint64_t     ps_timeouts;
+	uint64_t     ps_busy_ns;
+};
+
+
+struct exec_pool;
+
+
+/**
+ * exec_pool_new - create a job pool
+ * @max_running:		maximum number of jobs running at once
+ * @max_queued:			maximum number of jobs waiting to be started,
+ *				%0 for no limit
+ *
+ * Jobs are started in submission order as soon as fewer than
+ * @max_running are running. Their standard streams are driven by an
+ * I/O engine, see exec_io_new(). If starting a job fails with %EAGAIN,
+ * %EMFILE or %ENFILE, the job stays at the head of the queue and the
+ * number of concurrent jobs is capped at what is running, then raised by
+ * one per completed job. With nothing running, starting is retried with
+ * exponential backoff before the job is failed.
+ * NOTE: writing to a job that has exited raises SIGPIPE, callers
+ *       should ignore it.
+ *
+ * @return: the new pool, or %NULL with @errno set.
+ */
+extern struct exec_pool *exec_pool_new(unsigned int max_running,
+                                       unsigned int max_queued);
+
+
+/**
+ * exec_pool_free - destroy a job pool
+ * @pool:			pool to destroy, may be %NULL
+ *
+ * Running jobs are killed and reaped, queued jobs are dropped. No
+ * callbacks are called.
+ */
+extern void exec_pool_free(struct exec_pool *pool);
+
+
+/**
+ * exec_pool_submit - queue a job
+ * @pool:			the pool
+ * @job:			the job
+ *
+ * @job is referenced, not copied, and must stay valid until its callback
+ * has been called. Jobs are only started from exec_pool_run().
+ *
+ * @return: On success, %0 is returned, otherwise a negative error code.
+ *          %-EAGAIN if the queue is full.
+ */
+extern int exec_pool_submit(struct exec_pool *pool, struct exec_job *job);
+
+
+/**
+ * exec_pool_run - start queued jobs and wait for progress
+ * @pool:			the pool
+ * @timeout:			time to wait in milliseconds, %-1 to wait
+ *                              forever, %0 to return immediately
+ *
+ * Completion callbacks are called from here and may submit new jobs, but
+ * must not call exec_pool_run() themselves.
+ *
+ * @return: the number of jobs queued or running, or a negative error code.
+ */
+extern int exec_pool_run(struct exec_pool *pool, int timeout);
+
+
+/**
+ * exec_pool_wait - run a pool until all jobs have completed
+ * @pool:			the pool
+ *
+ * @return: On success, %0 is returned, otherwise a negative error code.
+ */
+extern int exec_pool_wait(struct exec_pool *pool);
+
+
+/**
+ * exec_pool_stats - get the counters of a job pool
+ * @pool:			the pool
+ * @stats:			filled with the counters
+ */
+extern void exec_pool_stats(const struct exec_pool *pool,
+                            struct exec_pool_stats *stats);
+
+#endif
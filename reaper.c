@@ -0,0 +1,198 @@
+/*
+ * =============================================================================
+ *
+ *       Filename:  reaper.c
+ *
+ *    Description:  Wait for many child processes at once
+ *
+ *        Version:  1.0
+ *        Created:  10/17/2026 11:20:37 AM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Oliver Lorenz (ol), olli@olorenz.org
+ *
+ * =============================================================================
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+#include "reaper.h"
+#include "internal.h"
+
+#define REAPER_MAX_EVENTS	64U
+
+struct exec_reaper {
+	int          er_epfd;
+	unsigned int er_count;
+};
+
+#ifdef __linux__
+struct exec_reaper *exec_reaper_new(void)
+{
+	struct exec_reaper *reaper;
+
+	if ((reaper = malloc(sizeof(*reaper))) == NULL)
+		return NULL;
+
+	reaper->er_epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (reaper->er_epfd == -1) {
+		free(reaper);
+		return NULL;
+	}
+	reaper->er_count = 0;
+
+	return reaper;
+}
+
+void exec_reaper_free(struct exec_reaper *reaper)
+{
+	if (!reaper)
+		return;
+
+	close(reaper->er_epfd);
+	free(reaper);
+}
+
+int exec_reaper_fd(const struct exec_reaper *reaper)
+{
+	return reaper->er_epfd;
+}
+
+int exec_reaper_add(struct exec_reaper *reaper, struct process_info *proc)
+{
+	struct epoll_event ev;
+
+	if (proc->pi_pidfd < 0)
+		return -EBADF;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.ptr = proc;
+
+	if (epoll_ctl(reaper->er_epfd, EPOLL_CTL_ADD, proc->pi_pidfd, &ev))
+		return -errno;
+
+	++reaper->er_count;
+	return 0;
+}
+
+int exec_reaper_del(struct exec_reaper *reaper, struct process_info *proc)
+{
+	if (epoll_ctl(reaper->er_epfd, EPOLL_CTL_DEL, proc->pi_pidfd, NULL))
+		return -errno;
+
+	--reaper->er_count;
+	return 0;
+}
+
+unsigned int exec_reaper_count(const struct exec_reaper *reaper)
+{
+	return reaper->er_count;
+}
+
+int exec_reaper_wait(struct exec_reaper *reaper, struct process_info **done,
+                     unsigned int max, int timeout)
+{
+	struct epoll_event events[REAPER_MAX_EVENTS];
+	struct process_info *proc;
+	struct rusage ru;
+	int i, num, reaped;
+	pid_t child;
+
+	if (!max)
+		return 0;
+	if (max > REAPER_MAX_EVENTS)
+		max = REAPER_MAX_EVENTS;
+
+	do {
+		num = epoll_wait(reaper->er_epfd, events, (int) max, timeout);
+	} while (num == -1 && errno == EINTR);
+
+	if (num == -1)
+		return -errno;
+
+	reaped = 0;
+	for (i = 0; i < num; ++i) {
+		proc = events[i].data.ptr;
+
+		/* a readable pidfd means there is a zombie waiting for us */
+		do {
+			child = wait4(proc->pi_pid, &proc->pi_retval,
+			              WNOHANG, &ru);
+		} while (child == (pid_t) -1 && errno == EINTR);
+
+		if (child == 0)
+			continue;
+
+		if (child == (pid_t) -1)
+			proc->pi_retval = -errno;
+		else
+			usage_from_rusage(&proc->pi_usage, &ru);
+
+		(void) epoll_ctl(reaper->er_epfd, EPOLL_CTL_DEL,
+		                 proc->pi_pidfd, NULL);
+		close(proc->pi_pidfd);
+		proc->pi_pidfd = -1;
+		--reaper->er_count;
+
+		done[reaped++] = proc;
+	}
+
+	return reaped;
+}
+#else
+struct exec_reaper *exec_reaper_new(void)
+{
+	errno = ENOSYS;
+	return NULL;
+}
+
+void exec_reaper_free(struct exec_reaper *reaper)
+{
+	free(reaper);
+}
+
+int exec_reaper_fd(const struct exec_reaper *reaper)
+{
+	(void) reaper;
+	return -1;
+}
+
+int exec_reaper_add(struct exec_reaper *reaper, struct process_info *proc)
+{
+	(void) reaper;
+	(void) proc;
+	return -ENOSYS;
+}
+
+int exec_reaper_del(struct exec_reaper *reaper, struct process_info *proc)
+{
+	(void) reaper;
+	(void) proc;
+	return -ENOSYS;
+}
+
+unsigned int exec_reaper_count(const struct exec_reaper *reaper)
+{
+	(void) reaper;
+	return 0;
+}
+
+int exec_reaper_wait(struct exec_reaper *reaper, struct process_info **done,
+                     unsigned int max, int timeout)
+{
+	(void) reaper;
+	(void) done;
+	(void) max;
+	(void) timeout;
+	return -ENOSYS;
+}
+#endif
@@ -0,0 +1,112 @@
+/*
+ * =============================================================================
+ *
+ *       Filename:  reaper.h
+ *
+ *    Description:  Wait for many child processes at once
+ *
+ *        Version:  1.0
+ *        Created:  10/17/2026 11:20:37 AM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Oliver Lorenz (ol), olli@olorenz.org
+ *
+ * =============================================================================
+ */
+
+#ifndef PROCEXEC_REAPER_H
+#define PROCEXEC_REAPER_H
+
+#include "exec.h"
+
+
+struct exec_reaper;
+
+
+/**
+ * exec_reaper_new - create a reaper
+ *
+ * A reaper watches the pidfds of any number of child processes through
+ * a single epoll(7) instance, so waiting costs O(ready) per wake-up no
+ * matter how many children are registered.
+ *
+ * @return: the new reaper, or %NULL with @errno set.
+ */
+extern struct exec_reaper *exec_reaper_new(void);
+
+
+/**
+ * exec_reaper_free - destroy a reaper
+ * @reaper:			reaper to destroy, may be %NULL
+ *
+ * Children still registered are neither waited for nor otherwise touched.
+ */
+extern void exec_reaper_free(struct exec_reaper *reaper);
+
+
+/**
+ * exec_reaper_fd - get the reaper's epoll descriptor
+ * @reaper:			the reaper
+ *
+ * The descriptor becomes readable whenever a registered child has exited
+ * and can be watched by an outer event loop.
+ */
+extern int exec_reaper_fd(const struct exec_reaper *reaper);
+
+
+/**
+ * exec_reaper_add - watch a child process
+ * @reaper:			the reaper
+ * @proc:			the child, as filled by exec_process()
+ *
+ * @proc is referenced, not copied, and must stay valid until it has been
+ * returned by exec_reaper_wait() or removed with exec_reaper_del().
+ *
+ * @return: On success, %0 is returned, otherwise a negative error
+ *          code. %-EBADF if @proc doesn't carry a pidfd.
+ */
+extern int exec_reaper_add(struct exec_reaper *reaper,
+                           struct process_info *proc);
+
+
+/**
+ * exec_reaper_del - stop watching a child process
+ * @reaper:			the reaper
+ * @proc:			a child previously passed to exec_reaper_add()
+ *
+ * @return: On success, %0 is returned, otherwise a negative error code.
+ */
+extern int exec_reaper_del(struct exec_reaper *reaper,
+                           struct process_info *proc);
+
+
+/**
+ * exec_reaper_count - get the number of children being watched
+ * @reaper:			the reaper
+ */
+extern unsigned int exec_reaper_count(const struct exec_reaper *reaper);
+
+
+/**
+ * exec_reaper_wait - reap children that have exited
+ * @reaper:			the reaper
+ * @done:			storage for up to @max pointers to reaped
+ *                              children
+ * @max:			size of @done
+ * @timeout:			time to wait in milliseconds, %-1 to wait
+ *                              forever, %0 to return immediately
+ *
+ * exec_reaper_wait() waits until at least one watched child has exited,
+ * reaps up to @max of them and stores them in @done. Each reaped child
+ * has its exit status in @pi_retval and its resource usage in @pi_usage,
+ * its pidfd closed and is no longer watched. Its pipes are left alone.
+ *
+ * @return: the number of children reaped, %0 on timeout,
+ *          or a negative error code.
+ */
+extern int exec_reaper_wait(struct exec_reaper *reaper,
+                            struct process_info **done, unsigned int max,
+                            int timeout);
+
+#endif
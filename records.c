@@ -0,0 +1,299 @@
+/*
+ * =============================================================================
+ *
+ *       Filename:  records.c
+ *
+ *    Description:  Split the output of a process into records
+ *
+ *        Version:  1.0
+ *        Created:  10/17/2026 09:41:18 PM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Oliver Lorenz (ol), olli@olorenz.org
+ *
+ * =============================================================================
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "records.h"
+#include "internal.h"
+
+#define RECORDS_MIN_SIZE	(64 * 1024)
+#define RECORDS_MAX_SIZE	(1024 * 1024)
+/* below this much room at the end, the buffer is compacted before reading */
+#define RECORDS_MIN_READ	(4 * 1024)
+/* bytes compared at once, the buffer has this much slack at its end */
+#define SCAN_BLOCK		64
+#define NO_DELIM		((size_t) -1)
+
+typedef uint64_t (*scan_fn)(const char *p, unsigned char delim);
+
+struct exec_records {
+	int            rr_fd;
+	unsigned char  rr_delim;
+	char          *rr_buf;
+	size_t         rr_size;
+	size_t         rr_max;
+	size_t         rr_start;
+	size_t         rr_end;
+	size_t         rr_scan;
+	size_t         rr_base;
+	uint64_t       rr_mask;
+	bool           rr_eof;
+	bool           rr_skip;
+	scan_fn        rr_scan_block;
+};
+
+/*
+ * Each of these returns a mask with bit n set if p[n] is the delimiter,
+ * for n < SCAN_BLOCK.
+ */
+#if defined(__x86_64__) || defined(__i386__)
+__attribute__((target("avx2")))
+static uint64_t scan_avx2(const char *p, unsigned char delim)
+{
+	__m256i d = _mm256_set1_epi8((char) delim);
+	__m256i lo, hi;
+	uint32_t mlo, mhi;
+
+	lo = _mm256_loadu_si256((const __m256i *) p);
+	hi = _mm256_loadu_si256((const __m256i *) (p + 32));
+	mlo = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(lo, d));
+	mhi = (uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(hi, d));
+
+	return (uint64_t) mhi << 32 | mlo;
+}
+
+__attribute__((target("sse2")))
+static uint64_t scan_sse2(const char *p, unsigned char delim)
+{
+	__m128i d = _mm_set1_epi8((char) delim);
+	uint64_t mask = 0;
+	unsigned int i;
+	__m128i v;
+
+	for (i = 0; i < SCAN_BLOCK; i += 16) {
+		v = _mm_loadu_si128((const __m128i *) (p + i));
+		mask |= (uint64_t) (uint16_t)
+		        _mm_movemask_epi8(_mm_cmpeq_epi8(v, d)) << i;
+	}
+
+	return mask;
+}
+#endif
+
+static uint64_t scan_scalar(const char *p, unsigned char delim)
+{
+	uint64_t mask = 0;
+	unsigned int i;
+
+	for (i = 0; i < SCAN_BLOCK; ++i)
+		mask |= (uint64_t) ((unsigned char) p[i] == delim) << i;
+
+	return mask;
+}
+
+static scan_fn scan_pick(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		return scan_avx2;
+	if (__builtin_cpu_supports("sse2"))
+		return scan_sse2;
+#endif
+	return scan_scalar;
+}
+
+/*
+ * Offset of the next delimiter at or after rr_scan, remembering the rest
+ * of the block for the next call.
+ */
+static size_t find_delim(struct exec_records *r)
+{
+	size_t left;
+	uint64_t mask;
+	unsigned int bit;
+
+	while (!r->rr_mask) {
+		if (r->rr_scan >= r->rr_end)
+			return NO_DELIM;
+
+		left = r->rr_end - r->rr_scan;
+		mask = r->rr_scan_block(r->rr_buf + r->rr_scan, r->rr_delim);
+		if (left < SCAN_BLOCK)
+			mask &= ((uint64_t) 1 << left) - 1;
+
+		r->rr_mask = mask;
+		r->rr_base = r->rr_scan;
+		r->rr_scan += left < SCAN_BLOCK ? left : SCAN_BLOCK;
+	}
+
+	bit = (unsigned int) __builtin_ctzll(r->rr_mask);
+	r->rr_mask &= r->rr_mask - 1;
+	return r->rr_base + bit;
+}
+
+/*
+ * Makes room behind the data and reads once. Only called with everything
+ * scanned and no delimiter left in the buffer.
+ */
+static int records_fill(struct exec_records *r,
+                        const struct timespec *deadline)
+{
+	size_t size;
+	ssize_t count;
+	char *buf;
+	int ret;
+
+	if (r->rr_skip) {
+		/* nothing in here is worth keeping */
+		r->rr_start = r->rr_end = r->rr_scan = 0;
+	} else if (r->rr_start && (r->rr_start == r->rr_end ||
+	                           r->rr_size - r->rr_end < RECORDS_MIN_READ)) {
+		/* move the partial record to the front */
+		memmove(r->rr_buf, r->rr_buf + r->rr_start,
+		        r->rr_end - r->rr_start);
+		r->rr_end -= r->rr_start;
+		r->rr_scan -= r->rr_start;
+		r->rr_start = 0;
+	}
+
+	if (r->rr_end == r->rr_size) {
+		if (r->rr_size >= r->rr_max) {
+			r->rr_skip = true;
+			return -E2BIG;
+		}
+
+		size = r->rr_size * 2 < r->rr_max ? r->rr_size * 2 : r->rr_max;
+		buf = realloc(r->rr_buf, size + SCAN_BLOCK);
+		if (!buf)
+			return -ENOMEM;
+		r->rr_buf = buf;
+		r->rr_size = size;
+	}
+
+	for (;;) {
+		if (deadline && (ret = fd_wait(r->rr_fd, POLLIN, deadline)))
+			return ret;
+
+		count = read(r->rr_fd, r->rr_buf + r->rr_end,
+		             r->rr_size - r->rr_end);
+		if (count > 0) {
+			r->rr_end += (size_t) count;
+			return 0;
+		}
+		if (count == 0) {
+			r->rr_eof = true;
+			return 0;
+		}
+
+		if (errno == EINTR)
+			continue;
+		if (errno != EAGAIN)
+			return -errno;
+		if (!deadline && (ret = fd_wait(r->rr_fd, POLLIN, NULL)))
+			return ret;
+	}
+}
+
+struct exec_records *exec_records_new(int fd, int delim, size_t max_size)
+{
+	struct exec_records *r;
+
+	if (!max_size)
+		max_size = RECORDS_MAX_SIZE;
+
+	if ((r = calloc(1, sizeof(*r))) == NULL)
+		return NULL;
+
+	r->rr_size = max_size < RECORDS_MIN_SIZE ? max_size : RECORDS_MIN_SIZE;
+	r->rr_buf = malloc(r->rr_size + SCAN_BLOCK);
+	if (!r->rr_buf) {
+		free(r);
+		return NULL;
+	}
+
+	r->rr_fd = fd;
+	r->rr_delim = (unsigned char) delim;
+	r->rr_max = max_size;
+	r->rr_scan_block = scan_pick();
+	return r;
+}
+
+void exec_records_free(struct exec_records *records)
+{
+	if (!records)
+		return;
+
+	free(records->rr_buf);
+	free(records);
+}
+
+int exec_records_next(struct exec_records *records,
+                      struct exec_record *rec,
+                      const struct timespec *deadline)
+{
+	struct exec_records *r = records;
+	size_t pos;
+	int ret;
+
+	for (;;) {
+		pos = find_delim(r);
+		if (pos != NO_DELIM) {
+			if (r->rr_skip) {
+				/* the end of an oversized record */
+				r->rr_skip = false;
+				r->rr_start = pos + 1;
+				continue;
+			}
+
+			rec->er_data = r->rr_buf + r->rr_start;
+			rec->er_size = pos - r->rr_start;
+			rec->er_partial = false;
+			r->rr_start = pos + 1;
+			return 1;
+		}
+
+		if (r->rr_eof) {
+			if (r->rr_skip || r->rr_start == r->rr_end) {
+				r->rr_skip = false;
+				r->rr_start = r->rr_end;
+				return 0;
+			}
+
+			rec->er_data = r->rr_buf + r->rr_start;
+			rec->er_size = r->rr_end - r->rr_start;
+			rec->er_partial = true;
+			r->rr_start = r->rr_end;
+			return 1;
+		}
+
+		if ((ret = records_fill(r, deadline)) != 0)
+			return ret;
+	}
+}
+
+int exec_records_foreach(struct exec_records *records,
+                         int (*fn)(const struct exec_record *rec, void *arg),
+                         void *arg, const struct timespec *deadline)
+{
+	struct exec_record rec;
+	int ret;
+
+	while ((ret = exec_records_next(records, &rec, deadline)) == 1) {
+		if ((ret = fn(&rec, arg)) != 0)
+			return ret;
+	}
+
+	return ret;
+}
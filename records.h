@@ -0,0 +1,105 @@
+/*
+ * =============================================================================
+ *
+ *       Filename:  records.h
+ *
+ *    Description:  Split the output of a process into records
+ *
+ *        Version:  1.0
+ *        Created:  10/17/2026 09:41:18 PM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Oliver Lorenz (ol), olli@olorenz.org
+ *
+ * =============================================================================
+ */
+
+#ifndef PROCEXEC_RECORDS_H
+#define PROCEXEC_RECORDS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+
+
+/**
+ * struct exec_record - view of a record
+ * @er_data:			first byte of the record, not terminated
+ * @er_size:			size of the record without its delimiter
+ * @er_partial:			%true for trailing data that end of file cut
+ *				off before a delimiter
+ *
+ * Points into the reader's buffer and is valid until the reader is used
+ * again.
+ */
+struct exec_record {
+	const char *er_data;
+	size_t      er_size;
+	bool        er_partial;
+};
+
+
+struct exec_records;
+
+
+/**
+ * exec_records_new - create a record reader
+ * @fd:				descriptor to read from, e.g. @pi_stdout
+ * @delim:			byte that ends a record, usually '\n' or '\0'
+ * @max_size:			largest record to accept, %0 for a default of
+ *				1 MiB
+ *
+ * Data is read into a buffer that is reused for the life of the reader
+ * and only grows up to @max_size. Records that span reads are moved to
+ * the front of the buffer and handed out in one piece. Delimiters are
+ * searched 64 bytes at a time with AVX2 or SSE2 where the CPU has them.
+ * @fd is not closed by exec_records_free().
+ *
+ * @return: the new reader, or %NULL with @errno set.
+ */
+extern struct exec_records *exec_records_new(int fd, int delim,
+                                             size_t max_size);
+
+
+/**
+ * exec_records_free - destroy a record reader
+ * @records:			reader to destroy, may be %NULL
+ */
+extern void exec_records_free(struct exec_records *records);
+
+
+/**
+ * exec_records_next - get the next record
+ * @records:			the reader
+ * @rec:			set to the record
+ * @deadline:			absolute %CLOCK_MONOTONIC time to give up
+ *				waiting for data, %NULL to wait forever
+ *
+ * A record longer than the reader's maximum is dropped up to its
+ * delimiter and reported as %-E2BIG, reading can go on afterwards.
+ *
+ * @return: %1 if @rec was set, %0 at end of file or a negative error
+ *          code, %-ETIMEDOUT once @deadline has passed.
+ */
+extern int exec_records_next(struct exec_records *records,
+                             struct exec_record *rec,
+                             const struct timespec *deadline);
+
+
+/**
+ * exec_records_foreach - pass every record to a callback
+ * @records:			the reader
+ * @fn:				called for each record, returns %0 to go on
+ * @arg:			passed to @fn
+ * @deadline:			see exec_records_next()
+ *
+ * @return: %0 at end of file, what @fn returned if it wasn't %0, or a
+ *          negative error code from exec_records_next().
+ */
+extern int exec_records_foreach(struct exec_records *records,
+                                int (*fn)(const struct exec_record *rec,
+                                          void *arg),
+                                void *arg, const struct timespec *deadline);
+
+#endif
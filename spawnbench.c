@@ -0,0 +1,809 @@
+/*
+ * =============================================================================
+ *
+ *       Filename:  spawnbench.c
+ *
+ *    Description:  Spawn path benchmark suite with machine-readable output
+ *
+ *        Version:  1.0
+ *        Created:  10/17/2026 07:41:09 PM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Oliver Lorenz (ol), olli@olorenz.org
+ *
+ * =============================================================================
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include "exec.h"
+#include "timing.h"
+
+#define ECHO_CMD		"/bin/echo"
+#define STREAM_CMD		"/usr/bin/head"
+#define DEFAULT_ITERATIONS	200U
+#define DEFAULT_STREAM_MIB	64U
+#define READ_SIZE		(64 * 1024)
+#define MAX_VALUES		16U
+#define MIB			(1024UL * 1024UL)
+
+extern char **environ;
+
+enum output_format {
+	OUTPUT_CSV,
+	OUTPUT_JSON
+};
+
+/* one spawn, in microseconds since it was started, %-1 if not measured */
+struct lat_sample {
+	double ls_spawn;
+	double ls_first;
+	double ls_exit;
+};
+
+struct bench_method {
+	const char        *bm_name;
+	int              (*bm_run)(const struct bench_method *m,
+	                           struct lat_sample *s);
+	int              (*bm_stream)(const struct bench_method *m,
+	                              size_t bytes, uint64_t *moved);
+	enum exec_backend  bm_backend;
+};
+
+struct bench_config {
+	size_t       bc_rss_mib;
+	unsigned int bc_threads;
+	unsigned int bc_nofile;
+};
+
+static char *echo_argv[] = { ECHO_CMD, "x", NULL };
+static struct exec_spec *echo_spec;
+
+static double now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (double) ts.tv_sec * 1e6 + (double) ts.tv_nsec / 1e3;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return (x > y) - (x < y);
+}
+
+/* read(2) that waits on descriptors handed out in nonblocking mode */
+static ssize_t read_wait(int fd, void *buf, size_t size)
+{
+	struct pollfd pfd;
+	ssize_t count;
+
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	for (;;) {
+		count = read(fd, buf, size);
+		if (count != -1)
+			return count;
+		if (errno == EAGAIN)
+			(void) poll(&pfd, 1, -1);
+		else if (errno != EINTR)
+			return -1;
+	}
+}
+
+/* reads the first byte, then drains @fd until end of file */
+static int drain(int fd, double start, struct lat_sample *s)
+{
+	char buf[256];
+	ssize_t count;
+
+	s->ls_first = -1;
+	while ((count = read_wait(fd, buf, sizeof(buf))) > 0) {
+		if (s->ls_first < 0)
+			s->ls_first = now_us() - start;
+	}
+
+	return count ? -errno : 0;
+}
+
+static int stream_fd(int fd, uint64_t *moved)
+{
+	static char buf[READ_SIZE];
+	ssize_t count;
+
+	while ((count = read_wait(fd, buf, sizeof(buf))) > 0)
+		*moved += (uint64_t) count;
+
+	return count ? -errno : 0;
+}
+
+static int run_exec(const struct bench_method *m, struct lat_sample *s)
+{
+	struct process_info proc;
+	struct exec_attr attr;
+	double start;
+	int ret;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.ea_backend = m->bm_backend;
+
+	start = now_us();
+	ret = exec_process_attr(&proc, false, NULL, USERINFO_TYPE_NONE,
+	                        echo_argv[0], echo_argv, &attr);
+	if (ret)
+		return ret;
+	s->ls_spawn = now_us() - start;
+
+	ret = drain(proc.pi_stdout, start, s);
+	ret |= wait_for_child(&proc, true) | proc.pi_retval;
+	s->ls_exit = now_us() - start;
+	return ret;
+}
+
+static int run_spec(const struct bench_method *m, struct lat_sample *s)
+{
+	struct process_info proc;
+	double start;
+	int ret;
+
+	(void) m;
+
+	start = now_us();
+	if ((ret = exec_spawn(echo_spec, &proc)) != 0)
+		return ret;
+	s->ls_spawn = now_us() - start;
+
+	ret = drain(proc.pi_stdout, start, s);
+	ret |= wait_for_child(&proc, true) | proc.pi_retval;
+	s->ls_exit = now_us() - start;
+	return ret;
+}
+
+static int run_system(const struct bench_method *m, struct lat_sample *s)
+{
+	double start;
+	int ret;
+
+	(void) m;
+
+	/* the shell's output is of no interest, and unmeasurable anyway */
+	start = now_us();
+	ret = system(ECHO_CMD " x >/dev/null");
+	s->ls_exit = now_us() - start;
+	s->ls_spawn = s->ls_first = -1;
+
+	return ret == -1 ? -errno : ret;
+}
+
+static int run_popen(const struct bench_method *m, struct lat_sample *s)
+{
+	double start;
+	FILE *fp;
+	int ret;
+
+	(void) m;
+
+	start = now_us();
+	if ((fp = popen(ECHO_CMD " x", "r")) == NULL)
+		return -errno;
+	s->ls_spawn = now_us() - start;
+
+	ret = drain(fileno(fp), start, s);
+	ret |= pclose(fp);
+	s->ls_exit = now_us() - start;
+	return ret;
+}
+
+/* posix_spawn(3) with a pipe for standard output */
+static int raw_spawn(char *const argv[], pid_t *pid, int *out)
+{
+	posix_spawn_file_actions_t actions;
+	int pipefd[2];
+	int err;
+
+	if (pipe2(pipefd, O_CLOEXEC))
+		return -errno;
+
+	if ((err = posix_spawn_file_actions_init(&actions)) == 0) {
+		err = posix_spawn_file_actions_adddup2(&actions, pipefd[1],
+		                                       STDOUT_FILENO);
+		if (!err)
+			err = posix_spawn(pid, argv[0], &actions, NULL,
+			                  argv, environ);
+		(void) posix_spawn_file_actions_destroy(&actions);
+	}
+
+	close(pipefd[1]);
+	if (err) {
+		close(pipefd[0]);
+		return -err;
+	}
+
+	*out = pipefd[0];
+	return 0;
+}
+
+static int raw_wait(pid_t pid)
+{
+	int status;
+
+	while (waitpid(pid, &status, 0) == -1) {
+		if (errno != EINTR)
+			return -errno;
+	}
+
+	return status;
+}
+
+static int run_posix(const struct bench_method *m, struct lat_sample *s)
+{
+	double start;
+	pid_t pid;
+	int ret, fd;
+
+	(void) m;
+
+	start = now_us();
+	if ((ret = raw_spawn(echo_argv, &pid, &fd)) != 0)
+		return ret;
+	s->ls_spawn = now_us() - start;
+
+	ret = drain(fd, start, s);
+	close(fd);
+	ret |= raw_wait(pid);
+	s->ls_exit = now_us() - start;
+	return ret;
+}
+
+static void stream_argv(size_t bytes, char *count, size_t size,
+                        char *argv[5])
+{
+	snprintf(count, size, "%zu", bytes);
+	argv[0] = STREAM_CMD;
+	argv[1] = "-c";
+	argv[2] = count;
+	argv[3] = "/dev/zero";
+	argv[4] = NULL;
+}
+
+static int stream_exec(const struct bench_method *m, size_t bytes,
+                       uint64_t *moved)
+{
+	struct process_info proc;
+	struct exec_attr attr;
+	char count[32], *argv[5];
+	int ret;
+
+	stream_argv(bytes, count, sizeof(count), argv);
+	memset(&attr, 0, sizeof(attr));
+	attr.ea_backend = m->bm_backend;
+
+	ret = exec_process_attr(&proc, false, NULL, USERINFO_TYPE_NONE,
+	                        argv[0], argv, &attr);
+	if (ret)
+		return ret;
+
+	ret = stream_fd(proc.pi_stdout, moved);
+	return ret | wait_for_child(&proc, true) | proc.pi_retval;
+}
+
+/*
+ * Lets the library drain the pipe, which is what grows it if asked to.
+ * /dev/null takes splice(2), so the pipe size is all that differs.
+ */
+static int stream_capture(const struct bench_method *m, size_t bytes,
+                          uint64_t *moved, size_t pipe_size, bool autogrow)
+{
+	struct process_info proc;
+	struct exec_attr attr;
+	char count[32], *argv[5];
+	int ret, sink;
+
+	stream_argv(bytes, count, sizeof(count), argv);
+	memset(&attr, 0, sizeof(attr));
+	attr.ea_backend = m->bm_backend;
+	attr.ea_stdio[STDOUT_FILENO].es_pipe_size = pipe_size;
+	attr.ea_pipe_autogrow = autogrow;
+
+	if ((sink = open("/dev/null", O_WRONLY | O_CLOEXEC)) == -1)
+		return -errno;
+
+	ret = exec_process_attr(&proc, false, NULL, USERINFO_TYPE_NONE,
+	                        argv[0], argv, &attr);
+	if (!ret) {
+		ret = exec_capture(&proc, sink, -1, moved, NULL, NULL);
+		ret |= wait_for_child(&proc, true) | proc.pi_retval;
+	}
+
+	close(sink);
+	return ret;
+}
+
+/* the pipe at its default size, sized up front and grown on demand */
+static int stream_pipe(const struct bench_method *m, size_t bytes,
+                       uint64_t *moved)
+{
+	return stream_capture(m, bytes, moved, 0, false);
+}
+
+static int stream_1m(const struct bench_method *m, size_t bytes,
+                     uint64_t *moved)
+{
+	return stream_capture(m, bytes, moved, MIB, false);
+}
+
+static int stream_grow(const struct bench_method *m, size_t bytes,
+                       uint64_t *moved)
+{
+	return stream_capture(m, bytes, moved, 0, true);
+}
+
+static int stream_popen(const struct bench_method *m, size_t bytes,
+                        uint64_t *moved)
+{
+	static char buf[READ_SIZE];
+	char cmd[64];
+	size_t count;
+	FILE *fp;
+
+	(void) m;
+
+	snprintf(cmd, sizeof(cmd), STREAM_CMD " -c %zu /dev/zero", bytes);
+	if ((fp = popen(cmd, "r")) == NULL)
+		return -errno;
+
+	while ((count = fread(buf, 1, sizeof(buf), fp)) > 0)
+		*moved += count;
+
+	return pclose(fp);
+}
+
+static int stream_posix(const struct bench_method *m, size_t bytes,
+                        uint64_t *moved)
+{
+	char count[32], *argv[5];
+	pid_t pid;
+	int ret, fd;
+
+	(void) m;
+
+	stream_argv(bytes, count, sizeof(count), argv);
+	if ((ret = raw_spawn(argv, &pid, &fd)) != 0)
+		return ret;
+
+	ret = stream_fd(fd, moved);
+	close(fd);
+	return ret | raw_wait(pid);
+}
+
+static const struct bench_method methods[] = {
+	{ "fork",	 run_exec,   stream_exec,  EXEC_BACKEND_FORK	    },
+	{ "vfork",	 run_exec,   stream_exec,  EXEC_BACKEND_VFORK	    },
+	{ "posix_spawn", run_exec,   stream_exec,  EXEC_BACKEND_POSIX_SPAWN },
+	{ "server",	 run_exec,   stream_exec,  EXEC_BACKEND_SERVER	    },
+	{ "exec_spawn",	 run_spec,   NULL,	   EXEC_BACKEND_DEFAULT	    },
+	{ "system",	 run_system, NULL,	   EXEC_BACKEND_DEFAULT	    },
+	{ "popen",	 run_popen,  stream_popen, EXEC_BACKEND_DEFAULT	    },
+	{ "raw_posix",	 run_posix,  stream_posix, EXEC_BACKEND_DEFAULT	    },
+	{ "pipe",	 run_exec,   stream_pipe,  EXEC_BACKEND_VFORK	    },
+	{ "pipe_1m",	 run_exec,   stream_1m,	   EXEC_BACKEND_VFORK	    },
+	{ "pipe_grow",	 run_exec,   stream_grow,  EXEC_BACKEND_VFORK	    },
+};
+
+struct bench_result {
+	double       br_spawn[3];
+	double       br_first[3];
+	double       br_exit[3];
+	double       br_spawns_per_s;
+	double       br_mb_per_s;
+	unsigned int br_failed;
+};
+
+static const double percentiles[] = { 0.50, 0.90, 0.99 };
+
+/* fills @out with the percentiles of @values, %-1 if there are none */
+static void summarize(double *values, unsigned int num, double out[3])
+{
+	unsigned int i, idx;
+
+	qsort(values, num, sizeof(*values), cmp_double);
+	for (i = 0; i < ARRAY_SIZE(percentiles); ++i) {
+		if (!num || values[0] < 0) {
+			out[i] = -1;
+			continue;
+		}
+
+		idx = (unsigned int) (percentiles[i] * num + 0.999999);
+		out[i] = values[(idx ? idx : 1) - 1];
+	}
+}
+
+static int bench_method(const struct bench_method *m,
+                        unsigned int iterations, size_t stream_bytes,
+                        struct bench_result *res)
+{
+	struct lat_sample sample;
+	double *spawn, *first, *exit_us;
+	unsigned int i, num;
+	uint64_t moved = 0;
+	double start;
+
+	spawn = calloc(iterations, sizeof(*spawn));
+	first = calloc(iterations, sizeof(*first));
+	exit_us = calloc(iterations, sizeof(*exit_us));
+	if (!spawn || !first || !exit_us) {
+		free(spawn);
+		free(first);
+		free(exit_us);
+		return -ENOMEM;
+	}
+
+	memset(res, 0, sizeof(*res));
+	start = now_us();
+	for (i = 0, num = 0; i < iterations; ++i) {
+		if (m->bm_run(m, &sample)) {
+			++res->br_failed;
+			continue;
+		}
+
+		spawn[num] = sample.ls_spawn;
+		first[num] = sample.ls_first;
+		exit_us[num] = sample.ls_exit;
+		++num;
+	}
+	res->br_spawns_per_s = num * 1e6 / (now_us() - start);
+
+	summarize(spawn, num, res->br_spawn);
+	summarize(first, num, res->br_first);
+	summarize(exit_us, num, res->br_exit);
+
+	res->br_mb_per_s = -1;
+	if (m->bm_stream && stream_bytes) {
+		start = now_us();
+		if (!m->bm_stream(m, stream_bytes, &moved) &&
+		    moved == stream_bytes)
+			res->br_mb_per_s = (double) moved /
+			                   (now_us() - start);
+		else
+			++res->br_failed;
+	}
+
+	free(spawn);
+	free(first);
+	free(exit_us);
+	return 0;
+}
+
+/* unmeasured values are left empty in CSV and null in JSON */
+static void print_value(enum output_format format, double value)
+{
+	if (value >= 0)
+		printf("%.1f", value);
+	else if (format == OUTPUT_JSON)
+		printf("null");
+}
+
+static void print_header(enum output_format format)
+{
+	if (format == OUTPUT_JSON) {
+		printf("[\n");
+		return;
+	}
+
+	printf("method,rss_mib,threads,nofile,iterations,failed,"
+	       "spawn_p50_us,spawn_p90_us,spawn_p99_us,"
+	       "first_byte_p50_us,first_byte_p90_us,first_byte_p99_us,"
+	       "exit_p50_us,exit_p90_us,exit_p99_us,"
+	       "spawns_per_s,mb_per_s\n");
+}
+
+static void print_result(enum output_format format, bool first_row,
+                         const char *method, const struct bench_config *cfg,
+                         unsigned int iterations,
+                         const struct bench_result *res)
+{
+	static const char *const keys[] = {
+		"spawn_p50_us", "spawn_p90_us", "spawn_p99_us",
+		"first_byte_p50_us", "first_byte_p90_us",
+		"first_byte_p99_us", "exit_p50_us", "exit_p90_us",
+		"exit_p99_us", "spawns_per_s", "mb_per_s"
+	};
+	double values[11];
+	unsigned int i;
+
+	for (i = 0; i < 3; ++i) {
+		values[i]     = res->br_spawn[i];
+		values[i + 3] = res->br_first[i];
+		values[i + 6] = res->br_exit[i];
+	}
+	values[9]  = res->br_spawns_per_s;
+	values[10] = res->br_mb_per_s;
+
+	if (format == OUTPUT_CSV) {
+		printf("%s,%zu,%u,%u,%u,%u", method, cfg->bc_rss_mib,
+		       cfg->bc_threads, cfg->bc_nofile, iterations,
+		       res->br_failed);
+		for (i = 0; i < ARRAY_SIZE(values); ++i) {
+			printf(",");
+			print_value(format, values[i]);
+		}
+		printf("\n");
+		return;
+	}
+
+	printf("%s  {\"method\": \"%s\", \"rss_mib\": %zu, \"threads\": %u, "
+	       "\"nofile\": %u, \"iterations\": %u, \"failed\": %u",
+	       first_row ? "" : ",\n", method, cfg->bc_rss_mib,
+	       cfg->bc_threads, cfg->bc_nofile, iterations, res->br_failed);
+	for (i = 0; i < ARRAY_SIZE(values); ++i) {
+		printf(", \"%s\": ", keys[i]);
+		print_value(format, values[i]);
+	}
+	printf("}");
+}
+
+/* runs every method under the current configuration */
+static void run_config(enum output_format format, bool *first_row,
+                       const struct bench_config *cfg,
+                       unsigned int iterations, size_t stream_bytes)
+{
+	struct bench_result res;
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(methods); ++i) {
+		if (bench_method(&methods[i], iterations, stream_bytes, &res))
+			continue;
+
+		print_result(format, *first_row, methods[i].bm_name, cfg,
+		             iterations, &res);
+		*first_row = false;
+		fflush(stdout);
+	}
+}
+
+static void *inflate_rss(size_t mib)
+{
+	char *mem;
+	size_t i;
+
+	if (!mib)
+		return NULL;
+
+	if ((mem = malloc(mib * MIB)) == NULL)
+		return NULL;
+
+	/* touch every page, untouched memory has no page tables to copy */
+	for (i = 0; i < mib * MIB; i += 4096)
+		mem[i] = (char) i;
+
+	return mem;
+}
+
+/* idle threads, blocked until the read end of @park is closed */
+static void *park_thread(void *arg)
+{
+	char c;
+
+	while (read(*(int *) arg, &c, 1) == -1 && errno == EINTR)
+		;
+
+	return NULL;
+}
+
+static int start_threads(pthread_t *threads, unsigned int num, int park[2])
+{
+	unsigned int i;
+	int err;
+
+	if (pipe2(park, O_CLOEXEC))
+		return -errno;
+
+	for (i = 0; i < num; ++i) {
+		err = pthread_create(&threads[i], NULL, park_thread, &park[0]);
+		if (err) {
+			close(park[1]);
+			while (i--)
+				pthread_join(threads[i], NULL);
+			close(park[0]);
+			return -err;
+		}
+	}
+
+	return 0;
+}
+
+static void stop_threads(pthread_t *threads, unsigned int num, int park[2])
+{
+	unsigned int i;
+
+	close(park[1]);
+	for (i = 0; i < num; ++i)
+		pthread_join(threads[i], NULL);
+	close(park[0]);
+}
+
+static unsigned int parse_list(const char *arg, unsigned long *values)
+{
+	unsigned int num = 0;
+	char *end;
+
+	while (*arg && num < MAX_VALUES) {
+		values[num++] = strtoul(arg, &end, 10);
+		if (*end != ',')
+			break;
+		arg = end + 1;
+	}
+
+	return num;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "usage: %s [-n iterations] [-m stream_mib] "
+	        "[-f csv|json]\n"
+	        "       [-r rss_mib,...] [-t threads,...] "
+	        "[-l nofile,...] [-s]\n"
+	        "  -s  also dump per-stage spawn timings to stderr\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+	static const unsigned long default_rss[] = { 0, 1024 };
+	static const unsigned long default_threads[] = { 0, 16 };
+	static const unsigned long default_nofile[] = { 1024, 16384 };
+	enum output_format format = OUTPUT_CSV;
+	unsigned int iterations = DEFAULT_ITERATIONS;
+	size_t stream_mib = DEFAULT_STREAM_MIB;
+	unsigned long rss[MAX_VALUES], threads[MAX_VALUES];
+	unsigned long nofile[MAX_VALUES];
+	unsigned int num_rss = 0, num_threads = 0, num_nofile = 0;
+	unsigned int r, t, l;
+	struct bench_config cfg;
+	struct rlimit limit, saved;
+	pthread_t *tids;
+	bool first_row = true;
+	bool stages = false;
+	char *dump;
+	void *ballast;
+	int park[2];
+	int opt;
+
+	while ((opt = getopt(argc, argv, "n:m:f:r:t:l:s")) != -1) {
+		switch (opt) {
+		case 'n':
+			iterations = (unsigned int) strtoul(optarg, NULL, 10);
+			break;
+		case 'm':
+			stream_mib = strtoul(optarg, NULL, 10);
+			break;
+		case 'f':
+			if (!strcmp(optarg, "json")) {
+				format = OUTPUT_JSON;
+			} else if (strcmp(optarg, "csv")) {
+				usage(argv[0]);
+				return 1;
+			}
+			break;
+		case 'r':
+			num_rss = parse_list(optarg, rss);
+			break;
+		case 't':
+			num_threads = parse_list(optarg, threads);
+			break;
+		case 'l':
+			num_nofile = parse_list(optarg, nofile);
+			break;
+		case 's':
+			stages = true;
+			break;
+		default:
+			usage(argv[0]);
+			return 1;
+		}
+	}
+
+	if (!iterations)
+		iterations = DEFAULT_ITERATIONS;
+
+	if (!num_rss) {
+		for (; num_rss < ARRAY_SIZE(default_rss); ++num_rss)
+			rss[num_rss] = default_rss[num_rss];
+	}
+	if (!num_threads) {
+		for (; num_threads < ARRAY_SIZE(default_threads); ++num_threads)
+			threads[num_threads] = default_threads[num_threads];
+	}
+	if (!num_nofile) {
+		for (; num_nofile < ARRAY_SIZE(default_nofile); ++num_nofile)
+			nofile[num_nofile] = default_nofile[num_nofile];
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	exec_timing_enable(stages);
+
+	/* while we're still small */
+	if (exec_server_start())
+		fprintf(stderr, "spawn server unavailable\n");
+
+	echo_spec = exec_spec_new(echo_argv[0], echo_argv, NULL,
+	                          USERINFO_TYPE_NONE, NULL);
+	if (!echo_spec) {
+		perror("exec_spec_new");
+		return 1;
+	}
+
+	if (getrlimit(RLIMIT_NOFILE, &saved)) {
+		perror("getrlimit");
+		return 1;
+	}
+
+	print_header(format);
+	for (r = 0; r < num_rss; ++r) {
+		cfg.bc_rss_mib = rss[r];
+		ballast = inflate_rss(cfg.bc_rss_mib);
+		if (cfg.bc_rss_mib && !ballast) {
+			fprintf(stderr, "cannot allocate %zu MiB\n",
+			        cfg.bc_rss_mib);
+			continue;
+		}
+
+		for (t = 0; t < num_threads; ++t) {
+			cfg.bc_threads = (unsigned int) threads[t];
+			tids = calloc(cfg.bc_threads + 1, sizeof(*tids));
+			if (!tids || start_threads(tids, cfg.bc_threads,
+			                           park)) {
+				fprintf(stderr, "cannot start %u threads\n",
+				        cfg.bc_threads);
+				free(tids);
+				continue;
+			}
+
+			for (l = 0; l < num_nofile; ++l) {
+				cfg.bc_nofile = (unsigned int) nofile[l];
+				limit.rlim_cur = cfg.bc_nofile;
+				limit.rlim_max = saved.rlim_max;
+				if (setrlimit(RLIMIT_NOFILE, &limit)) {
+					fprintf(stderr, "cannot set NOFILE to "
+					        "%u\n", cfg.bc_nofile);
+					continue;
+				}
+
+				run_config(format, &first_row, &cfg,
+				           iterations, stream_mib * MIB);
+			}
+
+			(void) setrlimit(RLIMIT_NOFILE, &saved);
+			stop_threads(tids, cfg.bc_threads, park);
+			free(tids);
+		}
+
+		free(ballast);
+	}
+
+	if (format == OUTPUT_JSON)
+		printf("\n]\n");
+
+	if (stages && exec_timing_prometheus(&dump) >= 0) {
+		fputs(dump, stderr);
+		free(dump);
+	}
+
+	exec_spec_free(echo_spec);
+	(void) exec_server_stop();
+	return 0;
+}
@@ -0,0 +1,619 @@
+/*
+ * =============================================================================
+ *
+ *       Filename:  spawnsrv.c
+ *
+ *    Description:  Pre-forked helper process spawning children on behalf
+ *                  of a potentially large parent
+ *
+ *        Version:  1.0
+ *        Created:  10/17/2026 10:02:41 AM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Oliver Lorenz (ol), olli@olorenz.org
+ *
+ * =============================================================================
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "exec.h"
+#include "internal.h"
+
+#define SERVER_MAX_MSG		(64 * 1024)
+#define SERVER_MAX_FDS		4
+
+#define SERVER_REQ_STDIO	(1U << 0)
+#define SERVER_REQ_STDIN	(1U << 1)
+#define SERVER_REQ_STDOUT	(1U << 2)
+#define SERVER_REQ_STDERR	(1U << 3)
+
+/*
+ * A request is followed by sr_strlen bytes of NUL-terminated strings:
+ * cmd, sr_argc arguments, sr_envc environment entries and, for
+ * USERINFO_TYPE_NAME, the user name. The working directory and, unless
+ * pipes are requested, the standard descriptors are passed as
+ * SCM_RIGHTS in that order.
+ */
+struct server_request {
+	uint32_t sr_flags;
+	int32_t  sr_user_type;
+	uint32_t sr_uid;
+	uint32_t sr_argc;
+	uint32_t sr_envc;
+	uint32_t sr_strlen;
+};
+
+/* followed by the child's stdin, stdout and stderr if pipes were asked for */
+struct server_reply {
+	int32_t  sr_res;
+	int32_t  sr_pid;
+};
+
+extern char **environ;
+
+static int server_sock = -1;
+static pid_t server_pid = -1;
+static pthread_mutex_t server_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static ssize_t send_msg(int sock, const void *buf, size_t len,
+                        const int *fds, unsigned int num_fds)
+{
+	union {
+		struct cmsghdr align;
+		char           buf[CMSG_SPACE(SERVER_MAX_FDS * sizeof(int))];
+	} control;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	ssize_t ret;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = (void *) buf;
+	iov.iov_len = len;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+
+	if (num_fds) {
+		memset(&control, 0, sizeof(control));
+		msg.msg_control = control.buf;
+		msg.msg_controllen = CMSG_SPACE(num_fds * sizeof(int));
+
+		cmsg = CMSG_FIRSTHDR(&msg);
+		cmsg->cmsg_level = SOL_SOCKET;
+		cmsg->cmsg_type = SCM_RIGHTS;
+		cmsg->cmsg_len = CMSG_LEN(num_fds * sizeof(int));
+		memcpy(CMSG_DATA(cmsg), fds, num_fds * sizeof(int));
+	}
+
+	do {
+		ret = sendmsg(sock, &msg, MSG_NOSIGNAL);
+	} while (ret == -1 && errno == EINTR);
+
+	return ret;
+}
+
+static ssize_t recv_msg(int sock, void *buf, size_t len, int flags,
+                        int *fds, unsigned int *num_fds)
+{
+	union {
+		struct cmsghdr align;
+		char           buf[CMSG_SPACE(SERVER_MAX_FDS * sizeof(int))];
+	} control;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	unsigned int i, count;
+	ssize_t ret;
+
+	memset(&msg, 0, sizeof(msg));
+	iov.iov_base = buf;
+	iov.iov_len = len;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	do {
+		ret = recvmsg(sock, &msg, flags);
+	} while (ret == -1 && errno == EINTR);
+
+	*num_fds = 0;
+	if (ret == -1)
+		return -1;
+
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+		if (cmsg->cmsg_level != SOL_SOCKET ||
+		    cmsg->cmsg_type != SCM_RIGHTS)
+			continue;
+
+		count = (unsigned int) ((cmsg->cmsg_len - CMSG_LEN(0)) /
+		                        sizeof(int));
+		for (i = 0; i < count; ++i) {
+			int fd;
+
+			memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int),
+			       sizeof(fd));
+			if (*num_fds < SERVER_MAX_FDS)
+				fds[(*num_fds)++] = fd;
+			else
+				close(fd);
+		}
+	}
+
+	if (msg.msg_flags & (MSG_TRUNC | MSG_CTRUNC)) {
+		for (i = 0; i < *num_fds; ++i)
+			close(fds[i]);
+		*num_fds = 0;
+		errno = EMSGSIZE;
+		return -1;
+	}
+
+	return ret;
+}
+
+static void close_all(const int *fds, unsigned int num_fds)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_fds; ++i)
+		close(fds[i]);
+}
+
+/*
+ * Splits @count NUL-terminated strings off @p into a NULL-terminated
+ * vector. Returns NULL if they exceed @end.
+ */
+static char **unpack_strings(char **p, const char *end, uint32_t count)
+{
+	char **vec;
+	uint32_t i;
+	char *nul;
+
+	if ((vec = malloc((count + 1) * sizeof(*vec))) == NULL)
+		return NULL;
+
+	for (i = 0; i < count; ++i) {
+		nul = memchr(*p, '\0', (size_t) (end - *p));
+		if (!nul) {
+			free(vec);
+			errno = EINVAL;
+			return NULL;
+		}
+		vec[i] = *p;
+		*p = nul + 1;
+	}
+	vec[count] = NULL;
+
+	return vec;
+}
+
+static void server_handle(int sock, char *buf, size_t len,
+                          const int *fds, unsigned int num_fds)
+{
+	struct server_request *req = (struct server_request *) buf;
+	struct server_reply reply;
+	struct process_info proc;
+	struct spawn_env env;
+	user_info_t user;
+	char **argv = NULL;
+	char **envp = NULL;
+	char *p, *end, *cmd;
+	unsigned int i, next_fd;
+	uid_t uid;
+	bool stdio = false;
+
+	memset(&reply, 0, sizeof(reply));
+	reply.sr_pid = -1;
+
+	if (len < sizeof(*req) || len - sizeof(*req) != req->sr_strlen ||
+	    !num_fds) {
+		reply.sr_res = -EINVAL;
+		goto out;
+	}
+
+	p = buf + sizeof(*req);
+	end = buf + len;
+
+	cmd = p;
+	if ((p = memchr(p, '\0', (size_t) (end - p))) == NULL) {
+		reply.sr_res = -EINVAL;
+		goto out;
+	}
+	++p;
+
+	if ((argv = unpack_strings(&p, end, req->sr_argc)) == NULL ||
+	    (envp = unpack_strings(&p, end, req->sr_envc)) == NULL) {
+		reply.sr_res = -errno;
+		goto out;
+	}
+
+	uid = (uid_t) req->sr_uid;
+	switch (req->sr_user_type) {
+	case USERINFO_TYPE_UID:
+		user.ui_uid = &uid;
+		break;
+	case USERINFO_TYPE_NAME:
+		if (!memchr(p, '\0', (size_t) (end - p))) {
+			reply.sr_res = -EINVAL;
+			goto out;
+		}
+		user.ui_name = p;
+		break;
+	default:
+		user.ui_name = NULL;
+		break;
+	}
+
+	memset(&env, 0, sizeof(env));
+	env.se_envp = envp;
+	env.se_cwd_fd = fds[0];
+	env.se_clone_flags = CLONE_PARENT;
+
+	stdio = (req->sr_flags & SERVER_REQ_STDIO);
+	next_fd = 1;
+	for (i = 0; i < 3; ++i) {
+		env.se_stdio_fds[i] = -1;
+		if (!(req->sr_flags & (SERVER_REQ_STDIN << i)))
+			continue;
+		if (next_fd >= num_fds) {
+			reply.sr_res = -EINVAL;
+			goto out;
+		}
+		env.se_stdio_fds[i] = fds[next_fd++];
+	}
+
+	/*
+	 * CLONE_PARENT makes our caller the parent, it does the waiting,
+	 * even for a child that failed to exec
+	 */
+	reply.sr_res = exec_spawn_env(stdio ? &proc : NULL, false, user,
+	                              (enum user_info_type) req->sr_user_type,
+	                              cmd, argv, NULL, &env);
+	reply.sr_pid = env.se_pid;
+
+out:
+	if (!reply.sr_res && stdio) {
+		int pipes[3];
+
+		pipes[0] = proc.pi_stdin;
+		pipes[1] = proc.pi_stdout;
+		pipes[2] = proc.pi_stderr;
+		(void) send_msg(sock, &reply, sizeof(reply), pipes, 3);
+		close_all(pipes, 3);
+		if (proc.pi_pidfd != -1)
+			close(proc.pi_pidfd);
+	} else {
+		(void) send_msg(sock, &reply, sizeof(reply), NULL, 0);
+	}
+
+	free(envp);
+	free(argv);
+}
+
+static _noreturn void server_main(int sock)
+{
+	static char buf[SERVER_MAX_MSG];
+	int fds[SERVER_MAX_FDS];
+	unsigned int num_fds;
+	struct server_reply reply;
+	ssize_t len;
+
+	for (;;) {
+		len = recv_msg(sock, buf, sizeof(buf), MSG_CMSG_CLOEXEC,
+		               fds, &num_fds);
+		if (len == 0)
+			_exit(0);
+
+		if (len == -1) {
+			if (errno != EMSGSIZE)
+				_exit(1);
+
+			memset(&reply, 0, sizeof(reply));
+			reply.sr_res = -EMSGSIZE;
+			reply.sr_pid = -1;
+			(void) send_msg(sock, &reply, sizeof(reply), NULL, 0);
+			continue;
+		}
+
+		server_handle(sock, buf, (size_t) len, fds, num_fds);
+		close_all(fds, num_fds);
+	}
+}
+
+/* called with server_lock held */
+static void server_gone(void)
+{
+	if (server_sock == -1)
+		return;
+
+	close(server_sock);
+	__atomic_store_n(&server_sock, -1, __ATOMIC_RELAXED);
+
+	(void) kill(server_pid, SIGKILL);
+	(void) reap_child(server_pid, NULL, NULL);
+	server_pid = -1;
+}
+
+int exec_server_start(void)
+{
+#ifdef __linux__
+	pid_t pid;
+	int sv[2];
+	int res;
+
+	pthread_mutex_lock(&server_lock);
+	if (server_sock != -1) {
+		res = 0;
+		goto out;
+	}
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, sv)) {
+		res = -errno;
+		goto out;
+	}
+
+	pid = fork();
+	if (pid == 0) {
+		/*
+		 * No PR_SET_PDEATHSIG, it fires when the forking thread
+		 * exits. Once the process is gone, so is the last reference
+		 * to sv[0], which makes server_main() see end of file.
+		 */
+		close(sv[0]);
+		close_fds_except(&sv[1], 1);
+		server_main(sv[1]);
+	}
+
+	res = (pid == (pid_t) -1 ? -errno : 0);
+	close(sv[1]);
+
+	if (res) {
+		close(sv[0]);
+		goto out;
+	}
+
+	server_pid = pid;
+	__atomic_store_n(&server_sock, sv[0], __ATOMIC_RELAXED);
+
+out:
+	pthread_mutex_unlock(&server_lock);
+	return res;
+#else
+	return -ENOSYS;
+#endif
+}
+
+int exec_server_stop(void)
+{
+	pid_t pid;
+
+	pthread_mutex_lock(&server_lock);
+	if (server_sock == -1) {
+		pthread_mutex_unlock(&server_lock);
+		return 0;
+	}
+
+	/* the server exits once it reads EOF */
+	close(server_sock);
+	__atomic_store_n(&server_sock, -1, __ATOMIC_RELAXED);
+	pid = server_pid;
+	server_pid = -1;
+	pthread_mutex_unlock(&server_lock);
+
+	return (reap_child(pid, NULL, NULL) ? -errno : 0);
+}
+
+bool exec_server_wanted(const struct exec_attr *attr)
+{
+	unsigned int i;
+
+	if (__atomic_load_n(&server_sock, __ATOMIC_RELAXED) == -1)
+		return false;
+
+	if (!attr)
+		return true;
+
+	if (attr->ea_backend != EXEC_BACKEND_DEFAULT &&
+	    attr->ea_backend != EXEC_BACKEND_SERVER)
+		return false;
+
+	/* the reply always carries three pipes */
+	for (i = 0; i < ARRAY_SIZE(attr->ea_stdio); ++i) {
+		if (attr->ea_stdio[i].es_mode != EXEC_STDIO_PIPE)
+			return false;
+	}
+
+	/* descriptor numbers can't be preserved across the socket */
+	return !attr->ea_num_inherit_fds;
+}
+
+static char *pack_request(bool stdio, user_info_t user,
+                          enum user_info_type user_type, const char *cmd,
+                          char *const argv[], size_t *len)
+{
+	struct server_request *req;
+	size_t strlen_total;
+	uint32_t argc, envc;
+	char *buf, *p;
+	uint32_t i;
+
+	strlen_total = strlen(cmd) + 1;
+	for (argc = 0; argv[argc]; ++argc)
+		strlen_total += strlen(argv[argc]) + 1;
+	for (envc = 0; environ && environ[envc]; ++envc)
+		strlen_total += strlen(environ[envc]) + 1;
+	if (user_type == USERINFO_TYPE_NAME)
+		strlen_total += strlen(user.ui_name) + 1;
+
+	*len = sizeof(*req) + strlen_total;
+	if (*len > SERVER_MAX_MSG) {
+		errno = E2BIG;
+		return NULL;
+	}
+
+	if ((buf = malloc(*len)) == NULL)
+		return NULL;
+
+	req = (struct server_request *) buf;
+	memset(req, 0, sizeof(*req));
+	req->sr_flags = stdio ? SERVER_REQ_STDIO : 0;
+	req->sr_user_type = user_type;
+	req->sr_uid = (user_type == USERINFO_TYPE_UID ? *(user.ui_uid) : 0);
+	req->sr_argc = argc;
+	req->sr_envc = envc;
+	req->sr_strlen = (uint32_t) strlen_total;
+
+	p = buf + sizeof(*req);
+	p = stpcpy(p, cmd) + 1;
+	for (i = 0; i < argc; ++i)
+		p = stpcpy(p, argv[i]) + 1;
+	for (i = 0; i < envc; ++i)
+		p = stpcpy(p, environ[i]) + 1;
+	if (user_type == USERINFO_TYPE_NAME)
+		(void) stpcpy(p, user.ui_name);
+
+	return buf;
+}
+
+int exec_server_spawn(struct process_info *proc_info, bool wait,
+                      user_info_t user, enum user_info_type user_type,
+                      const char *cmd, char *const argv[],
+                      const struct exec_attr *attr)
+{
+	struct server_request *req;
+	struct server_reply reply;
+	int fds[SERVER_MAX_FDS];
+	unsigned int i, num_fds;
+	int rfds[SERVER_MAX_FDS];
+	unsigned int num_rfds;
+	struct timespec start;
+	bool stdio;
+	size_t len;
+	ssize_t ret;
+	char *buf;
+	int res;
+
+	if (wait)
+		proc_info = NULL;
+	stdio = (proc_info != NULL);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	buf = pack_request(stdio, user, user_type, cmd, argv, &len);
+	if (!buf)
+		goto local;
+	req = (struct server_request *) buf;
+
+	num_fds = 0;
+	fds[num_fds++] = open(".", O_PATH | O_DIRECTORY | O_CLOEXEC);
+	if (fds[0] == -1) {
+		free(buf);
+		goto local;
+	}
+
+	for (i = 0; !stdio && i < 3; ++i) {
+		/* a closed descriptor stays closed in the child */
+		if (fcntl((int) i, F_GETFD) == -1)
+			continue;
+		req->sr_flags |= SERVER_REQ_STDIN << i;
+		fds[num_fds++] = (int) i;
+	}
+
+	pthread_mutex_lock(&server_lock);
+	if (server_sock == -1) {
+		pthread_mutex_unlock(&server_lock);
+		close(fds[0]);
+		free(buf);
+		goto local;
+	}
+
+	ret = send_msg(server_sock, buf, len, fds, num_fds);
+	close(fds[0]);
+	free(buf);
+
+	if (ret == -1) {
+		/* the request never made it, spawning locally is safe */
+		server_gone();
+		pthread_mutex_unlock(&server_lock);
+		goto local;
+	}
+
+	ret = recv_msg(server_sock, &reply, sizeof(reply), 0, rfds, &num_rfds);
+	if (ret != (ssize_t) sizeof(reply)) {
+		res = (ret == -1 ? -errno : -EPIPE);
+		close_all(rfds, num_rfds);
+		server_gone();
+		pthread_mutex_unlock(&server_lock);
+		goto exit;
+	}
+	pthread_mutex_unlock(&server_lock);
+
+	res = reply.sr_res;
+	if (res) {
+		close_all(rfds, num_rfds);
+		/* it's our child, gone already, but still to be reaped */
+		if (reply.sr_pid > 0)
+			(void) reap_child(reply.sr_pid, NULL, NULL);
+		goto exit;
+	}
+
+	if (stdio) {
+		if (num_rfds != 3) {
+			close_all(rfds, num_rfds);
+			res = -EPROTO;
+			goto exit;
+		}
+		proc_info->pi_pid    = reply.sr_pid;
+		proc_info->pi_stdin  = rfds[0];
+		proc_info->pi_stdout = rfds[1];
+		proc_info->pi_stderr = rfds[2];
+		proc_info->pi_pidfd  = open_pidfd(reply.sr_pid);
+		proc_info->pi_retval = 0;
+		proc_info->pi_nonblock = false;
+		memset(&proc_info->pi_usage, 0, sizeof(proc_info->pi_usage));
+		proc_info->pi_usage.eu_start = start;
+
+		/* the server's pipes are ours to size */
+		for (i = 0; i < 3; ++i)
+			proc_info->pi_pipe_size[i] =
+				pipe_setup_size(rfds[i], attr, i);
+		proc_info->pi_pipe_autogrow = attr && attr->ea_pipe_autogrow;
+
+		/* file status flags travel with the descriptions */
+		if (attr && attr->ea_nonblock)
+			(void) exec_stream_mode(proc_info, true);
+	}
+
+	if (wait) {
+		int status;
+
+		if (attr && attr->ea_usage)
+			attr->ea_usage->eu_start = start;
+		res = (reap_child(reply.sr_pid, &status,
+		                  attr ? attr->ea_usage : NULL) ?
+		       -errno : status);
+	}
+
+	return res;
+
+exit:
+	if (proc_info) {
+		memset(proc_info, 0, sizeof(*proc_info));
+		proc_info->pi_pidfd = -1;
+	}
+	return res;
+
+local:
+	return exec_spawn_env(proc_info, wait, user, user_type,
+	                      cmd, argv, attr, NULL);
+}
@@ -0,0 +1,427 @@
+/*
+ * =============================================================================
+ *
+ *       Filename:  timing.c
+ *
+ *    Description:  Per-stage spawn timing and latency histograms
+ *
+ *        Version:  1.0
+ *        Created:  10/17/2026 08:36:50 PM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Oliver Lorenz (ol), olli@olorenz.org
+ *
+ * =============================================================================
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "timing.h"
+#include "internal.h"
+
+/*
+ * Log-linear buckets: values below HIST_SUB get a bucket each, above
+ * that every power of two is split into HIST_SUB linear buckets.
+ */
+#define HIST_SUB_BITS		4
+#define HIST_SUB		(1U << HIST_SUB_BITS)
+#define HIST_MAX_EXP		40
+#define HIST_BUCKETS		((HIST_MAX_EXP - HIST_SUB_BITS + 2) * HIST_SUB)
+
+/* Prometheus buckets, as powers of two in nanoseconds */
+#define PROM_MIN_EXP		10
+#define PROM_MAX_EXP		30
+
+/*
+ * Stamps of concurrent spawns per thread, see exec_process_batch(), are
+ * mapped this many at a time
+ */
+#define TIMING_SLOTS		64
+#define TIMING_CHUNK_SIZE	(TIMING_SLOTS * NUM_TS * sizeof(uint64_t))
+
+/* th_count is only maintained for merged histograms */
+struct timing_hist {
+	uint64_t th_count;
+	uint64_t th_sum;
+	uint64_t th_max;
+	uint64_t th_buckets[HIST_BUCKETS];
+};
+
+/*
+ * Histograms of one thread. Only the owner writes them, readers load
+ * every counter atomically and may see a spawn half recorded.
+ */
+struct timing_thread {
+	struct timing_hist     tt_hist[EXEC_NUM_STAGES];
+	uint64_t             **tt_chunks;
+	unsigned int           tt_num_chunks;
+	pid_t                  tt_pid;
+	struct timing_thread  *tt_next;
+	struct timing_thread **tt_pprev;
+};
+
+int timing_active;
+
+static const char *const stage_names[EXEC_NUM_STAGES] = {
+	"resolve", "pipes", "fork", "setup", "creds", "close", "exec", "total"
+};
+
+/* the stamps that open and close each stage */
+static const unsigned char stage_stamps[EXEC_NUM_STAGES][2] = {
+	{ TS_START,    TS_RESOLVED },
+	{ TS_RESOLVED, TS_PIPES    },
+	{ TS_PIPES,    TS_CHILD    },
+	{ TS_CHILD,    TS_SETUP    },
+	{ TS_SETUP,    TS_CREDS    },
+	{ TS_CREDS,    TS_CLOSED   },
+	{ TS_CLOSED,   TS_DONE     },
+	{ TS_START,    TS_DONE     }
+};
+
+static pthread_mutex_t timing_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t timing_once = PTHREAD_ONCE_INIT;
+static pthread_key_t timing_key;
+static struct timing_thread *timing_threads;
+static struct timing_hist timing_retired[EXEC_NUM_STAGES];
+static __thread struct timing_thread *timing_self;
+
+static unsigned int hist_index(uint64_t value)
+{
+	unsigned int exp, idx;
+
+	if (value < HIST_SUB)
+		return (unsigned int) value;
+
+	exp = 63U - (unsigned int) __builtin_clzll(value);
+	idx = (exp - HIST_SUB_BITS + 1) * HIST_SUB +
+	      (unsigned int) ((value >> (exp - HIST_SUB_BITS)) &
+	                      (HIST_SUB - 1));
+
+	return (idx < HIST_BUCKETS ? idx : HIST_BUCKETS - 1);
+}
+
+/* largest value that lands in bucket @idx */
+static uint64_t hist_upper(unsigned int idx)
+{
+	unsigned int exp;
+	uint64_t sub;
+
+	if (idx < HIST_SUB)
+		return idx;
+
+	exp = idx / HIST_SUB + HIST_SUB_BITS - 1;
+	sub = HIST_SUB + idx % HIST_SUB;
+	return ((sub + 1) << (exp - HIST_SUB_BITS)) - 1;
+}
+
+static void hist_add(struct timing_hist *h, uint64_t value)
+{
+	uint64_t *bucket = &h->th_buckets[hist_index(value)];
+
+	/* single writer, the stores only have to be untorn for readers */
+	__atomic_store_n(bucket, *bucket + 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&h->th_sum, h->th_sum + value, __ATOMIC_RELAXED);
+	if (value > h->th_max)
+		__atomic_store_n(&h->th_max, value, __ATOMIC_RELAXED);
+}
+
+static void hist_merge(struct timing_hist *dst, struct timing_hist *src)
+{
+	unsigned int i;
+	uint64_t n, max;
+
+	/* counted from the buckets, so that the two always agree */
+	for (i = 0; i < HIST_BUCKETS; ++i) {
+		n = __atomic_load_n(&src->th_buckets[i], __ATOMIC_RELAXED);
+		dst->th_buckets[i] += n;
+		dst->th_count += n;
+	}
+
+	dst->th_sum += __atomic_load_n(&src->th_sum, __ATOMIC_RELAXED);
+	max = __atomic_load_n(&src->th_max, __ATOMIC_RELAXED);
+	if (max > dst->th_max)
+		dst->th_max = max;
+}
+
+static uint64_t hist_percentile(const struct timing_hist *h,
+                                unsigned int percent)
+{
+	uint64_t rank, seen, upper;
+	unsigned int i;
+
+	if (!h->th_count)
+		return 0;
+
+	rank = (h->th_count * percent + 99) / 100;
+	seen = 0;
+	for (i = 0; i < HIST_BUCKETS; ++i) {
+		seen += h->th_buckets[i];
+		if (seen >= rank)
+			break;
+	}
+
+	upper = hist_upper(i < HIST_BUCKETS ? i : HIST_BUCKETS - 1);
+	return (upper < h->th_max ? upper : h->th_max);
+}
+
+/* keeps what an exiting thread has recorded */
+static void timing_unmap(struct timing_thread *tt)
+{
+	unsigned int i;
+
+	for (i = 0; i < tt->tt_num_chunks; ++i)
+		(void) munmap(tt->tt_chunks[i], TIMING_CHUNK_SIZE);
+	free(tt->tt_chunks);
+	tt->tt_chunks = NULL;
+	tt->tt_num_chunks = 0;
+}
+
+static void timing_thread_exit(void *arg)
+{
+	struct timing_thread *tt = arg;
+	unsigned int i;
+
+	pthread_mutex_lock(&timing_lock);
+	for (i = 0; i < EXEC_NUM_STAGES; ++i)
+		hist_merge(&timing_retired[i], &tt->tt_hist[i]);
+	*tt->tt_pprev = tt->tt_next;
+	if (tt->tt_next)
+		tt->tt_next->tt_pprev = tt->tt_pprev;
+	pthread_mutex_unlock(&timing_lock);
+
+	timing_unmap(tt);
+	free(tt);
+}
+
+static void timing_init(void)
+{
+	(void) pthread_key_create(&timing_key, timing_thread_exit);
+}
+
+static struct timing_thread *timing_thread_get(void)
+{
+	struct timing_thread *tt;
+
+	if (timing_self)
+		return timing_self;
+
+	if (pthread_once(&timing_once, timing_init))
+		return NULL;
+
+	tt = calloc(1, sizeof(*tt));
+	if (!tt)
+		return NULL;
+
+	if (pthread_setspecific(timing_key, tt)) {
+		free(tt);
+		return NULL;
+	}
+
+	pthread_mutex_lock(&timing_lock);
+	tt->tt_next = timing_threads;
+	tt->tt_pprev = &timing_threads;
+	if (timing_threads)
+		timing_threads->tt_pprev = &tt->tt_next;
+	timing_threads = tt;
+	pthread_mutex_unlock(&timing_lock);
+
+	timing_self = tt;
+	return tt;
+}
+
+uint64_t *timing_begin(unsigned int slot)
+{
+	unsigned int chunk = slot / TIMING_SLOTS;
+	struct timing_thread *tt;
+	uint64_t **chunks;
+	uint64_t *stamps;
+	pid_t pid;
+
+	tt = timing_thread_get();
+	if (!tt)
+		return NULL;
+
+	/*
+	 * A forked child writes its stamps here, so they have to live in
+	 * shared memory. After fork(2), we would share it with our parent.
+	 */
+	pid = getpid();
+	if (tt->tt_pid != pid) {
+		timing_unmap(tt);
+		tt->tt_pid = pid;
+	}
+
+	/* chunks stay where they are, earlier slots may still be in use */
+	while (tt->tt_num_chunks <= chunk) {
+		chunks = realloc(tt->tt_chunks, (tt->tt_num_chunks + 1) *
+		                 sizeof(*chunks));
+		if (!chunks)
+			return NULL;
+		tt->tt_chunks = chunks;
+
+		stamps = mmap(NULL, TIMING_CHUNK_SIZE, PROT_READ | PROT_WRITE,
+		              MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (stamps == MAP_FAILED)
+			return NULL;
+		tt->tt_chunks[tt->tt_num_chunks++] = stamps;
+	}
+
+	stamps = &tt->tt_chunks[chunk][(slot % TIMING_SLOTS) * NUM_TS];
+	memset(stamps, 0, NUM_TS * sizeof(*stamps));
+	timing_stamp(stamps, TS_START);
+	return stamps;
+}
+
+void timing_end(uint64_t *stamps)
+{
+	struct timing_thread *tt = timing_self;
+	uint64_t from, to;
+	unsigned int i;
+
+	timing_stamp(stamps, TS_DONE);
+
+	for (i = 0; i < EXEC_NUM_STAGES; ++i) {
+		from = stamps[stage_stamps[i][0]];
+		to = stamps[stage_stamps[i][1]];
+
+		/* the child's stamps are missing for posix_spawn() */
+		if (!from || !to || to < from)
+			continue;
+
+		hist_add(&tt->tt_hist[i], to - from);
+	}
+}
+
+void exec_timing_enable(bool enable)
+{
+	__atomic_store_n(&timing_active, enable, __ATOMIC_RELAXED);
+}
+
+bool exec_timing_enabled(void)
+{
+	return __atomic_load_n(&timing_active, __ATOMIC_RELAXED) != 0;
+}
+
+const char *exec_stage_name(enum exec_stage stage)
+{
+	if ((unsigned int) stage >= EXEC_NUM_STAGES)
+		return NULL;
+
+	return stage_names[stage];
+}
+
+/* sums up the histograms of all threads, past and present */
+static struct timing_hist *timing_collect(void)
+{
+	struct timing_thread *tt;
+	struct timing_hist *all;
+	unsigned int i;
+
+	all = calloc(EXEC_NUM_STAGES, sizeof(*all));
+	if (!all)
+		return NULL;
+
+	pthread_mutex_lock(&timing_lock);
+	for (i = 0; i < EXEC_NUM_STAGES; ++i)
+		hist_merge(&all[i], &timing_retired[i]);
+	for (tt = timing_threads; tt; tt = tt->tt_next) {
+		for (i = 0; i < EXEC_NUM_STAGES; ++i)
+			hist_merge(&all[i], &tt->tt_hist[i]);
+	}
+	pthread_mutex_unlock(&timing_lock);
+
+	return all;
+}
+
+int exec_timing_snapshot(struct exec_timing_snapshot *snap)
+{
+	struct timing_hist *all;
+	unsigned int i;
+
+	all = timing_collect();
+	if (!all)
+		return -ENOMEM;
+
+	for (i = 0; i < EXEC_NUM_STAGES; ++i) {
+		struct exec_stage_stats *ss = &snap->ts_stages[i];
+
+		ss->ss_count  = all[i].th_count;
+		ss->ss_sum_ns = all[i].th_sum;
+		ss->ss_max_ns = all[i].th_max;
+		ss->ss_p50_ns = hist_percentile(&all[i], 50);
+		ss->ss_p90_ns = hist_percentile(&all[i], 90);
+		ss->ss_p99_ns = hist_percentile(&all[i], 99);
+	}
+
+	free(all);
+	return 0;
+}
+
+int exec_timing_prometheus(char **buffer)
+{
+	struct timing_hist *all;
+	unsigned int i, exp, idx;
+	uint64_t seen;
+	size_t size;
+	FILE *fp;
+	int err;
+
+	all = timing_collect();
+	if (!all)
+		return -ENOMEM;
+
+	fp = open_memstream(buffer, &size);
+	if (!fp) {
+		err = errno;
+		free(all);
+		return -err;
+	}
+
+	fprintf(fp, "# HELP exec_spawn_stage_seconds "
+	        "Time spent in each stage of a spawn.\n"
+	        "# TYPE exec_spawn_stage_seconds histogram\n");
+
+	for (i = 0; i < EXEC_NUM_STAGES; ++i) {
+		seen = 0;
+		idx = 0;
+		for (exp = PROM_MIN_EXP; exp <= PROM_MAX_EXP; ++exp) {
+			/* every bucket below holds values under 2^exp */
+			for (; idx < hist_index(1ULL << exp); ++idx)
+				seen += all[i].th_buckets[idx];
+
+			fprintf(fp, "exec_spawn_stage_seconds_bucket"
+			        "{stage=\"%s\",le=\"%.9g\"} %llu\n",
+			        stage_names[i],
+			        (double) (1ULL << exp) / NSEC_PER_SEC,
+			        (unsigned long long) seen);
+		}
+
+		fprintf(fp, "exec_spawn_stage_seconds_bucket"
+		        "{stage=\"%s\",le=\"+Inf\"} %llu\n"
+		        "exec_spawn_stage_seconds_sum{stage=\"%s\"} %.9f\n"
+		        "exec_spawn_stage_seconds_count{stage=\"%s\"} %llu\n",
+		        stage_names[i],
+		        (unsigned long long) all[i].th_count,
+		        stage_names[i],
+		        (double) all[i].th_sum / NSEC_PER_SEC,
+		        stage_names[i],
+		        (unsigned long long) all[i].th_count);
+	}
+
+	free(all);
+
+	if (fclose(fp)) {
+		err = errno;
+		free(*buffer);
+		*buffer = NULL;
+		return -err;
+	}
+
+	return (int) size;
+}
@@ -0,0 +1,138 @@
+/*
+ * =============================================================================
+ *
+ *       Filename:  timing.h
+ *
+ *    Description:  Per-stage spawn timing and latency histograms
+ *
+ *        Version:  1.0
+ *        Created:  10/17/2026 08:36:50 PM
+ *       Revision:  none
+ *       Compiler:  gcc
+ *
+ *         Author:  Oliver Lorenz (ol), olli@olorenz.org
+ *
+ * =============================================================================
+ */
+
+#ifndef PROCEXEC_TIMING_H
+#define PROCEXEC_TIMING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/**
+ * enum exec_stage - stage of a spawn
+ * @EXEC_STAGE_RESOLVE:		user and command lookup in the parent
+ * @EXEC_STAGE_PIPES:		standard stream pipes and the self-pipe
+ * @EXEC_STAGE_FORK:		from fork(2) or clone(2) until the child runs
+ * @EXEC_STAGE_SETUP:		child: standard streams, working directory
+ *				and resource limits
+ * @EXEC_STAGE_CREDS:		child: dropping privileges
+ * @EXEC_STAGE_CLOSE:		child: closing inherited descriptors
+ * @EXEC_STAGE_EXEC:		from execve(2) until the parent has seen the
+ *				self-pipe close
+ * @EXEC_STAGE_TOTAL:		the whole spawn, as seen by the parent
+ * @EXEC_NUM_STAGES:		number of stages
+ *
+ * The child's stages are not recorded for %EXEC_BACKEND_POSIX_SPAWN.
+ * Children created by the spawn server are timed in the server.
+ */
+enum exec_stage {
+	EXEC_STAGE_RESOLVE,
+	EXEC_STAGE_PIPES,
+	EXEC_STAGE_FORK,
+	EXEC_STAGE_SETUP,
+	EXEC_STAGE_CREDS,
+	EXEC_STAGE_CLOSE,
+	EXEC_STAGE_EXEC,
+	EXEC_STAGE_TOTAL,
+	EXEC_NUM_STAGES
+};
+
+
+/**
+ * struct exec_stage_stats - latency summary of a stage
+ * @ss_count:			spawns recorded
+ * @ss_sum_ns:			total time spent in the stage
+ * @ss_max_ns:			longest time spent in the stage
+ * @ss_p50_ns:			median
+ * @ss_p90_ns:			90th percentile
+ * @ss_p99_ns:			99th percentile
+ *
+ * Percentiles are upper bounds with a relative error below 1/16.
+ */
+struct exec_stage_stats {
+	uint64_t ss_count;
+	uint64_t ss_sum_ns;
+	uint64_t ss_max_ns;
+	uint64_t ss_p50_ns;
+	uint64_t ss_p90_ns;
+	uint64_t ss_p99_ns;
+};
+
+
+/**
+ * struct exec_timing_snapshot - latency summary of all stages
+ * @ts_stages:			one entry per &enum exec_stage
+ */
+struct exec_timing_snapshot {
+	struct exec_stage_stats ts_stages[EXEC_NUM_STAGES];
+};
+
+
+/**
+ * exec_timing_enable - switch spawn timing on or off
+ * @enable:			%true to record timings from now on
+ *
+ * Each successful spawn then takes a CLOCK_MONOTONIC timestamp per stage
+ * and adds the stage durations to histograms owned by the calling
+ * thread, which are updated without locks. While disabled, which is the
+ * default, spawns only test a flag. Building with -DEXEC_NO_TIMING
+ * removes even that.
+ */
+extern void exec_timing_enable(bool enable);
+
+
+/**
+ * exec_timing_enabled - check whether spawn timing is on
+ */
+extern bool exec_timing_enabled(void);
+
+
+/**
+ * exec_stage_name - get the name of a stage
+ * @stage:			the stage
+ *
+ * @return: a static string such as "fork", %NULL for invalid stages.
+ */
+extern const char *exec_stage_name(enum exec_stage stage);
+
+
+/**
+ * exec_timing_snapshot - summarize the timings recorded so far
+ * @snap:			filled with the summary
+ *
+ * Combines the histograms of all threads, including those that have
+ * exited. Counts may lag behind spawns still being recorded.
+ *
+ * @return: On success, %0 is returned, otherwise a negative error code.
+ */
+extern int exec_timing_snapshot(struct exec_timing_snapshot *snap);
+
+
+/**
+ * exec_timing_prometheus - dump the timings in Prometheus text format
+ * @buffer:			set to a newly allocated string, to be freed
+ *				by the caller
+ *
+ * Emits the histogram exec_spawn_stage_seconds, labelled by stage, with
+ * buckets at powers of two from about one microsecond to one second.
+ *
+ * @return: On success, the length of @buffer is returned, otherwise a
+ *          negative error code.
+ */
+extern int exec_timing_prometheus(char **buffer);
+
+#endif